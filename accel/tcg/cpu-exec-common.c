@@ -81,10 +81,22 @@ void cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc)
     cpu_loop_exit(cpu);
 }
 
+__thread void *tcg_atomic_step_haddr;
+__thread int tcg_atomic_step_size;
+__thread bool tcg_atomic_step_striped;
+
 void cpu_loop_exit_atomic(CPUState *cpu, uintptr_t pc)
+{
+    cpu_loop_exit_atomic_at(cpu, pc, NULL, 0);
+}
+
+void cpu_loop_exit_atomic_at(CPUState *cpu, uintptr_t pc,
+                             void *haddr, int size)
 {
     /* Prevent looping if already executing in a serial context. */
     g_assert(!cpu_in_serial_context(cpu));
+    tcg_atomic_step_haddr = haddr;
+    tcg_atomic_step_size = size;
     cpu->exception_index = EXCP_ATOMIC;
     cpu_loop_exit_restore(cpu, pc);
 }
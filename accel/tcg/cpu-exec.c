@@ -363,17 +363,8 @@ static inline bool check_for_breakpoints(CPUState *cpu, vaddr pc,
         check_for_breakpoints_slow(cpu, pc, cflags);
 }
 
-/**
- * helper_lookup_tb_ptr: quick check for next tb
- * @env: current cpu state
- *
- * Look for an existing TB matching the current cpu state.
- * If found, return the code pointer.  If not found, return
- * the tcg epilogue so that we return into cpu_tb_exec.
- */
-const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+static TranslationBlock *lookup_tb_next(CPUState *cpu, TCGTBCPUState *s)
 {
-    CPUState *cpu = env_cpu(env);
     TranslationBlock *tb;
 
     /*
@@ -385,22 +376,67 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
      */
     cpu->neg.can_do_io = true;
 
-    TCGTBCPUState s = cpu->cc->tcg_ops->get_tb_cpu_state(cpu);
-    s.cflags = curr_cflags(cpu);
+    *s = cpu->cc->tcg_ops->get_tb_cpu_state(cpu);
+    s->cflags = curr_cflags(cpu);
 
-    if (check_for_breakpoints(cpu, s.pc, &s.cflags)) {
+    if (check_for_breakpoints(cpu, s->pc, &s->cflags)) {
         cpu_loop_exit(cpu);
     }
 
-    tb = tb_lookup(cpu, s);
+    tb = tb_lookup(cpu, *s);
+    if (tb && qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        log_cpu_exec(s->pc, cpu, tb);
+    }
+    return tb;
+}
+
+/**
+ * helper_lookup_tb_ptr: quick check for next tb
+ * @env: current cpu state
+ *
+ * Look for an existing TB matching the current cpu state.
+ * If found, return the code pointer.  If not found, return
+ * the tcg epilogue so that we return into cpu_tb_exec.
+ */
+const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    TCGTBCPUState s;
+    TranslationBlock *tb = lookup_tb_next(env_cpu(env), &s);
+
+    return tb ? tb->tc.ptr : tcg_code_gen_epilogue;
+}
+
+/**
+ * helper_lookup_tb_slot: slow path of an inline target cache
+ * @env: current cpu state
+ * @opaque: CPUJumpSlot that missed
+ *
+ * Like helper_lookup_tb_ptr, and additionally fill the slot so that
+ * the next execution of the branch jumps to the TB without a call.
+ * Slots are not filled while anything needs to observe every TB
+ * lookup, i.e. breakpoints or exec logging.
+ */
+const void *HELPER(lookup_tb_slot)(CPUArchState *env, void *opaque)
+{
+    CPUState *cpu = env_cpu(env);
+    CPUJumpSlot *slot = opaque;
+    /* Read before the lookup, so that a racing invalidation wins */
+    uint32_t gen = qatomic_read(&cpu->tb_jmp_cache->slot_gen);
+    TCGTBCPUState s;
+    TranslationBlock *tb = lookup_tb_next(cpu, &s);
+
     if (tb == NULL) {
         return tcg_code_gen_epilogue;
     }
 
-    if (qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
-        log_cpu_exec(s.pc, cpu, tb);
+    if (QTAILQ_EMPTY(&cpu->breakpoints)
+        && !qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        slot->pc = s.pc;
+        slot->cs_base = s.cs_base;
+        slot->flags = s.flags | (uint64_t)s.cflags << 32;
+        slot->ptr = tb->tc.ptr;
+        slot->gen = gen;
     }
-
     return tb->tc.ptr;
 }
 
@@ -546,20 +582,127 @@ static void cpu_exec_longjmp_cleanup(CPUState *cpu)
     assert_no_pages_locked();
 }
 
+/*
+ * Stripe locks for cpu_exec_step_atomic(), keyed by 16-byte host granule.
+ * An access of up to 16 bytes touches at most two granules.
+ */
+#define ATOMIC_STRIPE_BITS 8
+#define ATOMIC_STRIPE_SIZE (1 << ATOMIC_STRIPE_BITS)
+
+static QemuMutex atomic_stripe[ATOMIC_STRIPE_SIZE];
+static bool atomic_stripes_enabled;
+
+static QemuSpin atomic_stats_lock;
+static GHashTable *atomic_stats;        /* pc -> AtomicStepStat */
+
+void cpu_exec_atomic_stripes_enable(void)
+{
+    for (int i = 0; i < ATOMIC_STRIPE_SIZE; i++) {
+        qemu_mutex_init(&atomic_stripe[i]);
+    }
+    qatomic_set(&atomic_stripes_enabled, true);
+}
+
+static unsigned atomic_stripe_index(uintptr_t haddr)
+{
+    return ((uint64_t)(haddr >> 4) * 0x9e3779b97f4a7c15ull)
+           >> (64 - ATOMIC_STRIPE_BITS);
+}
+
+static void atomic_step_count(vaddr pc, bool striped)
+{
+    AtomicStepStat *st;
+
+    qemu_spin_lock(&atomic_stats_lock);
+    if (!atomic_stats) {
+        atomic_stats = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                             NULL, g_free);
+    }
+    st = g_hash_table_lookup(atomic_stats, &pc);
+    if (!st) {
+        st = g_new0(AtomicStepStat, 1);
+        st->pc = pc;
+        g_hash_table_insert(atomic_stats, &st->pc, st);
+    }
+    if (striped) {
+        st->striped++;
+    } else {
+        st->exclusive++;
+    }
+    qemu_spin_unlock(&atomic_stats_lock);
+}
+
+static gint atomic_step_stat_cmp(gconstpointer a, gconstpointer b)
+{
+    const AtomicStepStat *sa = a;
+    const AtomicStepStat *sb = b;
+    uint64_t na = sa->exclusive + sa->striped;
+    uint64_t nb = sb->exclusive + sb->striped;
+
+    return na < nb ? 1 : na > nb ? -1 : 0;
+}
+
+GArray *cpu_exec_atomic_step_stats(void)
+{
+    GArray *stats = g_array_new(false, false, sizeof(AtomicStepStat));
+    GHashTableIter iter;
+    AtomicStepStat *st;
+
+    qemu_spin_lock(&atomic_stats_lock);
+    if (atomic_stats) {
+        g_hash_table_iter_init(&iter, atomic_stats);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&st)) {
+            g_array_append_val(stats, *st);
+        }
+    }
+    qemu_spin_unlock(&atomic_stats_lock);
+
+    g_array_sort(stats, atomic_step_stat_cmp);
+    return stats;
+}
+
 void cpu_exec_step_atomic(CPUState *cpu)
 {
     TranslationBlock *tb;
     int tb_exit;
+    uintptr_t haddr = (uintptr_t)tcg_atomic_step_haddr;
+    int size = tcg_atomic_step_size;
+    bool striped = size && qatomic_read(&atomic_stripes_enabled);
+    unsigned lo = 0, hi = 0;
+
+    tcg_atomic_step_size = 0;
+    if (striped) {
+        /* Lock in index order, so that overlapping steps cannot deadlock */
+        lo = atomic_stripe_index(haddr);
+        hi = atomic_stripe_index(haddr + size - 1);
+        if (lo > hi) {
+            unsigned t = lo;
+            lo = hi;
+            hi = t;
+        }
+        qemu_mutex_lock(&atomic_stripe[lo]);
+        if (hi != lo) {
+            qemu_mutex_lock(&atomic_stripe[hi]);
+        }
+        tcg_atomic_step_striped = true;
+    }
 
     if (sigsetjmp(cpu->jmp_env, 0) == 0) {
-        start_exclusive();
-        g_assert(cpu == current_cpu);
-        g_assert(!cpu->running);
-        cpu->running = true;
+        if (striped) {
+            /* Other cpus keep running, but exclusive work waits for us */
+            cpu_exec_start(cpu);
+        } else {
+            start_exclusive();
+            g_assert(cpu == current_cpu);
+            g_assert(!cpu->running);
+            cpu->running = true;
+        }
 
         TCGTBCPUState s = cpu->cc->tcg_ops->get_tb_cpu_state(cpu);
         s.cflags = curr_cflags(cpu);
 
+        atomic_step_count(s.pc, striped);
+
         /* Execute in a serial context. */
         s.cflags &= ~CF_PARALLEL;
         /* After 1 insn, return and release the exclusive lock. */
@@ -587,6 +730,16 @@ void cpu_exec_step_atomic(CPUState *cpu)
         cpu_exec_longjmp_cleanup(cpu);
     }
 
+    if (striped) {
+        cpu_exec_end(cpu);
+        tcg_atomic_step_striped = false;
+        if (hi != lo) {
+            qemu_mutex_unlock(&atomic_stripe[hi]);
+        }
+        qemu_mutex_unlock(&atomic_stripe[lo]);
+        return;
+    }
+
     /*
      * As we start the exclusive region before codegen we must still
      * be in the region if we longjump out of either the codegen or
@@ -1068,6 +1221,11 @@ bool tcg_exec_realizefn(CPUState *cpu, Error **errp)
     }
 
     cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    cpu->tb_jmp_cache->slot_gen = 1;
+    /* Unbalanced returns pop these: point them at a real slot */
+    for (int i = 0; i < TB_JMP_RS_SIZE; i++) {
+        cpu->tb_jmp_cache->rs[i] = offsetof(CPUJumpCache, slot);
+    }
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
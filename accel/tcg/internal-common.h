@@ -21,13 +21,22 @@ extern bool one_insn_per_tb;
 
 extern bool icount_align_option;
 
+/* Host memory of the access that raised EXCP_ATOMIC; size 0 if unknown */
+extern __thread void *tcg_atomic_step_haddr;
+extern __thread int tcg_atomic_step_size;
+
+/* Set while cpu_exec_step_atomic() holds the stripe locks of the access */
+extern __thread bool tcg_atomic_step_striped;
+
 /*
  * Return true if CS is not running in parallel with other cpus, either
- * because there are no other cpus or we are within an exclusive context.
+ * because there are no other cpus or we are within an exclusive context,
+ * or if everything that may race with it is locked out by stripe locks.
  */
 static inline bool cpu_in_serial_context(CPUState *cs)
 {
-    return !tcg_cflags_has(cs, CF_PARALLEL) || cpu_in_exclusive_context(cs);
+    return !tcg_cflags_has(cs, CF_PARALLEL) || cpu_in_exclusive_context(cs)
+           || tcg_atomic_step_striped;
 }
 
 /**
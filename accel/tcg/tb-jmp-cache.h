@@ -9,6 +9,7 @@
 #ifndef ACCEL_TCG_TB_JMP_CACHE_H
 #define ACCEL_TCG_TB_JMP_CACHE_H
 
+#include "qemu/atomic.h"
 #include "qemu/rcu.h"
 #include "exec/cpu-common.h"
 
@@ -22,12 +23,51 @@
  * non-NULL value of 'tb'.  Strictly speaking pc is only needed for
  * CF_PCREL, but it's used always for simplicity.
  */
+#define TB_JMP_SLOT_BITS 10
+#define TB_JMP_SLOT_SIZE (1 << TB_JMP_SLOT_BITS)
+#define TB_JMP_RS_SIZE 64
+
+/*
+ * Inline target cache entry of an indirect branch, see
+ * translator_lookup_and_goto_ptr().  An entry is only valid while
+ * gen matches CPUJumpCache.slot_gen and is otherwise read and written
+ * by its own CPU only, from generated code and helper_lookup_tb_slot.
+ */
+typedef struct CPUJumpSlot {
+    vaddr pc;
+    uint64_t cs_base;
+    uint64_t flags;             /* TB flags | cflags << 32 */
+    const void *ptr;
+    uint32_t gen;
+} CPUJumpSlot;
+
 typedef struct CPUJumpCache {
     struct rcu_head rcu;
     struct {
         TranslationBlock *tb;
         vaddr pc;
     } array[TB_JMP_CACHE_SIZE];
+
+    /*
+     * Bumped in parallel whenever any TB is invalidated, which
+     * invalidates all slots at once.  Never 0, so that a zeroed
+     * slot is never valid.
+     */
+    uint32_t slot_gen;
+    /*
+     * Shadow return stack of slot offsets, pushed by calls.  Every entry
+     * always holds the offset of some element of slot[].
+     */
+    uint32_t rs_top;
+    uint32_t rs[TB_JMP_RS_SIZE];
+    CPUJumpSlot slot[TB_JMP_SLOT_SIZE];
 } CPUJumpCache;
 
+static inline void tb_jmp_cache_inval_slots(CPUJumpCache *jc)
+{
+    uint32_t gen = qatomic_read(&jc->slot_gen) + 1;
+
+    qatomic_set(&jc->slot_gen, gen ? gen : 1);
+}
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
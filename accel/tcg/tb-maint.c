@@ -36,6 +36,7 @@
 #include "internal-common.h"
 #ifdef CONFIG_USER_ONLY
 #include "user/page-protection.h"
+#include "linux-user/microhook-smc.h"
 #define runstate_is_running()  true
 #else
 #include "system/runstate.h"
@@ -107,15 +108,18 @@ static void tb_record(TranslationBlock *tb)
     assert_memory_lock();
     tb->itree.last = tb->itree.start + tb->size - 1;
 
-    /* translator_loop() must have made all TB pages non-writable */
+    /*
+     * translator_loop() must have made all TB pages non-writable,
+     * except for write-hot pages whose blocks check themselves.
+     */
     addr = tb_page_addr0(tb);
     flags = page_get_flags(addr);
-    assert(!(flags & PAGE_WRITE));
+    assert(!(flags & PAGE_WRITE) || microhook_smc_page_hot(addr));
 
     addr = tb_page_addr1(tb);
     if (addr != -1) {
         flags = page_get_flags(addr);
-        assert(!(flags & PAGE_WRITE));
+        assert(!(flags & PAGE_WRITE) || microhook_smc_page_hot(addr));
     }
 
     interval_tree_insert(&tb->itree, &tb_root);
@@ -909,6 +913,8 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             if (qatomic_read(&jc->array[h].tb) == tb) {
                 qatomic_set(&jc->array[h].tb, NULL);
             }
+            /* Slots are not indexed by pc, so drop them all */
+            tb_jmp_cache_inval_slots(jc);
         }
     }
 }
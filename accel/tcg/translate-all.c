@@ -37,6 +37,9 @@
 #include "internal-common.h"
 #include "tcg/perf.h"
 #include "tcg/insn-start-words.h"
+#include "qemu/timer.h"
+#include "linux-user/microhook-tbprof.h"
+#include "linux-user/microhook-trace.h"
 
 TBContext tb_ctx;
 
@@ -190,6 +193,10 @@ void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
         cpu->neg.icount_decr.u16.low += insns_left;
     }
 
+    if (microhook_trace_enabled()) {
+        microhook_trace_partial(cpu, tb->icount - insns_left);
+    }
+
     cpu->cc->tcg_ops->restore_state_to_opc(cpu, tb, data);
 }
 
@@ -284,6 +291,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     }
     QEMU_BUILD_BUG_ON(CF_COUNT_MASK + 1 != TCG_MAX_INSNS);
 
+    /* Restarts count towards the cost of translating the block */
+    ti = microhook_tbprof_enabled() ? get_clock() : 0;
+
  buffer_overflow:
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
@@ -397,6 +407,13 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     }
     tb->tc.size = gen_code_size;
 
+    if (microhook_tbprof_enabled()) {
+        microhook_tbprof_record(s.pc, s.flags, tb->icount, get_clock() - ti,
+                                tcg_ctx->nb_ops_emitted,
+                                tcg_ctx->nb_ops_optimized,
+                                gen_code_size + search_size);
+    }
+
     /*
      * For CF_PCREL, attribute all executions of the generated code
      * to its first mapping.
@@ -637,4 +654,5 @@ void tcg_flush_jmp_cache(CPUState *cpu)
     for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
         qatomic_set(&jc->array[i].tb, NULL);
     }
+    tb_jmp_cache_inval_slots(jc);
 }
@@ -20,7 +20,107 @@
 #include "internal-common.h"
 #include "disas/disas.h"
 #include "tb-internal.h"
+#include "tb-jmp-cache.h"
 #include "linux-user/microhook-coverage.h"
+#include "linux-user/microhook-ranges.h"
+#include "linux-user/microhook-sched.h"
+#include "linux-user/microhook-smc.h"
+#include "linux-user/microhook-tbprof.h"
+#include "linux-user/microhook-trace.h"
+
+static void gen_microhook_range_hit(void *site)
+{
+    /* Callbacks may read and write guest registers, PC included */
+    static TCGHelperInfo info = {
+        .flags = 0,
+        /* Match microhook_ranges_hit: void (*)(void *) */
+        .typemask = dh_typemask(void, 0) | dh_typemask(ptr, 1),
+    };
+
+    tcg_gen_call1(microhook_ranges_hit, &info, NULL,
+                  tcgv_ptr_temp(tcg_constant_ptr(site)));
+}
+
+static void gen_microhook_smc_check(void *site)
+{
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_WG,
+        /* Match microhook_smc_check: void (*)(void *) */
+        .typemask = dh_typemask(void, 0) | dh_typemask(ptr, 1),
+    };
+
+    tcg_gen_call1(microhook_smc_check, &info, NULL,
+                  tcgv_ptr_temp(tcg_constant_ptr(site)));
+}
+
+static void gen_microhook_tbprof_count(uint64_t *counter)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(counter);
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_addi_i64(val, val, 1);
+    tcg_gen_st_i64(val, ptr, 0);
+
+    tcg_temp_free_i64(val);
+}
+
+/*
+ * Make room for the records of the block if needed, then append its id.
+ * The memory accesses of the block append their own records.
+ */
+static void gen_microhook_trace_block(uint32_t id, int records)
+{
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_RWG,
+        /* Match microhook_trace_flush: void (*)(CPUArchState *) */
+        .typemask = dh_typemask(void, 0) | dh_typemask(ptr, 1),
+    };
+    TCGLabel *room = gen_new_label();
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_ptr end = tcg_temp_new_ptr();
+
+    tcg_gen_ld_ptr(ptr, tcg_env,
+                   offsetof(CPUState, neg.exec_trace_ptr) - sizeof(CPUState));
+    tcg_gen_ld_ptr(end, tcg_env,
+                   offsetof(CPUState, neg.exec_trace_end) - sizeof(CPUState));
+    tcg_gen_addi_ptr(ptr, ptr, records * sizeof(uint64_t));
+    tcg_gen_brcond_ptr(TCG_COND_LTU, ptr, end, room);
+    tcg_gen_call1(microhook_trace_flush, &info, NULL, tcgv_ptr_temp(tcg_env));
+    gen_set_label(room);
+
+    ptr = tcg_temp_new_ptr();
+    tcg_gen_ld_ptr(ptr, tcg_env,
+                   offsetof(CPUState, neg.exec_trace_ptr) - sizeof(CPUState));
+    tcg_gen_st_i64(tcg_constant_i64((uint64_t)MICROHOOK_TRACE_TB
+                                    << MICROHOOK_TRACE_TAG_SHIFT | id),
+                   ptr, 0);
+    tcg_gen_addi_ptr(ptr, ptr, sizeof(uint64_t));
+    tcg_gen_st_ptr(ptr, tcg_env,
+                   offsetof(CPUState, neg.exec_trace_ptr) - sizeof(CPUState));
+}
+
+/* Count the block against the thread's time slice */
+static void gen_microhook_sched_count(void)
+{
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_RWG,
+        /* Match microhook_sched_expired: void (*)(CPUArchState *) */
+        .typemask = dh_typemask(void, 0) | dh_typemask(ptr, 1),
+    };
+    TCGLabel *left = gen_new_label();
+    TCGv_i32 budget = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(budget, tcg_env,
+                   offsetof(CPUState, neg.sched_budget) - sizeof(CPUState));
+    tcg_gen_subi_i32(budget, budget, 1);
+    tcg_gen_st_i32(budget, tcg_env,
+                   offsetof(CPUState, neg.sched_budget) - sizeof(CPUState));
+    tcg_gen_brcondi_i32(TCG_COND_GE, budget, 0, left);
+    tcg_gen_call1(microhook_sched_expired, &info, NULL,
+                  tcgv_ptr_temp(tcg_env));
+    gen_set_label(left);
+}
 
 static void set_can_do_io(DisasContextBase *db, bool val)
 {
@@ -120,6 +220,135 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return translator_is_same_page(db, dest);
 }
 
+/* Round-robin slot assignment; two branches sharing a slot only miss */
+static unsigned next_jmp_slot;
+
+static bool use_jmp_slots(DisasContextBase *db)
+{
+    return !(tb_cflags(db->tb) & (CF_NO_GOTO_PTR | CF_COUNT_MASK |
+                                   CF_SINGLE_STEP | CF_BP_PAGE));
+}
+
+static uint32_t alloc_jmp_slot(void)
+{
+    unsigned i = qatomic_fetch_inc(&next_jmp_slot) % TB_JMP_SLOT_SIZE;
+
+    return offsetof(CPUJumpCache, slot) + i * sizeof(CPUJumpSlot);
+}
+
+static TCGv_ptr load_jmp_cache(void)
+{
+    TCGv_ptr jc = tcg_temp_new_ptr();
+
+    tcg_gen_ld_ptr(jc, tcg_env,
+                   offsetof(CPUState, tb_jmp_cache) - sizeof(CPUState));
+    return jc;
+}
+
+/* Compute &jc->rs[top % TB_JMP_RS_SIZE] */
+static TCGv_ptr rs_entry(TCGv_ptr jc, TCGv_i32 top)
+{
+    TCGv_i32 idx = tcg_temp_new_i32();
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+
+    tcg_gen_andi_i32(idx, top, TB_JMP_RS_SIZE - 1);
+    tcg_gen_shli_i32(idx, idx, 2);
+    tcg_gen_ext_i32_ptr(ptr, idx);
+    tcg_gen_add_ptr(ptr, ptr, jc);
+    return ptr;
+}
+
+/* Push a fresh slot for the return to the call site onto the stack */
+static void gen_push_return(TCGv_ptr jc)
+{
+    TCGv_i32 top = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(top, jc, offsetof(CPUJumpCache, rs_top));
+    tcg_gen_st_i32(tcg_constant_i32(alloc_jmp_slot()), rs_entry(jc, top),
+                   offsetof(CPUJumpCache, rs));
+    tcg_gen_addi_i32(top, top, 1);
+    tcg_gen_st_i32(top, jc, offsetof(CPUJumpCache, rs_top));
+}
+
+void translator_push_return(DisasContextBase *db)
+{
+    if (use_jmp_slots(db)) {
+        gen_push_return(load_jmp_cache());
+    }
+}
+
+void translator_lookup_and_goto_ptr(DisasContextBase *db, TCGv_i64 dest,
+                                    bool ret, bool call)
+{
+    TranslationBlock *tb = db->tb;
+    uint64_t flags = tb->flags | (uint64_t)tb_cflags(tb) << 32;
+    TCGLabel *miss;
+    TCGv_ptr jc, slot, ptr;
+    TCGv_i64 t64;
+    TCGv_i32 t32, gen;
+
+    if (!use_jmp_slots(db)) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    plugin_gen_disable_mem_helpers();
+    miss = gen_new_label();
+    jc = load_jmp_cache();
+    slot = tcg_temp_new_ptr();
+    if (ret) {
+        /*
+         * Pop the slot of the calling site.  Under- and overflow wrap
+         * around; entries start out naming slot[0] and only ever get
+         * slot offsets, so a stale one just names some other slot.  If
+         * the branch is also a call, its return slot replaces the popped
+         * entry.
+         */
+        TCGv_i32 top = tcg_temp_new_i32();
+        TCGv_ptr ent;
+
+        tcg_gen_ld_i32(top, jc, offsetof(CPUJumpCache, rs_top));
+        tcg_gen_subi_i32(top, top, 1);
+        ent = rs_entry(jc, top);
+        t32 = tcg_temp_new_i32();
+        tcg_gen_ld_i32(t32, ent, offsetof(CPUJumpCache, rs));
+        if (call) {
+            tcg_gen_st_i32(tcg_constant_i32(alloc_jmp_slot()), ent,
+                           offsetof(CPUJumpCache, rs));
+        } else {
+            tcg_gen_st_i32(top, jc, offsetof(CPUJumpCache, rs_top));
+        }
+        tcg_gen_ext_i32_ptr(slot, t32);
+        tcg_gen_add_ptr(slot, slot, jc);
+    } else {
+        if (call) {
+            gen_push_return(jc);
+        }
+        tcg_gen_addi_ptr(slot, jc, alloc_jmp_slot());
+    }
+
+    t64 = tcg_temp_new_i64();
+    tcg_gen_ld_i64(t64, slot, offsetof(CPUJumpSlot, pc));
+    tcg_gen_brcond_i64(TCG_COND_NE, t64, dest, miss);
+    tcg_gen_ld_i64(t64, slot, offsetof(CPUJumpSlot, flags));
+    tcg_gen_brcondi_i64(TCG_COND_NE, t64, flags, miss);
+    tcg_gen_ld_i64(t64, slot, offsetof(CPUJumpSlot, cs_base));
+    tcg_gen_brcondi_i64(TCG_COND_NE, t64, tb->cs_base, miss);
+    t32 = tcg_temp_new_i32();
+    gen = tcg_temp_new_i32();
+    tcg_gen_ld_i32(t32, slot, offsetof(CPUJumpSlot, gen));
+    tcg_gen_ld_i32(gen, jc, offsetof(CPUJumpCache, slot_gen));
+    tcg_gen_brcond_i32(TCG_COND_NE, t32, gen, miss);
+
+    ptr = tcg_temp_new_ptr();
+    tcg_gen_ld_ptr(ptr, slot, offsetof(CPUJumpSlot, ptr));
+    tcg_gen_goto_ptr(ptr);
+
+    gen_set_label(miss);
+    gen_helper_lookup_tb_slot(ptr, tcg_env, slot);
+    tcg_gen_goto_ptr(ptr);
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -128,6 +357,9 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     TCGOp *icount_start_insn;
     TCGOp *first_insn_start = NULL;
     bool plugin_enabled;
+    bool trace = microhook_trace_enabled();
+    uint32_t trace_insn_off[TCG_MAX_INSNS];
+    uint32_t trace_sites[MICROHOOK_TRACE_SITES];
 
     /* Initialize DisasContext */
     db->tb = tb;
@@ -147,6 +379,9 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
+    /* A restarted translation may have left its sites behind */
+    tcg_ctx->exec_trace_sites = NULL;
+
     /* Start translating.  */
     icount_start_insn = gen_tb_start(db, cflags);
     ops->tb_start(db, cpu);
@@ -155,6 +390,12 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     plugin_enabled = plugin_gen_tb_start(cpu, db);
     db->plugin_enabled = plugin_enabled;
 
+    /* Record the memory accesses of guest instructions only */
+    if (trace && microhook_trace_mem_enabled()) {
+        tcg_ctx->exec_trace_sites = trace_sites;
+    }
+    tcg_ctx->exec_trace_nb_mem = 0;
+
     while (true) {
         *max_insns = ++db->num_insns;
         ops->insn_start(db, cpu);
@@ -168,6 +409,11 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
             plugin_gen_insn_start(cpu, db);
         }
 
+        if (trace) {
+            trace_insn_off[db->num_insns - 1] = db->pc_next - db->pc_first;
+            tcg_ctx->exec_trace_insn = db->num_insns - 1;
+        }
+
         /*
          * Disassemble one instruction.  The translate_insn hook should
          * update db->pc_next and db->is_jmp to indicate what should be
@@ -233,6 +479,63 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
         microhook_coverage_record_block(db->pc_first, tb->size);
     }
 
+    /* Blocks on write-hot pages validate their bytes before anything else */
+    if (microhook_smc_enabled()) {
+        void *site = microhook_smc_translate(db->pc_first, tb->size,
+                                             tb->flags);
+
+        if (site) {
+            tcg_ctx->emit_before_op = first_insn_start;
+            gen_microhook_smc_check(site);
+            tcg_ctx->emit_before_op = NULL;
+        }
+    }
+
+    /* Instrument the start of blocks that fall into a range hook */
+    if (microhook_ranges_active()) {
+        void *site = microhook_ranges_translate(db->pc_first, tb->size);
+
+        if (site) {
+            tcg_ctx->emit_before_op = first_insn_start;
+            gen_microhook_range_hit(site);
+            tcg_ctx->emit_before_op = NULL;
+        }
+    }
+
+    /* Log block entries for -exec-trace */
+    if (trace) {
+        int nb_mem = tcg_ctx->exec_trace_nb_mem;
+        int nb_sites = MIN(nb_mem, MICROHOOK_TRACE_SITES);
+        uint32_t id = microhook_trace_translate(db->pc_first, db->num_insns,
+                                                trace_insn_off,
+                                                nb_sites, trace_sites);
+
+        tcg_ctx->exec_trace_sites = NULL;
+        tcg_ctx->emit_before_op = first_insn_start;
+        gen_microhook_trace_block(id, MIN(1 + nb_mem,
+                                          MICROHOOK_TRACE_RESERVE));
+        tcg_ctx->emit_before_op = NULL;
+    }
+
+    /* Count executions for -tb-profile; not atomic, so approximate */
+    if (microhook_tbprof_enabled()) {
+        uint64_t *counter = microhook_tbprof_translate(db->pc_first,
+                                                       tb->flags);
+
+        if (counter) {
+            tcg_ctx->emit_before_op = first_insn_start;
+            gen_microhook_tbprof_count(counter);
+            tcg_ctx->emit_before_op = NULL;
+        }
+    }
+
+    /* Time slices of -deterministic-threads end at a block boundary */
+    if (microhook_sched_enabled()) {
+        tcg_ctx->emit_before_op = first_insn_start;
+        gen_microhook_sched_count();
+        tcg_ctx->emit_before_op = NULL;
+    }
+
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
         && qemu_log_in_addr_range(db->pc_first)) {
         FILE *logfile = qemu_log_trylock();
@@ -42,6 +42,7 @@
 #include "backend-ldst.h"
 #include "internal-common.h"
 #include "tb-internal.h"
+#include "linux-user/microhook-smc.h"
 
 __thread uintptr_t helper_retaddr;
 
@@ -645,7 +646,8 @@ void tb_lock_page0(tb_page_addr_t address)
         }
     }
 
-    if (prot & PAGE_WRITE) {
+    /* Write-hot pages stay writable; their blocks check themselves */
+    if ((prot & PAGE_WRITE) && !microhook_smc_page_hot(start)) {
         pageflags_set_clear(start, last, 0, PAGE_WRITE);
         mprotect(g2h_untagged(start), last - start + 1,
                  prot & (PAGE_READ | PAGE_EXEC) ? PROT_READ : PROT_NONE);
@@ -735,6 +737,9 @@ int page_unprotect(CPUState *cpu, tb_page_addr_t address, uintptr_t pc)
             prot = (prot & ~PAGE_EXEC) | PAGE_READ;
         }
         mprotect((void *)g2h_untagged(start), len, prot & PAGE_RWX);
+        if (microhook_smc_enabled()) {
+            microhook_smc_write_fault(start);
+        }
     }
     mmap_unlock();
 
@@ -1230,7 +1235,7 @@ static void *atomic_mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
 
     /* Enforce qemu required alignment.  */
     if (unlikely(addr & (size - 1))) {
-        cpu_loop_exit_atomic(cpu, retaddr);
+        cpu_loop_exit_atomic_at(cpu, retaddr, g2h(cpu, addr), size);
     }
 
     ret = g2h(cpu, addr);
@@ -13,3 +13,28 @@
 #include "qemu/osdep.h"
 #include "qemu.h"
 #include "common-user/plugin-api.c.inc"
+
+/*
+ * Coverage - the microhook coverage engine is only available in
+ * linux-user.
+ */
+bool qemu_plugin_coverage_enable(void)
+{
+    return false;
+}
+
+GArray *qemu_plugin_coverage_snapshot(void)
+{
+    return NULL;
+}
+
+GArray *qemu_plugin_coverage_modules(void)
+{
+    return g_array_new(false, true,
+                       sizeof(struct qemu_plugin_coverage_module));
+}
+
+bool qemu_plugin_coverage_write_drcov(const char *path)
+{
+    return false;
+}
@@ -24,6 +24,27 @@
 void cpu_exec_init_all(void);
 void cpu_exec_step_atomic(CPUState *cpu);
 
+/*
+ * Let cpu_exec_step_atomic() serialise accesses whose host address is
+ * known with a lock striped by address, instead of stopping all other
+ * cpus.  Only accesses that go through the same fallback are mutually
+ * atomic then; a host atomic by another cpu on overlapping memory is not
+ * held off.
+ */
+void cpu_exec_atomic_stripes_enable(void);
+
+typedef struct AtomicStepStat {
+    vaddr pc;
+    uint64_t exclusive;     /* Steps that stopped all other cpus */
+    uint64_t striped;       /* Steps that only took stripe locks */
+} AtomicStepStat;
+
+/*
+ * Return the number of cpu_exec_step_atomic() calls per guest pc, as a
+ * GArray of AtomicStepStat sorted by total count, highest first.
+ */
+GArray *cpu_exec_atomic_step_stats(void);
+
 #define REAL_HOST_PAGE_ALIGN(addr) ROUND_UP((addr), qemu_real_host_page_size())
 
 /* The CPU list lock nests outside page_(un)lock or mmap_(un)lock */
@@ -200,6 +221,12 @@ static inline bool cpu_loop_exit_requested(CPUState *cpu)
 
 G_NORETURN void cpu_loop_exit_noexc(CPUState *cpu);
 G_NORETURN void cpu_loop_exit_atomic(CPUState *cpu, uintptr_t pc);
+/*
+ * Like cpu_loop_exit_atomic, for an access of @size bytes at host address
+ * @haddr, which lets the serial re-execution lock out only that memory.
+ */
+G_NORETURN void cpu_loop_exit_atomic_at(CPUState *cpu, uintptr_t pc,
+                                        void *haddr, int size);
 G_NORETURN void cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
 #endif /* CONFIG_TCG */
 G_NORETURN void cpu_loop_exit(CPUState *cpu);
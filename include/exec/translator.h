@@ -159,6 +159,39 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_push_return
+ * @db: Disassembly context
+ *
+ * Record a call on the shadow return stack, so that the matching
+ * translator_lookup_and_goto_ptr() with @ret set can predict the
+ * return.  Emit before ending the TB with the direct jump to the
+ * callee; indirect calls pass @call to translator_lookup_and_goto_ptr().
+ */
+void translator_push_return(DisasContextBase *db);
+
+/**
+ * translator_lookup_and_goto_ptr
+ * @db: Disassembly context
+ * @dest: target pc of the branch, already stored to the cpu state
+ * @ret: the branch is a return from a call
+ * @call: the branch is a call; with @ret, the return is popped first
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), but first try an inline cache:
+ * a per-branch slot for indirect jumps and calls, or the slot of the
+ * calling site popped off the shadow return stack for returns.  A slot
+ * hit jumps straight to the host code of the next TB.
+ *
+ * The next TB is matched against the flags the current TB was
+ * translated with.  Only use this while the state those flags are
+ * computed from is unchanged since the start of the TB, and fall back
+ * to tcg_gen_lookup_and_goto_ptr() otherwise.  The branch itself must
+ * not change the TB flags either.
+ */
+void translator_lookup_and_goto_ptr(DisasContextBase *db,
+                                    struct TCGv_i64_d *dest,
+                                    bool ret, bool call);
+
 /**
  * translator_io_start
  * @db: Disassembly context
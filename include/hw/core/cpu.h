@@ -359,6 +359,9 @@ typedef union IcountDecr {
  * @plugin_mem_cbs: active plugin memory callbacks
  * @plugin_mem_value_low: 64 lower bits of latest accessed mem value.
  * @plugin_mem_value_high: 64 higher bits of latest accessed mem value.
+ * @exec_trace_ptr: next free record of the -exec-trace buffer.
+ * @exec_trace_end: end of the -exec-trace buffer.
+ * @sched_budget: blocks left in the -deterministic-threads time slice.
  */
 typedef struct CPUNegativeOffsetState {
     CPUTLB tlb;
@@ -373,6 +376,11 @@ typedef struct CPUNegativeOffsetState {
 #endif
     IcountDecr icount_decr;
     bool can_do_io;
+    /* Appended to by generated code, see linux-user/microhook-trace.h */
+    uint64_t *exec_trace_ptr;
+    uint64_t *exec_trace_end;
+    /* Counted down by generated code, see linux-user/microhook-sched.h */
+    int32_t sched_budget;
 } CPUNegativeOffsetState;
 
 struct KVMState;
@@ -4,4 +4,36 @@
 void init_paths(const char *prefix);
 const char *path(const char *pathname);
 
+/*
+ * Turn the prefix into the read-only lower layer of a copy-on-write
+ * overlay, with changes going to upper_dir, which is created if needed.
+ */
+bool init_overlay(const char *upper_dir, Error **errp);
+
+/*
+ * Host name for reading pathname relative to dirfd, following a final
+ * symlink if follow. Without an overlay this is path(pathname).
+ */
+const char *path_at(int dirfd, const char *pathname, bool follow);
+
+/*
+ * Host name for changing or creating pathname relative to dirfd, copying
+ * it up to the upper layer first. Without an overlay this is path(pathname).
+ */
+const char *path_write_at(int dirfd, const char *pathname, bool follow);
+
+/* mkdirat(), unlinkat() and renameat2() through the overlay */
+int path_mkdirat(int dirfd, const char *pathname, mode_t mode);
+int path_unlinkat(int dirfd, const char *pathname, int flags);
+int path_renameat2(int olddirfd, const char *oldpath, int newdirfd,
+                   const char *newpath, unsigned int flags);
+
+/*
+ * Directories opened in the upper layer are listed by path_getdents64()
+ * instead of the host, merged with the lower layer and without whiteouts.
+ */
+void path_opened_dir(int fd);
+bool path_is_overlay_dir(int fd);
+int path_getdents64(int fd, void *dirp, unsigned int count);
+
 #endif
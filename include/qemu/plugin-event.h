@@ -23,6 +23,9 @@ enum qemu_plugin_event {
     QEMU_PLUGIN_EV_VCPU_INTERRUPT,
     QEMU_PLUGIN_EV_VCPU_EXCEPTION,
     QEMU_PLUGIN_EV_VCPU_HOSTCALL,
+    QEMU_PLUGIN_EV_VCPU_SYSCALL_FILTER,
+    QEMU_PLUGIN_EV_VCPU_SYSCALL_RET_FILTER,
+    QEMU_PLUGIN_EV_COVERAGE,
     QEMU_PLUGIN_EV_MAX, /* total number of plugin events we support */
 };
 
@@ -64,6 +64,9 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
+    qemu_plugin_vcpu_syscall_filter_cb_t vcpu_syscall_filter;
+    qemu_plugin_vcpu_syscall_ret_filter_cb_t vcpu_syscall_ret_filter;
+    qemu_plugin_coverage_cb_t        coverage;
     void *generic;
 };
 
@@ -169,6 +172,11 @@ qemu_plugin_vcpu_syscall(CPUState *cpu, int64_t num, uint64_t a1,
                          uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5,
                          uint64_t a6, uint64_t a7, uint64_t a8);
 void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
+bool qemu_plugin_vcpu_syscall_filter(CPUState *cpu, int64_t num,
+                                     uint64_t *args, uint64_t *sysret);
+void qemu_plugin_vcpu_syscall_ret_filter(CPUState *cpu, int64_t num,
+                                         const uint64_t *args,
+                                         int64_t *sysret);
 
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_low,
@@ -179,6 +187,9 @@ void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
 
+void qemu_plugin_coverage_cb(const struct qemu_plugin_coverage_block *blocks,
+                             size_t n);
+
 void qemu_plugin_add_dyn_cb_arr(GArray *arr);
 
 static inline void qemu_plugin_disable_mem_helpers(CPUState *cpu)
@@ -280,6 +291,18 @@ static inline
 void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret)
 { }
 
+static inline bool
+qemu_plugin_vcpu_syscall_filter(CPUState *cpu, int64_t num,
+                                uint64_t *args, uint64_t *sysret)
+{
+    return false;
+}
+
+static inline void
+qemu_plugin_vcpu_syscall_ret_filter(CPUState *cpu, int64_t num,
+                                    const uint64_t *args, int64_t *sysret)
+{ }
+
 static inline void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                                            uint64_t value_low,
                                            uint64_t value_high,
@@ -293,6 +316,11 @@ static inline void qemu_plugin_flush_cb(void)
 static inline void qemu_plugin_atexit_cb(void)
 { }
 
+static inline void
+qemu_plugin_coverage_cb(const struct qemu_plugin_coverage_block *blocks,
+                        size_t n)
+{ }
+
 static inline
 void qemu_plugin_add_dyn_cb_arr(GArray *arr)
 { }
@@ -72,11 +72,18 @@ typedef uint64_t qemu_plugin_id_t;
  * - added qemu_plugin_write_memory_hwaddr
  * - added qemu_plugin_write_register
  * - added qemu_plugin_translate_vaddr
+ *
+ * version 6:
+ * - added qemu_plugin_register_vcpu_syscall_filter_cb
+ * - added qemu_plugin_register_vcpu_syscall_ret_filter_cb
+ * - added qemu_plugin_coverage_enable, qemu_plugin_coverage_snapshot,
+ *   qemu_plugin_coverage_modules, qemu_plugin_coverage_write_drcov and
+ *   qemu_plugin_register_coverage_cb
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 5
+#define QEMU_PLUGIN_VERSION 6
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -811,6 +818,185 @@ void
 qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
                                          qemu_plugin_vcpu_syscall_ret_cb_t cb);
 
+/* number of syscall arguments passed to the syscall filter callbacks */
+#define QEMU_PLUGIN_SYSCALL_ARGS 8
+
+/**
+ * typedef qemu_plugin_vcpu_syscall_filter_cb_t - syscall filter callback
+ * @id: unique plugin id
+ * @vcpu_index: vCPU that is about to execute the syscall
+ * @num: guest syscall number
+ * @args: the QEMU_PLUGIN_SYSCALL_ARGS syscall arguments, writable
+ * @sysret: return value to use if the syscall is skipped
+ *
+ * The callback may modify @args in place; the (possibly modified)
+ * arguments are passed to the next filter and then to the syscall.
+ *
+ * Returns true to skip the syscall, in which case @sysret is returned
+ * to the guest and no further filters are called. Returns false to let
+ * the syscall proceed.
+ */
+typedef bool
+(*qemu_plugin_vcpu_syscall_filter_cb_t)(qemu_plugin_id_t id,
+                                        unsigned int vcpu_index,
+                                        int64_t num, uint64_t *args,
+                                        uint64_t *sysret);
+
+/**
+ * qemu_plugin_register_vcpu_syscall_filter_cb() - register a syscall filter
+ * @id: plugin ID
+ * @cb: callback function
+ *
+ * The @cb function is called before every guest syscall, at the same
+ * point as the microhook pre-syscall hook and before any observe-only
+ * syscall callback. Only available in user-mode emulation.
+ */
+QEMU_PLUGIN_API
+void
+qemu_plugin_register_vcpu_syscall_filter_cb(qemu_plugin_id_t id,
+                                            qemu_plugin_vcpu_syscall_filter_cb_t cb);
+
+/**
+ * typedef qemu_plugin_vcpu_syscall_ret_filter_cb_t - syscall return filter
+ * @id: unique plugin id
+ * @vcpu_index: vCPU that executed the syscall
+ * @num: guest syscall number
+ * @args: the QEMU_PLUGIN_SYSCALL_ARGS arguments the syscall was run with
+ * @sysret: the syscall return value, writable
+ *
+ * The callback may rewrite *@sysret; the new value is what the guest
+ * sees.
+ */
+typedef void
+(*qemu_plugin_vcpu_syscall_ret_filter_cb_t)(qemu_plugin_id_t id,
+                                            unsigned int vcpu_index,
+                                            int64_t num,
+                                            const uint64_t *args,
+                                            int64_t *sysret);
+
+/**
+ * qemu_plugin_register_vcpu_syscall_ret_filter_cb() - register a return filter
+ * @id: plugin ID
+ * @cb: callback function
+ *
+ * The @cb function is called after every guest syscall that was not
+ * skipped by a filter, at the same point as the microhook post-syscall
+ * hook. Only available in user-mode emulation.
+ */
+QEMU_PLUGIN_API
+void
+qemu_plugin_register_vcpu_syscall_ret_filter_cb(
+    qemu_plugin_id_t id, qemu_plugin_vcpu_syscall_ret_filter_cb_t cb);
+
+
+/**
+ * struct qemu_plugin_coverage_block - a block seen by the coverage engine
+ * @vaddr: guest virtual address of the block start
+ * @size: size of the block in bytes
+ * @module_id: index into qemu_plugin_coverage_modules(), or
+ *             QEMU_PLUGIN_COVERAGE_NO_MODULE if the block is not part
+ *             of any mapped image (e.g. JIT code)
+ */
+struct qemu_plugin_coverage_block {
+    uint64_t vaddr;
+    uint32_t size;
+    uint16_t module_id;
+    uint16_t reserved;
+};
+
+#define QEMU_PLUGIN_COVERAGE_NO_MODULE 0xffff
+
+/**
+ * struct qemu_plugin_coverage_module - an executable image in the guest
+ * @id: module id, as used in &qemu_plugin_coverage_block.module_id
+ * @base: guest load base (address of file offset 0)
+ * @start: first executable guest address
+ * @end: one past the last executable guest address
+ * @entry: entry point, 0 if unknown
+ * @path: host path of the image, valid until exit
+ */
+struct qemu_plugin_coverage_module {
+    uint16_t id;
+    uint64_t base;
+    uint64_t start;
+    uint64_t end;
+    uint64_t entry;
+    const char *path;
+};
+
+/**
+ * qemu_plugin_coverage_enable() - start the built-in coverage engine
+ *
+ * Starts block collection in microhook's coverage engine if it is not
+ * already running (e.g. because of -coverage). Blocks are recorded
+ * once, at translation time, without any per-execution callbacks.
+ *
+ * Returns true on success, false if coverage is not available (for
+ * example in system emulation).
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_coverage_enable(void);
+
+/**
+ * qemu_plugin_coverage_snapshot() - copy of all blocks recorded so far
+ *
+ * Returns a GArray of &struct qemu_plugin_coverage_block, or NULL if
+ * coverage is not enabled. The caller must free it with
+ * g_array_free(arr, true).
+ */
+QEMU_PLUGIN_API
+GArray *qemu_plugin_coverage_snapshot(void);
+
+/**
+ * qemu_plugin_coverage_modules() - copy of the module table
+ *
+ * Returns a GArray of &struct qemu_plugin_coverage_module, indexed by
+ * module id. The caller must free the array with g_array_free(arr,
+ * true); the path strings are owned by QEMU.
+ */
+QEMU_PLUGIN_API
+GArray *qemu_plugin_coverage_modules(void);
+
+/**
+ * qemu_plugin_coverage_write_drcov() - write the coverage as a DRCov file
+ * @path: output file name
+ *
+ * Writes all blocks recorded so far, with the full module table, in
+ * DRCov version 2 format.
+ *
+ * Returns true on success.
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_coverage_write_drcov(const char *path);
+
+/**
+ * typedef qemu_plugin_coverage_cb_t - new coverage callback
+ * @id: unique plugin id
+ * @blocks: newly recorded blocks
+ * @n: number of entries in @blocks
+ * @userdata: user data passed at registration
+ *
+ * @blocks is only valid for the duration of the callback.
+ */
+typedef void (*qemu_plugin_coverage_cb_t)(
+    qemu_plugin_id_t id, const struct qemu_plugin_coverage_block *blocks,
+    size_t n, void *userdata);
+
+/**
+ * qemu_plugin_register_coverage_cb() - register a new coverage callback
+ * @id: plugin ID
+ * @cb: callback function
+ * @userdata: user data for callback
+ *
+ * The @cb function is called with batches of blocks as the coverage
+ * engine discovers them. Each block is reported exactly once. Batches
+ * are delivered when full and when the engine flushes its output, so a
+ * block may be reported some time after it was first translated.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_coverage_cb(qemu_plugin_id_t id,
+                                      qemu_plugin_coverage_cb_t cb,
+                                      void *userdata);
 
 /**
  * qemu_plugin_insn_disas() - return disassembly string for instruction
@@ -14,6 +14,9 @@ void perf_enable_perfmap(void);
 /* Start writing jit-<pid>.dump. */
 void perf_enable_jitdump(void);
 
+/* Is either perf-<pid>.map or jit-<pid>.dump being written? */
+bool perf_enabled(void);
+
 /* Add information about TCG prologue to profiler maps. */
 void perf_report_prologue(const void *start, size_t size);
 
@@ -36,6 +39,11 @@ static inline void perf_report_prologue(const void *start, size_t size)
 {
 }
 
+static inline bool perf_enabled(void)
+{
+    return false;
+}
+
 static inline void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
                                     const void *start)
 {
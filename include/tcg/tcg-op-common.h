@@ -75,6 +75,14 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_goto_ptr() - jump to host code of a TB
+ * @ptr: Host code pointer, as returned by helper_lookup_tb_ptr
+ *
+ * Ends the basic block; only code behind a label may follow.
+ */
+void tcg_gen_goto_ptr(TCGv_ptr ptr);
+
 void tcg_gen_plugin_cb(unsigned from);
 void tcg_gen_plugin_mem_cb(TCGv_i64 addr, unsigned meminfo);
 
@@ -531,6 +539,17 @@ static inline void tcg_gen_brcondi_ptr(TCGCond cond, TCGv_ptr a,
     glue(tcg_gen_brcondi_,PTR)(cond, (NAT)a, b, label);
 }
 
+static inline void tcg_gen_brcond_ptr(TCGCond cond, TCGv_ptr a,
+                                      TCGv_ptr b, TCGLabel *label)
+{
+    glue(tcg_gen_brcond_,PTR)(cond, (NAT)a, (NAT)b, label);
+}
+
+static inline void tcg_gen_umin_ptr(TCGv_ptr r, TCGv_ptr a, TCGv_ptr b)
+{
+    glue(tcg_gen_umin_,PTR)((NAT)r, (NAT)a, (NAT)b);
+}
+
 static inline void tcg_gen_ext_i32_ptr(TCGv_ptr r, TCGv_i32 a)
 {
 #if UINTPTR_MAX == UINT32_MAX
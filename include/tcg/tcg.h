@@ -364,6 +364,8 @@ struct TCGContext {
     int nb_temps;
     int nb_indirects;
     int nb_ops;
+    int nb_ops_emitted;           /* nb_ops before tcg_optimize() */
+    int nb_ops_optimized;         /* nb_ops after tcg_optimize() */
     TCGType addr_type;            /* TCG_TYPE_I32 or TCG_TYPE_I64 */
     TCGBar guest_mo;
 
@@ -418,6 +420,15 @@ struct TCGContext {
     struct qemu_plugin_insn *plugin_insn;
 #endif
 
+    /*
+     * Guest memory accesses of the TB being translated for -exec-trace:
+     * when exec_trace_sites is set, each one appends a record, and the
+     * first ones are described in exec_trace_sites.
+     */
+    uint32_t *exec_trace_sites;
+    int exec_trace_insn;          /* index of the insn being translated */
+    int exec_trace_nb_mem;        /* accesses instrumented so far */
+
     /* For host-specific values. */
 #ifdef __riscv
     MemOp riscv_cur_vsew;
@@ -652,6 +663,17 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
 
+/**
+ * tcg_region_set_adaptive:
+ * @initial: initial usable size of each region, in bytes
+ *
+ * Only use the first @initial bytes of each region and double that every
+ * time the buffer is flushed while mostly full, up to the reserved size.
+ * Each flush also returns the pages used so far to the host. Must be
+ * called after tcg_init() and before the first translation.
+ */
+void tcg_region_set_adaptive(size_t initial);
+
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
 
@@ -1076,6 +1076,8 @@ static void pgb_dynamic(const char *image_name, uintptr_t guest_loaddr,
     guest_base = ret;
 }
 
+static bool guest_base_probed;
+
 void probe_guest_base(const char *image_name, abi_ulong guest_loaddr,
                       abi_ulong guest_hiaddr)
 {
@@ -1099,7 +1101,13 @@ void probe_guest_base(const char *image_name, abi_ulong guest_loaddr,
         }
     }
 
-    if (have_guest_base) {
+    /*
+     * guest_base is part of the translated code, so an image loaded by an
+     * in-place exec goes into the address space chosen for the first one.
+     */
+    if (guest_base_probed) {
+        assert(reserved_va);
+    } else if (have_guest_base) {
         pgb_fixed(image_name, guest_loaddr, guest_hiaddr, align);
     } else {
         pgb_dynamic(image_name, guest_loaddr, guest_hiaddr, align);
@@ -1112,8 +1120,12 @@ void probe_guest_base(const char *image_name, abi_ulong guest_loaddr,
     }
 
     assert(QEMU_IS_ALIGNED(guest_base, align));
-    qemu_log_mask(CPU_LOG_PAGE, "Locating guest address space "
-                  "@ 0x%" PRIx64 "\n", (uint64_t)guest_base);
+    if (!guest_base_probed) {
+        qemu_log_mask(CPU_LOG_PAGE, "Locating guest address space "
+                      "@ 0x%" PRIx64 "\n", (uint64_t)guest_base);
+        startup_phase("guest-base");
+        guest_base_probed = true;
+    }
 }
 
 enum {
@@ -1566,12 +1578,17 @@ static void load_elf_image(const char *image_name, const ImageSource *src,
         info->end_data = info->end_code;
     }
 
-    if (qemu_log_enabled()) {
+    /*
+     * Images mapped from a file were registered with microhook-modules by
+     * target_mmap(), which finds their load bias from the program headers,
+     * loads their symbols on the first lookup and reports them to perf.
+     * Only in-memory images (the vdso) need their symbols read here; they
+     * have no file for perf's DWARF lookup.
+     */
+    if (src->fd < 0 && qemu_log_enabled()) {
         load_symbols(ehdr, src, load_bias);
     }
 
-    debuginfo_report_elf(image_name, src->fd, load_bias);
-
     mmap_unlock();
 
     close(src->fd);
@@ -1831,39 +1848,48 @@ static void load_symbols(struct elfhdr *hdr, const ImageSource *src,
     g_free(syms);
 }
 
-uint32_t get_elf_eflags(int fd)
+static bool read_elf_ehdr(int fd, struct elfhdr *ehdr)
 {
-    struct elfhdr ehdr;
     off_t offset;
     int ret;
 
     /* Read ELF header */
     offset = lseek(fd, 0, SEEK_SET);
     if (offset == (off_t) -1) {
-        return 0;
+        return false;
     }
-    ret = read(fd, &ehdr, sizeof(ehdr));
-    if (ret < sizeof(ehdr)) {
-        return 0;
+    ret = read(fd, ehdr, sizeof(*ehdr));
+    if (ret < sizeof(*ehdr)) {
+        return false;
     }
     offset = lseek(fd, offset, SEEK_SET);
     if (offset == (off_t) -1) {
-        return 0;
+        return false;
     }
 
     /* Check ELF signature */
-    if (!elf_check_ident(&ehdr)) {
-        return 0;
+    if (!elf_check_ident(ehdr)) {
+        return false;
     }
 
     /* check header */
-    bswap_ehdr(&ehdr);
-    if (!elf_check_ehdr(&ehdr)) {
-        return 0;
-    }
+    bswap_ehdr(ehdr);
+    return elf_check_ehdr(ehdr);
+}
+
+uint32_t get_elf_eflags(int fd)
+{
+    struct elfhdr ehdr;
 
     /* return architecture id */
-    return ehdr.e_flags;
+    return read_elf_ehdr(fd, &ehdr) ? ehdr.e_flags : 0;
+}
+
+bool is_target_elf(int fd)
+{
+    struct elfhdr ehdr;
+
+    return read_elf_ehdr(fd, &ehdr);
 }
 
 int load_elf_binary(struct linux_binprm *bprm, struct image_info *info)
@@ -23,6 +23,12 @@
 #include "user-internals.h"
 #include "qemu/plugin.h"
 #include "microhook-coverage.h"
+#include "microhook-density.h"
+#include "microhook-pcap.h"
+#include "microhook.h"
+#include "microhook-ranges.h"
+#include "microhook-tbprof.h"
+#include "microhook-trace.h"
 
 #ifdef CONFIG_GCOV
 extern void __gcov_dump(void);
@@ -30,11 +36,25 @@ extern void __gcov_dump(void);
 
 void preexit_cleanup(CPUArchState *env, int code)
 {
+        /* The state torn down here still belongs to the vfork() parent */
+        if (in_vfork_child()) {
+            return;
+        }
 #ifdef CONFIG_GCOV
         __gcov_dump();
 #endif
         gdb_exit(code);
         qemu_plugin_user_exit();
+        microhook_ranges_flush();
+        microhook_on_exit(code);
         microhook_coverage_shutdown();
+        microhook_pcap_finish();
+        microhook_trace_finish();
+        if (microhook_density_enabled()) {
+            microhook_density_report();
+        }
+        if (microhook_tbprof_enabled()) {
+            microhook_tbprof_report();
+        }
         perf_exit();
 }
@@ -88,6 +88,8 @@ int loader_exec(int fdexec, const char *filename, char **argv, char **envp,
                 struct image_info *infop, struct linux_binprm *);
 
 uint32_t get_elf_eflags(int fd);
+/* Whether fd holds an ELF executable this QEMU can load */
+bool is_target_elf(int fd);
 int load_elf_binary(struct linux_binprm *bprm, struct image_info *info);
 int load_flt_binary(struct linux_binprm *bprm, struct image_info *info);
 
@@ -25,6 +25,7 @@
 #include <sys/syscall.h>
 #include <sys/resource.h>
 #include <sys/shm.h>
+#include <dirent.h>
 #include <linux/binfmts.h>
 
 #include "qapi/error.h"
@@ -59,6 +60,16 @@
 #include "exec/page-vary.h"
 #include "microhook.h"
 #include "microhook-coverage.h"
+#include "microhook-covmap.h"
+#include "microhook-density.h"
+#include "microhook-net.h"
+#include "microhook-pcap.h"
+#include "microhook-tbprof.h"
+#include "microhook-trace.h"
+#include "microhook-ranges.h"
+#include "microhook-sched.h"
+#include "microhook-smc.h"
+#include "microhook-threads.h"
 
 #ifdef CONFIG_SEMIHOSTING
 #include "semihosting/semihost.h"
@@ -86,6 +97,9 @@ uintptr_t guest_base;
 bool have_guest_base;
 
 bool qemu_dup_for_children;
+bool qemu_slow_vfork;
+static bool exec_in_process;
+static bool cpu_model_from_elf;
 int qemu_argc;
 char **qemu_argv;
 
@@ -106,6 +120,15 @@ static const char *microhook_script;
  */
 static const char *coverage_file;
 
+/*
+ * Coverage map shared with other instances of a campaign
+ */
+static const char *coverage_map_file;
+static const char *pcap_file;
+static const char *exec_trace_file;
+static bool exec_trace_mem;
+static int exec_trace_fd = -1;
+
 /*
  * Use PATH environment variable to find binary
  */
@@ -118,6 +141,23 @@ static bool use_path;
 static int last_log_mask;
 static const char *last_log_filename;
 
+/*
+ * Start of the current and of the first startup phase, for -d startup.
+ */
+static int64_t startup_begin;
+static int64_t startup_last;
+
+void startup_phase(const char *name)
+{
+    int64_t now = get_clock();
+
+    if (qemu_loglevel_mask(LOG_STARTUP)) {
+        qemu_log("startup: %-12s %8.3f ms\n", name,
+                 (now - startup_last) / (double)SCALE_MS);
+    }
+    startup_last = now;
+}
+
 /*
  * When running 32-on-64 we should make sure we can fit all of the possible
  * guest address space into a contiguous chunk of virtual host memory.
@@ -149,6 +189,7 @@ unsigned long guest_addr_max;
 static void usage(int exitcode);
 
 static const char *interp_prefix = CONFIG_QEMU_INTERP_PREFIX;
+static const char *overlay_dir;
 const char *qemu_uname_release;
 
 #if !defined(TARGET_DEFAULT_STACK_SIZE)
@@ -204,6 +245,168 @@ void fork_end(pid_t pid)
     end_exclusive();
 }
 
+/*
+ * Host fds that belong to QEMU: those open when the guest started and
+ * those registered since.
+ */
+static GHashTable *qemu_fds;
+static GMutex qemu_fds_lock;
+
+void qemu_fd_register(int fd)
+{
+    g_mutex_lock(&qemu_fds_lock);
+    if (!qemu_fds) {
+        qemu_fds = g_hash_table_new(NULL, NULL);
+    }
+    g_hash_table_add(qemu_fds, GINT_TO_POINTER(fd));
+    g_mutex_unlock(&qemu_fds_lock);
+}
+
+void qemu_fd_unregister(int fd)
+{
+    g_mutex_lock(&qemu_fds_lock);
+    if (qemu_fds) {
+        g_hash_table_remove(qemu_fds, GINT_TO_POINTER(fd));
+    }
+    g_mutex_unlock(&qemu_fds_lock);
+}
+
+static GArray *list_cloexec_fds(void)
+{
+    GArray *fds = g_array_new(false, false, sizeof(int));
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *de;
+
+    if (!dir) {
+        return fds;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        int fd, flags;
+
+        if (qemu_strtoi(de->d_name, NULL, 10, &fd) < 0 || fd == dirfd(dir)) {
+            continue;
+        }
+        flags = fcntl(fd, F_GETFD);
+        if (flags >= 0 && (flags & FD_CLOEXEC)) {
+            g_array_append_val(fds, fd);
+        }
+    }
+    closedir(dir);
+    return fds;
+}
+
+static bool is_qemu_fd(int fd)
+{
+    bool ret;
+
+    g_mutex_lock(&qemu_fds_lock);
+    ret = qemu_fds && g_hash_table_contains(qemu_fds, GINT_TO_POINTER(fd));
+    g_mutex_unlock(&qemu_fds_lock);
+    return ret;
+}
+
+int exec_in_place(CPUArchState *env, const char *pathname, char **argv,
+                  char **envp)
+{
+    CPUState *cpu = env_cpu(env);
+    TaskState *ts = get_task_state(cpu);
+    struct image_info *info = ts->info;
+    g_autoptr(GArray) fds = NULL;
+    g_autoptr(GHashTable) script_fds = NULL;
+    g_autofree char *file = NULL;
+    int fd, ret;
+
+    /*
+     * The new image must fit into the reserved guest address space, and
+     * neither other threads nor a vfork() parent may still be using the
+     * old one.
+     */
+    if (!exec_in_process || !reserved_va || in_vfork_child() ||
+        CPU_NEXT(first_cpu)) {
+        return 1;
+    }
+
+    file = g_strdup(path(pathname));
+    if (access(file, X_OK) != 0) {
+        return -errno;
+    }
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (!is_target_elf(fd) ||
+        (cpu_model_from_elf &&
+         strcmp(get_elf_cpu_model(get_elf_eflags(fd)), cpu_model) != 0)) {
+        close(fd);
+        return 1;
+    }
+
+    /* From here on the old program is gone; copy what lives in its memory */
+    argv = g_strdupv(argv);
+    envp = g_strdupv(envp);
+    if (!realpath(file, real_exec_path)) {
+        pstrcpy(real_exec_path, sizeof(real_exec_path), file);
+    }
+    exec_path = real_exec_path;
+
+    microhook_ranges_flush();
+
+    /* Files and sockets of the hook script carry on with the interpreter */
+    script_fds = g_hash_table_new(NULL, NULL);
+    microhook_script_fds(script_fds);
+
+    fds = list_cloexec_fds();
+    for (guint i = 0; i < fds->len; i++) {
+        int cloexec_fd = g_array_index(fds, int, i);
+
+        if (!is_qemu_fd(cloexec_fd) &&
+            !g_hash_table_contains(script_fds, GINT_TO_POINTER(cloexec_fd))) {
+            close(cloexec_fd);
+            fd_trans_unregister(cloexec_fd);
+            if (microhook_pcap_enabled()) {
+                microhook_pcap_closed(cloexec_fd);
+            }
+        }
+    }
+
+    flush_signal_handlers();
+    ts->child_tidptr = 0;
+    ts->sigaltstack_used.ss_sp = 0;
+    ts->sigaltstack_used.ss_size = 0;
+    ts->sigaltstack_used.ss_flags = TARGET_SS_DISABLE;
+    ts->sys_dispatch_len = -1;
+#ifdef TARGET_M68K
+    ts->tp_value = 0;
+#endif
+#ifdef TARGET_AARCH64
+    ts->gcs_base = 0;
+    ts->gcs_size = 0;
+    ts->gcs_el0_locked = 0;
+#endif
+
+    target_munmap_all();
+
+    memset(info, 0, sizeof(*info));
+    memset(ts->bprm, 0, sizeof(*ts->bprm));
+    ret = loader_exec(fd, exec_path, argv, envp, info, ts->bprm);
+    g_strfreev(argv);
+    g_strfreev(envp);
+    if (ret != 0) {
+        printf("Error while loading %s: %s\n", exec_path, strerror(-ret));
+        _exit(EXIT_FAILURE);
+    }
+    target_set_brk(info->brk);
+
+    cpu_reset(cpu);
+    init_main_thread(cpu, info);
+
+    if (microhook_coverage_enabled()) {
+        microhook_coverage_set_binary_info(exec_path, info->start_code,
+                                           info->end_code, info->entry);
+    }
+    return 0;
+}
+
 __thread CPUState *thread_cpu;
 
 bool qemu_cpu_is_self(CPUState *cpu)
@@ -359,6 +562,11 @@ static void handle_arg_ld_prefix(const char *arg)
     interp_prefix = strdup(arg);
 }
 
+static void handle_arg_overlay(const char *arg)
+{
+    overlay_dir = strdup(arg);
+}
+
 static void handle_arg_seed(const char *arg)
 {
     seed_optarg = arg;
@@ -488,11 +696,156 @@ static void handle_arg_coverage(const char *arg)
     coverage_file = arg ? strdup(arg) : NULL;
 }
 
+static void handle_arg_coverage_map(const char *arg)
+{
+    coverage_map_file = strdup(arg);
+}
+
+static void handle_arg_pcap(const char *arg)
+{
+    pcap_file = strdup(arg);
+}
+
+static void handle_arg_exec_trace(const char *arg)
+{
+    g_auto(GStrv) opts = g_strsplit(arg, ",", -1);
+
+    for (int i = 1; opts[i]; i++) {
+        if (!strcmp(opts[i], "mem")) {
+            exec_trace_mem = true;
+        } else if (sscanf(opts[i], "fd=%d", &exec_trace_fd) == 1) {
+            continue;
+        } else {
+            fprintf(stderr, "Unknown -exec-trace option '%s'\n", opts[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    exec_trace_file = strdup(opts[0]);
+}
+
+/*
+ * Hand the value from child_arg() to QEMUs started by execve() in place of
+ * that of option opt, on their command line with -qemu-children and in the
+ * variable env if the guest inherits it.
+ */
+static void set_child_arg(const char *opt, const char *env,
+                          char *(*child_arg)(void))
+{
+    g_autofree char *arg = NULL;
+
+    if (!qemu_dup_for_children && !getenv(env)) {
+        return;
+    }
+    arg = child_arg();
+    if (qemu_dup_for_children) {
+        for (int i = 1; i + 1 < qemu_argc; i++) {
+            const char *name = qemu_argv[i];
+
+            if (name[0] == '-' && name[1] == '-') {
+                name++;
+            }
+            if (name[0] == '-' && !strcmp(name + 1, opt)) {
+                free(qemu_argv[i + 1]);
+                qemu_argv[i + 1] = strdup(arg);
+            }
+        }
+    }
+    if (getenv(env)) {
+        g_autofree char *var = g_strdup_printf("%s=%s", env, arg);
+
+        envlist_setenv(envlist, var);
+    }
+}
+
+static void handle_arg_redirect(const char *arg)
+{
+    g_auto(GStrv) specs = g_strsplit(arg, ";", -1);
+
+    for (int i = 0; specs[i]; i++) {
+        if (*specs[i] && microhook_net_parse_rule(specs[i]) < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void handle_arg_atomic_stripes(const char *arg)
+{
+    cpu_exec_atomic_stripes_enable();
+}
+
+static void handle_arg_smc_adaptive(const char *arg)
+{
+    microhook_smc_enable();
+}
+
+static void handle_arg_density(const char *arg)
+{
+    microhook_density_enable();
+}
+
+static void handle_arg_tb_profile(const char *arg)
+{
+    g_auto(GStrv) opts = g_strsplit(arg, ",", -1);
+    bool exec = false;
+    int pid = 0;
+
+    for (int i = 1; opts[i]; i++) {
+        if (!strcmp(opts[i], "exec")) {
+            exec = true;
+        } else if (sscanf(opts[i], "pid=%d", &pid) == 1) {
+            continue;
+        } else {
+            fprintf(stderr, "Unknown -tb-profile option '%s'\n", opts[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    microhook_tbprof_enable(opts[0], exec, pid);
+}
+
+static void handle_arg_deterministic_threads(const char *arg)
+{
+    g_auto(GStrv) opts = g_strsplit(arg, ",", -1);
+    uint64_t seed, quantum = 0;
+
+    if (qemu_strtou64(opts[0], NULL, 0, &seed)) {
+        fprintf(stderr, "Invalid -deterministic-threads seed '%s'\n",
+                opts[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 1; opts[i]; i++) {
+        if (!g_str_has_prefix(opts[i], "quantum=")) {
+            fprintf(stderr, "Unknown -deterministic-threads option '%s'\n",
+                    opts[i]);
+            exit(EXIT_FAILURE);
+        }
+        if (qemu_strtou64(opts[i] + strlen("quantum="), NULL, 0, &quantum) ||
+            !quantum || quantum > MICROHOOK_SCHED_QUANTUM_MAX) {
+            fprintf(stderr, "Invalid -deterministic-threads quantum '%s': "
+                    "must be between 1 and %d\n",
+                    opts[i] + strlen("quantum="), MICROHOOK_SCHED_QUANTUM_MAX);
+            exit(EXIT_FAILURE);
+        }
+    }
+    microhook_sched_init(seed, quantum);
+}
+
 static void handle_arg_qemu_children(const char *arg)
 {
     qemu_dup_for_children = true;
 }
 
+static void handle_arg_exec_in_process(const char *arg)
+{
+    exec_in_process = true;
+    /* Used whenever the exec cannot stay in this process */
+    qemu_dup_for_children = true;
+}
+
+static void handle_arg_slow_vfork(const char *arg)
+{
+    qemu_slow_vfork = true;
+}
+
 static void handle_arg_use_path(const char *arg)
 {
     use_path = true;
@@ -525,6 +878,8 @@ static const struct qemu_argument arg_table[] = {
      "port",       "wait gdb connection to 'port'"},
     {"L",          "QEMU_LD_PREFIX",   true,  handle_arg_ld_prefix,
      "path",       "set the elf interpreter prefix to 'path'"},
+    {"overlay",    "QEMU_OVERLAY",     true,  handle_arg_overlay,
+     "dir",        "keep changes to the -L prefix in 'dir' instead"},
     {"s",          "QEMU_STACK_SIZE",  true,  handle_arg_stack_size,
      "size",       "set the stack size to 'size' bytes"},
     {"cpu",        "QEMU_CPU",         true,  handle_arg_cpu,
@@ -580,10 +935,49 @@ static const struct qemu_argument arg_table[] = {
      "script.py",  "Load Python script for syscall hooking"},
     {"coverage",   "QEMU_COVERAGE",    true,  handle_arg_coverage,
      "file.drcov", "Generate DRCov coverage file (default: coverage.drcov)"},
+    {"coverage-map", "QEMU_COVERAGE_MAP", true, handle_arg_coverage_map,
+     "file",       "OR coverage into a bitmap file shared with other "
+                   "instances (see scripts/microhook-farm.py)"},
+    {"pcap",       "QEMU_PCAP",        true,  handle_arg_pcap,
+     "file.pcapng", "Capture the payloads of guest socket syscalls"},
+    {"exec-trace", "QEMU_EXEC_TRACE",  true,  handle_arg_exec_trace,
+     "file[,mem]", "Write a compressed trace of executed blocks (mem: and "
+                   "of memory accesses); see scripts/microhook-trace.py"},
+    {"redirect",   "QEMU_REDIRECT",    true,  handle_arg_redirect,
+     "[ops@]ip:port=target",
+                   "Redirect connect/bind/sendto on matching addresses to "
+                   "inet:ip[:port] or unix:path (repeatable, or ';' separated)"},
+    {"atomic-stripes", "QEMU_ATOMIC_STRIPES", false, handle_arg_atomic_stripes,
+     "",           "Serialise atomics the host cannot do with per-address "
+                   "locks instead of stopping all threads"},
+    {"smc-adaptive", "QEMU_SMC_ADAPTIVE", false, handle_arg_smc_adaptive,
+     "",           "Stop write-protecting code pages that are rewritten "
+                   "often and validate their blocks on entry instead"},
+    {"density",    "QEMU_DENSITY",     false, handle_arg_density,
+     "",           "Keep memory use low for running many instances per host "
+                   "and print a resident memory breakdown at exit"},
+    {"tb-profile", "QEMU_TB_PROFILE",  true,  handle_arg_tb_profile,
+     "file.json[,exec]",
+                   "Write the translation cost of every block at exit "
+                   "(exec: also count block executions)"},
+    {"deterministic-threads",
+                   "QEMU_DETERMINISTIC_THREADS", true,
+                   handle_arg_deterministic_threads,
+     "seed[,quantum=N]",
+                   "Run one guest thread at a time, switching every N blocks "
+                   "on average and at blocking syscalls, in an order drawn "
+                   "from seed"},
     {"qemu-children",
                    "QEMU_CHILDREN",    false, handle_arg_qemu_children,
      "",           "Run child processes (created with execve) with qemu "
                    "(as instantiated for the parent)"},
+    {"exec-in-process",
+                   "QEMU_EXEC_IN_PROCESS", false, handle_arg_exec_in_process,
+     "",           "Load programs started with execve into this qemu "
+                   "instead of running a new one (implies -qemu-children)"},
+    {"slow-vfork", "QEMU_SLOW_VFORK",  false, handle_arg_slow_vfork,
+     "",           "Emulate vfork with fork instead of sharing memory with "
+                   "the child until it calls execve"},
     {"use-path",   "QEMU_USE_PATH",    false, handle_arg_use_path,
      "",           "Use PATH environment variable to find binary"},
     {NULL, NULL, false, NULL, NULL, NULL}
@@ -782,6 +1176,8 @@ int main(int argc, char **argv, char **envp)
     unsigned long max_reserved_va;
     bool preserve_argv0;
 
+    startup_begin = startup_last = get_clock();
+
     error_init(argv[0]);
     module_call_init(MODULE_INIT_TRACE);
     qemu_init_cpu_list();
@@ -832,12 +1228,14 @@ int main(int argc, char **argv, char **envp)
     qemu_set_log_filename_flags(last_log_filename,
                                 last_log_mask | (enable_strace * LOG_STRACE),
                                 &error_fatal);
+    startup_phase("args");
 
     if (!trace_init_backends()) {
         exit(1);
     }
     trace_init_file();
     qemu_plugin_load_list(&plugins, &error_fatal);
+    startup_phase("trace");
 
     /* Initialize microhook if a script was provided */
     if (microhook_script) {
@@ -854,8 +1252,17 @@ int main(int argc, char **argv, char **envp)
 
     /* Scan interp_prefix dir for replacement files. */
     init_paths(interp_prefix);
+    if (overlay_dir) {
+        Error *err = NULL;
+
+        if (!init_overlay(overlay_dir, &err)) {
+            error_reportf_err(err, "-overlay: ");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     init_qemu_uname_release();
+    startup_phase("paths");
 
     /*
      * Manage binfmt-misc open-binary flag
@@ -901,6 +1308,7 @@ int main(int argc, char **argv, char **envp)
 
     if (cpu_model == NULL) {
         cpu_model = get_elf_cpu_model(get_elf_eflags(execfd));
+        cpu_model_from_elf = true;
     }
     cpu_type = parse_cpu_option(cpu_model);
 
@@ -916,6 +1324,8 @@ int main(int argc, char **argv, char **envp)
                                 opt_tb_size, &error_abort);
         ac->init_machine(accel, NULL);
     }
+    microhook_density_init_tcg();
+    startup_phase("accel");
 
     /*
      * Finalize page size before creating CPUs.
@@ -930,6 +1340,7 @@ int main(int argc, char **argv, char **envp)
     env = cpu_env(cpu);
     cpu_reset(cpu);
     thread_cpu = cpu;
+    startup_phase("cpu");
 
     /*
      * Reserving too much vm space via mmap can run into problems with rlimits,
@@ -1017,6 +1428,27 @@ int main(int argc, char **argv, char **envp)
             exit(1);
         }
     }
+    startup_phase("crypto");
+
+    /*
+     * Children run by execve() append to the same capture, continue
+     * their process's trace and leave the profile report of this one
+     * alone. Set up before the guest's environment is built, which may
+     * pass the options on to them too.
+     */
+    if (pcap_file && microhook_pcap_init(pcap_file) == 0) {
+        set_child_arg("pcap", "QEMU_PCAP", microhook_pcap_child_arg);
+    }
+    if (exec_trace_file &&
+        microhook_trace_init(exec_trace_file, exec_trace_fd,
+                             exec_trace_mem) == 0) {
+        set_child_arg("exec-trace", "QEMU_EXEC_TRACE",
+                      microhook_trace_child_arg);
+    }
+    if (microhook_tbprof_enabled()) {
+        set_child_arg("tb-profile", "QEMU_TB_PROFILE",
+                      microhook_tbprof_child_arg);
+    }
 
     target_environ = envlist_to_environ(envlist, NULL);
     envlist_free(envlist);
@@ -1079,6 +1511,7 @@ int main(int argc, char **argv, char **envp)
     task_settid(ts);
 
     fd_trans_init();
+    startup_phase("setup");
 
     ret = loader_exec(execfd, exec_path, target_argv, target_environ,
                       info, &bprm);
@@ -1086,6 +1519,7 @@ int main(int argc, char **argv, char **envp)
         printf("Error while loading %s: %s\n", exec_path, strerror(-ret));
         _exit(EXIT_FAILURE);
     }
+    startup_phase("loader");
 
     /* Initialize coverage if requested (after binary is loaded) */
     if (coverage_file || getenv("QEMU_COVERAGE")) {
@@ -1097,6 +1531,12 @@ int main(int argc, char **argv, char **envp)
             atexit(microhook_coverage_shutdown);
         }
     }
+    if (coverage_map_file && microhook_covmap_init(coverage_map_file) == 0 &&
+        !microhook_coverage_enabled()) {
+        /* Only collect blocks; the map is the output */
+        microhook_coverage_collect();
+    }
+    startup_phase("coverage");
 
     for (wrk = target_environ; *wrk; wrk++) {
         g_free(*wrk);
@@ -1138,22 +1578,44 @@ int main(int argc, char **argv, char **envp)
     target_set_brk(info->brk);
     syscall_init();
     signal_init(rtsig_map);
+    startup_phase("syscall");
 
     /* Now that we've loaded the binary, GUEST_BASE is fixed.  Delay
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
     tcg_prologue_init();
+    startup_phase("prologue");
 
     init_main_thread(cpu, info);
+    microhook_threads_start(cpu->cc->get_pc(cpu));
+    microhook_sched_add_thread(cpu);
+    microhook_on_thread_start(qemu_get_thread_id(), cpu->cc->get_pc(cpu));
+    startup_phase("main-thread");
 
     if (gdbstub) {
         gdbserver_start(gdbstub, &error_fatal);
+        /* The debugger follows forks, which needs the child's own copy */
+        qemu_slow_vfork = true;
+        exec_in_process = false;
     }
 
 #ifdef CONFIG_SEMIHOSTING
     qemu_semihosting_guestfd_init();
 #endif
 
+    if (qemu_loglevel_mask(LOG_STARTUP)) {
+        qemu_log("startup: %-12s %8.3f ms\n", "total",
+                 (get_clock() - startup_begin) / (double)SCALE_MS);
+    }
+
+    if (exec_in_process) {
+        g_autoptr(GArray) fds = list_cloexec_fds();
+
+        for (guint i = 0; i < fds->len; i++) {
+            qemu_fd_register(g_array_index(fds, int, i));
+        }
+    }
+
     cpu_loop(env);
     /* never exits */
     return 0;
@@ -0,0 +1,322 @@
+/*
+ * Microhook Call - synchronous calls of guest functions for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * The vCPU of the calling thread is borrowed: its registers are saved, set
+ * up for the call and run through cpu_exec() like cpu_loop() would, until
+ * the function returns to a stop address guarded by a breakpoint. Blocks
+ * are looked up in and added to the usual translation cache, so repeated
+ * calls run at the same speed as the guest calling the function itself.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "exec/cpu-common.h"
+#include "hw/core/cpu.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "user-mmap.h"
+#include "microhook-call.h"
+#include <glib.h>
+
+#define CALL_DEFAULT_STACK_SIZE (256 * KiB)
+
+/* Private stack of the calling thread, reused across calls */
+static __thread abi_ulong t_stack = 0;
+static __thread abi_ulong t_stack_size = 0;
+
+static bool get_stack(size_t size)
+{
+    abi_long stack;
+
+    size = TARGET_PAGE_ALIGN(size ? size : CALL_DEFAULT_STACK_SIZE);
+    if (t_stack && t_stack_size >= size) {
+        return true;
+    }
+    if (t_stack) {
+        target_munmap(t_stack, t_stack_size);
+        t_stack = 0;
+    }
+
+    stack = target_mmap(0, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == -1) {
+        return false;
+    }
+    t_stack = stack;
+    t_stack_size = size;
+    return true;
+}
+
+/*
+ * Set up registers and stack for calling pc with args, returning to ret.
+ * sp is the 16-byte aligned top of the private stack.
+ * Returns false if the target or the number of arguments is unsupported.
+ */
+static bool setup_call(CPUArchState *env, uint64_t pc, const uint64_t *args,
+                       int nargs, abi_ulong sp, abi_ulong ret)
+{
+#if defined(TARGET_ARM)
+    if (env->aarch64) {
+        if (nargs > 8) {
+            return false;
+        }
+        for (int i = 0; i < nargs; i++) {
+            env->xregs[i] = args[i];
+        }
+        env->xregs[30] = ret;
+        env->xregs[31] = sp;
+        env->pc = pc;
+    } else {
+        if (nargs > 4) {
+            return false;
+        }
+        for (int i = 0; i < nargs; i++) {
+            env->regs[i] = args[i];
+        }
+        env->regs[14] = ret;
+        env->regs[13] = sp;
+        env->thumb = pc & 1;
+        env->regs[15] = pc & ~1;
+    }
+    return true;
+
+#elif defined(TARGET_X86_64)
+    static const int arg_regs[] = { R_EDI, R_ESI, R_EDX, R_ECX, R_R8, R_R9 };
+
+    if (nargs > (int)ARRAY_SIZE(arg_regs)) {
+        return false;
+    }
+    for (int i = 0; i < nargs; i++) {
+        env->regs[arg_regs[i]] = args[i];
+    }
+    sp -= 8;
+    if (put_user_ual(ret, sp)) {
+        return false;
+    }
+    env->regs[R_ESP] = sp;
+    env->eip = pc;
+    return true;
+
+#elif defined(TARGET_I386)
+    /* cdecl: arguments on the stack, 16-byte aligned */
+    sp = (sp - nargs * 4) & ~15;
+    for (int i = 0; i < nargs; i++) {
+        if (put_user_ual(args[i], sp + i * 4)) {
+            return false;
+        }
+    }
+    sp -= 4;
+    if (put_user_ual(ret, sp)) {
+        return false;
+    }
+    env->regs[R_ESP] = sp;
+    env->eip = pc;
+    return true;
+
+#elif defined(TARGET_MIPS) || defined(TARGET_MIPS64)
+    if (nargs > 8) {
+        return false;
+    }
+#if defined(TARGET_ABI_MIPSO32)
+    /* o32: a0-a3, then the stack above the 16-byte argument save area */
+    sp -= 32;
+    for (int i = 0; i < nargs; i++) {
+        if (i < 4) {
+            env->active_tc.gpr[4 + i] = args[i];
+        } else if (put_user_ual(args[i], sp + 16 + (i - 4) * 4)) {
+            return false;
+        }
+    }
+#else
+    for (int i = 0; i < nargs; i++) {
+        env->active_tc.gpr[4 + i] = args[i];
+    }
+#endif
+    env->active_tc.gpr[25] = pc;    /* t9, for position independent code */
+    env->active_tc.gpr[31] = ret;
+    env->active_tc.gpr[29] = sp;
+    env->active_tc.PC = pc;
+    return true;
+
+#elif defined(TARGET_RISCV32) || defined(TARGET_RISCV64)
+    if (nargs > 8) {
+        return false;
+    }
+    for (int i = 0; i < nargs; i++) {
+        env->gpr[10 + i] = args[i];
+    }
+    env->gpr[1] = ret;
+    env->gpr[2] = sp;
+    env->pc = pc;
+    return true;
+
+#else
+    return false;
+#endif
+}
+
+static uint64_t call_result(CPUArchState *env)
+{
+#if defined(TARGET_ARM)
+    return env->aarch64 ? env->xregs[0] : env->regs[0];
+#elif defined(TARGET_I386)
+    return env->regs[R_EAX];
+#elif defined(TARGET_MIPS) || defined(TARGET_MIPS64)
+    return env->active_tc.gpr[2];
+#elif defined(TARGET_RISCV32) || defined(TARGET_RISCV64)
+    return env->gpr[10];
+#else
+    return 0;
+#endif
+}
+
+/* Runs on a timer thread; the call loop notices the deadline */
+static void call_watchdog(union sigval sv)
+{
+    cpu_exit(sv.sival_ptr);
+}
+
+MicrohookCallStatus microhook_call(uint64_t addr, const uint64_t *args,
+                                   int nargs, const MicrohookCallOpts *opts,
+                                   uint64_t *result, int *exception,
+                                   int *sig)
+{
+    CPUState *cpu = thread_cpu;
+    TaskState *ts;
+    struct emulated_sigtable sync;
+    CPUArchState *env;
+    g_autofree CPUArchState *saved = NULL;
+    CPUBreakpoint *bp = NULL;
+    int old_sstep;
+    timer_t timer;
+    bool have_timer = false;
+    int64_t deadline = 0;
+    uint64_t steps = 0;
+    abi_ulong stop;
+    MicrohookCallStatus status;
+
+    if (!cpu || cpu->running) {
+        return MICROHOOK_CALL_BUSY;
+    }
+    if (nargs > MICROHOOK_CALL_MAX_ARGS) {
+        return MICROHOOK_CALL_UNSUPPORTED;
+    }
+    if (!get_stack(opts->stack_size)) {
+        return MICROHOOK_CALL_NOMEM;
+    }
+
+    env = cpu_env(cpu);
+    saved = g_memdup2(env, sizeof(*env));
+
+    /* The lowest stack address is never executed: returning there stops */
+    stop = t_stack;
+    if (!setup_call(env, addr, args, nargs,
+                    (t_stack + t_stack_size) & ~(abi_ulong)15, stop)) {
+        memcpy(env, saved, sizeof(*env));
+        return MICROHOOK_CALL_UNSUPPORTED;
+    }
+
+    /* Faults of the function are queued here; keep the caller's apart */
+    ts = get_task_state(cpu);
+    sync = ts->sync_signal;
+    ts->sync_signal.pending = 0;
+
+    /*
+     * User mode has no instruction counter, so a limit means stepping one
+     * instruction at a time. Single-stepping overrides breakpoints; the pc
+     * is compared with the stop address after every step instead.
+     */
+    old_sstep = cpu->singlestep_enabled;
+    if (opts->max_insns) {
+        cpu_single_step(cpu, SSTEP_ENABLE | SSTEP_NOIRQ | SSTEP_NOTIMER);
+    } else {
+        cpu_breakpoint_insert(cpu, stop, BP_GDB, &bp);
+    }
+
+    if (opts->timeout_ns) {
+        struct sigevent sev = {
+            .sigev_notify = SIGEV_THREAD,
+            .sigev_notify_function = call_watchdog,
+            .sigev_value.sival_ptr = cpu,
+        };
+        /* Keep kicking in case a kick lands between two cpu_exec() */
+        struct itimerspec its = {
+            .it_value.tv_sec = opts->timeout_ns / NANOSECONDS_PER_SECOND,
+            .it_value.tv_nsec = opts->timeout_ns % NANOSECONDS_PER_SECOND,
+            .it_interval.tv_nsec = SCALE_MS,
+        };
+
+        deadline = get_clock() + opts->timeout_ns;
+        have_timer = timer_create(CLOCK_MONOTONIC, &sev, &timer) == 0 &&
+                     timer_settime(timer, 0, &its, NULL) == 0;
+    }
+
+    for (;;) {
+        int trapnr;
+
+        if (cpu->cc->get_pc(cpu) == stop) {
+            status = MICROHOOK_CALL_OK;
+            break;
+        }
+        if (deadline && get_clock() >= deadline) {
+            status = MICROHOOK_CALL_TIMEOUT;
+            break;
+        }
+        if (opts->max_insns && steps++ >= opts->max_insns) {
+            status = MICROHOOK_CALL_INSN_LIMIT;
+            break;
+        }
+
+        cpu_exec_start(cpu);
+        trapnr = cpu_exec(cpu);
+        cpu_exec_end(cpu);
+        process_queued_cpu_work(cpu);
+
+        /*
+         * Most targets report a fault as EXCP_INTERRUPT with the signal
+         * queued, which would re-execute the faulting instruction forever.
+         */
+        if (ts->sync_signal.pending) {
+            *exception = trapnr;
+            *sig = ts->sync_signal.pending;
+            status = MICROHOOK_CALL_EXCEPTION;
+            break;
+        }
+        if (trapnr == EXCP_INTERRUPT || trapnr == EXCP_YIELD) {
+            /* Watchdog or a signal; signals are delivered after the call */
+            continue;
+        }
+        if (trapnr == EXCP_ATOMIC) {
+            cpu_exec_step_atomic(cpu);
+            continue;
+        }
+        if (trapnr == EXCP_DEBUG &&
+            (opts->max_insns || cpu->cc->get_pc(cpu) == stop)) {
+            continue;
+        }
+        *exception = trapnr;
+        status = MICROHOOK_CALL_EXCEPTION;
+        break;
+    }
+
+    if (have_timer) {
+        timer_delete(timer);
+    }
+    if (bp) {
+        cpu_breakpoint_remove_by_ref(cpu, bp);
+    }
+    cpu_single_step(cpu, old_sstep);
+    ts->sync_signal = sync;
+
+    *result = call_result(env);
+    memcpy(env, saved, sizeof(*env));
+    return status;
+}
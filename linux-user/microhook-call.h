@@ -0,0 +1,60 @@
+/*
+ * Microhook Call - synchronous calls of guest functions for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_CALL_H
+#define MICROHOOK_CALL_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Maximum number of integer arguments of a call */
+#define MICROHOOK_CALL_MAX_ARGS 8
+
+typedef enum {
+    MICROHOOK_CALL_OK,
+    MICROHOOK_CALL_UNSUPPORTED,     /* Target or argument count */
+    MICROHOOK_CALL_BUSY,            /* Called from within generated code */
+    MICROHOOK_CALL_NOMEM,           /* No room for the private stack */
+    MICROHOOK_CALL_TIMEOUT,
+    MICROHOOK_CALL_INSN_LIMIT,
+    MICROHOOK_CALL_EXCEPTION,       /* Syscall, fault or breakpoint */
+} MicrohookCallStatus;
+
+typedef struct MicrohookCallOpts {
+    size_t stack_size;          /* Private stack size, 0 for the default */
+    uint64_t timeout_ns;        /* 0 for none */
+    uint64_t max_insns;         /* 0 for none */
+} MicrohookCallOpts;
+
+/*
+ * Call a guest function and run it to completion on the calling thread.
+ * addr: guest address of the function
+ * args: nargs integer arguments, passed as the target's C ABI does
+ * result: receives the return value register
+ * exception: receives the exception index for MICROHOOK_CALL_EXCEPTION
+ * sig: receives the guest signal a fault raised, 0 for other exceptions
+ *
+ * The function runs on the calling thread's vCPU in the same TCG engine,
+ * reusing its translations, with a private stack and its return address
+ * pointing at a stop address. The vCPU registers are restored afterwards,
+ * whatever the outcome. The function must not make syscalls. A fault in
+ * the function ends the call; its signal is not delivered to the guest.
+ *
+ * Must be called from a hook running outside generated code, e.g. a
+ * syscall or lifecycle hook.
+ */
+MicrohookCallStatus microhook_call(uint64_t addr, const uint64_t *args,
+                                   int nargs, const MicrohookCallOpts *opts,
+                                   uint64_t *result, int *exception,
+                                   int *sig);
+
+#endif /* MICROHOOK_CALL_H */
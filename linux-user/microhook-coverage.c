@@ -13,7 +13,13 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/qht.h"
+#include "qemu/xxhash.h"
+#include "qemu/plugin.h"
 #include "microhook-coverage.h"
+#include "microhook-covmap.h"
+#include "microhook-modules.h"
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
@@ -24,37 +30,59 @@
 /* Flush coverage to disk every N new blocks */
 #define COVERAGE_FLUSH_INTERVAL 100
 
+/* Number of new blocks handed to plugins per callback */
+#define COVERAGE_BATCH_SIZE 64
+
+/* Initial size of the block hash table */
+#define COVERAGE_HT_SIZE (1 << 12)
+
 /* DRCov basic block entry structure (8 bytes) */
 typedef struct {
     uint32_t start;     /* Offset from module base */
     uint16_t size;      /* Size of basic block */
-    uint16_t mod_id;    /* Module ID (always 0 for single binary) */
+    uint16_t mod_id;    /* Module ID */
 } __attribute__((packed)) drcov_bb_entry_t;
 
-/* Internal block record */
-typedef struct {
-    uint64_t pc;        /* Guest virtual address */
-    uint32_t size;      /* Block size in bytes */
-} bb_record_t;
-
 /* Global state */
 static bool g_coverage_enabled = false;
 static char *g_output_filename = NULL;
 static char *g_filename_template = NULL;  /* Original template with %d/%s */
-static GHashTable *g_blocks = NULL;     /* Hash table for deduplication: pc -> bb_record_t* */
-static GMutex g_lock;
-static unsigned long g_new_block_count = 0;  /* Counter for periodic flush */
+static struct qht g_blocks;             /* Dedup set: MicrohookCoverageBlock */
+static unsigned long g_block_count = 0;  /* Total unique blocks */
+static GMutex g_lock;                   /* Protects output file and names */
+
+/* Pending blocks for the plugin coverage callbacks */
+static MicrohookCoverageBlock g_batch[COVERAGE_BATCH_SIZE];
+static size_t g_batch_len = 0;
+static GMutex g_batch_lock;
 
 /* Binary information */
-static char *g_binary_path = NULL;
 static char *g_binary_name = NULL;        /* basename of binary */
-static uint64_t g_start_code = 0;
-static uint64_t g_end_code = 0;
-static uint64_t g_entry = 0;
 
 /* Forward declaration */
 static void microhook_coverage_flush_unlocked(void);
 
+static bool block_cmp(const void *a, const void *b)
+{
+    const MicrohookCoverageBlock *ba = a;
+    const MicrohookCoverageBlock *bb = b;
+
+    return ba->vaddr == bb->vaddr;
+}
+
+static bool block_lookup_cmp(const void *obj, const void *userp)
+{
+    const MicrohookCoverageBlock *block = obj;
+    const uint64_t *pc = userp;
+
+    return block->vaddr == *pc;
+}
+
+static inline uint32_t block_hash(uint64_t pc)
+{
+    return qemu_xxhash2(pc);
+}
+
 /*
  * Expand format specifiers in filename template:
  *   %d - current date+time (YYYY-MM-DD-HH:MM:SS)
@@ -105,38 +133,38 @@ static char *expand_filename_template(const char *template, const char *progname
 }
 
 int microhook_coverage_init(const char *filename)
+{
+    microhook_coverage_collect();
+
+    /*
+     * Store filename template (expanded again when binary info is set).
+     * Collection may have started earlier, e.g. for a plugin.
+     */
+    g_mutex_lock(&g_lock);
+    if (!g_filename_template) {
+        g_filename_template = g_strdup(filename && *filename ?
+                                       filename : "coverage.drcov");
+        g_output_filename = expand_filename_template(g_filename_template,
+                                                     g_binary_name);
+    }
+    g_mutex_unlock(&g_lock);
+    return 0;
+}
+
+int microhook_coverage_collect(void)
 {
     if (g_coverage_enabled) {
-        fprintf(stderr, "microhook-coverage: already initialized\n");
-        return -1;
+        return 0;
     }
 
     g_mutex_init(&g_lock);
+    g_mutex_init(&g_batch_lock);
 
-    /* Store filename template (will be expanded when binary info is set) */
-    if (filename && *filename) {
-        g_filename_template = g_strdup(filename);
-    } else {
-        g_filename_template = g_strdup("coverage.drcov");
-    }
-    
-    /* Initial expansion without program name (will be updated in set_binary_info) */
-    g_output_filename = expand_filename_template(g_filename_template, NULL);
-
-    /* Create hash table for block deduplication */
-    g_blocks = g_hash_table_new_full(g_int64_hash, g_int64_equal,
-                                     NULL, g_free);
-    if (!g_blocks) {
-        fprintf(stderr, "microhook-coverage: failed to create hash table\n");
-        g_free(g_output_filename);
-        g_free(g_filename_template);
-        g_output_filename = NULL;
-        g_filename_template = NULL;
-        return -1;
-    }
+    /* Hash table for block deduplication, lock-free for lookups */
+    qht_init(&g_blocks, block_cmp, COVERAGE_HT_SIZE, QHT_MODE_AUTO_RESIZE);
 
-    g_new_block_count = 0;
-    g_coverage_enabled = true;
+    g_block_count = 0;
+    qatomic_store_release(&g_coverage_enabled, true);
     fprintf(stderr, "microhook-coverage: initialized\n");
     return 0;
 }
@@ -148,12 +176,13 @@ void microhook_coverage_set_binary_info(const char *path,
 {
     g_mutex_lock(&g_lock);
 
-    g_free(g_binary_path);
-    g_binary_path = path ? g_strdup(path) : NULL;
-    g_start_code = start_code;
-    g_end_code = end_code;
-    g_entry = entry;
-    
+    /*
+     * The main binary is normally already in the module table because it
+     * was mapped from a file; this fills in its entry point, or adds it
+     * if it was not.
+     */
+    microhook_modules_add(path, start_code, start_code, end_code, entry);
+
     /* Extract basename for %s substitution */
     g_free(g_binary_name);
     if (path) {
@@ -176,153 +205,227 @@ void microhook_coverage_set_binary_info(const char *path,
 
 bool microhook_coverage_enabled(void)
 {
-    return g_coverage_enabled;
+    return qatomic_read(&g_coverage_enabled);
+}
+
+/* Copy the pending batch out and empty it. Must hold g_batch_lock. */
+static size_t take_batch_locked(MicrohookCoverageBlock *batch)
+{
+    size_t n = g_batch_len;
+
+    memcpy(batch, g_batch, n * sizeof(batch[0]));
+    g_batch_len = 0;
+    return n;
+}
+
+/*
+ * Hand the pending batch to plugins. The batch is copied out so the
+ * callbacks run without g_batch_lock held.
+ */
+static void microhook_coverage_deliver_batch(void)
+{
+    MicrohookCoverageBlock batch[COVERAGE_BATCH_SIZE];
+    size_t n;
+
+    g_mutex_lock(&g_batch_lock);
+    n = take_batch_locked(batch);
+    g_mutex_unlock(&g_batch_lock);
+
+    if (n) {
+        qemu_plugin_coverage_cb(batch, n);
+    }
 }
 
 void microhook_coverage_record_block(uint64_t pc, uint32_t size)
 {
-    if (!g_coverage_enabled || !g_blocks) {
+    uint32_t hash = block_hash(pc);
+    MicrohookCoverageBlock batch[COVERAGE_BATCH_SIZE];
+    size_t n = 0;
+
+    if (!microhook_coverage_enabled()) {
         return;
     }
 
-    g_mutex_lock(&g_lock);
+    /* Fast path: block already recorded */
+    if (qht_lookup_custom(&g_blocks, &pc, hash, block_lookup_cmp)) {
+        return;
+    }
 
-    /* Check if block already recorded */
-    if (!g_hash_table_contains(g_blocks, &pc)) {
-        /* Create new record */
-        bb_record_t *record = g_new(bb_record_t, 1);
-        record->pc = pc;
-        record->size = size;
-
-        /* Insert into hash table (key is pointer to pc field in record) */
-        g_hash_table_insert(g_blocks, &record->pc, record);
-
-        /* Increment counter and flush periodically */
-        g_new_block_count++;
-        if (g_new_block_count >= COVERAGE_FLUSH_INTERVAL) {
-            microhook_coverage_flush_unlocked();
-            g_new_block_count = 0;
-        }
+    MicrohookCoverageBlock *block = g_new0(MicrohookCoverageBlock, 1);
+    const MicrohookModule *mod = microhook_modules_lookup(pc);
+
+    block->vaddr = pc;
+    block->size = size;
+    block->module_id = mod ? mod->id : QEMU_PLUGIN_COVERAGE_NO_MODULE;
+
+    if (!qht_insert(&g_blocks, block, hash, NULL)) {
+        /* Lost a race with another thread translating the same block */
+        g_free(block);
+        return;
     }
 
-    g_mutex_unlock(&g_lock);
+    microhook_covmap_record(mod, pc, size);
+
+    /* Empty a full batch before anyone else can append to it */
+    g_mutex_lock(&g_batch_lock);
+    g_batch[g_batch_len++] = *block;
+    if (g_batch_len == COVERAGE_BATCH_SIZE) {
+        n = take_batch_locked(batch);
+    }
+    g_mutex_unlock(&g_batch_lock);
+
+    if (n) {
+        qemu_plugin_coverage_cb(batch, n);
+    }
+
+    /* Flush periodically */
+    if (qatomic_fetch_inc(&g_block_count) % COVERAGE_FLUSH_INTERVAL ==
+        COVERAGE_FLUSH_INTERVAL - 1) {
+        microhook_coverage_deliver_batch();
+        g_mutex_lock(&g_lock);
+        microhook_coverage_flush_unlocked();
+        g_mutex_unlock(&g_lock);
+    }
 }
 
-/* Helper to write binary data */
-static void write_bb_entry(FILE *fp, const drcov_bb_entry_t *entry)
+static void snapshot_block_cb(void *p, uint32_t h, void *up)
 {
-    fwrite(entry, sizeof(drcov_bb_entry_t), 1, fp);
-}
+    GArray *blocks = up;
 
-/* Callback for iterating blocks and writing to file */
-typedef struct {
-    FILE *fp;
-    uint64_t base;
-    unsigned long count;
-} write_context_t;
+    g_array_append_val(blocks, *(MicrohookCoverageBlock *)p);
+}
 
-static void write_block_cb(gpointer key, gpointer value, gpointer user_data)
+GArray *microhook_coverage_snapshot(void)
 {
-    (void)key;
-    bb_record_t *record = (bb_record_t *)value;
-    write_context_t *ctx = (write_context_t *)user_data;
-
-    /* Only include blocks within the binary's code range */
-    if (record->pc >= ctx->base && record->pc < g_end_code) {
-        drcov_bb_entry_t entry;
-        entry.start = (uint32_t)(record->pc - ctx->base);
-        entry.size = (uint16_t)(record->size > 0xFFFF ? 0xFFFF : record->size);
-        entry.mod_id = 0;
+    GArray *blocks;
 
-        write_bb_entry(ctx->fp, &entry);
-        ctx->count++;
+    if (!microhook_coverage_enabled()) {
+        return NULL;
     }
+
+    blocks = g_array_sized_new(false, false, sizeof(MicrohookCoverageBlock),
+                               qatomic_read(&g_block_count));
+    qht_iter(&g_blocks, snapshot_block_cb, blocks);
+    return blocks;
 }
 
-static void count_block_cb(gpointer key, gpointer value, gpointer user_data)
+/* Helper to write binary data */
+static void write_bb_entry(FILE *fp, const drcov_bb_entry_t *entry)
 {
-    (void)key;
-    bb_record_t *record = (bb_record_t *)value;
-    unsigned long *count = (unsigned long *)user_data;
-    uint64_t base = g_start_code;
-
-    /* Only count blocks within the binary's code range */
-    if (record->pc >= base && record->pc < g_end_code) {
-        (*count)++;
-    }
+    fwrite(entry, sizeof(drcov_bb_entry_t), 1, fp);
 }
 
-/*
- * Write current coverage to file (must be called with g_lock held).
- * This overwrites the file each time with all accumulated coverage.
- */
-static void microhook_coverage_flush_unlocked(void)
+static bool write_drcov(const char *filename)
 {
-    if (!g_coverage_enabled || !g_blocks || !g_output_filename) {
-        return;
+    g_autoptr(GArray) blocks = microhook_coverage_snapshot();
+    unsigned num_modules = microhook_modules_count();
+    unsigned long block_count = 0;
+
+    if (!blocks) {
+        return false;
     }
 
-    FILE *fp = fopen(g_output_filename, "wb");
+    FILE *fp = fopen(filename, "wb");
     if (!fp) {
         fprintf(stderr, "microhook-coverage: failed to open output file: %s\n",
-                g_output_filename);
-        return;
+                filename);
+        return false;
     }
 
-    /* Count blocks that will be included */
-    unsigned long block_count = 0;
-    g_hash_table_foreach(g_blocks, count_block_cb, &block_count);
+    /* Only blocks inside a known module can be expressed in DRCov */
+    for (guint i = 0; i < blocks->len; i++) {
+        MicrohookCoverageBlock *b = &g_array_index(blocks,
+                                                   MicrohookCoverageBlock, i);
+        if (b->module_id < num_modules) {
+            block_count++;
+        }
+    }
 
     /* Write DRCov header (version 2 format for compatibility) */
     fprintf(fp, "DRCOV VERSION: 2\n");
     fprintf(fp, "DRCOV FLAVOR: drcov-64\n");
-    fprintf(fp, "Module Table: version 2, count 1\n");
+    fprintf(fp, "Module Table: version 2, count %u\n", num_modules);
     fprintf(fp, "Columns: id, base, end, entry, path\n");
 
-    /* Write module entry */
-    const char *path = g_binary_path ? g_binary_path : "unknown";
-    fprintf(fp, "0, 0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64 ", %s\n",
-            g_start_code, g_end_code, g_entry, path);
+    /* Write module entries */
+    for (unsigned i = 0; i < num_modules; i++) {
+        const MicrohookModule *mod = microhook_modules_get(i);
+        fprintf(fp, "%u, 0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64 ", %s\n",
+                i, mod->base, mod->end, mod->entry, mod->path);
+    }
 
     /* Write BB table header */
     fprintf(fp, "BB Table: %lu bbs\n", block_count);
 
     /* Write basic block entries in binary format */
-    if (block_count > 0) {
-        write_context_t ctx = {
-            .fp = fp,
-            .base = g_start_code,
-            .count = 0
-        };
-        g_hash_table_foreach(g_blocks, write_block_cb, &ctx);
+    for (guint i = 0; i < blocks->len; i++) {
+        MicrohookCoverageBlock *b = &g_array_index(blocks,
+                                                   MicrohookCoverageBlock, i);
+        const MicrohookModule *mod;
+        drcov_bb_entry_t entry;
+
+        if (b->module_id >= num_modules) {
+            continue;
+        }
+        mod = microhook_modules_get(b->module_id);
+        entry.start = (uint32_t)(b->vaddr - mod->base);
+        entry.size = (uint16_t)(b->size > 0xFFFF ? 0xFFFF : b->size);
+        entry.mod_id = b->module_id;
+        write_bb_entry(fp, &entry);
     }
 
     fclose(fp);
+    return true;
+}
+
+bool microhook_coverage_write_drcov(const char *path)
+{
+    bool ok;
+
+    g_mutex_lock(&g_lock);
+    ok = write_drcov(path);
+    g_mutex_unlock(&g_lock);
+
+    return ok;
+}
+
+/*
+ * Write current coverage to file (must be called with g_lock held).
+ * This overwrites the file each time with all accumulated coverage.
+ */
+static void microhook_coverage_flush_unlocked(void)
+{
+    if (!microhook_coverage_enabled() || !g_output_filename) {
+        return;
+    }
+
+    write_drcov(g_output_filename);
 }
 
 void microhook_coverage_shutdown(void)
 {
-    if (!g_coverage_enabled) {
+    if (!microhook_coverage_enabled()) {
         return;
     }
 
+    microhook_coverage_deliver_batch();
+
     g_mutex_lock(&g_lock);
 
     /* Final flush */
     microhook_coverage_flush_unlocked();
 
-    unsigned long block_count = 0;
-    if (g_blocks) {
-        g_hash_table_foreach(g_blocks, count_block_cb, &block_count);
+    if (g_output_filename) {
+        fprintf(stderr, "microhook-coverage: wrote %lu blocks to %s\n",
+                qatomic_read(&g_block_count), g_output_filename);
     }
-    fprintf(stderr, "microhook-coverage: wrote %lu blocks to %s\n",
-            block_count, g_output_filename);
 
-    /* Free resources */
-    if (g_blocks) {
-        g_hash_table_destroy(g_blocks);
-        g_blocks = NULL;
-    }
+    /*
+     * Stop recording, but keep the block table: other guest threads may
+     * still be translating while the process exits, and lookups into the
+     * table are lock-free.
+     */
+    qatomic_set(&g_coverage_enabled, false);
 
     g_free(g_output_filename);
     g_output_filename = NULL;
@@ -330,14 +433,8 @@ void microhook_coverage_shutdown(void)
     g_free(g_filename_template);
     g_filename_template = NULL;
 
-    g_free(g_binary_path);
-    g_binary_path = NULL;
-    
     g_free(g_binary_name);
     g_binary_name = NULL;
 
-    g_coverage_enabled = false;
-
     g_mutex_unlock(&g_lock);
-    g_mutex_clear(&g_lock);
 }
@@ -13,16 +13,34 @@
 #define MICROHOOK_COVERAGE_H
 
 #include "qemu/osdep.h"
+#include "qemu/qemu-plugin.h"
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+ * A recorded block. This is the same structure that is handed to TCG
+ * plugins, so batches can be passed through without conversion.
+ */
+typedef struct qemu_plugin_coverage_block MicrohookCoverageBlock;
+
 /*
  * Initialize the coverage subsystem.
- * filename: path to the output drcov file (NULL for default "coverage.drcov")
+ * filename: path to the output drcov file (NULL or empty for
+ *           coverage.drcov)
+ *
+ * If blocks are already being collected, this only sets the output file
+ * (if none was set yet) and succeeds.
  * Returns 0 on success, -1 on failure.
  */
 int microhook_coverage_init(const char *filename);
 
+/*
+ * Collect blocks without writing a drcov file, e.g. on behalf of a plugin
+ * or for -coverage-map. A later microhook_coverage_init() adds the file.
+ * Returns 0 on success, -1 on failure.
+ */
+int microhook_coverage_collect(void);
+
 /*
  * Shutdown the coverage subsystem and write the drcov file.
  * This should be called at program exit.
@@ -40,7 +58,8 @@ bool microhook_coverage_enabled(void);
  * size: size of the block in bytes
  *
  * This should be called from the translator when a block is translated.
- * The function is thread-safe and will deduplicate blocks.
+ * The function is thread-safe and will deduplicate blocks; lookups of
+ * already known blocks are lock-free.
  */
 void microhook_coverage_record_block(uint64_t pc, uint32_t size);
 
@@ -56,4 +75,16 @@ void microhook_coverage_set_binary_info(const char *path,
                                        uint64_t end_code,
                                        uint64_t entry);
 
+/*
+ * Return a copy of all blocks recorded so far as a GArray of
+ * MicrohookCoverageBlock, or NULL if coverage is not enabled.
+ */
+GArray *microhook_coverage_snapshot(void);
+
+/*
+ * Write all blocks recorded so far to path in DRCov format.
+ * Returns true on success.
+ */
+bool microhook_coverage_write_drcov(const char *path);
+
 #endif /* MICROHOOK_COVERAGE_H */
@@ -0,0 +1,157 @@
+/*
+ * Microhook Coverage Map - coverage bitmap shared between instances
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Every instance of a campaign maps the same file and ORs one bit per block
+ * into it, keyed by module basename and offset so that the same block gets
+ * the same bit regardless of where a process loaded the module. Whoever
+ * sets a bit first appends an event to a ring in the same file, which the
+ * launcher follows to report campaign-wide progress while it runs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/xxhash.h"
+#include "microhook-covmap.h"
+#include <glib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+static CovMapHeader *g_hdr = NULL;
+static CovMapEvent *g_ring = NULL;
+static uint64_t *g_bitmap = NULL;
+static uint32_t g_pid;
+
+static size_t covmap_size(uint32_t map_bits, uint32_t ring_size)
+{
+    return sizeof(CovMapHeader) + ring_size * sizeof(CovMapEvent) +
+           ((size_t)1 << map_bits) / 8;
+}
+
+/* Must be called with the file locked */
+static bool covmap_create(int fd)
+{
+    CovMapHeader hdr = {
+        .magic = COVMAP_MAGIC,
+        .version = COVMAP_VERSION,
+        .map_bits = COVMAP_DEFAULT_BITS,
+        .ring_size = COVMAP_DEFAULT_RING,
+    };
+
+    return ftruncate(fd, covmap_size(hdr.map_bits, hdr.ring_size)) == 0 &&
+           pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+}
+
+int microhook_covmap_init(const char *path)
+{
+    CovMapHeader hdr;
+    struct stat st;
+    size_t size;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "microhook: failed to open coverage map '%s': %s\n",
+                path, strerror(errno));
+        return -1;
+    }
+
+    /* Only the first of several instances started together initialises it */
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) == 0 && st.st_size == 0 && !covmap_create(fd)) {
+        fprintf(stderr, "microhook: failed to create coverage map '%s': %s\n",
+                path, strerror(errno));
+        goto fail;
+    }
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != COVMAP_MAGIC || hdr.version != COVMAP_VERSION ||
+        hdr.map_bits < 6 || hdr.map_bits > 32 ||
+        !is_power_of_2(hdr.ring_size)) {
+        fprintf(stderr, "microhook: '%s' is not a coverage map\n", path);
+        goto fail;
+    }
+
+    size = covmap_size(hdr.map_bits, hdr.ring_size);
+    if (fstat(fd, &st) != 0 || st.st_size < size) {
+        fprintf(stderr, "microhook: coverage map '%s' is truncated\n", path);
+        goto fail;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "microhook: failed to map coverage map '%s': %s\n",
+                path, strerror(errno));
+        goto fail;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    g_pid = getpid();
+    g_ring = map + sizeof(CovMapHeader);
+    g_bitmap = (void *)(g_ring + hdr.ring_size);
+    qatomic_inc(&((CovMapHeader *)map)->instances);
+    qatomic_store_release(&g_hdr, map);
+    return 0;
+
+fail:
+    flock(fd, LOCK_UN);
+    close(fd);
+    return -1;
+}
+
+bool microhook_covmap_enabled(void)
+{
+    return qatomic_read(&g_hdr) != NULL;
+}
+
+static void publish_event(const char *module, uint64_t offset, uint32_t size)
+{
+    uint64_t seq = qatomic_fetch_inc(&g_hdr->event_head);
+    CovMapEvent *ev = &g_ring[seq & (g_hdr->ring_size - 1)];
+
+    /* Invalidate the slot while it is rewritten */
+    qatomic_set(&ev->seq, 0);
+    smp_wmb();
+    ev->pid = g_pid;
+    ev->size = size;
+    ev->offset = offset;
+    g_strlcpy(ev->module, module, sizeof(ev->module));
+    qatomic_store_release(&ev->seq, seq + 1);
+}
+
+void microhook_covmap_record(const MicrohookModule *mod, uint64_t pc,
+                             uint32_t size)
+{
+    const char *module = "";
+    uint64_t offset = pc, mask, old;
+    uint32_t bit;
+
+    if (!microhook_covmap_enabled()) {
+        return;
+    }
+
+    if (mod) {
+        const char *slash = strrchr(mod->path, '/');
+
+        module = slash ? slash + 1 : mod->path;
+        offset = pc - mod->base;
+    }
+
+    bit = qemu_xxhash4(offset, g_str_hash(module)) &
+          (((uint64_t)1 << g_hdr->map_bits) - 1);
+    mask = 1ULL << (bit % 64);
+
+    qatomic_inc(&g_hdr->blocks);
+    old = qatomic_fetch_or(&g_bitmap[bit / 64], mask);
+    if (!(old & mask)) {
+        qatomic_inc(&g_hdr->covered);
+        publish_event(module, offset, size);
+    }
+}
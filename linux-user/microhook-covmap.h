@@ -0,0 +1,84 @@
+/*
+ * Microhook Coverage Map - coverage bitmap shared between instances
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_COVMAP_H
+#define MICROHOOK_COVMAP_H
+
+#include "qemu/osdep.h"
+#include "microhook-modules.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Layout of the map file, in host byte order. scripts/microhook-farm.py
+ * reads the same layout; bump COVMAP_VERSION when changing it.
+ *
+ *   CovMapHeader
+ *   CovMapEvent[ring_size]
+ *   uint64_t bitmap[(1 << map_bits) / 64]
+ */
+#define COVMAP_MAGIC        0x4d43484dU     /* "MHCM" */
+#define COVMAP_VERSION      1
+
+#define COVMAP_DEFAULT_BITS 20
+#define COVMAP_DEFAULT_RING 4096
+
+typedef struct CovMapHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t map_bits;      /* log2 of the number of bits in the bitmap */
+    uint32_t ring_size;     /* Number of event slots, a power of 2 */
+    uint64_t covered;       /* Bits set so far */
+    uint64_t blocks;        /* Blocks translated for the first time by
+                               their instance, summed over instances */
+    uint64_t instances;     /* Instances that attached so far */
+    uint64_t event_head;    /* Sequence number of the next event */
+    uint64_t reserved[2];
+} CovMapHeader;
+
+/*
+ * Published whenever an instance sets a bit nobody had set before. An
+ * event is valid once seq holds its sequence number plus one; readers
+ * that fall more than ring_size events behind lose the oldest ones.
+ */
+typedef struct CovMapEvent {
+    uint64_t seq;
+    uint32_t pid;
+    uint32_t size;          /* Block size in bytes */
+    uint64_t offset;        /* Offset from the module base, or guest pc */
+    char module[40];        /* Module basename, empty if none */
+} CovMapEvent;
+
+/*
+ * Attach to the map file at path, creating and initialising it if it is
+ * empty or does not exist.
+ * Returns 0 on success, -1 on failure.
+ */
+int microhook_covmap_init(const char *path);
+
+/*
+ * Check whether this instance is attached to a map.
+ */
+bool microhook_covmap_enabled(void);
+
+/*
+ * Set the bit of a block this instance translated for the first time,
+ * publishing an event if no instance had covered it before.
+ * mod: module containing the block, or NULL
+ * pc: guest virtual address of the block start
+ * size: size of the block in bytes
+ *
+ * Lock-free; called from the coverage recorder.
+ */
+void microhook_covmap_record(const MicrohookModule *mod, uint64_t pc,
+                             uint32_t size);
+
+#endif /* MICROHOOK_COVMAP_H */
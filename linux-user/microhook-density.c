@@ -0,0 +1,175 @@
+/*
+ * Microhook Density - low memory profile for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Most of an idle instance's footprint is the translation buffer, which is
+ * reserved at its full size and backed with huge pages, and never shrinks
+ * once code has been generated into it. The density profile starts with a
+ * small usable buffer that grows whenever it fills up, and hands the pages
+ * of flushed code back to the host.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "exec/mmap-lock.h"
+#include "user/page-protection.h"
+#include "tcg/tcg.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "microhook-density.h"
+#include <glib.h>
+
+/* Usable translation buffer size to start with */
+#define DENSITY_INITIAL_TB_SIZE (4 * MiB)
+
+enum {
+    RSS_JIT,
+    RSS_GUEST,
+    RSS_PYTHON,
+    RSS_QEMU,
+    RSS_LIBS,
+    RSS_HEAP,
+    RSS_STACK,
+    RSS_NUM,
+};
+
+static const char *const rss_names[RSS_NUM] = {
+    [RSS_JIT] = "jit",
+    [RSS_GUEST] = "guest",
+    [RSS_PYTHON] = "python",
+    [RSS_QEMU] = "qemu",
+    [RSS_LIBS] = "libs",
+    [RSS_HEAP] = "heap",
+    [RSS_STACK] = "stack",
+};
+
+static bool g_enabled = false;
+
+void microhook_density_enable(void)
+{
+    g_enabled = true;
+}
+
+bool microhook_density_enabled(void)
+{
+    return g_enabled;
+}
+
+void microhook_density_init_tcg(void)
+{
+    if (g_enabled) {
+        tcg_region_set_adaptive(DENSITY_INITIAL_TB_SIZE);
+    }
+}
+
+static bool in_jit(uintptr_t addr)
+{
+    const void *p = (const void *)addr;
+
+    return in_code_gen_buffer(p) ||
+           (tcg_splitwx_diff && in_code_gen_buffer(p - tcg_splitwx_diff));
+}
+
+/* Must be called with the mmap lock held */
+static int classify(uintptr_t start, uintptr_t end, const char *path,
+                    const char *self)
+{
+    if (in_jit(start) || in_jit(end - 1)) {
+        return RSS_JIT;
+    }
+    /* With a zero guest_base every address passes h2g_valid() */
+    if (h2g_valid(start) && (page_get_flags(h2g(start)) & PAGE_VALID)) {
+        return RSS_GUEST;
+    }
+    if (g_str_equal(path, "[heap]")) {
+        return RSS_HEAP;
+    }
+    if (g_str_has_prefix(path, "[stack")) {
+        return RSS_STACK;
+    }
+    if (strstr(path, "libpython")) {
+        return RSS_PYTHON;
+    }
+    if (self && g_str_equal(path, self)) {
+        return RSS_QEMU;
+    }
+    if (path[0] == '/') {
+        return RSS_LIBS;
+    }
+    return RSS_HEAP;
+}
+
+GArray *microhook_density_rss(void)
+{
+    GArray *entries = g_array_new(false, true, sizeof(MicrohookRssEntry));
+    g_autofree char *self = g_file_read_link("/proc/self/exe", NULL);
+    g_autofree char *line = NULL;
+    MicrohookRssEntry *cur = NULL;
+    size_t cap = 0;
+    FILE *fp;
+
+    g_array_set_size(entries, RSS_NUM);
+    for (int i = 0; i < RSS_NUM; i++) {
+        g_array_index(entries, MicrohookRssEntry, i).name = rss_names[i];
+    }
+
+    fp = fopen("/proc/self/smaps", "r");
+    if (!fp) {
+        return entries;
+    }
+
+    mmap_lock();
+    while (getline(&line, &cap, fp) > 0) {
+        uint64_t start, end, kb;
+        int path_off = 0;
+
+        if (g_ascii_isxdigit(line[0]) && !g_ascii_isupper(line[0])) {
+            /* Mapping header: start-end perms offset dev inode [path] */
+            if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %*s %*s %*s %*s %n",
+                       &start, &end, &path_off) < 2 || path_off == 0) {
+                cur = NULL;
+                continue;
+            }
+            g_strchomp(line + path_off);
+            cur = &g_array_index(entries, MicrohookRssEntry,
+                                 classify(start, end, line + path_off, self));
+        } else if (!cur) {
+            continue;
+        } else if (sscanf(line, "Rss: %" SCNu64, &kb) == 1) {
+            cur->rss += kb * KiB;
+        } else if (sscanf(line, "Pss: %" SCNu64, &kb) == 1) {
+            cur->pss += kb * KiB;
+        } else if (sscanf(line, "Shared_Clean: %" SCNu64, &kb) == 1 ||
+                   sscanf(line, "Shared_Dirty: %" SCNu64, &kb) == 1) {
+            cur->shared += kb * KiB;
+        }
+    }
+    mmap_unlock();
+
+    fclose(fp);
+    return entries;
+}
+
+void microhook_density_report(void)
+{
+    g_autoptr(GArray) entries = microhook_density_rss();
+    uint64_t rss = 0, pss = 0;
+
+    for (guint i = 0; i < entries->len; i++) {
+        MicrohookRssEntry *e = &g_array_index(entries, MicrohookRssEntry, i);
+
+        fprintf(stderr, "microhook: rss %-6s %8" PRIu64 " kB "
+                "(pss %8" PRIu64 " kB, shared %8" PRIu64 " kB)\n",
+                e->name, e->rss / KiB, e->pss / KiB, e->shared / KiB);
+        rss += e->rss;
+        pss += e->pss;
+    }
+    fprintf(stderr, "microhook: rss %-6s %8" PRIu64 " kB (pss %8" PRIu64
+            " kB)\n", "total", rss / KiB, pss / KiB);
+}
@@ -0,0 +1,58 @@
+/*
+ * Microhook Density - low memory profile for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_DENSITY_H
+#define MICROHOOK_DENSITY_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Resident memory of one kind of mapping, in bytes
+ */
+typedef struct MicrohookRssEntry {
+    const char *name;       /* jit, guest, python, qemu, libs, heap, stack */
+    uint64_t rss;
+    uint64_t pss;           /* rss with shared pages split between users */
+    uint64_t shared;        /* part of rss also mapped by other processes */
+} MicrohookRssEntry;
+
+/*
+ * Enable the density profile. Must be called before the accelerator is
+ * initialised.
+ */
+void microhook_density_enable(void);
+
+/*
+ * Check whether the density profile is enabled.
+ */
+bool microhook_density_enabled(void);
+
+/*
+ * Apply the profile to the translation buffer. Called once TCG has been
+ * initialised, before the prologue is generated.
+ */
+void microhook_density_init_tcg(void);
+
+/*
+ * Return the resident memory of this process broken down by kind of
+ * mapping, as a GArray of MicrohookRssEntry.
+ */
+GArray *microhook_density_rss(void);
+
+/*
+ * Print the breakdown from microhook_density_rss() to stderr. Called when
+ * the guest exits with the profile enabled.
+ */
+void microhook_density_report(void);
+
+#endif /* MICROHOOK_DENSITY_H */
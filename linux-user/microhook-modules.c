@@ -0,0 +1,501 @@
+/*
+ * Microhook Modules - guest module (ELF image) tracking for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Keeps an append-only table of the executable images mapped into the
+ * guest so that coverage, symbolisation and hooks can attribute guest
+ * addresses to the main binary, the dynamic loader and shared objects.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "elf.h"
+#include "disas/disas.h"
+#include "tcg/debuginfo.h"
+#include "tcg/perf.h"
+#include "microhook-modules.h"
+#include <glib.h>
+
+/* A function symbol, already relocated to its guest address */
+typedef struct {
+    uint64_t addr;
+    uint64_t size;
+    const char *name;
+} MicrohookSymbol;
+
+/*
+ * Symbols of one module, shared by all copies of the module. Loaded at
+ * most once, under g_lock, and read-only afterwards.
+ */
+struct MicrohookModuleSyms {
+    bool loaded;
+    unsigned num;
+    MicrohookSymbol *syms;  /* Sorted by addr */
+    char *strtab;
+};
+
+/*
+ * Published modules. Slots are filled under g_lock and then made visible
+ * by bumping g_num_modules with release semantics, so readers only need
+ * an acquire load of the count. A slot may later be replaced by a wider
+ * copy of the same module; the old copy is intentionally leaked so that
+ * pointers handed out earlier stay valid.
+ */
+static MicrohookModule *g_modules[MICROHOOK_MODULES_MAX];
+static unsigned g_num_modules = 0;
+static GMutex g_lock;
+
+static void register_syminfo(void);
+static void image_layout(int fd, uint64_t start, uint64_t len,
+                         uint64_t offset, uint64_t *base, uint64_t *bias);
+
+static char *fd_to_path(int fd)
+{
+    char link[64];
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    return g_file_read_link(link, NULL);
+}
+
+/* Must be called with g_lock held */
+static const MicrohookModule *add_module_locked(const char *path,
+                                                uint64_t base, uint64_t bias,
+                                                uint64_t start, uint64_t end,
+                                                uint64_t entry)
+{
+    unsigned n = g_num_modules;
+
+    /* Another executable segment of an image we already know */
+    for (unsigned i = 0; i < n; i++) {
+        MicrohookModule *old = g_modules[i];
+
+        if (old->base == base && strcmp(old->path, path) == 0) {
+            MicrohookModule *mod;
+
+            if (start >= old->start && end <= old->end) {
+                return old;
+            }
+            mod = g_memdup2(old, sizeof(*old));
+            mod->start = MIN(old->start, start);
+            mod->end = MAX(old->end, end);
+            if (!mod->entry) {
+                mod->entry = entry;
+            }
+            qatomic_rcu_set(&g_modules[i], mod);
+            return mod;
+        }
+    }
+
+    if (n >= MICROHOOK_MODULES_MAX) {
+        return NULL;
+    }
+
+    MicrohookModule *mod = g_new0(MicrohookModule, 1);
+    mod->id = n;
+    mod->base = base;
+    mod->bias = bias;
+    mod->start = start;
+    mod->end = end;
+    mod->entry = entry;
+    mod->path = g_strdup(path);
+    mod->syms = g_new0(MicrohookModuleSyms, 1);
+
+    g_modules[n] = mod;
+    qatomic_store_release(&g_num_modules, n + 1);
+    return mod;
+}
+
+void microhook_modules_note_mmap(uint64_t start, uint64_t len, int fd,
+                                 uint64_t offset)
+{
+    g_autofree char *path = NULL;
+    const MicrohookModule *mod;
+    uint64_t base, bias;
+    unsigned n;
+
+    if (fd < 0 || offset > start) {
+        return;
+    }
+
+    path = fd_to_path(fd);
+    if (!path) {
+        return;
+    }
+    image_layout(fd, start, len, offset, &base, &bias);
+
+    g_mutex_lock(&g_lock);
+    n = g_num_modules;
+    mod = add_module_locked(path, base, bias, start, start + len, 0);
+    g_mutex_unlock(&g_lock);
+
+    /*
+     * New image: let perf see its DWARF and symbols too. Done outside
+     * g_lock because perf_report_code() takes the debuginfo lock first.
+     */
+    if (mod && mod->id == n && perf_enabled()) {
+        debuginfo_report_elf(mod->path, -1, mod->bias);
+    }
+    register_syminfo();
+}
+
+const MicrohookModule *microhook_modules_add(const char *path, uint64_t base,
+                                             uint64_t start, uint64_t end,
+                                             uint64_t entry)
+{
+    const MicrohookModule *mod;
+
+    g_mutex_lock(&g_lock);
+    mod = microhook_modules_lookup(start);
+    if (!mod) {
+        mod = add_module_locked(path ? path : "unknown", base, base,
+                                start, end, entry);
+    } else if (!mod->entry && entry) {
+        /* Images mapped before we knew their entry point */
+        MicrohookModule *upd = g_memdup2(mod, sizeof(*mod));
+        upd->entry = entry;
+        qatomic_rcu_set(&g_modules[mod->id], upd);
+        mod = upd;
+    }
+    g_mutex_unlock(&g_lock);
+
+    return mod;
+}
+
+unsigned microhook_modules_count(void)
+{
+    return qatomic_load_acquire(&g_num_modules);
+}
+
+const MicrohookModule *microhook_modules_get(unsigned id)
+{
+    if (id >= microhook_modules_count()) {
+        return NULL;
+    }
+    return qatomic_rcu_read(&g_modules[id]);
+}
+
+const MicrohookModule *microhook_modules_lookup(uint64_t pc)
+{
+    unsigned n = microhook_modules_count();
+
+    /* Newest first, so a re-used address range maps to the latest image */
+    while (n-- > 0) {
+        const MicrohookModule *mod = qatomic_rcu_read(&g_modules[n]);
+
+        if (pc >= mod->start && pc < mod->end) {
+            return mod;
+        }
+    }
+    return NULL;
+}
+
+#define ELF_GET(p, be, type, field) \
+    elf_get((const uint8_t *)(p) + offsetof(type, field), \
+            sizeof(((type *)0)->field), be)
+
+static uint64_t elf_get(const uint8_t *p, size_t size, bool be)
+{
+    switch (size) {
+    case 1:
+        return *p;
+    case 2:
+        return be ? lduw_be_p(p) : lduw_le_p(p);
+    case 4:
+        return be ? (uint32_t)ldl_be_p(p) : (uint32_t)ldl_le_p(p);
+    case 8:
+        return be ? ldq_be_p(p) : ldq_le_p(p);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Work out where the image in fd was loaded from one of its mappings:
+ * the PT_LOAD segment with file contents inside [offset, offset + len)
+ * sits at start + (p_offset - offset), which is bias + p_vaddr. The base
+ * is then the address of file offset 0 in the first segment. Falls back
+ * to start - offset for both, which is only right if the virtual
+ * addresses of the segments equal their file offsets.
+ */
+static void image_layout(int fd, uint64_t start, uint64_t len,
+                         uint64_t offset, uint64_t *base, uint64_t *bias)
+{
+    uint8_t ehdr[sizeof(Elf64_Ehdr)];
+    g_autofree uint8_t *phdrs = NULL;
+    uint64_t phoff, first = UINT64_MAX;
+    size_t phentsize;
+    unsigned phnum;
+    bool is64, be, found = false;
+
+    *base = *bias = start - offset;
+
+    if (pread(fd, ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+        memcmp(ehdr, ELFMAG, SELFMAG) != 0) {
+        return;
+    }
+    is64 = ehdr[EI_CLASS] == ELFCLASS64;
+    be = ehdr[EI_DATA] == ELFDATA2MSB;
+    if (is64) {
+        phoff = ELF_GET(ehdr, be, Elf64_Ehdr, e_phoff);
+        phnum = ELF_GET(ehdr, be, Elf64_Ehdr, e_phnum);
+        phentsize = sizeof(Elf64_Phdr);
+    } else {
+        phoff = ELF_GET(ehdr, be, Elf32_Ehdr, e_phoff);
+        phnum = ELF_GET(ehdr, be, Elf32_Ehdr, e_phnum);
+        phentsize = sizeof(Elf32_Phdr);
+    }
+    if (phnum == 0 || phnum > 256) {
+        return;
+    }
+
+    phdrs = g_malloc(phnum * phentsize);
+    if (pread(fd, phdrs, phnum * phentsize, phoff) != phnum * phentsize) {
+        return;
+    }
+
+    for (unsigned i = 0; i < phnum; i++) {
+        const uint8_t *ph = phdrs + i * phentsize;
+        uint64_t type, poff, vaddr;
+
+        if (is64) {
+            type = ELF_GET(ph, be, Elf64_Phdr, p_type);
+            poff = ELF_GET(ph, be, Elf64_Phdr, p_offset);
+            vaddr = ELF_GET(ph, be, Elf64_Phdr, p_vaddr);
+        } else {
+            type = ELF_GET(ph, be, Elf32_Phdr, p_type);
+            poff = ELF_GET(ph, be, Elf32_Phdr, p_offset);
+            vaddr = ELF_GET(ph, be, Elf32_Phdr, p_vaddr);
+        }
+        if (type != PT_LOAD) {
+            continue;
+        }
+        /* Segments are sorted by p_vaddr; remember the first one's */
+        if (first == UINT64_MAX) {
+            first = vaddr - poff;
+        }
+        if (!found && poff >= offset && poff - offset < len) {
+            *bias = start + (poff - offset) - vaddr;
+            found = true;
+        }
+    }
+    if (found) {
+        *base = *bias + first;
+    }
+}
+
+static int symbol_cmp(const void *a, const void *b)
+{
+    const MicrohookSymbol *sa = a;
+    const MicrohookSymbol *sb = b;
+
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+/*
+ * Read the function symbols of an ELF image. Works for either ELF class
+ * and byte order, independent of the host. Must be called with g_lock
+ * held; the caller publishes the result by setting ms->loaded.
+ */
+static void load_symbols_locked(const MicrohookModule *mod,
+                                MicrohookModuleSyms *ms)
+{
+    g_autoptr(GMappedFile) file = NULL;
+    const uint8_t *data;
+    size_t len, shentsize, symentsize;
+    uint64_t shoff, bias;
+    unsigned shnum, nsyms;
+    const uint8_t *symtab = NULL, *strtab = NULL;
+    uint64_t symtab_size = 0, strtab_size = 0;
+    bool is64, be;
+
+    file = g_mapped_file_new(mod->path, false, NULL);
+    if (!file) {
+        return;
+    }
+    data = (const uint8_t *)g_mapped_file_get_contents(file);
+    len = g_mapped_file_get_length(file);
+
+    if (len < sizeof(Elf64_Ehdr) || memcmp(data, ELFMAG, SELFMAG) != 0) {
+        return;
+    }
+    is64 = data[EI_CLASS] == ELFCLASS64;
+    be = data[EI_DATA] == ELFDATA2MSB;
+
+    if (is64) {
+        shoff = ELF_GET(data, be, Elf64_Ehdr, e_shoff);
+        shnum = ELF_GET(data, be, Elf64_Ehdr, e_shnum);
+        bias = ELF_GET(data, be, Elf64_Ehdr, e_type) == ET_DYN ? mod->bias : 0;
+        shentsize = sizeof(Elf64_Shdr);
+        symentsize = sizeof(Elf64_Sym);
+    } else {
+        shoff = ELF_GET(data, be, Elf32_Ehdr, e_shoff);
+        shnum = ELF_GET(data, be, Elf32_Ehdr, e_shnum);
+        bias = ELF_GET(data, be, Elf32_Ehdr, e_type) == ET_DYN ? mod->bias : 0;
+        shentsize = sizeof(Elf32_Shdr);
+        symentsize = sizeof(Elf32_Sym);
+    }
+    if (shoff > len || shnum > (len - shoff) / shentsize) {
+        return;
+    }
+
+    /* Prefer the full .symtab; stripped images only have .dynsym */
+    for (int pass = 0; pass < 2 && !symtab; pass++) {
+        uint32_t want = pass == 0 ? SHT_SYMTAB : SHT_DYNSYM;
+
+        for (unsigned i = 0; i < shnum; i++) {
+            const uint8_t *sh = data + shoff + i * shentsize;
+            uint64_t type, off, size, link;
+
+            if (is64) {
+                type = ELF_GET(sh, be, Elf64_Shdr, sh_type);
+                off = ELF_GET(sh, be, Elf64_Shdr, sh_offset);
+                size = ELF_GET(sh, be, Elf64_Shdr, sh_size);
+                link = ELF_GET(sh, be, Elf64_Shdr, sh_link);
+            } else {
+                type = ELF_GET(sh, be, Elf32_Shdr, sh_type);
+                off = ELF_GET(sh, be, Elf32_Shdr, sh_offset);
+                size = ELF_GET(sh, be, Elf32_Shdr, sh_size);
+                link = ELF_GET(sh, be, Elf32_Shdr, sh_link);
+            }
+            if (type != want || link >= shnum ||
+                off > len || size > len - off) {
+                continue;
+            }
+
+            const uint8_t *lsh = data + shoff + link * shentsize;
+            uint64_t soff = is64 ? ELF_GET(lsh, be, Elf64_Shdr, sh_offset)
+                                 : ELF_GET(lsh, be, Elf32_Shdr, sh_offset);
+            uint64_t ssize = is64 ? ELF_GET(lsh, be, Elf64_Shdr, sh_size)
+                                  : ELF_GET(lsh, be, Elf32_Shdr, sh_size);
+            if (soff > len || ssize > len - soff || ssize == 0) {
+                continue;
+            }
+
+            symtab = data + off;
+            symtab_size = size;
+            strtab = data + soff;
+            strtab_size = ssize;
+            break;
+        }
+    }
+    if (!symtab) {
+        return;
+    }
+
+    /* Names point into a private copy of the string table */
+    ms->strtab = g_malloc(strtab_size + 1);
+    memcpy(ms->strtab, strtab, strtab_size);
+    ms->strtab[strtab_size] = '\0';
+
+    nsyms = symtab_size / symentsize;
+    ms->syms = g_new(MicrohookSymbol, nsyms);
+    ms->num = 0;
+
+    for (unsigned i = 0; i < nsyms; i++) {
+        const uint8_t *sym = symtab + i * symentsize;
+        uint64_t name, value, size, shndx, info;
+
+        if (is64) {
+            name = ELF_GET(sym, be, Elf64_Sym, st_name);
+            value = ELF_GET(sym, be, Elf64_Sym, st_value);
+            size = ELF_GET(sym, be, Elf64_Sym, st_size);
+            shndx = ELF_GET(sym, be, Elf64_Sym, st_shndx);
+            info = ELF_GET(sym, be, Elf64_Sym, st_info);
+        } else {
+            name = ELF_GET(sym, be, Elf32_Sym, st_name);
+            value = ELF_GET(sym, be, Elf32_Sym, st_value);
+            size = ELF_GET(sym, be, Elf32_Sym, st_size);
+            shndx = ELF_GET(sym, be, Elf32_Sym, st_shndx);
+            info = ELF_GET(sym, be, Elf32_Sym, st_info);
+        }
+
+        if (shndx == SHN_UNDEF || shndx >= SHN_LORESERVE ||
+            ELF_ST_TYPE(info) != STT_FUNC || name >= strtab_size) {
+            continue;
+        }
+#if defined(TARGET_ARM) || defined(TARGET_MIPS)
+        /* The bottom address bit marks a Thumb or MIPS16 symbol.  */
+        value &= ~(uint64_t)1;
+#endif
+        ms->syms[ms->num++] = (MicrohookSymbol) {
+            .addr = value + bias,
+            .size = size,
+            .name = ms->strtab + name,
+        };
+    }
+
+    qsort(ms->syms, ms->num, sizeof(MicrohookSymbol), symbol_cmp);
+}
+
+const char *microhook_modules_symbol(uint64_t pc, uint64_t *offset)
+{
+    const MicrohookModule *mod = microhook_modules_lookup(pc);
+    MicrohookModuleSyms *ms;
+    const MicrohookSymbol *best = NULL;
+    unsigned lo, hi;
+
+    if (!mod) {
+        return NULL;
+    }
+
+    ms = mod->syms;
+    if (!qatomic_load_acquire(&ms->loaded)) {
+        g_mutex_lock(&g_lock);
+        if (!ms->loaded) {
+            load_symbols_locked(mod, ms);
+            qatomic_store_release(&ms->loaded, true);
+        }
+        g_mutex_unlock(&g_lock);
+    }
+
+    /* Last symbol starting at or below pc */
+    lo = 0;
+    hi = ms->num;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (ms->syms[mid].addr <= pc) {
+            best = &ms->syms[mid];
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (!best || (best->size && pc >= best->addr + best->size)) {
+        return NULL;
+    }
+    if (offset) {
+        *offset = pc - best->addr;
+    }
+    return best->name;
+}
+
+static const char *modules_lookup_symbol(struct syminfo *s, uint64_t addr)
+{
+    const char *name = microhook_modules_symbol(addr, NULL);
+
+    return name ? name : "";
+}
+
+static struct syminfo g_syminfo = {
+    .lookup_symbol = modules_lookup_symbol,
+};
+
+/* Make module symbols visible to lookup_symbol(), once */
+static void register_syminfo(void)
+{
+    static bool registered;
+
+    if (!qatomic_xchg(&registered, true)) {
+        g_syminfo.next = syminfos;
+        qatomic_store_release(&syminfos, &g_syminfo);
+    }
+}
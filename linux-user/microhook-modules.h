@@ -0,0 +1,91 @@
+/*
+ * Microhook Modules - guest module (ELF image) tracking for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_MODULES_H
+#define MICROHOOK_MODULES_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Maximum number of modules (DRCov module ids are 16 bit) */
+#define MICROHOOK_MODULES_MAX 4096
+
+/*
+ * A file-backed executable image mapped into the guest: the main binary,
+ * the dynamic loader, or any shared object loaded later.
+ *
+ * Modules are never freed once published, so pointers returned by the
+ * lookup functions stay valid for the lifetime of the process.
+ */
+typedef struct MicrohookModuleSyms MicrohookModuleSyms;
+
+typedef struct MicrohookModule {
+    uint16_t id;        /* Index in the module table */
+    uint64_t base;      /* Guest load base (address of file offset 0) */
+    uint64_t bias;      /* Load bias added to the ELF virtual addresses */
+    uint64_t start;     /* First executable guest address */
+    uint64_t end;       /* One past the last executable guest address */
+    uint64_t entry;     /* Entry point, 0 if unknown */
+    char *path;         /* Host path of the backing file */
+    MicrohookModuleSyms *syms;  /* Symbol table, loaded on first lookup */
+} MicrohookModule;
+
+/*
+ * Record a file-backed executable mapping.
+ * start/len: guest range that was mapped
+ * fd: host file descriptor the range was mapped from
+ * offset: file offset of start
+ *
+ * Called from target_mmap() with the mmap lock held. Mappings of a file
+ * that is already known at the same load base extend that module.
+ */
+void microhook_modules_note_mmap(uint64_t start, uint64_t len, int fd,
+                                 uint64_t offset);
+
+/*
+ * Explicitly add a module, e.g. for images not mapped through a file.
+ * Returns the module, or an existing module covering start.
+ */
+const MicrohookModule *microhook_modules_add(const char *path, uint64_t base,
+                                             uint64_t start, uint64_t end,
+                                             uint64_t entry);
+
+/*
+ * Number of modules currently in the table. Lock-free.
+ */
+unsigned microhook_modules_count(void);
+
+/*
+ * Get module by id, NULL if out of range. Lock-free.
+ */
+const MicrohookModule *microhook_modules_get(unsigned id);
+
+/*
+ * Find the module whose executable range contains pc, NULL if none.
+ * Lock-free.
+ */
+const MicrohookModule *microhook_modules_lookup(uint64_t pc);
+
+/*
+ * Find the function symbol containing pc in any module.
+ * offset: if non-NULL, receives pc minus the symbol start
+ *
+ * The module's ELF .symtab (or .dynsym if stripped) is read on the first
+ * lookup into that module. Returns NULL if no symbol covers pc; the
+ * returned string is valid for the lifetime of the process.
+ *
+ * The table is also registered with lookup_symbol(), so -d in_asm, perf
+ * maps and plugins see symbols from all loaded shared objects.
+ */
+const char *microhook_modules_symbol(uint64_t pc, uint64_t *offset);
+
+#endif /* MICROHOOK_MODULES_H */
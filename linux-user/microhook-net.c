@@ -0,0 +1,508 @@
+/*
+ * Microhook Net - socket redirection rules for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Guest firmware often talks to hard-coded peers. Instead of network
+ * namespaces or packet filters on the host, the addresses passed to
+ * connect(), bind() and sendto() are matched against rules here and either
+ * rewritten, or the socket is swapped for a Unix socket or one end of a
+ * socketpair under the same fd. Data then flows through the host kernel
+ * as usual; nothing here runs per packet beyond the address match.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "microhook-net.h"
+#include <glib.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+
+typedef enum {
+    NET_TO_INET,
+    NET_TO_UNIX,
+    NET_TO_PAIR,
+} NetAction;
+
+typedef struct NetRule {
+    int id;
+    unsigned ops;
+    int family;                 /* AF_UNSPEC matches any address */
+    uint8_t addr[16];
+    int prefix;                 /* Significant bits of addr */
+    int port;                   /* -1 matches any port */
+    NetAction action;
+    struct sockaddr_storage target;
+    socklen_t target_len;
+    bool keep_port;
+    MicrohookNetPairFn pair_fn;
+    void *opaque;
+} NetRule;
+
+static GMutex g_lock;
+static GPtrArray *g_rules = NULL;
+static int g_next_id = 1;
+static int g_num_rules = 0;
+
+/* Parse an IPv4 or bracketed IPv6 address with an optional /prefix */
+static bool parse_addr(const char *s, int *family, uint8_t *addr, int *prefix)
+{
+    g_autofree char *host = NULL;
+    const char *slash;
+    int max;
+
+    if (strcmp(s, "*") == 0) {
+        *family = AF_UNSPEC;
+        *prefix = 0;
+        return true;
+    }
+
+    slash = strchr(s, '/');
+    host = slash ? g_strndup(s, slash - s) : g_strdup(s);
+    if (host[0] == '[') {
+        size_t len = strlen(host);
+
+        if (len < 2 || host[len - 1] != ']') {
+            return false;
+        }
+        host[len - 1] = '\0';
+        *family = AF_INET6;
+        max = 128;
+        if (inet_pton(AF_INET6, host + 1, addr) != 1) {
+            return false;
+        }
+    } else {
+        *family = AF_INET;
+        max = 32;
+        if (inet_pton(AF_INET, host, addr) != 1) {
+            return false;
+        }
+    }
+
+    *prefix = max;
+    if (slash) {
+        char *end;
+        long bits = strtol(slash + 1, &end, 10);
+
+        if (*end || end == slash + 1 || bits < 0 || bits > max) {
+            return false;
+        }
+        *prefix = bits;
+    }
+    return true;
+}
+
+static bool parse_port(const char *s, int *port)
+{
+    char *end;
+    long val;
+
+    if (strcmp(s, "*") == 0) {
+        *port = -1;
+        return true;
+    }
+    val = strtol(s, &end, 10);
+    if (*end || end == s || val < 0 || val > 65535) {
+        return false;
+    }
+    *port = val;
+    return true;
+}
+
+/* Split "host:port" at the last colon outside brackets */
+static bool split_host_port(const char *s, char **host, char **port)
+{
+    const char *colon = strrchr(s, ':');
+    const char *bracket = strrchr(s, ']');
+
+    if (!colon || (bracket && colon < bracket)) {
+        return false;
+    }
+    *host = g_strndup(s, colon - s);
+    *port = g_strdup(colon + 1);
+    return true;
+}
+
+static bool parse_match(NetRule *rule, const char *match)
+{
+    g_autofree char *host = NULL;
+    g_autofree char *port = NULL;
+
+    if (strcmp(match, "*") == 0) {
+        rule->family = AF_UNSPEC;
+        rule->port = -1;
+        return true;
+    }
+    return split_host_port(match, &host, &port) &&
+           parse_addr(host, &rule->family, rule->addr, &rule->prefix) &&
+           parse_port(port, &rule->port);
+}
+
+static bool parse_target(NetRule *rule, const char *target)
+{
+    if (g_str_has_prefix(target, "unix:")) {
+        struct sockaddr_un *sun = (struct sockaddr_un *)&rule->target;
+        const char *path = target + 5;
+        size_t len = strlen(path);
+
+        if (!len || len >= sizeof(sun->sun_path)) {
+            return false;
+        }
+        sun->sun_family = AF_UNIX;
+        memcpy(sun->sun_path, path, len);
+        if (path[0] == '@') {
+            /* Abstract socket: no trailing NUL, length counts */
+            sun->sun_path[0] = '\0';
+            rule->target_len = offsetof(struct sockaddr_un, sun_path) + len;
+        } else {
+            rule->target_len = sizeof(*sun);
+        }
+        rule->action = NET_TO_UNIX;
+        return true;
+    }
+
+    if (g_str_has_prefix(target, "inet:")) {
+        g_autofree char *host = NULL;
+        g_autofree char *port = NULL;
+        uint8_t addr[16];
+        int family, prefix, portnum = -1;
+
+        target += 5;
+        if (!split_host_port(target, &host, &port) ||
+            (host[0] != '[' && strchr(host, ':'))) {
+            /* No port, or an unbracketed IPv6 address */
+            g_free(host);
+            g_free(port);
+            host = g_strdup(target);
+            port = g_strdup("*");
+        }
+        if (!parse_addr(host, &family, addr, &prefix) ||
+            family == AF_UNSPEC || strchr(host, '/') ||
+            !parse_port(port, &portnum)) {
+            return false;
+        }
+
+        rule->keep_port = portnum <= 0;
+        if (family == AF_INET) {
+            struct sockaddr_in *sin = (struct sockaddr_in *)&rule->target;
+
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons(portnum > 0 ? portnum : 0);
+            memcpy(&sin->sin_addr, addr, 4);
+            rule->target_len = sizeof(*sin);
+        } else {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&rule->target;
+
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = htons(portnum > 0 ? portnum : 0);
+            memcpy(&sin6->sin6_addr, addr, 16);
+            rule->target_len = sizeof(*sin6);
+        }
+        rule->action = NET_TO_INET;
+        return true;
+    }
+
+    return false;
+}
+
+int microhook_net_add_rule(unsigned ops, const char *match,
+                           const char *target, MicrohookNetPairFn pair_fn,
+                           void *opaque, char **errp)
+{
+    NetRule *rule = g_new0(NetRule, 1);
+    int id;
+
+    rule->ops = ops & MICROHOOK_NET_ALL;
+    if (!rule->ops) {
+        *errp = g_strdup("no operations given");
+        goto fail;
+    }
+    if (!parse_match(rule, match)) {
+        *errp = g_strdup_printf("invalid match '%s', expected ip:port", match);
+        goto fail;
+    }
+    if (target) {
+        if (!parse_target(rule, target)) {
+            *errp = g_strdup_printf("invalid target '%s', expected "
+                                    "inet:ip[:port] or unix:path", target);
+            goto fail;
+        }
+    } else {
+        if (!pair_fn) {
+            *errp = g_strdup("either a target or a handler is required");
+            goto fail;
+        }
+        if (rule->ops & MICROHOOK_NET_BIND) {
+            *errp = g_strdup("socketpair rules cannot apply to bind");
+            goto fail;
+        }
+        rule->action = NET_TO_PAIR;
+        rule->pair_fn = pair_fn;
+        rule->opaque = opaque;
+    }
+
+    g_mutex_lock(&g_lock);
+    if (!g_rules) {
+        g_rules = g_ptr_array_new_with_free_func(g_free);
+    }
+    id = rule->id = g_next_id++;
+    g_ptr_array_add(g_rules, rule);
+    qatomic_set(&g_num_rules, g_rules->len);
+    g_mutex_unlock(&g_lock);
+    return id;
+
+fail:
+    g_free(rule);
+    return -1;
+}
+
+unsigned microhook_net_parse_ops(const char *list)
+{
+    g_auto(GStrv) names = g_strsplit(list, ",", -1);
+    unsigned ops = 0;
+
+    for (int i = 0; names[i]; i++) {
+        const char *name = g_strstrip(names[i]);
+
+        if (strcmp(name, "connect") == 0) {
+            ops |= MICROHOOK_NET_CONNECT;
+        } else if (strcmp(name, "bind") == 0) {
+            ops |= MICROHOOK_NET_BIND;
+        } else if (strcmp(name, "sendto") == 0) {
+            ops |= MICROHOOK_NET_SENDTO;
+        } else {
+            return 0;
+        }
+    }
+    return ops;
+}
+
+int microhook_net_parse_rule(const char *spec)
+{
+    g_autofree char *match = NULL;
+    g_autofree char *err = NULL;
+    const char *eq = strchr(spec, '=');
+    const char *at = strchr(spec, '@');
+    unsigned ops = MICROHOOK_NET_ALL;
+    int id;
+
+    if (!eq) {
+        fprintf(stderr, "microhook: invalid redirect '%s', "
+                "expected [ops@]ip:port=target\n", spec);
+        return -1;
+    }
+    if (at && at < eq) {
+        g_autofree char *list = g_strndup(spec, at - spec);
+
+        ops = microhook_net_parse_ops(list);
+        if (!ops) {
+            fprintf(stderr, "microhook: invalid socket operations '%s', "
+                    "expected connect, bind or sendto\n", list);
+            return -1;
+        }
+        spec = at + 1;
+    }
+
+    match = g_strndup(spec, eq - spec);
+    id = microhook_net_add_rule(ops, match, eq + 1, NULL, NULL, &err);
+    if (id < 0) {
+        fprintf(stderr, "microhook: invalid redirect: %s\n", err);
+    }
+    return id;
+}
+
+static bool rule_matches(const NetRule *rule, unsigned op,
+                         const struct sockaddr *addr, socklen_t len)
+{
+    const uint8_t *ip;
+    int port;
+
+    if (!(rule->ops & op)) {
+        return false;
+    }
+    if (addr->sa_family == AF_INET && len >= sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+
+        ip = (const uint8_t *)&sin->sin_addr;
+        port = ntohs(sin->sin_port);
+    } else if (addr->sa_family == AF_INET6 &&
+               len >= sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+
+        ip = (const uint8_t *)&sin6->sin6_addr;
+        port = ntohs(sin6->sin6_port);
+    } else {
+        return false;
+    }
+
+    if (rule->port >= 0 && rule->port != port) {
+        return false;
+    }
+    if (rule->family == AF_UNSPEC) {
+        return true;
+    }
+    if (rule->family != addr->sa_family) {
+        return false;
+    }
+    for (int bits = rule->prefix, i = 0; bits > 0; bits -= 8, i++) {
+        uint8_t mask = bits >= 8 ? 0xff : (uint8_t)(0xff << (8 - bits));
+
+        if ((ip[i] ^ rule->addr[i]) & mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int sock_int_opt(int fd, int opt)
+{
+    int val = -1;
+    socklen_t len = sizeof(val);
+
+    if (getsockopt(fd, SOL_SOCKET, opt, &val, &len) < 0) {
+        return -1;
+    }
+    return val;
+}
+
+/*
+ * Swap the socket behind fd for newfd, keeping the file status and
+ * close-on-exec flags the guest set on the old one.
+ */
+static int replace_socket(int fd, int newfd)
+{
+    int fl = fcntl(fd, F_GETFL);
+    int fdfl = fcntl(fd, F_GETFD);
+
+    if (fl >= 0) {
+        fcntl(newfd, F_SETFL, fl);
+    }
+    if (dup2(newfd, fd) < 0) {
+        int err = errno;
+
+        close(newfd);
+        return -err;
+    }
+    close(newfd);
+    if (fdfl >= 0) {
+        fcntl(fd, F_SETFD, fdfl);
+    }
+    return 0;
+}
+
+/* Make fd a socket of the given family with the same type, if it is not */
+static int ensure_family(int fd, int family, bool autobind)
+{
+    int type, newfd;
+
+    if (sock_int_opt(fd, SO_DOMAIN) == family) {
+        return 0;
+    }
+    type = sock_int_opt(fd, SO_TYPE);
+    if (type < 0) {
+        return -errno;
+    }
+    newfd = socket(family, type, 0);
+    if (newfd < 0) {
+        return -errno;
+    }
+    /* Give datagram sockets an address so that replies find their way */
+    if (autobind && family == AF_UNIX && type == SOCK_DGRAM) {
+        sa_family_t af = AF_UNIX;
+
+        bind(newfd, (struct sockaddr *)&af, sizeof(af));
+    }
+    return replace_socket(fd, newfd);
+}
+
+static int to_pair(int fd, const NetRule *rule, const struct sockaddr *addr,
+                   socklen_t len)
+{
+    int sv[2], type, ret;
+
+    /* A later sendto() on the same socket is already paired */
+    if (sock_int_opt(fd, SO_DOMAIN) == AF_UNIX) {
+        return MICROHOOK_NET_PAIRED;
+    }
+    type = sock_int_opt(fd, SO_TYPE);
+    if (type < 0) {
+        return -errno;
+    }
+    if (socketpair(AF_UNIX, type, 0, sv) < 0) {
+        return -errno;
+    }
+    ret = replace_socket(fd, sv[0]);
+    if (ret < 0) {
+        close(sv[1]);
+        return ret;
+    }
+    fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+    rule->pair_fn(rule->opaque, sv[1], addr, len);
+    return MICROHOOK_NET_PAIRED;
+}
+
+int microhook_net_redirect(int fd, unsigned op, const struct sockaddr *addr,
+                           socklen_t len, struct sockaddr_storage *out,
+                           socklen_t *out_len)
+{
+    NetRule rule;
+    bool found = false;
+    int ret;
+
+    if (!qatomic_read(&g_num_rules) || !addr ||
+        (addr->sa_family != AF_INET && addr->sa_family != AF_INET6)) {
+        return MICROHOOK_NET_PASS;
+    }
+
+    /* Copy the rule so that the handler runs without the lock */
+    g_mutex_lock(&g_lock);
+    for (guint i = 0; i < g_rules->len; i++) {
+        NetRule *r = g_ptr_array_index(g_rules, i);
+
+        if (rule_matches(r, op, addr, len)) {
+            rule = *r;
+            found = true;
+            break;
+        }
+    }
+    g_mutex_unlock(&g_lock);
+
+    if (!found) {
+        return MICROHOOK_NET_PASS;
+    }
+
+    switch (rule.action) {
+    case NET_TO_PAIR:
+        return to_pair(fd, &rule, addr, len);
+
+    case NET_TO_UNIX:
+        ret = ensure_family(fd, AF_UNIX, op != MICROHOOK_NET_BIND);
+        if (ret < 0) {
+            return ret;
+        }
+        break;
+
+    case NET_TO_INET:
+        ret = ensure_family(fd, rule.target.ss_family, false);
+        if (ret < 0) {
+            return ret;
+        }
+        if (rule.keep_port) {
+            /* sin_port and sin6_port share their offset */
+            in_port_t port = ((const struct sockaddr_in *)addr)->sin_port;
+
+            ((struct sockaddr_in *)&rule.target)->sin_port = port;
+        }
+        break;
+    }
+
+    memcpy(out, &rule.target, rule.target_len);
+    *out_len = rule.target_len;
+    return MICROHOOK_NET_REWRITTEN;
+}
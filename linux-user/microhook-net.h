@@ -0,0 +1,85 @@
+/*
+ * Microhook Net - socket redirection rules for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_NET_H
+#define MICROHOOK_NET_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/* Socket operations a rule applies to */
+#define MICROHOOK_NET_CONNECT   (1u << 0)
+#define MICROHOOK_NET_BIND      (1u << 1)
+#define MICROHOOK_NET_SENDTO    (1u << 2)
+#define MICROHOOK_NET_ALL       (MICROHOOK_NET_CONNECT | MICROHOOK_NET_BIND | \
+                                 MICROHOOK_NET_SENDTO)
+
+/* Results of microhook_net_redirect() */
+#define MICROHOOK_NET_PASS      0   /* No rule matched */
+#define MICROHOOK_NET_REWRITTEN 1   /* Use the rewritten address */
+#define MICROHOOK_NET_PAIRED    2   /* fd is now a connected socketpair end */
+
+/*
+ * Called with the other end of a socketpair that replaced a guest socket.
+ * fd: host fd, owned by the callee from now on
+ * addr/len: address the guest asked for
+ */
+typedef void (*MicrohookNetPairFn)(void *opaque, int fd,
+                                   const struct sockaddr *addr,
+                                   socklen_t len);
+
+/*
+ * Add a rule.
+ * ops: MICROHOOK_NET_* operations to apply it to
+ * match: "ip:port", where ip may be "*", an IPv4 or a bracketed IPv6
+ *        address with an optional "/prefix", and port may be "*"
+ * target: "inet:ip[:port]" to rewrite the address (a missing or "*" port
+ *         keeps the original one), "unix:path" to use a Unix socket
+ *         ("unix:@name" for an abstract one), or NULL to hand one end of
+ *         a socketpair to pair_fn
+ *
+ * Rules are matched in the order they were added. Returns the rule id, or
+ * -1 with an error message in errp if the rule is malformed.
+ */
+int microhook_net_add_rule(unsigned ops, const char *match,
+                           const char *target, MicrohookNetPairFn pair_fn,
+                           void *opaque, char **errp);
+
+/*
+ * Parse a comma separated list of connect, bind and sendto into
+ * MICROHOOK_NET_* bits. Returns 0 if the list contains anything else.
+ */
+unsigned microhook_net_parse_ops(const char *list);
+
+/*
+ * Add a rule from a command line specification "[ops@]match=target", where
+ * ops is a comma separated list of connect, bind and sendto.
+ * Returns the rule id or -1 after printing an error.
+ */
+int microhook_net_parse_rule(const char *spec);
+
+/*
+ * Apply the rules to a socket operation on a guest address.
+ * fd: host fd of the socket (may be replaced by another socket)
+ * op: the MICROHOOK_NET_* operation
+ * addr/len: host version of the guest address
+ * out/out_len: receives the address to use for MICROHOOK_NET_REWRITTEN
+ *
+ * Called from the syscall layer. Returns MICROHOOK_NET_PASS without any
+ * locking when there are no rules, or a negative host errno on failure.
+ */
+int microhook_net_redirect(int fd, unsigned op, const struct sockaddr *addr,
+                           socklen_t len, struct sockaddr_storage *out,
+                           socklen_t *out_len);
+
+#endif /* MICROHOOK_NET_H */
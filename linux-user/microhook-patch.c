@@ -0,0 +1,153 @@
+/*
+ * Microhook Patch - runtime patching of guest code for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * A plain write into guest code either faults on a read-only mapping or
+ * leaves translated blocks of the old code behind. Patches are written
+ * with the host page temporarily made writable, and the stale blocks are
+ * invalidated afterwards with one pass per guest page.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "exec/mmap-lock.h"
+#include "exec/page-protection.h"
+#include "exec/translation-block.h"
+#include "user/page-protection.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "microhook-patch.h"
+#include <glib.h>
+
+/* Patched bytes within one guest page */
+typedef struct {
+    uint64_t start;
+    uint64_t last;
+} PatchSpan;
+
+static gint span_cmp(gconstpointer a, gconstpointer b)
+{
+    const PatchSpan *sa = a;
+    const PatchSpan *sb = b;
+
+    return sa->start < sb->start ? -1 : sa->start > sb->start;
+}
+
+/*
+ * Host protection of the host page at start, as target_mprotect() and
+ * the write protection of translated code left it. Must be called with
+ * the mmap lock held.
+ */
+static int host_page_prot(uint64_t start, uint64_t size)
+{
+    int prot = 0;
+
+    for (uint64_t addr = start; addr < start + size;
+         addr += TARGET_PAGE_SIZE) {
+        int flags = page_get_flags(addr);
+
+        if (flags & (PAGE_READ | PAGE_EXEC)) {
+            prot |= PROT_READ;
+        }
+        if (flags & PAGE_WRITE) {
+            prot |= PROT_WRITE;
+        }
+    }
+    return prot;
+}
+
+/* Must be called with the mmap lock held */
+static void write_patch(const MicrohookPatch *patch)
+{
+    uint64_t host_page_size = qemu_real_host_page_size();
+    uint64_t last = patch->addr + patch->len - 1;
+
+    for (uint64_t page = patch->addr & -host_page_size; page <= last;
+         page += host_page_size) {
+        uint64_t start = MAX(patch->addr, page);
+        uint64_t end = MIN(last, page + host_page_size - 1);
+        int prot = host_page_prot(page, host_page_size);
+
+        /*
+         * Another guest thread writing to the page meanwhile would not
+         * fault; its translations are still dropped below.
+         */
+        if (!(prot & PROT_WRITE)) {
+            mprotect(g2h_untagged(page), host_page_size,
+                     PROT_READ | PROT_WRITE);
+        }
+        memcpy(g2h_untagged(start), patch->data + (start - patch->addr),
+               end - start + 1);
+        if (!(prot & PROT_WRITE)) {
+            mprotect(g2h_untagged(page), host_page_size, prot);
+        }
+    }
+}
+
+int microhook_patch_apply(const MicrohookPatch *patches, size_t n,
+                          size_t *bad)
+{
+    g_autoptr(GArray) spans = g_array_new(false, false, sizeof(PatchSpan));
+    int pages = 0;
+
+    mmap_lock();
+
+    /* Validate everything before writing anything */
+    for (size_t i = 0; i < n; i++) {
+        const MicrohookPatch *p = &patches[i];
+
+        if (p->len && (!guest_range_valid_untagged(p->addr, p->len) ||
+                       !page_check_range(p->addr, p->len, PAGE_VALID))) {
+            mmap_unlock();
+            if (bad) {
+                *bad = i;
+            }
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const MicrohookPatch *p = &patches[i];
+        uint64_t last = p->addr + p->len - 1;
+
+        if (!p->len) {
+            continue;
+        }
+        write_patch(p);
+
+        for (uint64_t page = p->addr & TARGET_PAGE_MASK; page <= last;
+             page += TARGET_PAGE_SIZE) {
+            PatchSpan span = {
+                .start = MAX(p->addr, page),
+                .last = MIN(last, page + TARGET_PAGE_SIZE - 1),
+            };
+            g_array_append_val(spans, span);
+        }
+    }
+
+    /* One invalidation per page, covering all patches on it */
+    g_array_sort(spans, span_cmp);
+    for (guint i = 0; i < spans->len;) {
+        PatchSpan *span = &g_array_index(spans, PatchSpan, i);
+        uint64_t page = span->start & TARGET_PAGE_MASK;
+        uint64_t start = span->start, last = span->last;
+
+        for (i++; i < spans->len; i++) {
+            span = &g_array_index(spans, PatchSpan, i);
+            if ((span->start & TARGET_PAGE_MASK) != page) {
+                break;
+            }
+            last = MAX(last, span->last);
+        }
+        tb_invalidate_phys_range(thread_cpu, start, last);
+        pages++;
+    }
+
+    mmap_unlock();
+    return pages;
+}
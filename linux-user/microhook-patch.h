@@ -0,0 +1,43 @@
+/*
+ * Microhook Patch - runtime patching of guest code for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_PATCH_H
+#define MICROHOOK_PATCH_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * One write to guest memory
+ */
+typedef struct MicrohookPatch {
+    uint64_t addr;          /* Guest virtual address */
+    const void *data;
+    size_t len;
+} MicrohookPatch;
+
+/*
+ * Apply a set of patches.
+ * patches: array of n patches, applied in order
+ * bad: if non-NULL, receives the index of the first invalid patch
+ *
+ * Every patch must lie in mapped guest memory, whatever its protection;
+ * otherwise nothing is written and -1 is returned. Read-only and
+ * write-protected code pages are made writable for the duration of the
+ * write and restored afterwards, and the translations of each patched page
+ * are invalidated once, however many patches hit it.
+ * Returns the number of pages whose translations were invalidated.
+ */
+int microhook_patch_apply(const MicrohookPatch *patches, size_t n,
+                          size_t *bad);
+
+#endif /* MICROHOOK_PATCH_H */
@@ -0,0 +1,1015 @@
+/*
+ * Microhook Pcap - pcapng capture of guest socket traffic for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Payloads are taken from guest memory after each socket syscall finished
+ * and appended as pcapng blocks to a buffer owned by the calling thread.
+ * IP sockets get synthesised IPv4/IPv6 and TCP/UDP headers from the
+ * socket's addresses, so the capture opens in any dissector as is. A
+ * writer thread collects full buffers, and every buffer at least once a
+ * second, and writes them out; guest threads never touch the file.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/units.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "microhook-pcap.h"
+#include <glib.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#define PCAP_BUF_SIZE   (256 * KiB)
+#define PCAP_FLUSH_US   G_USEC_PER_SEC
+#define PCAP_SEGMENT    65000       /* Payload per synthesised IP packet */
+
+/* Extra operations next to the TARGET_SYS_* socketcall numbers */
+#define PCAP_READV      100
+#define PCAP_WRITEV     101
+
+#define PCAPNG_SHB      0x0a0d0d0a
+#define PCAPNG_IDB      0x00000001
+#define PCAPNG_EPB      0x00000006
+#define PCAPNG_MAGIC    0x1a2b3c4d
+
+#define OPT_ENDOFOPT    0
+#define OPT_SHB_USERAPPL 4
+#define OPT_IF_NAME     2
+#define OPT_EPB_FLAGS   2
+
+enum {
+    IF_IP,
+    IF_UNIX,
+    IF_NETLINK,
+    IF_PACKET,
+};
+
+/* One interface per kind of socket, in interface id order */
+static const struct {
+    const char *name;
+    uint16_t linktype;
+} g_ifaces[] = {
+    [IF_IP]      = { "ip",      101 },  /* LINKTYPE_RAW */
+    [IF_UNIX]    = { "unix",    147 },  /* LINKTYPE_USER0 */
+    [IF_NETLINK] = { "netlink", 253 },  /* LINKTYPE_NETLINK */
+    [IF_PACKET]  = { "packet",  1 },    /* LINKTYPE_ETHERNET */
+};
+
+enum {
+    DIR_IN,
+    DIR_OUT,
+};
+
+typedef struct PcapSock {
+    int domain;                 /* -1 if the fd is not a socket */
+    int type;
+    int protocol;
+    struct sockaddr_storage local;
+    struct sockaddr_storage peer;
+    uint32_t seq[2];            /* Next TCP sequence number per direction */
+} PcapSock;
+
+/* Guest memory holding part of a payload */
+typedef struct PcapPiece {
+    void *host;
+    abi_ulong guest;
+    size_t len;
+} PcapPiece;
+
+typedef struct PcapCursor {
+    const PcapPiece *pieces;
+    guint i;
+    size_t off;
+} PcapCursor;
+
+typedef struct PcapThread {
+    GMutex lock;                /* Taken by the owner and the writer */
+    GByteArray *buf;
+} PcapThread;
+
+static bool g_enabled = false;
+static int g_fd = -1;
+static GThread *g_writer = NULL;
+static GAsyncQueue *g_queue = NULL;
+static GByteArray g_stop;       /* Tells the writer to finish */
+static GByteArray g_sync;       /* Tells the writer to report progress */
+static GMutex g_sync_lock;
+static GCond g_sync_cond;
+static uint64_t g_sync_done = 0;
+
+static GMutex g_lock;           /* Protects g_threads */
+static GList *g_threads = NULL;
+
+static GMutex g_sock_lock;      /* Protects g_socks */
+static GHashTable *g_socks = NULL;
+static GHashTable *g_parent_socks = NULL;   /* Set aside for a vfork child */
+
+static __thread PcapThread *t_pcap = NULL;
+static __thread GArray *t_pieces = NULL;
+
+bool microhook_pcap_enabled(void)
+{
+    return qatomic_read(&g_enabled);
+}
+
+/* Block construction */
+
+static void put_u16(GByteArray *b, uint16_t v)
+{
+    g_byte_array_append(b, (const guint8 *)&v, sizeof(v));
+}
+
+static void put_u32(GByteArray *b, uint32_t v)
+{
+    g_byte_array_append(b, (const guint8 *)&v, sizeof(v));
+}
+
+static void put_pad(GByteArray *b)
+{
+    static const guint8 zero[4];
+
+    g_byte_array_append(b, zero, -b->len & 3);
+}
+
+static void put_option(GByteArray *b, uint16_t code, const void *data,
+                       uint16_t len)
+{
+    put_u16(b, code);
+    put_u16(b, len);
+    g_byte_array_append(b, data, len);
+    put_pad(b);
+}
+
+static size_t block_begin(GByteArray *b, uint32_t type)
+{
+    size_t start = b->len;
+
+    put_u32(b, type);
+    put_u32(b, 0);
+    return start;
+}
+
+static void block_end(GByteArray *b, size_t start)
+{
+    uint32_t len = b->len - start + 4;
+
+    memcpy(b->data + start + 4, &len, sizeof(len));
+    put_u32(b, len);
+}
+
+static void put_payload(GByteArray *b, PcapCursor *c, size_t len)
+{
+    while (len) {
+        const PcapPiece *p = &c->pieces[c->i];
+        size_t n = MIN(len, p->len - c->off);
+
+        g_byte_array_append(b, (const guint8 *)p->host + c->off, n);
+        c->off += n;
+        len -= n;
+        if (c->off == p->len) {
+            c->i++;
+            c->off = 0;
+        }
+    }
+}
+
+static void put_packet(GByteArray *b, int iface, int dir, int64_t ts,
+                       const uint8_t *hdr, size_t hlen, PcapCursor *c,
+                       size_t len)
+{
+    size_t start = block_begin(b, PCAPNG_EPB);
+    uint32_t flags = dir == DIR_IN ? 1 : 2;
+
+    put_u32(b, iface);
+    put_u32(b, ts >> 32);
+    put_u32(b, ts);
+    put_u32(b, hlen + len);
+    put_u32(b, hlen + len);
+    g_byte_array_append(b, hdr, hlen);
+    put_payload(b, c, len);
+    put_pad(b);
+    put_option(b, OPT_EPB_FLAGS, &flags, sizeof(flags));
+    put_option(b, OPT_ENDOFOPT, NULL, 0);
+    block_end(b, start);
+}
+
+/* Address bytes and port (network order) of ss, or zeros for another family */
+static void sock_ip(const struct sockaddr_storage *ss, int family,
+                    uint8_t *ip, uint16_t *port)
+{
+    memset(ip, 0, 16);
+    *port = 0;
+    if (ss->ss_family != family) {
+        return;
+    }
+    if (family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+
+        memcpy(ip, &sin->sin_addr, 4);
+        *port = sin->sin_port;
+    } else {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+
+        memcpy(ip, &sin6->sin6_addr, 16);
+        *port = sin6->sin6_port;
+    }
+}
+
+static size_t put_ip_header(uint8_t *hdr, int family, int proto,
+                            const uint8_t *src, const uint8_t *dst,
+                            size_t len)
+{
+    if (family == AF_INET) {
+        uint32_t sum = 0;
+
+        memset(hdr, 0, 20);
+        hdr[0] = 0x45;
+        stw_be_p(hdr + 2, 20 + len);
+        stw_be_p(hdr + 6, 0x4000);      /* Don't fragment */
+        hdr[8] = 64;
+        hdr[9] = proto;
+        memcpy(hdr + 12, src, 4);
+        memcpy(hdr + 16, dst, 4);
+        for (int i = 0; i < 20; i += 2) {
+            sum += lduw_be_p(hdr + i);
+        }
+        while (sum >> 16) {
+            sum = (sum & 0xffff) + (sum >> 16);
+        }
+        stw_be_p(hdr + 10, ~sum);
+        return 20;
+    }
+
+    stl_be_p(hdr, 0x60000000);
+    stw_be_p(hdr + 4, len);
+    hdr[6] = proto;
+    hdr[7] = 64;
+    memcpy(hdr + 8, src, 16);
+    memcpy(hdr + 24, dst, 16);
+    return 40;
+}
+
+/* Writer */
+
+static void write_all(const void *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(g_fd, data, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "microhook: pcap write failed: %s\n",
+                    strerror(errno));
+            return;
+        }
+        data = (const uint8_t *)data + n;
+        len -= n;
+    }
+}
+
+/* Must be called with t->lock held */
+static void thread_flush_locked(PcapThread *t)
+{
+    if (t->buf->len) {
+        g_async_queue_push(g_queue, t->buf);
+        t->buf = g_byte_array_sized_new(PCAP_BUF_SIZE);
+    }
+}
+
+/* Hand every thread's buffered packets to the writer */
+static void sweep(void)
+{
+    g_mutex_lock(&g_lock);
+    for (GList *l = g_threads; l; l = l->next) {
+        PcapThread *t = l->data;
+
+        g_mutex_lock(&t->lock);
+        thread_flush_locked(t);
+        g_mutex_unlock(&t->lock);
+    }
+    g_mutex_unlock(&g_lock);
+}
+
+static gpointer writer_thread(gpointer opaque)
+{
+    for (;;) {
+        GByteArray *b = g_async_queue_timeout_pop(g_queue, PCAP_FLUSH_US);
+
+        if (!b) {
+            /* Nothing filled up for a while: collect partial buffers */
+            sweep();
+            continue;
+        }
+        if (b == &g_stop) {
+            break;
+        }
+        if (b == &g_sync) {
+            g_mutex_lock(&g_sync_lock);
+            g_sync_done++;
+            g_cond_broadcast(&g_sync_cond);
+            g_mutex_unlock(&g_sync_lock);
+            continue;
+        }
+        /* Whole blocks per write, so forked writers never interleave */
+        write_all(b->data, b->len);
+        g_byte_array_unref(b);
+    }
+    return NULL;
+}
+
+static PcapThread *thread_get(void)
+{
+    if (!t_pcap) {
+        PcapThread *t = g_new0(PcapThread, 1);
+
+        g_mutex_init(&t->lock);
+        t->buf = g_byte_array_sized_new(PCAP_BUF_SIZE);
+        g_mutex_lock(&g_lock);
+        g_threads = g_list_prepend(g_threads, t);
+        g_mutex_unlock(&g_lock);
+        t_pcap = t;
+    }
+    return t_pcap;
+}
+
+/* Socket tracking */
+
+static bool is_ip(int domain)
+{
+    return domain == AF_INET || domain == AF_INET6;
+}
+
+static PcapSock *probe_socket(int fd)
+{
+    PcapSock *s = g_new0(PcapSock, 1);
+    socklen_t len = sizeof(s->domain);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &s->domain, &len) < 0) {
+        s->domain = -1;
+        return s;
+    }
+    len = sizeof(s->type);
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, &s->type, &len);
+    len = sizeof(s->protocol);
+    getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &s->protocol, &len);
+    len = sizeof(s->local);
+    getsockname(fd, (struct sockaddr *)&s->local, &len);
+    len = sizeof(s->peer);
+    if (getpeername(fd, (struct sockaddr *)&s->peer, &len) < 0) {
+        memset(&s->peer, 0, sizeof(s->peer));
+    }
+    s->seq[DIR_IN] = s->seq[DIR_OUT] = 1;
+    return s;
+}
+
+static bool needs_probe(const PcapSock *s)
+{
+    uint8_t ip[16];
+    uint16_t port;
+
+    if (!s) {
+        return true;
+    }
+    /* Unbound datagram sockets get a port with their first send */
+    if (is_ip(s->domain)) {
+        sock_ip(&s->local, s->domain, ip, &port);
+        return port == 0;
+    }
+    return false;
+}
+
+/*
+ * Look up what fd is, and take len bytes of TCP sequence space in
+ * direction dir. Sockets are probed once and remembered until the fd is
+ * closed, replaced or (re)connected.
+ */
+static bool sock_get(int fd, int dir, size_t len, PcapSock *info)
+{
+    PcapSock *s;
+
+    g_mutex_lock(&g_sock_lock);
+    s = g_hash_table_lookup(g_socks, GINT_TO_POINTER(fd));
+    if (needs_probe(s)) {
+        g_mutex_unlock(&g_sock_lock);
+        s = probe_socket(fd);
+        g_mutex_lock(&g_sock_lock);
+        g_hash_table_replace(g_socks, GINT_TO_POINTER(fd), s);
+    }
+    *info = *s;
+    s->seq[dir] += len;
+    g_mutex_unlock(&g_sock_lock);
+
+    return info->domain >= 0;
+}
+
+static void sock_forget(int fd)
+{
+    g_mutex_lock(&g_sock_lock);
+    g_hash_table_remove(g_socks, GINT_TO_POINTER(fd));
+    g_mutex_unlock(&g_sock_lock);
+}
+
+#ifdef TARGET_NR_close_range
+static void sock_forget_all(void)
+{
+    g_mutex_lock(&g_sock_lock);
+    g_hash_table_remove_all(g_socks);
+    g_mutex_unlock(&g_sock_lock);
+}
+#endif
+
+/* Guest memory */
+
+static size_t add_buf(abi_ulong addr, size_t len)
+{
+    PcapPiece p = { .guest = addr, .len = len };
+
+    if (!len) {
+        return 0;
+    }
+    p.host = lock_user(VERIFY_READ, addr, len, 1);
+    if (!p.host) {
+        return 0;
+    }
+    g_array_append_val(t_pieces, p);
+    return len;
+}
+
+/* Add up to len bytes described by a guest iovec array */
+static size_t add_iov(abi_ulong vec, abi_ulong count, size_t len)
+{
+    struct target_iovec *iov;
+    size_t total = 0;
+
+    if (count == 0 || count > IOV_MAX) {
+        return 0;
+    }
+    iov = lock_user(VERIFY_READ, vec, count * sizeof(*iov), 1);
+    if (!iov) {
+        return 0;
+    }
+    for (abi_ulong i = 0; i < count && total < len; i++) {
+        abi_ulong base = tswapal(iov[i].iov_base);
+        abi_ulong n = MIN(tswapal(iov[i].iov_len), len - total);
+
+        if (add_buf(base, n) != n) {
+            break;
+        }
+        total += n;
+    }
+    unlock_user(iov, vec, 0);
+    return total;
+}
+
+static void pieces_release(void)
+{
+    for (guint i = 0; i < t_pieces->len; i++) {
+        PcapPiece *p = &g_array_index(t_pieces, PcapPiece, i);
+
+        unlock_user(p->host, p->guest, 0);
+    }
+    g_array_set_size(t_pieces, 0);
+}
+
+/* Read an IP address from a guest sockaddr */
+static bool guest_sockaddr(abi_ulong addr, abi_ulong len,
+                           struct sockaddr_storage *ss)
+{
+    void *p;
+
+    memset(ss, 0, sizeof(*ss));
+    if (!addr || len < sizeof(struct target_sockaddr)) {
+        return false;
+    }
+    len = MIN(len, sizeof(*ss));
+    p = lock_user(VERIFY_READ, addr, len, 1);
+    if (!p) {
+        return false;
+    }
+    memcpy(ss, p, len);
+    unlock_user(p, addr, 0);
+    ss->ss_family = tswap16(ss->ss_family);
+    return is_ip(ss->ss_family);
+}
+
+/* Recording */
+
+/* Record len bytes held by t_pieces, moved through fd in direction dir */
+static void record(int fd, int dir, const struct sockaddr_storage *addr,
+                   size_t len)
+{
+    PcapCursor c = { .pieces = (PcapPiece *)t_pieces->data };
+    int64_t ts = g_get_real_time();
+    uint8_t local[16], remote[16];
+    uint16_t lport, rport;
+    uint8_t hdr[60];
+    PcapSock s;
+    PcapThread *t;
+    int iface, proto = 0;
+    bool synth = false;
+    uint32_t seq;
+
+    if (!len || !sock_get(fd, dir, len, &s)) {
+        return;
+    }
+
+    switch (s.domain) {
+    case AF_INET:
+    case AF_INET6:
+        iface = IF_IP;
+        if (s.type == SOCK_STREAM) {
+            proto = IPPROTO_TCP;
+        } else if (s.type == SOCK_DGRAM) {
+            proto = IPPROTO_UDP;
+        } else {
+            proto = s.protocol;
+        }
+        /* Raw IPv4 sockets receive the IP header along with the data */
+        synth = !(s.domain == AF_INET && s.type == SOCK_RAW && dir == DIR_IN);
+        break;
+    case AF_UNIX:
+        iface = IF_UNIX;
+        break;
+    case AF_NETLINK:
+        iface = IF_NETLINK;
+        break;
+    case AF_PACKET:
+        /* Datagram packet sockets carry network layer packets */
+        iface = s.type == SOCK_RAW ? IF_PACKET : IF_IP;
+        break;
+    default:
+        return;
+    }
+
+    sock_ip(&s.local, s.domain, local, &lport);
+    sock_ip(addr ? addr : &s.peer, s.domain, remote, &rport);
+    seq = s.seq[dir];
+
+    t = thread_get();
+    g_mutex_lock(&t->lock);
+    do {
+        size_t n = synth ? MIN(len, PCAP_SEGMENT) : len;
+        size_t hlen = 0;
+
+        if (synth) {
+            size_t iplen = s.domain == AF_INET ? 20 : 40;
+            uint8_t *l4 = hdr + iplen;
+            size_t l4len = 0;
+
+            if (proto == IPPROTO_TCP || proto == IPPROTO_UDP) {
+                stw_he_p(l4, dir == DIR_OUT ? lport : rport);
+                stw_he_p(l4 + 2, dir == DIR_OUT ? rport : lport);
+            }
+            if (proto == IPPROTO_TCP) {
+                stl_be_p(l4 + 4, seq);
+                stl_be_p(l4 + 8, s.seq[!dir]);
+                l4[12] = 5 << 4;
+                l4[13] = 0x18;          /* PSH, ACK */
+                stw_be_p(l4 + 14, 65535);
+                stl_be_p(l4 + 16, 0);
+                l4len = 20;
+                seq += n;
+            } else if (proto == IPPROTO_UDP) {
+                stw_be_p(l4 + 4, 8 + n);
+                stw_be_p(l4 + 6, 0);
+                l4len = 8;
+            }
+            hlen = put_ip_header(hdr, s.domain, proto,
+                                 dir == DIR_OUT ? local : remote,
+                                 dir == DIR_OUT ? remote : local,
+                                 l4len + n) + l4len;
+        }
+        put_packet(t->buf, iface, dir, ts, hdr, hlen, &c, n);
+        len -= n;
+    } while (len);
+    if (t->buf->len >= PCAP_BUF_SIZE) {
+        thread_flush_locked(t);
+    }
+    g_mutex_unlock(&t->lock);
+}
+
+static void record_msg(int fd, int dir, abi_ulong msg, size_t len)
+{
+    struct target_msghdr *m;
+    struct sockaddr_storage ss;
+    bool has_addr;
+
+    if (!lock_user_struct(VERIFY_READ, m, msg, 1)) {
+        return;
+    }
+    has_addr = guest_sockaddr(tswapal(m->msg_name), tswap32(m->msg_namelen),
+                              &ss);
+    len = add_iov(tswapal(m->msg_iov), tswapal(m->msg_iovlen), len);
+    unlock_user_struct(m, msg, 0);
+
+    record(fd, dir, has_addr ? &ss : NULL, len);
+    pieces_release();
+}
+
+static void record_mmsg(int fd, int dir, abi_ulong vec, abi_long n)
+{
+    for (abi_long i = 0; i < n; i++) {
+        abi_ulong m = vec + i * sizeof(struct target_mmsghdr);
+        uint32_t len;
+
+        if (get_user_u32(len, m + offsetof(struct target_mmsghdr, msg_len))) {
+            break;
+        }
+        record_msg(fd, dir, m + offsetof(struct target_mmsghdr, msg_hdr),
+                   len);
+    }
+}
+
+/*
+ * Record the data of a socket operation, with arguments laid out as for
+ * socketcall(). Receive lengths are clamped to the buffer, since MSG_TRUNC
+ * returns the length of the whole datagram.
+ */
+static void pcap_op(int op, abi_long ret, const abi_long *a)
+{
+    struct sockaddr_storage ss;
+    abi_ulong len;
+    uint32_t alen;
+
+    if (op == TARGET_SYS_CONNECT || op == TARGET_SYS_BIND) {
+        sock_forget(a[0]);
+        return;
+    }
+    if (ret <= 0) {
+        return;
+    }
+    if (!t_pieces) {
+        t_pieces = g_array_new(false, false, sizeof(PcapPiece));
+    }
+
+    switch (op) {
+    case TARGET_SYS_SEND:
+        len = add_buf(a[1], ret);
+        record(a[0], DIR_OUT, NULL, len);
+        break;
+    case TARGET_SYS_RECV:
+        if (a[3] & MSG_PEEK) {
+            return;
+        }
+        len = add_buf(a[1], MIN((abi_ulong)ret, (abi_ulong)a[2]));
+        record(a[0], DIR_IN, NULL, len);
+        break;
+    case TARGET_SYS_SENDTO:
+        len = add_buf(a[1], ret);
+        record(a[0], DIR_OUT, guest_sockaddr(a[4], a[5], &ss) ? &ss : NULL,
+               len);
+        break;
+    case TARGET_SYS_RECVFROM:
+        if (a[3] & MSG_PEEK) {
+            return;
+        }
+        if (!a[5] || get_user_u32(alen, a[5])) {
+            alen = 0;
+        }
+        len = add_buf(a[1], MIN((abi_ulong)ret, (abi_ulong)a[2]));
+        record(a[0], DIR_IN, guest_sockaddr(a[4], alen, &ss) ? &ss : NULL,
+               len);
+        break;
+    case TARGET_SYS_SENDMSG:
+        record_msg(a[0], DIR_OUT, a[1], ret);
+        return;
+    case TARGET_SYS_RECVMSG:
+        if (a[2] & MSG_PEEK) {
+            return;
+        }
+        record_msg(a[0], DIR_IN, a[1], ret);
+        return;
+    case TARGET_SYS_SENDMMSG:
+        record_mmsg(a[0], DIR_OUT, a[1], ret);
+        return;
+    case TARGET_SYS_RECVMMSG:
+        if (a[3] & MSG_PEEK) {
+            return;
+        }
+        record_mmsg(a[0], DIR_IN, a[1], ret);
+        return;
+    case PCAP_WRITEV:
+        len = add_iov(a[1], a[2], ret);
+        record(a[0], DIR_OUT, NULL, len);
+        break;
+    case PCAP_READV:
+        len = add_iov(a[1], a[2], ret);
+        record(a[0], DIR_IN, NULL, len);
+        break;
+    default:
+        return;
+    }
+    pieces_release();
+}
+
+#ifdef TARGET_NR_socketcall
+static void pcap_socketcall(int num, abi_ulong vptr, abi_long ret)
+{
+    abi_long a[6] = { 0 };
+
+    switch (num) {
+    case TARGET_SYS_SEND:
+    case TARGET_SYS_RECV:
+    case TARGET_SYS_SENDTO:
+    case TARGET_SYS_RECVFROM:
+    case TARGET_SYS_SENDMSG:
+    case TARGET_SYS_RECVMSG:
+    case TARGET_SYS_SENDMMSG:
+    case TARGET_SYS_RECVMMSG:
+    case TARGET_SYS_CONNECT:
+    case TARGET_SYS_BIND:
+        break;
+    default:
+        return;
+    }
+    for (int i = 0; i < (int)ARRAY_SIZE(a); i++) {
+        if (get_user_ual(a[i], vptr + i * sizeof(abi_ulong))) {
+            break;
+        }
+    }
+    pcap_op(num, ret, a);
+}
+#endif
+
+void microhook_pcap_syscall(int num, abi_long ret, abi_long arg1,
+                            abi_long arg2, abi_long arg3, abi_long arg4,
+                            abi_long arg5, abi_long arg6)
+{
+    abi_long a[6] = { arg1, arg2, arg3, arg4, arg5, arg6 };
+    int op;
+
+    switch (num) {
+    case TARGET_NR_close:
+        sock_forget(arg1);
+        return;
+#ifdef TARGET_NR_close_range
+    case TARGET_NR_close_range:
+        sock_forget_all();
+        return;
+#endif
+#ifdef TARGET_NR_dup2
+    case TARGET_NR_dup2:
+#endif
+#ifdef TARGET_NR_dup3
+    case TARGET_NR_dup3:
+#endif
+        sock_forget(arg2);
+        return;
+#ifdef TARGET_NR_socketcall
+    case TARGET_NR_socketcall:
+        pcap_socketcall(arg1, arg2, ret);
+        return;
+#endif
+    case TARGET_NR_read:
+        a[3] = 0;
+        op = TARGET_SYS_RECV;
+        break;
+    case TARGET_NR_write:
+        op = TARGET_SYS_SEND;
+        break;
+    case TARGET_NR_readv:
+        op = PCAP_READV;
+        break;
+    case TARGET_NR_writev:
+        op = PCAP_WRITEV;
+        break;
+#ifdef TARGET_NR_send
+    case TARGET_NR_send:
+        op = TARGET_SYS_SEND;
+        break;
+#endif
+#ifdef TARGET_NR_recv
+    case TARGET_NR_recv:
+        op = TARGET_SYS_RECV;
+        break;
+#endif
+#ifdef TARGET_NR_sendto
+    case TARGET_NR_sendto:
+        op = TARGET_SYS_SENDTO;
+        break;
+#endif
+#ifdef TARGET_NR_recvfrom
+    case TARGET_NR_recvfrom:
+        op = TARGET_SYS_RECVFROM;
+        break;
+#endif
+#ifdef TARGET_NR_sendmsg
+    case TARGET_NR_sendmsg:
+        op = TARGET_SYS_SENDMSG;
+        break;
+#endif
+#ifdef TARGET_NR_recvmsg
+    case TARGET_NR_recvmsg:
+        op = TARGET_SYS_RECVMSG;
+        break;
+#endif
+#ifdef TARGET_NR_sendmmsg
+    case TARGET_NR_sendmmsg:
+        op = TARGET_SYS_SENDMMSG;
+        break;
+#endif
+#ifdef TARGET_NR_recvmmsg
+    case TARGET_NR_recvmmsg:
+        op = TARGET_SYS_RECVMMSG;
+        break;
+#endif
+#ifdef TARGET_NR_recvmmsg_time64
+    case TARGET_NR_recvmmsg_time64:
+        op = TARGET_SYS_RECVMMSG;
+        break;
+#endif
+#ifdef TARGET_NR_connect
+    case TARGET_NR_connect:
+        op = TARGET_SYS_CONNECT;
+        break;
+#endif
+#ifdef TARGET_NR_bind
+    case TARGET_NR_bind:
+        op = TARGET_SYS_BIND;
+        break;
+#endif
+    default:
+        return;
+    }
+    pcap_op(op, ret, a);
+}
+
+/* Setup and teardown */
+
+static void write_header(void)
+{
+    g_autoptr(GByteArray) b = g_byte_array_new();
+    static const char appl[] = "microhook";
+    size_t start;
+
+    start = block_begin(b, PCAPNG_SHB);
+    put_u32(b, PCAPNG_MAGIC);
+    put_u16(b, 1);
+    put_u16(b, 0);
+    put_u32(b, UINT32_MAX);         /* Section length unknown */
+    put_u32(b, UINT32_MAX);
+    put_option(b, OPT_SHB_USERAPPL, appl, strlen(appl));
+    put_option(b, OPT_ENDOFOPT, NULL, 0);
+    block_end(b, start);
+
+    for (int i = 0; i < (int)ARRAY_SIZE(g_ifaces); i++) {
+        start = block_begin(b, PCAPNG_IDB);
+        put_u16(b, g_ifaces[i].linktype);
+        put_u16(b, 0);
+        put_u32(b, 0);              /* No snapshot length */
+        put_option(b, OPT_IF_NAME, g_ifaces[i].name,
+                   strlen(g_ifaces[i].name));
+        put_option(b, OPT_ENDOFOPT, NULL, 0);
+        block_end(b, start);
+    }
+
+    write_all(b->data, b->len);
+}
+
+int microhook_pcap_init(const char *path)
+{
+    int fd;
+
+    /* A capture continued by a child QEMU after execve() */
+    if (sscanf(path, "fd:%d", &fd) == 1) {
+        g_fd = fd;
+    } else {
+        /* Appending keeps the blocks of forked writers whole */
+        g_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                    0644);
+        if (g_fd < 0) {
+            fprintf(stderr, "microhook: cannot open pcap file %s: %s\n",
+                    path, strerror(errno));
+            return -1;
+        }
+        write_header();
+    }
+    qemu_fd_register(g_fd);
+
+    g_socks = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    g_queue = g_async_queue_new();
+    g_writer = g_thread_new("pcap-writer", writer_thread, NULL);
+    qatomic_set(&g_enabled, true);
+    return 0;
+}
+
+char *microhook_pcap_child_arg(void)
+{
+    fcntl(g_fd, F_SETFD, 0);
+    return g_strdup_printf("fd:%d", g_fd);
+}
+
+void microhook_pcap_closed(int fd)
+{
+    sock_forget(fd);
+}
+
+void microhook_pcap_thread_exit(void)
+{
+    PcapThread *t = t_pcap;
+
+    if (!t) {
+        return;
+    }
+    g_mutex_lock(&g_lock);
+    g_threads = g_list_remove(g_threads, t);
+    g_mutex_unlock(&g_lock);
+
+    if (t->buf->len && qatomic_read(&g_enabled)) {
+        g_async_queue_push(g_queue, t->buf);
+    } else {
+        g_byte_array_unref(t->buf);
+    }
+    g_mutex_clear(&t->lock);
+    g_free(t);
+    t_pcap = NULL;
+}
+
+void microhook_pcap_after_fork(void)
+{
+    if (!qatomic_read(&g_enabled)) {
+        return;
+    }
+
+    /*
+     * Locks may have been held by threads that do not exist here, and
+     * everything buffered so far is written by the parent.
+     */
+    g_mutex_init(&g_lock);
+    g_mutex_init(&g_sock_lock);
+    g_mutex_init(&g_sync_lock);
+    g_cond_init(&g_sync_cond);
+    g_threads = NULL;
+    if (t_pcap) {
+        g_mutex_init(&t_pcap->lock);
+        g_byte_array_set_size(t_pcap->buf, 0);
+        g_threads = g_list_prepend(NULL, t_pcap);
+    }
+    g_queue = g_async_queue_new();
+    g_writer = g_thread_new("pcap-writer", writer_thread, NULL);
+}
+
+void microhook_pcap_vfork_begin(void)
+{
+    if (!qatomic_read(&g_enabled)) {
+        return;
+    }
+
+    /* The child's fd table is a copy it may change */
+    sweep();
+    g_mutex_lock(&g_sock_lock);
+    g_parent_socks = g_socks;
+    g_socks = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    g_mutex_unlock(&g_sock_lock);
+}
+
+void microhook_pcap_vfork_end(void)
+{
+    if (!qatomic_read(&g_enabled) || !g_parent_socks) {
+        return;
+    }
+    sweep();
+    g_mutex_lock(&g_sock_lock);
+    g_hash_table_destroy(g_socks);
+    g_socks = g_parent_socks;
+    g_parent_socks = NULL;
+    g_mutex_unlock(&g_sock_lock);
+}
+
+void microhook_pcap_sync(void)
+{
+    uint64_t ticket;
+
+    if (!qatomic_read(&g_enabled)) {
+        return;
+    }
+    sweep();
+    g_mutex_lock(&g_sync_lock);
+    ticket = g_sync_done + 1;
+    g_async_queue_push(g_queue, &g_sync);
+    while (g_sync_done < ticket) {
+        g_cond_wait(&g_sync_cond, &g_sync_lock);
+    }
+    g_mutex_unlock(&g_sync_lock);
+}
+
+void microhook_pcap_finish(void)
+{
+    if (!qatomic_xchg(&g_enabled, false)) {
+        return;
+    }
+    sweep();
+    g_async_queue_push(g_queue, &g_stop);
+    g_thread_join(g_writer);
+    g_writer = NULL;
+}
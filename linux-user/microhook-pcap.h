@@ -0,0 +1,70 @@
+/*
+ * Microhook Pcap - pcapng capture of guest socket traffic for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_PCAP_H
+#define MICROHOOK_PCAP_H
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "user/abitypes.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Start capturing to path, which is truncated. Returns 0 on success or -1
+ * after printing an error.
+ */
+int microhook_pcap_init(const char *path);
+
+/* Whether a capture is running */
+bool microhook_pcap_enabled(void);
+
+/*
+ * Record the payload of a finished syscall if it moved data through a
+ * socket, and track fds whose socket may have changed.
+ * Called from do_syscall() right after do_syscall1().
+ */
+void microhook_pcap_syscall(int num, abi_long ret, abi_long arg1,
+                            abi_long arg2, abi_long arg3, abi_long arg4,
+                            abi_long arg5, abi_long arg6);
+
+/*
+ * Argument for -pcap that lets a QEMU started by execve() continue the
+ * capture in the same file. Makes the file descriptor inheritable.
+ */
+char *microhook_pcap_child_arg(void);
+
+/* Forget fd, which QEMU closed for the guest, e.g. on an in-place exec */
+void microhook_pcap_closed(int fd);
+
+/* Hand the calling thread's buffered packets to the writer */
+void microhook_pcap_thread_exit(void);
+
+/* Continue the capture in a forked child, which has only the caller */
+void microhook_pcap_after_fork(void);
+
+/*
+ * Called in a vfork() child, which runs on the parent's buffer and socket
+ * table: write out the parent's packets and track the child's sockets
+ * apart.
+ */
+void microhook_pcap_vfork_begin(void);
+
+/* Called in the parent once its vfork() child has exec'd or exited */
+void microhook_pcap_vfork_end(void);
+
+/* Write out everything buffered so far and wait for it, e.g. before execve */
+void microhook_pcap_sync(void);
+
+/* Write out everything buffered and stop the writer */
+void microhook_pcap_finish(void);
+
+#endif /* MICROHOOK_PCAP_H */
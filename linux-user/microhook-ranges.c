@@ -0,0 +1,285 @@
+/*
+ * Microhook Ranges - guest address range hooks for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Ranges are kept in an interval tree that is only consulted when a block
+ * is translated, so blocks outside every range run without any overhead.
+ * Hits are recorded from generated code at the start of each matching
+ * block, appended to a per-thread buffer and handed to the delivery
+ * callback in batches instead of one call per block.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/interval-tree.h"
+#include "accel/tcg/getpc.h"
+#include "exec/cpu-common.h"
+#include "exec/mmap-lock.h"
+#include "exec/tb-flush.h"
+#include "exec/translation-block.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "microhook-ranges.h"
+#include <glib.h>
+
+/* Number of buffered events that triggers a delivery from generated code */
+#define RANGE_BATCH_SIZE 256
+
+typedef struct MicrohookRange {
+    IntervalTreeNode node;      /* [start, end - 1] */
+    int id;
+    MicrohookRangeMode mode;
+    unsigned period;
+    MicrohookRangeDeliverFn deliver;
+    void *opaque;
+    GHashTable *seen;           /* FIRST: block pcs already reported */
+} MicrohookRange;
+
+typedef struct {
+    MicrohookRange *range;
+    unsigned count;             /* SAMPLED: executions, FIRST: ran once */
+} RangeSiteEntry;
+
+/*
+ * Run-time hooks of one block. Generated code holds a pointer to the site,
+ * so sites are never freed; a site built for an older set of ranges is
+ * simply replaced in g_sites.
+ */
+typedef struct {
+    uint64_t pc;
+    unsigned gen;
+    unsigned num;
+    RangeSiteEntry entries[];
+} RangeSite;
+
+typedef struct {
+    MicrohookRange *range;
+    uint64_t pc;
+} RangeEvent;
+
+static IntervalTreeRoot g_tree;
+static GHashTable *g_sites = NULL;      /* pc -> RangeSite */
+static unsigned g_gen = 0;              /* Bumped whenever a range is added */
+static int g_next_id = 0;
+static bool g_active = false;
+static GMutex g_lock;
+
+static __thread GArray *t_events = NULL;    /* RangeEvent */
+static __thread bool t_in_generated_code = false;
+static __thread bool t_delivering = false;
+
+static void push_event(MicrohookRange *range, uint64_t pc)
+{
+    RangeEvent ev = { .range = range, .pc = pc };
+
+    if (!t_events) {
+        t_events = g_array_sized_new(false, false, sizeof(RangeEvent),
+                                     RANGE_BATCH_SIZE);
+    }
+    g_array_append_val(t_events, ev);
+}
+
+static void deliver_events(void)
+{
+    RangeEvent *events;
+    uint64_t *pcs;
+    unsigned n;
+
+    if (!t_events || t_events->len == 0 || t_delivering) {
+        return;
+    }
+
+    t_delivering = true;
+    events = &g_array_index(t_events, RangeEvent, 0);
+    n = t_events->len;
+    pcs = g_new(uint64_t, n);
+
+    /* One call per range, keeping the execution order within a range */
+    for (unsigned i = 0; i < n; i++) {
+        MicrohookRange *range = events[i].range;
+        size_t k = 0;
+
+        if (!range) {
+            continue;
+        }
+        for (unsigned j = i; j < n; j++) {
+            if (events[j].range == range) {
+                pcs[k++] = events[j].pc;
+                events[j].range = NULL;
+            }
+        }
+        range->deliver(range->opaque, pcs, k);
+    }
+
+    g_free(pcs);
+    g_array_set_size(t_events, 0);
+    t_delivering = false;
+}
+
+int microhook_ranges_add(uint64_t start, uint64_t end,
+                         MicrohookRangeMode mode, unsigned period,
+                         MicrohookRangeDeliverFn deliver, void *opaque)
+{
+    MicrohookRange *range;
+
+    if (end <= start || !deliver) {
+        return -1;
+    }
+    if (mode == MICROHOOK_RANGE_SAMPLED && period == 0) {
+        return -1;
+    }
+
+    range = g_new0(MicrohookRange, 1);
+    range->node.start = start;
+    range->node.last = end - 1;
+    range->mode = mode;
+    range->period = period;
+    range->deliver = deliver;
+    range->opaque = opaque;
+    if (mode == MICROHOOK_RANGE_FIRST) {
+        range->seen = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+
+    g_mutex_lock(&g_lock);
+    range->id = g_next_id++;
+    interval_tree_insert(&range->node, &g_tree);
+    if (!g_sites) {
+        g_sites = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+    g_gen++;
+    qatomic_set(&g_active, true);
+    g_mutex_unlock(&g_lock);
+
+    /*
+     * Retranslate code that is already inside the range. From within
+     * generated code (a range callback) that code may still be running,
+     * so fall back to a flush at the next safe point.
+     */
+    if (t_in_generated_code) {
+        queue_tb_flush(thread_cpu);
+    } else {
+        mmap_lock();
+        tb_invalidate_phys_range(thread_cpu, start, end - 1);
+        mmap_unlock();
+    }
+
+    return range->id;
+}
+
+bool microhook_ranges_active(void)
+{
+    return qatomic_read(&g_active);
+}
+
+void *microhook_ranges_translate(uint64_t pc, uint32_t size)
+{
+    uint64_t last = pc + MAX(size, 1) - 1;
+    IntervalTreeNode *node;
+    RangeSite *site;
+    unsigned num = 0;
+
+    g_mutex_lock(&g_lock);
+
+    site = g_hash_table_lookup(g_sites, &pc);
+    if (site && site->gen == g_gen) {
+        goto out;
+    }
+
+    for (node = interval_tree_iter_first(&g_tree, pc, last); node;
+         node = interval_tree_iter_next(node, pc, last)) {
+        MicrohookRange *range = container_of(node, MicrohookRange, node);
+
+        if (range->mode != MICROHOOK_RANGE_FIRST ||
+            !g_hash_table_contains(range->seen, &pc)) {
+            num++;
+        }
+    }
+
+    if (num == 0) {
+        site = NULL;
+        goto out;
+    }
+
+    site = g_malloc0(sizeof(RangeSite) + num * sizeof(RangeSiteEntry));
+    site->pc = pc;
+    site->gen = g_gen;
+    for (node = interval_tree_iter_first(&g_tree, pc, last); node;
+         node = interval_tree_iter_next(node, pc, last)) {
+        MicrohookRange *range = container_of(node, MicrohookRange, node);
+
+        /* A retranslated block is not reported again */
+        if (range->mode != MICROHOOK_RANGE_FIRST ||
+            !g_hash_table_contains(range->seen, &pc)) {
+            site->entries[site->num++].range = range;
+        }
+    }
+    g_hash_table_replace(g_sites, &site->pc, site);
+
+out:
+    g_mutex_unlock(&g_lock);
+    return site;
+}
+
+/* Claim the first execution of pc for range, across all of its sites */
+static bool claim_first(MicrohookRange *range, uint64_t pc)
+{
+    bool claimed = false;
+
+    g_mutex_lock(&g_lock);
+    if (!g_hash_table_contains(range->seen, &pc)) {
+        uint64_t *key = g_new(uint64_t, 1);
+
+        *key = pc;
+        g_hash_table_add(range->seen, key);
+        claimed = true;
+    }
+    g_mutex_unlock(&g_lock);
+
+    return claimed;
+}
+
+void microhook_ranges_hit(void *opaque)
+{
+    RangeSite *site = opaque;
+    uintptr_t ra = GETPC();
+
+    for (unsigned i = 0; i < site->num; i++) {
+        RangeSiteEntry *e = &site->entries[i];
+
+        if (e->range->mode == MICROHOOK_RANGE_FIRST) {
+            /* Only the first thread through the site looks any further */
+            if (qatomic_read(&e->count) || qatomic_xchg(&e->count, 1) ||
+                !claim_first(e->range, site->pc)) {
+                continue;
+            }
+        } else if (e->range->mode == MICROHOOK_RANGE_SAMPLED) {
+            /* Racy across threads, which is fine for sampling */
+            unsigned count = qatomic_read(&e->count) + 1;
+
+            qatomic_set(&e->count, count);
+            if (count % e->range->period) {
+                continue;
+            }
+        }
+        push_event(e->range, site->pc);
+    }
+
+    if (t_events && t_events->len >= RANGE_BATCH_SIZE) {
+        /* Nothing of the block has run yet: the guest is at its first insn */
+        cpu_restore_state(thread_cpu, ra);
+        t_in_generated_code = true;
+        deliver_events();
+        t_in_generated_code = false;
+    }
+}
+
+void microhook_ranges_flush(void)
+{
+    deliver_events();
+}
@@ -0,0 +1,74 @@
+/*
+ * Microhook Ranges - guest address range hooks for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_RANGES_H
+#define MICROHOOK_RANGES_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * When a range hook reports a block
+ */
+typedef enum {
+    MICROHOOK_RANGE_FIRST,   /* Once per block, when it first executes */
+    MICROHOOK_RANGE_EVERY,   /* Every execution of the block */
+    MICROHOOK_RANGE_SAMPLED, /* Every period-th execution of the block */
+} MicrohookRangeMode;
+
+/*
+ * Delivery callback. pcs holds the start addresses of n blocks executed by
+ * the calling thread, in execution order.
+ */
+typedef void (*MicrohookRangeDeliverFn)(void *opaque, const uint64_t *pcs,
+                                        size_t n);
+
+/*
+ * Hook all blocks overlapping the guest range [start, end).
+ * period: reporting period for MICROHOOK_RANGE_SAMPLED, ignored otherwise
+ *
+ * Translated code already inside the range is invalidated so that it
+ * picks up the hook. Returns the hook id (>= 0), or -1 on error.
+ */
+int microhook_ranges_add(uint64_t start, uint64_t end,
+                         MicrohookRangeMode mode, unsigned period,
+                         MicrohookRangeDeliverFn deliver, void *opaque);
+
+/*
+ * Check whether any range hooks are registered. Lock-free.
+ */
+bool microhook_ranges_active(void);
+
+/*
+ * Match a block at translation time.
+ * pc: guest virtual address of the block start
+ * size: size of the block in bytes
+ *
+ * Called from the translator with the mmap lock held. Returns an opaque
+ * site to pass to microhook_ranges_hit() from the generated code, or NULL
+ * if the block needs no run-time instrumentation.
+ */
+void *microhook_ranges_translate(uint64_t pc, uint32_t size);
+
+/*
+ * Run-time hook, called from generated code at the start of an
+ * instrumented block.
+ */
+void microhook_ranges_hit(void *site);
+
+/*
+ * Deliver all events buffered by the calling thread. Must not be called
+ * from generated code.
+ */
+void microhook_ranges_flush(void);
+
+#endif /* MICROHOOK_RANGES_H */
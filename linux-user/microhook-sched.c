@@ -0,0 +1,883 @@
+/*
+ * Microhook Sched - deterministic thread scheduling for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Guest threads still run on host threads of their own, but only the one
+ * that has the turn executes guest code; the others wait on a condition
+ * variable of their own, so the turn is handed over directly. A thread
+ * passes it on when its time slice, counted in blocks by generated code,
+ * runs out, and when a syscall would block. Such a syscall is not issued
+ * until it can complete: the thread retries it each time it gets the turn
+ * and lets the others run in between. Every decision is taken by the
+ * thread that has the turn, from a PRNG seeded on the command line, so the
+ * same seed gives the same interleaving as long as the guest sees the same
+ * inputs. Syscalls that wait for something other than the guest's own
+ * threads, or that may block after they started, run unscheduled, and the
+ * interleaving after them depends on when they return.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/path.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "special-errno.h"
+#include "microhook-sched.h"
+#include <glib.h>
+#include <poll.h>
+#include <linux/futex.h>
+
+/* Pause between rounds in which every thread waits in a syscall */
+#define SCHED_IDLE_US   1000
+
+/* Most file descriptors of a poll() that are checked while waiting */
+#define SCHED_MAX_POLL  1024
+
+typedef enum {
+    SCHED_RUNNABLE,     /* Runs guest code when it has the turn */
+    SCHED_WAITING,      /* Retries a syscall when it has the turn */
+    SCHED_OUTSIDE,      /* In a syscall that runs unscheduled */
+} SchedState;
+
+typedef struct SchedThread {
+    CPUState *cpu;
+    SchedState state;
+    GCond turn;             /* Signalled when the thread gets the turn */
+    /* The futex waited on in FUTEX_WAIT, and whether a wake reached it */
+    abi_ulong futex_addr;
+    uint32_t futex_bitset;
+    bool futex_woken;
+} SchedThread;
+
+/* What a waiting syscall waits for */
+typedef struct {
+    bool futex;             /* A futex wake, or else poll() readiness */
+    abi_ulong futex_addr;
+    uint32_t futex_val;
+    struct pollfd *fds;
+    nfds_t nfds;
+    struct pollfd fd;       /* Storage for a single file descriptor */
+    bool timeout;
+    clockid_t clock;
+    int64_t deadline;       /* In microseconds of clock */
+    int64_t timeout_ret;    /* Result when the deadline passes */
+} SchedWait;
+
+static bool g_enabled = false;
+static uint64_t g_rng;
+static uint64_t g_quantum;
+static GMutex g_lock;
+static GPtrArray *g_threads = NULL;     /* SchedThread, in creation order */
+static SchedThread *g_current = NULL;   /* Has the turn, or NULL */
+static unsigned g_idle = 0;             /* Retries in vain in a row */
+
+static __thread SchedThread *t_sched = NULL;
+static __thread bool t_outside;         /* Current syscall is unscheduled */
+static __thread int64_t t_woken;        /* Threads woken by a futex wake */
+
+bool microhook_sched_enabled(void)
+{
+    return qatomic_read(&g_enabled);
+}
+
+/* splitmix64, only called by the thread that has the turn */
+static uint64_t next_random(void)
+{
+    uint64_t z = g_rng += 0x9e3779b97f4a7c15ULL;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int32_t next_slice(void)
+{
+    return next_random() % (2 * g_quantum) + 1;
+}
+
+/* Turns */
+
+/* Draw the thread to run next, from those that are not outside */
+static SchedThread *pick_locked(void)
+{
+    unsigned n = 0;
+
+    for (guint i = 0; i < g_threads->len; i++) {
+        SchedThread *t = g_ptr_array_index(g_threads, i);
+
+        n += t->state != SCHED_OUTSIDE;
+    }
+    if (!n) {
+        return NULL;
+    }
+    n = next_random() % n;
+    for (guint i = 0; i < g_threads->len; i++) {
+        SchedThread *t = g_ptr_array_index(g_threads, i);
+
+        if (t->state != SCHED_OUTSIDE && !n--) {
+            return t;
+        }
+    }
+    g_assert_not_reached();
+}
+
+static bool any_runnable_locked(void)
+{
+    for (guint i = 0; i < g_threads->len; i++) {
+        SchedThread *t = g_ptr_array_index(g_threads, i);
+
+        if (t->state == SCHED_RUNNABLE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Give the turn to next and, unless self is NULL, wait for it to return */
+static void switch_locked(SchedThread *self, SchedThread *next)
+{
+    g_current = next;
+    if (next && next != self) {
+        g_cond_signal(&next->turn);
+    }
+    while (self && g_current != self) {
+        g_cond_wait(&self->turn, &g_lock);
+    }
+}
+
+void microhook_sched_init(uint64_t seed, uint64_t quantum)
+{
+    g_rng = seed;
+    g_quantum = quantum ? MIN(quantum, MICROHOOK_SCHED_QUANTUM_MAX)
+                        : MICROHOOK_SCHED_QUANTUM;
+    g_threads = g_ptr_array_new();
+    qatomic_set(&g_enabled, true);
+}
+
+void microhook_sched_add_thread(CPUState *cpu)
+{
+    SchedThread *t;
+
+    if (!qatomic_read(&g_enabled)) {
+        return;
+    }
+    t = g_new0(SchedThread, 1);
+    t->cpu = cpu;
+    t->state = SCHED_RUNNABLE;
+    g_cond_init(&t->turn);
+
+    g_mutex_lock(&g_lock);
+    g_ptr_array_add(g_threads, t);
+    if (!g_current) {
+        g_current = t;
+    }
+    g_mutex_unlock(&g_lock);
+    t_sched = t;
+}
+
+void microhook_sched_thread_begin(void)
+{
+    SchedThread *t = t_sched;
+
+    if (!t) {
+        return;
+    }
+    g_mutex_lock(&g_lock);
+    while (g_current != t) {
+        g_cond_wait(&t->turn, &g_lock);
+    }
+    g_idle = 0;
+    g_mutex_unlock(&g_lock);
+}
+
+void microhook_sched_thread_exit(void)
+{
+    SchedThread *t = t_sched;
+
+    if (!t) {
+        return;
+    }
+    g_mutex_lock(&g_lock);
+    g_ptr_array_remove(g_threads, t);
+    if (g_current == t) {
+        switch_locked(NULL, pick_locked());
+    }
+    g_mutex_unlock(&g_lock);
+
+    g_cond_clear(&t->turn);
+    g_free(t);
+    t_sched = NULL;
+}
+
+void microhook_sched_after_fork(void)
+{
+    SchedThread *self = t_sched;
+
+    if (!self) {
+        return;
+    }
+
+    /* The other threads do not exist here; their state may be torn */
+    g_mutex_init(&g_lock);
+    for (guint i = 0; i < g_threads->len; i++) {
+        SchedThread *t = g_ptr_array_index(g_threads, i);
+
+        if (t != self) {
+            g_free(t);
+        }
+    }
+    g_ptr_array_set_size(g_threads, 0);
+    g_ptr_array_add(g_threads, self);
+    g_cond_init(&self->turn);
+    self->state = SCHED_RUNNABLE;
+    g_current = self;
+    g_idle = 0;
+}
+
+/* Time slices */
+
+void microhook_sched_expired(CPUArchState *env)
+{
+    cpu_exit(env_cpu(env));
+}
+
+void microhook_sched_preempt(CPUArchState *env)
+{
+    CPUState *cpu = env_cpu(env);
+    SchedThread *t = t_sched;
+
+    if (!t || t->cpu != cpu || cpu->neg.sched_budget >= 0) {
+        return;
+    }
+    g_mutex_lock(&g_lock);
+    cpu->neg.sched_budget = next_slice();
+    switch_locked(t, pick_locked());
+    g_idle = 0;
+    g_mutex_unlock(&g_lock);
+}
+
+/* Syscalls */
+
+static int64_t now_us(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static void set_timeout_ms(SchedWait *w, int ms, int64_t ret)
+{
+    if (ms >= 0) {
+        w->timeout = true;
+        w->clock = CLOCK_MONOTONIC;
+        w->deadline = now_us(CLOCK_MONOTONIC) + (int64_t)ms * 1000;
+        w->timeout_ret = ret;
+    }
+}
+
+/*
+ * Read the guest timespec at addr into a deadline, relative to now unless
+ * absolute. Returns false if it cannot be read.
+ */
+static bool set_timeout_ts(SchedWait *w, abi_ulong addr, bool time64,
+                           bool absolute, clockid_t clock, int64_t ret)
+{
+    int64_t sec, nsec;
+
+    if (time64) {
+        struct target__kernel_timespec *ts;
+
+        if (!lock_user_struct(VERIFY_READ, ts, addr, 1)) {
+            return false;
+        }
+        __get_user(sec, &ts->tv_sec);
+        __get_user(nsec, &ts->tv_nsec);
+        unlock_user_struct(ts, addr, 0);
+    } else {
+        struct target_timespec *ts;
+
+        if (!lock_user_struct(VERIFY_READ, ts, addr, 1)) {
+            return false;
+        }
+        __get_user(sec, &ts->tv_sec);
+        __get_user(nsec, &ts->tv_nsec);
+        unlock_user_struct(ts, addr, 0);
+    }
+    w->timeout = true;
+    w->clock = clock;
+    w->deadline = sec * G_USEC_PER_SEC + nsec / 1000 +
+                  (absolute ? 0 : now_us(clock));
+    w->timeout_ret = ret;
+    return true;
+}
+
+/* Whether fd is ready for events; w keeps it to check again */
+static bool fd_ready(SchedWait *w, int fd, short events)
+{
+    w->fd = (struct pollfd) { .fd = fd, .events = events };
+    w->fds = &w->fd;
+    w->nfds = 1;
+    return poll(w->fds, 1, 0) != 0;
+}
+
+/* Whether reading or writing fd would block, as opposed to fail */
+static bool fd_would_block(SchedWait *w, int fd, short events)
+{
+    int fl;
+
+    if (fd_ready(w, fd, events)) {
+        return false;
+    }
+    fl = fcntl(fd, F_GETFL);
+    return fl >= 0 && !(fl & O_NONBLOCK);
+}
+
+/* Whether a poll() on the guest's pollfd array would block */
+static bool poll_would_block(SchedWait *w, abi_ulong addr, abi_ulong nfds)
+{
+    struct target_pollfd *target_pfd;
+
+    if (!nfds || nfds > SCHED_MAX_POLL) {
+        return false;
+    }
+    target_pfd = lock_user(VERIFY_READ, addr,
+                           sizeof(struct target_pollfd) * nfds, 1);
+    if (!target_pfd) {
+        return false;
+    }
+    w->fds = g_new(struct pollfd, nfds);
+    w->nfds = nfds;
+    for (abi_ulong i = 0; i < nfds; i++) {
+        w->fds[i].fd = tswap32(target_pfd[i].fd);
+        w->fds[i].events = tswap16(target_pfd[i].events);
+    }
+    unlock_user(target_pfd, addr, 0);
+    return poll(w->fds, w->nfds, 0) == 0;
+}
+
+/* Mark up to n threads waiting on the futex at addr as woken */
+static int64_t futex_wake_locked(abi_ulong addr, int64_t n, uint32_t bitset)
+{
+    int64_t woken = 0;
+
+    for (guint i = 0; i < g_threads->len && woken < n; i++) {
+        SchedThread *t = g_ptr_array_index(g_threads, i);
+
+        if (t->state == SCHED_WAITING && t->futex_addr == addr &&
+            !t->futex_woken && (t->futex_bitset & bitset)) {
+            t->futex_woken = true;
+            woken++;
+        }
+    }
+    return woken;
+}
+
+/*
+ * Whether a futex() call would block. Wakes are recorded for the threads
+ * waiting here; the others are woken by the host futex as usual.
+ */
+static bool futex_would_block(SchedWait *w, bool time64, abi_ulong uaddr,
+                              int op, uint32_t val, abi_ulong timeout,
+                              abi_ulong uaddr2, uint32_t val3)
+{
+    uint32_t cur;
+
+    switch (op & FUTEX_CMD_MASK) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET:
+        if ((op & FUTEX_CMD_MASK) == FUTEX_WAIT_BITSET && !val3) {
+            return false;
+        }
+        if (get_user_u32(cur, uaddr) || cur != val) {
+            return false;
+        }
+        w->futex = true;
+        w->futex_addr = uaddr;
+        w->futex_val = val;
+        t_sched->futex_addr = uaddr;
+        t_sched->futex_bitset = (op & FUTEX_CMD_MASK) == FUTEX_WAIT ?
+                                FUTEX_BITSET_MATCH_ANY : val3;
+        t_sched->futex_woken = false;
+        if (timeout &&
+            !set_timeout_ts(w, timeout, time64,
+                            (op & FUTEX_CMD_MASK) == FUTEX_WAIT_BITSET,
+                            op & FUTEX_CLOCK_REALTIME ? CLOCK_REALTIME
+                                                      : CLOCK_MONOTONIC,
+                            -TARGET_ETIMEDOUT)) {
+            return false;
+        }
+        return true;
+    case FUTEX_WAKE:
+    case FUTEX_WAKE_BITSET:
+        g_mutex_lock(&g_lock);
+        t_woken = futex_wake_locked(uaddr, (int32_t)val,
+                                    (op & FUTEX_CMD_MASK) == FUTEX_WAKE ?
+                                    FUTEX_BITSET_MATCH_ANY : val3);
+        g_mutex_unlock(&g_lock);
+        return false;
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+    case FUTEX_WAKE_OP:
+        /* Waking every waiter is allowed: futex waits may end spuriously */
+        g_mutex_lock(&g_lock);
+        futex_wake_locked(uaddr, INT64_MAX, FUTEX_BITSET_MATCH_ANY);
+        futex_wake_locked(uaddr2, INT64_MAX, FUTEX_BITSET_MATCH_ANY);
+        g_mutex_unlock(&g_lock);
+        return false;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Whether writing len bytes to fd may block partway: a pipe or socket
+ * drains only as fast as the reader, which may be another guest thread.
+ * A pipe that polls writable takes up to PIPE_BUF bytes at once.
+ */
+static bool fd_may_stall(int fd, size_t len)
+{
+    struct stat st;
+    int fl = fcntl(fd, F_GETFL);
+
+    if (fl < 0 || (fl & O_NONBLOCK) || fstat(fd, &st) < 0) {
+        return false;
+    }
+    return S_ISSOCK(st.st_mode) || (S_ISFIFO(st.st_mode) && len > PIPE_BUF);
+}
+
+/* Whether opening pathname waits for the other end of a FIFO */
+static bool open_may_block(int dirfd, abi_ulong pathname, uint64_t flags)
+{
+    struct stat st;
+    char *p;
+    bool fifo;
+
+    if (flags & (TARGET_O_NONBLOCK | TARGET_O_PATH)) {
+        return false;
+    }
+    p = lock_user_string(pathname);
+    if (!p) {
+        return false;
+    }
+    fifo = fstatat(dirfd, path(p), &st, 0) == 0 && S_ISFIFO(st.st_mode);
+    unlock_user(p, pathname, 0);
+    return fifo;
+}
+
+/*
+ * Whether num is a syscall that runs unscheduled when it blocks: it waits
+ * for something outside the program, or it may block after it started,
+ * where retrying it once it could start would not help.
+ */
+static bool syscall_outside(int num, int64_t arg1, int64_t arg2,
+                            int64_t arg3, int64_t arg4)
+{
+    uint64_t how_flags;
+
+    switch (num) {
+#ifdef TARGET_NR_futex
+    case TARGET_NR_futex:
+#endif
+#ifdef TARGET_NR_futex_time64
+    case TARGET_NR_futex_time64:
+#endif
+        switch (arg2 & FUTEX_CMD_MASK) {
+        case FUTEX_LOCK_PI:
+        case FUTEX_LOCK_PI2:
+        case FUTEX_WAIT_REQUEUE_PI:
+            return true;
+        }
+        return false;
+#ifdef TARGET_NR_select
+    case TARGET_NR_select:
+#endif
+#ifdef TARGET_NR__newselect
+    case TARGET_NR__newselect:
+#endif
+#ifdef TARGET_NR_pselect6
+    case TARGET_NR_pselect6:
+#endif
+#ifdef TARGET_NR_pselect6_time64
+    case TARGET_NR_pselect6_time64:
+#endif
+#ifdef TARGET_NR_nanosleep
+    case TARGET_NR_nanosleep:
+#endif
+#ifdef TARGET_NR_clock_nanosleep
+    case TARGET_NR_clock_nanosleep:
+#endif
+#ifdef TARGET_NR_clock_nanosleep_time64
+    case TARGET_NR_clock_nanosleep_time64:
+#endif
+#ifdef TARGET_NR_pause
+    case TARGET_NR_pause:
+#endif
+#ifdef TARGET_NR_sigsuspend
+    case TARGET_NR_sigsuspend:
+#endif
+#ifdef TARGET_NR_rt_sigsuspend
+    case TARGET_NR_rt_sigsuspend:
+#endif
+#ifdef TARGET_NR_rt_sigtimedwait
+    case TARGET_NR_rt_sigtimedwait:
+#endif
+#ifdef TARGET_NR_rt_sigtimedwait_time64
+    case TARGET_NR_rt_sigtimedwait_time64:
+#endif
+#ifdef TARGET_NR_wait4
+    case TARGET_NR_wait4:
+#endif
+#ifdef TARGET_NR_waitpid
+    case TARGET_NR_waitpid:
+#endif
+#ifdef TARGET_NR_waitid
+    case TARGET_NR_waitid:
+#endif
+#ifdef TARGET_NR_connect
+    case TARGET_NR_connect:
+#endif
+#ifdef TARGET_NR_socketcall
+    case TARGET_NR_socketcall:
+#endif
+#ifdef TARGET_NR_ipc
+    case TARGET_NR_ipc:
+#endif
+#ifdef TARGET_NR_msgrcv
+    case TARGET_NR_msgrcv:
+#endif
+#ifdef TARGET_NR_semop
+    case TARGET_NR_semop:
+#endif
+#ifdef TARGET_NR_semtimedop
+    case TARGET_NR_semtimedop:
+#endif
+#ifdef TARGET_NR_semtimedop_time64
+    case TARGET_NR_semtimedop_time64:
+#endif
+#ifdef TARGET_NR_mq_timedreceive
+    case TARGET_NR_mq_timedreceive:
+#endif
+#ifdef TARGET_NR_mq_timedreceive_time64
+    case TARGET_NR_mq_timedreceive_time64:
+#endif
+#ifdef TARGET_NR_flock
+    case TARGET_NR_flock:
+#endif
+#ifdef TARGET_NR_msgsnd
+    case TARGET_NR_msgsnd:
+#endif
+#ifdef TARGET_NR_mq_timedsend
+    case TARGET_NR_mq_timedsend:
+#endif
+#ifdef TARGET_NR_mq_timedsend_time64
+    case TARGET_NR_mq_timedsend_time64:
+#endif
+#ifdef TARGET_NR_splice
+    case TARGET_NR_splice:
+#endif
+#ifdef TARGET_NR_tee
+    case TARGET_NR_tee:
+#endif
+#ifdef TARGET_NR_vmsplice
+    case TARGET_NR_vmsplice:
+#endif
+#ifdef TARGET_NR_sendfile
+    case TARGET_NR_sendfile:
+#endif
+#ifdef TARGET_NR_sendfile64
+    case TARGET_NR_sendfile64:
+#endif
+#ifdef TARGET_NR_copy_file_range
+    case TARGET_NR_copy_file_range:
+#endif
+        return true;
+#ifdef TARGET_NR_fcntl
+    case TARGET_NR_fcntl:
+#endif
+#ifdef TARGET_NR_fcntl64
+    case TARGET_NR_fcntl64:
+#endif
+        /* A lock held by another thread through its own open file */
+        return arg2 == TARGET_F_SETLKW || arg2 == TARGET_F_SETLKW64 ||
+               arg2 == TARGET_F_OFD_SETLKW;
+#ifdef TARGET_NR_open
+    case TARGET_NR_open:
+        return open_may_block(AT_FDCWD, arg1, arg2);
+#endif
+#ifdef TARGET_NR_creat
+    case TARGET_NR_creat:
+        return open_may_block(AT_FDCWD, arg1, TARGET_O_WRONLY);
+#endif
+    case TARGET_NR_openat:
+        return open_may_block(arg1, arg2, arg3);
+    case TARGET_NR_openat2:
+        return !get_user_u64(how_flags, arg3) &&
+               open_may_block(arg1, arg2, how_flags);
+
+    /* Writes complete in pieces as the reader takes the data */
+    case TARGET_NR_write:
+        return fd_may_stall(arg1, (abi_ulong)arg3);
+    case TARGET_NR_writev:
+        return fd_may_stall(arg1, SIZE_MAX);
+#ifdef TARGET_NR_send
+    case TARGET_NR_send:
+#endif
+#ifdef TARGET_NR_sendto
+    case TARGET_NR_sendto:
+#endif
+#ifdef TARGET_NR_sendmmsg
+    case TARGET_NR_sendmmsg:
+#endif
+        return !(arg4 & MSG_DONTWAIT) && fd_may_stall(arg1, SIZE_MAX);
+#ifdef TARGET_NR_sendmsg
+    case TARGET_NR_sendmsg:
+        return !(arg3 & MSG_DONTWAIT) && fd_may_stall(arg1, SIZE_MAX);
+#endif
+
+    /* Reads that wait for more than the first data */
+#ifdef TARGET_NR_recv
+    case TARGET_NR_recv:
+#endif
+#ifdef TARGET_NR_recvfrom
+    case TARGET_NR_recvfrom:
+#endif
+        return (arg4 & (MSG_WAITALL | MSG_DONTWAIT)) == MSG_WAITALL;
+#ifdef TARGET_NR_recvmsg
+    case TARGET_NR_recvmsg:
+        return (arg3 & (MSG_WAITALL | MSG_DONTWAIT)) == MSG_WAITALL;
+#endif
+#ifdef TARGET_NR_recvmmsg
+    case TARGET_NR_recvmmsg:
+        return !(arg4 & MSG_DONTWAIT) &&
+               ((arg4 & MSG_WAITALL) ||
+                ((abi_uint)arg3 > 1 && !(arg4 & MSG_WAITFORONE)));
+#endif
+    default:
+        return false;
+    }
+}
+
+/* Whether the syscall would block; if so, w says what it waits for */
+static bool syscall_would_block(SchedWait *w, int num, int64_t arg1,
+                                int64_t arg2, int64_t arg3, int64_t arg4,
+                                int64_t arg5, int64_t arg6)
+{
+    switch (num) {
+#ifdef TARGET_NR_futex
+    case TARGET_NR_futex:
+        return futex_would_block(w, false, arg1, arg2, arg3, arg4, arg5,
+                                 arg6);
+#endif
+#ifdef TARGET_NR_futex_time64
+    case TARGET_NR_futex_time64:
+        return futex_would_block(w, true, arg1, arg2, arg3, arg4, arg5,
+                                 arg6);
+#endif
+    case TARGET_NR_read:
+    case TARGET_NR_readv:
+#ifdef TARGET_NR_accept
+    case TARGET_NR_accept:
+#endif
+#ifdef TARGET_NR_accept4
+    case TARGET_NR_accept4:
+#endif
+        return fd_would_block(w, arg1, POLLIN);
+#ifdef TARGET_NR_recv
+    case TARGET_NR_recv:
+#endif
+#ifdef TARGET_NR_recvfrom
+    case TARGET_NR_recvfrom:
+#endif
+#ifdef TARGET_NR_recvmmsg
+    case TARGET_NR_recvmmsg:
+#endif
+        return !(arg4 & MSG_DONTWAIT) && fd_would_block(w, arg1, POLLIN);
+#ifdef TARGET_NR_recvmsg
+    case TARGET_NR_recvmsg:
+        return !(arg3 & MSG_DONTWAIT) && fd_would_block(w, arg1, POLLIN);
+#endif
+    case TARGET_NR_write:
+    case TARGET_NR_writev:
+        return fd_would_block(w, arg1, POLLOUT);
+#ifdef TARGET_NR_send
+    case TARGET_NR_send:
+#endif
+#ifdef TARGET_NR_sendto
+    case TARGET_NR_sendto:
+#endif
+        return !(arg4 & MSG_DONTWAIT) && fd_would_block(w, arg1, POLLOUT);
+#ifdef TARGET_NR_sendmsg
+    case TARGET_NR_sendmsg:
+        return !(arg3 & MSG_DONTWAIT) && fd_would_block(w, arg1, POLLOUT);
+#endif
+#ifdef TARGET_NR_poll
+    case TARGET_NR_poll:
+        if (!(int)arg3) {
+            return false;
+        }
+        set_timeout_ms(w, arg3, 0);
+        return poll_would_block(w, arg1, arg2);
+#endif
+#ifdef TARGET_NR_ppoll
+    case TARGET_NR_ppoll:
+        if (arg3 && !set_timeout_ts(w, arg3, false, false,
+                                    CLOCK_MONOTONIC, 0)) {
+            return false;
+        }
+        return (!w->timeout || w->deadline > now_us(CLOCK_MONOTONIC)) &&
+               poll_would_block(w, arg1, arg2);
+#endif
+#ifdef TARGET_NR_ppoll_time64
+    case TARGET_NR_ppoll_time64:
+        if (arg3 && !set_timeout_ts(w, arg3, true, false,
+                                    CLOCK_MONOTONIC, 0)) {
+            return false;
+        }
+        return (!w->timeout || w->deadline > now_us(CLOCK_MONOTONIC)) &&
+               poll_would_block(w, arg1, arg2);
+#endif
+#ifdef TARGET_NR_epoll_wait
+    case TARGET_NR_epoll_wait:
+#endif
+#ifdef TARGET_NR_epoll_pwait
+    case TARGET_NR_epoll_pwait:
+#endif
+#if defined(TARGET_NR_epoll_wait) || defined(TARGET_NR_epoll_pwait)
+        if (!(int)arg4) {
+            return false;
+        }
+        set_timeout_ms(w, arg4, 0);
+        return !fd_ready(w, arg1, POLLIN);
+#endif
+    default:
+        return false;
+    }
+}
+
+/*
+ * Wait for the syscall to be ready, letting the other threads run. Returns
+ * true with the result in *ret if it must not run after all.
+ */
+static bool wait_locked(SchedThread *t, SchedWait *w, int64_t *ret)
+{
+    TaskState *ts = get_task_state(t->cpu);
+    bool done;
+
+    t->state = SCHED_WAITING;
+    for (;;) {
+        switch_locked(t, pick_locked());
+
+        if (w->futex) {
+            uint32_t cur;
+
+            /* A wake or a new value both end the wait */
+            if (t->futex_woken ||
+                get_user_u32(cur, w->futex_addr) || cur != w->futex_val) {
+                *ret = 0;
+                done = true;
+                break;
+            }
+        } else if (poll(w->fds, w->nfds, 0) != 0) {
+            done = false;
+            break;
+        }
+        if (qatomic_read(&ts->signal_pending)) {
+            *ret = -QEMU_ERESTARTSYS;
+            done = true;
+            break;
+        }
+        if (w->timeout && now_us(w->clock) >= w->deadline) {
+            *ret = w->timeout_ret;
+            done = true;
+            break;
+        }
+
+        /* Nothing in the process can make progress: wait for the outside */
+        if (++g_idle > g_threads->len && !any_runnable_locked()) {
+            g_mutex_unlock(&g_lock);
+            g_usleep(SCHED_IDLE_US);
+            g_mutex_lock(&g_lock);
+        }
+    }
+    t->state = SCHED_RUNNABLE;
+    t->futex_addr = 0;
+    g_idle = 0;
+    return done;
+}
+
+bool microhook_sched_syscall(CPUArchState *env, int num, int64_t arg1,
+                             int64_t arg2, int64_t arg3, int64_t arg4,
+                             int64_t arg5, int64_t arg6, int64_t *ret)
+{
+    SchedThread *t = t_sched;
+    SchedWait w = { 0 };
+    bool done = false;
+
+    t_woken = 0;
+    t_outside = false;
+    if (!t || t->cpu != env_cpu(env) || in_vfork_child()) {
+        return false;
+    }
+
+    if (num == TARGET_NR_sched_yield) {
+        g_mutex_lock(&g_lock);
+        env_cpu(env)->neg.sched_budget = next_slice();
+        switch_locked(t, pick_locked());
+        g_idle = 0;
+        g_mutex_unlock(&g_lock);
+        *ret = 0;
+        return true;
+    }
+
+    if (syscall_outside(num, arg1, arg2, arg3, arg4)) {
+        g_mutex_lock(&g_lock);
+        t->state = SCHED_OUTSIDE;
+        t_outside = true;
+        switch_locked(NULL, pick_locked());
+        g_mutex_unlock(&g_lock);
+        return false;
+    }
+
+    if (syscall_would_block(&w, num, arg1, arg2, arg3, arg4, arg5, arg6)) {
+        g_mutex_lock(&g_lock);
+        done = wait_locked(t, &w, ret);
+        g_mutex_unlock(&g_lock);
+    }
+    if (w.fds != &w.fd) {
+        g_free(w.fds);
+    }
+    return done;
+}
+
+int64_t microhook_sched_syscall_done(CPUArchState *env, int num,
+                                     int64_t ret)
+{
+    SchedThread *t = t_sched;
+
+    if (t_outside) {
+        /* Back in line; take the turn if nobody has it */
+        g_mutex_lock(&g_lock);
+        t->state = SCHED_RUNNABLE;
+        if (!g_current) {
+            g_current = t;
+        }
+        while (g_current != t) {
+            g_cond_wait(&t->turn, &g_lock);
+        }
+        g_idle = 0;
+        g_mutex_unlock(&g_lock);
+        t_outside = false;
+    }
+    if (t_woken && ret >= 0) {
+        ret += t_woken;
+    }
+    t_woken = 0;
+    return ret;
+}
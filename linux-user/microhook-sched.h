@@ -0,0 +1,81 @@
+/*
+ * Microhook Sched - deterministic thread scheduling for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_SCHED_H
+#define MICROHOOK_SCHED_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Average number of blocks a thread runs before the next switch */
+#define MICROHOOK_SCHED_QUANTUM     10000
+/* Largest quantum; a time slice, up to twice the quantum, is an int32_t */
+#define MICROHOOK_SCHED_QUANTUM_MAX (INT32_MAX / 2)
+
+/*
+ * Run one guest thread at a time, switching every quantum blocks on
+ * average and when a thread would block in a syscall. The thread to run
+ * next and the length of each time slice are drawn from seed. Must be
+ * called before the main thread is added.
+ */
+void microhook_sched_init(uint64_t seed, uint64_t quantum);
+
+/* Whether threads are scheduled. Lock-free. */
+bool microhook_sched_enabled(void);
+
+/*
+ * Add the calling thread, running cpu. The first thread added runs
+ * right away; the others are added by clone() in the new thread before
+ * the parent continues, and wait for their turn in
+ * microhook_sched_thread_begin().
+ */
+void microhook_sched_add_thread(CPUState *cpu);
+
+/* Wait until the new calling thread is scheduled for the first time */
+void microhook_sched_thread_begin(void);
+
+/* Remove the exiting calling thread and pass on its turn */
+void microhook_sched_thread_exit(void);
+
+/* Keep only the calling thread in a forked child */
+void microhook_sched_after_fork(void);
+
+/*
+ * Called by generated code when the time slice of env's thread ran out.
+ * Makes the thread leave the cpu loop at the next block.
+ */
+void microhook_sched_expired(CPUArchState *env);
+
+/*
+ * Switch threads if the calling thread's time slice ran out. Called from
+ * the cpu loop, outside of generated code.
+ */
+void microhook_sched_preempt(CPUArchState *env);
+
+/*
+ * Called before a syscall runs. If it would block, let other threads run
+ * until it can complete. Returns true with the result in *ret if the
+ * syscall must not run: a futex wait that was woken or any wait that
+ * timed out or was interrupted.
+ */
+bool microhook_sched_syscall(CPUArchState *env, int num, int64_t arg1,
+                             int64_t arg2, int64_t arg3, int64_t arg4,
+                             int64_t arg5, int64_t arg6, int64_t *ret);
+
+/*
+ * Called after a syscall ran. Returns its result, adjusted for the
+ * threads a futex wake woke in the scheduler.
+ */
+int64_t microhook_sched_syscall_done(CPUArchState *env, int num,
+                                     int64_t ret);
+
+#endif /* MICROHOOK_SCHED_H */
@@ -0,0 +1,336 @@
+/*
+ * Microhook SMC - adaptive self-modifying code handling for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Code pages are normally write-protected, and every guest write to one
+ * faults, invalidates all blocks on the page and makes it writable until
+ * code is translated from it again. Unpackers and JITs that alternate
+ * between writing and executing a page pay for that on every iteration.
+ *
+ * Pages that take many write faults in a short time become write-hot: they
+ * stay writable, and blocks translated from them compare their guest bytes
+ * against a copy taken at translation time on every entry. Once no block
+ * has seen a modification for a while, the page is cooled down: its blocks
+ * are invalidated and the retranslated code protects the page again.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
+#include "accel/tcg/getpc.h"
+#include "exec/cpu-common.h"
+#include "exec/mmap-lock.h"
+#include "exec/target_page.h"
+#include "exec/translation-block.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "microhook-smc.h"
+#include <glib.h>
+
+/* Write faults within SMC_HOT_WINDOW_NS that make a page write-hot */
+#define SMC_HOT_FAULTS      32
+#define SMC_HOT_WINDOW_NS   (NANOSECONDS_PER_SECOND / 10)
+
+/* Time without modifications after which a write-hot page is cooled down */
+#define SMC_COOL_NS         NANOSECONDS_PER_SECOND
+
+/* Clean entries of a block between two cool-down checks */
+#define SMC_COOL_PERIOD     4096
+
+/* Write faults waiting to be accounted, see microhook_smc_write_fault() */
+#define SMC_PENDING_FAULTS  256
+
+typedef struct {
+    uint64_t page;
+    unsigned faults;            /* Write faults in the current window */
+    int64_t window_start;
+    bool hot;
+    int64_t last_change;        /* Last modification seen while hot */
+} SmcPage;
+
+/*
+ * Run-time check of one block. Generated code holds a pointer to the site,
+ * so sites are never freed; retranslating a block with the same start,
+ * size and flags refreshes the copy in place, which keeps memory bounded
+ * by the number of distinct blocks.
+ */
+typedef struct {
+    uint64_t pc;
+    uint32_t size;
+    uint32_t flags;             /* TB flags the block was translated with */
+    unsigned clean;             /* Entries since the last cool-down check */
+    uint8_t bytes[];
+} SmcSite;
+
+typedef struct {
+    uint64_t page;
+    int64_t time;
+} SmcFault;
+
+static GHashTable *g_pages = NULL;      /* page -> SmcPage */
+static GHashTable *g_sites = NULL;      /* (pc, size, flags) -> SmcSite */
+static bool g_enabled = false;
+static GMutex g_lock;
+
+/* Faults not accounted yet. Protected by the mmap lock. */
+static SmcFault g_faults[SMC_PENDING_FAULTS];
+static unsigned g_nb_faults;
+
+static uint64_t smc_page_size(void)
+{
+    return MAX(qemu_real_host_page_size(), TARGET_PAGE_SIZE);
+}
+
+/* Pages are tracked at the granularity tb_lock_page0() protects them */
+static uint64_t smc_page(uint64_t addr)
+{
+    return addr & -smc_page_size();
+}
+
+static guint site_hash(gconstpointer key)
+{
+    const SmcSite *site = key;
+
+    return g_int64_hash(&site->pc) ^ site->size ^ site->flags;
+}
+
+static gboolean site_equal(gconstpointer a, gconstpointer b)
+{
+    const SmcSite *sa = a;
+    const SmcSite *sb = b;
+
+    return sa->pc == sb->pc && sa->size == sb->size &&
+           sa->flags == sb->flags;
+}
+
+/* Must be called with g_lock held */
+static SmcPage *lookup_page_locked(uint64_t addr)
+{
+    uint64_t page = smc_page(addr);
+
+    return g_pages ? g_hash_table_lookup(g_pages, &page) : NULL;
+}
+
+/* Must be called with g_lock held */
+static bool page_hot_locked(uint64_t addr)
+{
+    SmcPage *p = lookup_page_locked(addr);
+
+    return p && p->hot;
+}
+
+/* Must be called with g_lock held */
+static void account_fault_locked(uint64_t page, int64_t now)
+{
+    SmcPage *p = lookup_page_locked(page);
+
+    if (!p) {
+        p = g_new0(SmcPage, 1);
+        p->page = smc_page(page);
+        p->window_start = now;
+        g_hash_table_insert(g_pages, &p->page, p);
+    }
+
+    if (now - p->window_start > SMC_HOT_WINDOW_NS) {
+        p->window_start = now;
+        p->faults = 0;
+    }
+    if (++p->faults >= SMC_HOT_FAULTS && !p->hot) {
+        p->hot = true;
+        p->last_change = now;
+    }
+}
+
+/*
+ * Account the faults recorded since the last call. Must be called with
+ * the mmap lock and g_lock held.
+ */
+static void drain_faults_locked(void)
+{
+    for (unsigned i = 0; i < g_nb_faults; i++) {
+        account_fault_locked(g_faults[i].page, g_faults[i].time);
+    }
+    g_nb_faults = 0;
+}
+
+void microhook_smc_enable(void)
+{
+    g_mutex_lock(&g_lock);
+    if (!g_pages) {
+        g_pages = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                        NULL, g_free);
+        g_sites = g_hash_table_new(site_hash, site_equal);
+    }
+    qatomic_set(&g_enabled, true);
+    g_mutex_unlock(&g_lock);
+}
+
+bool microhook_smc_enabled(void)
+{
+    return qatomic_read(&g_enabled);
+}
+
+void microhook_smc_write_fault(uint64_t page)
+{
+    /*
+     * This runs in a signal handler: only note the fault, and leave the
+     * allocations to the next translation, which is the first to look at
+     * the page again. A fault that does not fit is not counted.
+     */
+    if (g_nb_faults < SMC_PENDING_FAULTS) {
+        g_faults[g_nb_faults].page = page;
+        g_faults[g_nb_faults].time = get_clock();
+        g_nb_faults++;
+    }
+}
+
+bool microhook_smc_page_hot(uint64_t addr)
+{
+    bool hot;
+
+    if (!microhook_smc_enabled()) {
+        return false;
+    }
+
+    g_mutex_lock(&g_lock);
+    drain_faults_locked();
+    hot = page_hot_locked(addr);
+    g_mutex_unlock(&g_lock);
+
+    return hot;
+}
+
+void *microhook_smc_translate(uint64_t pc, uint32_t size, uint32_t flags)
+{
+    SmcSite key = { .pc = pc, .size = size, .flags = flags };
+    SmcSite *site = NULL;
+
+    if (!microhook_smc_enabled()) {
+        return NULL;
+    }
+
+    g_mutex_lock(&g_lock);
+    drain_faults_locked();
+
+    if (!page_hot_locked(pc) && !page_hot_locked(pc + MAX(size, 1) - 1)) {
+        goto out;
+    }
+
+    site = g_hash_table_lookup(g_sites, &key);
+    if (!site) {
+        site = g_malloc0(sizeof(SmcSite) + size);
+        site->pc = pc;
+        site->size = size;
+        site->flags = flags;
+        g_hash_table_add(g_sites, site);
+    }
+
+    /*
+     * The translator has just read the same bytes. A concurrent write from
+     * another thread in between can slip past the check, exactly like any
+     * other unsynchronised cross-modification of code.
+     */
+    memcpy(site->bytes, g2h_untagged(pc), size);
+    qatomic_set(&site->clean, 0);
+
+out:
+    g_mutex_unlock(&g_lock);
+    return site;
+}
+
+/*
+ * Cool down the pages of a block if none of them saw a modification for
+ * SMC_COOL_NS. Must be called with g_lock held.
+ */
+static bool cool_down_locked(SmcSite *site)
+{
+    uint64_t first = smc_page(site->pc);
+    uint64_t last = smc_page(site->pc + MAX(site->size, 1) - 1);
+    int64_t now = get_clock();
+    SmcPage *p;
+
+    for (uint64_t page = first; page <= last; page += smc_page_size()) {
+        p = lookup_page_locked(page);
+        if (p && p->hot && now - p->last_change < SMC_COOL_NS) {
+            return false;
+        }
+    }
+    for (uint64_t page = first; page <= last; page += smc_page_size()) {
+        p = lookup_page_locked(page);
+        if (p) {
+            p->hot = false;
+            p->faults = 0;
+        }
+    }
+    return true;
+}
+
+/* Must be called with g_lock held */
+static void note_change_locked(SmcSite *site)
+{
+    uint64_t first = smc_page(site->pc);
+    uint64_t last = smc_page(site->pc + MAX(site->size, 1) - 1);
+    int64_t now = get_clock();
+    SmcPage *p;
+
+    for (uint64_t page = first; page <= last; page += smc_page_size()) {
+        p = lookup_page_locked(page);
+        if (p) {
+            p->last_change = now;
+        }
+    }
+}
+
+void microhook_smc_check(void *opaque)
+{
+    SmcSite *site = opaque;
+    uintptr_t ra = GETPC();
+    CPUState *cpu = thread_cpu;
+    uint64_t start = 0, last = 0;
+    bool modified, retranslate = false;
+
+    modified = memcmp(g2h_untagged(site->pc), site->bytes, site->size) != 0;
+    if (likely(!modified)) {
+        /* Racy across threads, which only shifts the next check */
+        unsigned clean = qatomic_read(&site->clean) + 1;
+
+        qatomic_set(&site->clean, clean);
+        if (likely(clean % SMC_COOL_PERIOD)) {
+            return;
+        }
+    }
+
+    mmap_lock();
+    g_mutex_lock(&g_lock);
+    if (modified) {
+        /* Only this block is known to be stale */
+        note_change_locked(site);
+        start = site->pc;
+        last = site->pc + MAX(site->size, 1) - 1;
+        retranslate = true;
+    } else if (cool_down_locked(site)) {
+        /* Drop every checked block so the pages get protected again */
+        start = smc_page(site->pc);
+        last = smc_page(site->pc + MAX(site->size, 1) - 1)
+               + smc_page_size() - 1;
+        retranslate = true;
+    }
+    g_mutex_unlock(&g_lock);
+
+    if (retranslate) {
+        /* Nothing of the block has run yet: restart at its first insn */
+        cpu_restore_state(cpu, ra);
+        tb_invalidate_phys_range(cpu, start, last);
+    }
+    mmap_unlock();
+
+    if (retranslate) {
+        cpu_loop_exit_noexc(cpu);
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Microhook SMC - adaptive self-modifying code handling for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_SMC_H
+#define MICROHOOK_SMC_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Enable the adaptive policy. Must be called before the guest starts.
+ */
+void microhook_smc_enable(void);
+
+/*
+ * Check whether the adaptive policy is enabled. Lock-free.
+ */
+bool microhook_smc_enabled(void);
+
+/*
+ * Account a write fault on a page holding translated code.
+ * page: guest address of the (host page aligned) page being unprotected
+ *
+ * Called from page_unprotect() with the mmap lock held, possibly in a
+ * signal handler; the fault is only recorded there and accounted by the
+ * next call that asks about a page. A page that takes enough faults in a
+ * short time becomes write-hot.
+ */
+void microhook_smc_write_fault(uint64_t page);
+
+/*
+ * Check whether the page containing addr is write-hot. Write-hot pages are
+ * left writable when code is translated from them.
+ *
+ * Called with the mmap lock held.
+ */
+bool microhook_smc_page_hot(uint64_t addr);
+
+/*
+ * Match a block at translation time.
+ * pc: guest virtual address of the block start
+ * size: size of the block in bytes
+ * flags: TB flags the block is translated with
+ *
+ * Called from the translator with the mmap lock held. Returns an opaque
+ * site to pass to microhook_smc_check() from the generated code, or NULL
+ * if the block lies on write-protected pages only.
+ */
+void *microhook_smc_translate(uint64_t pc, uint32_t size, uint32_t flags);
+
+/*
+ * Run-time check, called from generated code at the start of a block on a
+ * write-hot page. If the guest bytes changed since translation, the block
+ * is invalidated and the cpu loop restarted at its first instruction.
+ */
+void microhook_smc_check(void *site);
+
+#endif /* MICROHOOK_SMC_H */
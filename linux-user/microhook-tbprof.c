@@ -0,0 +1,312 @@
+/*
+ * Microhook TB profile - translation cost profiling for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Every translation of a block is timed and its sizes at each stage are
+ * recorded: guest instructions, TCG ops as emitted by the frontend, TCG ops
+ * left after tcg_optimize() and host bytes. Blocks are identified by their
+ * start and TB flags, so a block translated again after a flush, an
+ * invalidation or an exit from a partially executed block accumulates in
+ * the same record. The report ranks blocks by their total translation time
+ * and, if executions are counted, by executions times host size.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/target-info.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "microhook-modules.h"
+#include "microhook-tbprof.h"
+#include <glib.h>
+
+/* Blocks listed by execution cost in the report */
+#define TBPROF_TOP_EXEC     100
+
+/*
+ * Profile of one block. Generated code increments executions directly, so
+ * records are never freed.
+ */
+typedef struct {
+    uint64_t pc;
+    uint32_t flags;
+    uint64_t executions;
+    unsigned translations;
+    int64_t ns;                 /* Total translation time */
+    /* Sizes of the last translation */
+    int icount;
+    int ops;
+    int ops_opt;
+    int host_size;
+} TbProf;
+
+static GHashTable *g_blocks = NULL;     /* (pc, flags) -> TbProf */
+static char *g_path = NULL;
+static pid_t g_pid;
+static bool g_enabled = false;
+static bool g_exec = false;
+static GMutex g_lock;
+
+/* Sums over all translations, for the expansion ratios */
+static uint64_t g_translations;
+static uint64_t g_insns;
+static uint64_t g_ops;
+static uint64_t g_ops_opt;
+static uint64_t g_host_bytes;
+static int64_t g_ns;
+
+static guint block_hash(gconstpointer key)
+{
+    const TbProf *p = key;
+
+    return g_int64_hash(&p->pc) ^ p->flags;
+}
+
+static gboolean block_equal(gconstpointer a, gconstpointer b)
+{
+    const TbProf *pa = a;
+    const TbProf *pb = b;
+
+    return pa->pc == pb->pc && pa->flags == pb->flags;
+}
+
+/* Must be called with g_lock held */
+static TbProf *lookup_block_locked(uint64_t pc, uint32_t flags)
+{
+    TbProf key = { .pc = pc, .flags = flags };
+    TbProf *p = g_hash_table_lookup(g_blocks, &key);
+
+    if (!p) {
+        p = g_new0(TbProf, 1);
+        p->pc = pc;
+        p->flags = flags;
+        g_hash_table_add(g_blocks, p);
+    }
+    return p;
+}
+
+void microhook_tbprof_enable(const char *path, bool exec, pid_t pid)
+{
+    g_mutex_lock(&g_lock);
+    if (!g_blocks) {
+        g_blocks = g_hash_table_new(block_hash, block_equal);
+    }
+    g_free(g_path);
+    g_path = g_strdup(path);
+    g_pid = pid ? pid : getpid();
+    g_exec = exec;
+    qatomic_set(&g_enabled, true);
+    g_mutex_unlock(&g_lock);
+}
+
+char *microhook_tbprof_child_arg(void)
+{
+    return g_strdup_printf("%s%s,pid=%d", g_path, g_exec ? ",exec" : "",
+                           (int)g_pid);
+}
+
+bool microhook_tbprof_enabled(void)
+{
+    return qatomic_read(&g_enabled);
+}
+
+uint64_t *microhook_tbprof_translate(uint64_t pc, uint32_t flags)
+{
+    TbProf *p;
+
+    if (!g_exec) {
+        return NULL;
+    }
+    g_mutex_lock(&g_lock);
+    p = lookup_block_locked(pc, flags);
+    g_mutex_unlock(&g_lock);
+    return &p->executions;
+}
+
+void microhook_tbprof_record(uint64_t pc, uint32_t flags, int icount,
+                             int64_t ns, int ops, int ops_opt,
+                             int host_size)
+{
+    TbProf *p;
+
+    g_mutex_lock(&g_lock);
+    p = lookup_block_locked(pc, flags);
+    p->translations++;
+    p->ns += ns;
+    p->icount = icount;
+    p->ops = ops;
+    p->ops_opt = ops_opt;
+    p->host_size = host_size;
+
+    g_translations++;
+    g_insns += icount;
+    g_ops += ops;
+    g_ops_opt += ops_opt;
+    g_host_bytes += host_size;
+    g_ns += ns;
+    g_mutex_unlock(&g_lock);
+}
+
+static double ratio(uint64_t a, uint64_t b)
+{
+    return b ? (double)a / b : 0;
+}
+
+static uint64_t exec_cost(const TbProf *p)
+{
+    return qatomic_read(&p->executions) * p->host_size;
+}
+
+static gint cmp_translate(gconstpointer a, gconstpointer b)
+{
+    const TbProf *pa = *(const TbProf **)a;
+    const TbProf *pb = *(const TbProf **)b;
+
+    if (pa->ns != pb->ns) {
+        return pa->ns < pb->ns ? 1 : -1;
+    }
+    return pa->pc < pb->pc ? -1 : pa->pc > pb->pc;
+}
+
+static gint cmp_exec(gconstpointer a, gconstpointer b)
+{
+    uint64_t ca = exec_cost(*(const TbProf **)a);
+    uint64_t cb = exec_cost(*(const TbProf **)b);
+
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Write s as a JSON string */
+static void put_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void put_block(FILE *f, const TbProf *p)
+{
+    uint64_t offset;
+    const char *sym = microhook_modules_symbol(p->pc, &offset);
+
+    fprintf(f, "    {\"pc\": \"0x%" PRIx64 "\", \"flags\": \"0x%" PRIx32 "\"",
+            p->pc, p->flags);
+    if (sym) {
+        g_autofree char *name = g_strdup_printf("%s+0x%" PRIx64, sym, offset);
+
+        fprintf(f, ", \"symbol\": ");
+        put_string(f, name);
+    }
+    fprintf(f, ", \"translations\": %u, \"translate_ns\": %" PRId64
+            ", \"insns\": %d, \"ops\": %d, \"ops_opt\": %d"
+            ", \"host_size\": %d",
+            p->translations, p->ns, p->icount, p->ops, p->ops_opt,
+            p->host_size);
+    if (g_exec) {
+        fprintf(f, ", \"executions\": %" PRIu64 ", \"exec_cost\": %" PRIu64,
+                qatomic_read(&p->executions), exec_cost(p));
+    }
+    fprintf(f, "}");
+}
+
+static void put_blocks(FILE *f, const char *name, GPtrArray *blocks,
+                       guint n)
+{
+    fprintf(f, ",\n  \"%s\": [", name);
+    for (guint i = 0; i < n; i++) {
+        fputs(i ? ",\n" : "\n", f);
+        put_block(f, g_ptr_array_index(blocks, i));
+    }
+    fprintf(f, "\n  ]");
+}
+
+void microhook_tbprof_report(void)
+{
+    g_autoptr(GPtrArray) blocks = NULL;
+    g_autofree char *path = NULL;
+    GHashTableIter iter;
+    gpointer key;
+    FILE *f;
+
+    g_mutex_lock(&g_lock);
+
+    /*
+     * A forked child, or a program it exec'd, must not overwrite the
+     * report of the process that was started with -tb-profile
+     */
+    if (getpid() == g_pid) {
+        path = g_strdup(g_path);
+    } else {
+        path = g_strdup_printf("%s.%d", g_path, getpid());
+    }
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "microhook: cannot write TB profile %s: %s\n",
+                path, strerror(errno));
+        g_mutex_unlock(&g_lock);
+        return;
+    }
+
+    /* Skip blocks whose translation never finished */
+    blocks = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, g_blocks);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        TbProf *p = key;
+
+        if (p->translations) {
+            g_ptr_array_add(blocks, p);
+        }
+    }
+
+    fprintf(f, "{\n  \"target\": \"%s\",\n  \"exec_counts\": %s,\n",
+            target_name(), g_exec ? "true" : "false");
+    fprintf(f, "  \"summary\": {\n"
+            "    \"blocks\": %u,\n"
+            "    \"translations\": %" PRIu64 ",\n"
+            "    \"retranslations\": %" PRIu64 ",\n"
+            "    \"translate_ns\": %" PRId64 ",\n"
+            "    \"insns\": %" PRIu64 ",\n"
+            "    \"ops\": %" PRIu64 ",\n"
+            "    \"ops_opt\": %" PRIu64 ",\n"
+            "    \"host_bytes\": %" PRIu64 ",\n"
+            "    \"ops_per_insn\": %.3f,\n"
+            "    \"ops_opt_per_insn\": %.3f,\n"
+            "    \"opt_ratio\": %.3f,\n"
+            "    \"host_bytes_per_insn\": %.3f,\n"
+            "    \"host_bytes_per_op\": %.3f,\n"
+            "    \"ns_per_insn\": %.3f\n"
+            "  }",
+            blocks->len, g_translations, g_translations - blocks->len, g_ns,
+            g_insns, g_ops, g_ops_opt, g_host_bytes,
+            ratio(g_ops, g_insns), ratio(g_ops_opt, g_insns),
+            ratio(g_ops_opt, g_ops), ratio(g_host_bytes, g_insns),
+            ratio(g_host_bytes, g_ops_opt), ratio(g_ns, g_insns));
+
+    g_ptr_array_sort(blocks, cmp_translate);
+    put_blocks(f, "by_translation", blocks, blocks->len);
+    if (g_exec) {
+        g_ptr_array_sort(blocks, cmp_exec);
+        put_blocks(f, "by_execution", blocks,
+                   MIN(blocks->len, TBPROF_TOP_EXEC));
+    }
+    fprintf(f, "\n}\n");
+    fclose(f);
+
+    g_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,60 @@
+/*
+ * Microhook TB profile - translation cost profiling for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_TBPROF_H
+#define MICROHOOK_TBPROF_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Profile every translation and write the report to path when the guest
+ * exits. With exec, generated code also counts how often each block runs.
+ * Processes other than pid, or the caller if pid is 0, write to
+ * <path>.<pid> instead. Must be called before the first block is
+ * translated.
+ */
+void microhook_tbprof_enable(const char *path, bool exec, pid_t pid);
+
+/*
+ * Argument for -tb-profile that keeps a QEMU started by execve() in
+ * another process from writing the report to path.
+ */
+char *microhook_tbprof_child_arg(void);
+
+/*
+ * Check whether translations are profiled.
+ */
+bool microhook_tbprof_enabled(void);
+
+/*
+ * Return the execution counter of the block at (pc, flags) for the code
+ * being generated to increment, or NULL if executions are not counted.
+ * Called by the translator with mmap_lock held.
+ */
+uint64_t *microhook_tbprof_translate(uint64_t pc, uint32_t flags);
+
+/*
+ * Record one finished translation of the block at (pc, flags): the time it
+ * took in nanoseconds, including restarts, its guest instructions, its TCG
+ * ops before and after tcg_optimize() and the host bytes it occupies.
+ */
+void microhook_tbprof_record(uint64_t pc, uint32_t flags, int icount,
+                             int64_t ns, int ops, int ops_opt,
+                             int host_size);
+
+/*
+ * Write the report. Called when the guest exits with profiling enabled.
+ */
+void microhook_tbprof_report(void);
+
+#endif /* MICROHOOK_TBPROF_H */
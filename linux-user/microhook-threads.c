@@ -0,0 +1,146 @@
+/*
+ * Microhook Threads - registry of live guest threads for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * The registry is maintained from the clone/exit/fork paths independent
+ * of any hook script, so it is always accurate when a script asks for it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "microhook-threads.h"
+#include <glib.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+    int tid;
+    uint64_t start_pc;
+    clockid_t clock;        /* Per-thread CPU-time clock */
+    bool have_clock;
+} MicrohookThread;
+
+static GHashTable *g_threads = NULL;   /* tid -> MicrohookThread */
+static GMutex g_lock;
+
+/* Start PC of the calling thread, which survives fork() */
+static __thread uint64_t t_start_pc;
+
+static uint64_t thread_cpu_time(const MicrohookThread *t)
+{
+    struct timespec ts;
+
+    if (!t->have_clock || clock_gettime(t->clock, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Must be called with g_lock held */
+static void add_self_locked(uint64_t start_pc)
+{
+    MicrohookThread *t = g_new0(MicrohookThread, 1);
+
+    t->tid = qemu_get_thread_id();
+    t->start_pc = start_pc;
+    t_start_pc = start_pc;
+    t->have_clock = pthread_getcpuclockid(pthread_self(), &t->clock) == 0;
+
+    if (!g_threads) {
+        g_threads = g_hash_table_new_full(g_int_hash, g_int_equal,
+                                          NULL, g_free);
+    }
+    g_hash_table_replace(g_threads, &t->tid, t);
+}
+
+void microhook_threads_start(uint64_t start_pc)
+{
+    g_mutex_lock(&g_lock);
+    add_self_locked(start_pc);
+    g_mutex_unlock(&g_lock);
+}
+
+uint64_t microhook_threads_exit(void)
+{
+    int tid = qemu_get_thread_id();
+    MicrohookThread *t;
+    uint64_t cpu_time = 0;
+
+    g_mutex_lock(&g_lock);
+    t = g_threads ? g_hash_table_lookup(g_threads, &tid) : NULL;
+    if (t) {
+        cpu_time = thread_cpu_time(t);
+        g_hash_table_remove(g_threads, &tid);
+    }
+    g_mutex_unlock(&g_lock);
+
+    return cpu_time;
+}
+
+void microhook_threads_after_fork(void)
+{
+    /*
+     * Like fork_end() does for the other locks, re-initialise ours: it
+     * may have been held by another thread at fork time.
+     */
+    g_mutex_init(&g_lock);
+
+    if (g_threads) {
+        g_hash_table_remove_all(g_threads);
+    }
+    add_self_locked(t_start_pc);
+}
+
+bool microhook_threads_self(MicrohookThreadInfo *info)
+{
+    int tid = qemu_get_thread_id();
+    MicrohookThread *t;
+
+    g_mutex_lock(&g_lock);
+    t = g_threads ? g_hash_table_lookup(g_threads, &tid) : NULL;
+    if (t) {
+        info->tid = t->tid;
+        info->start_pc = t->start_pc;
+        info->cpu_time_ns = thread_cpu_time(t);
+    }
+    g_mutex_unlock(&g_lock);
+
+    return t != NULL;
+}
+
+static gint thread_info_cmp(gconstpointer a, gconstpointer b)
+{
+    const MicrohookThreadInfo *ta = a;
+    const MicrohookThreadInfo *tb = b;
+
+    return ta->tid - tb->tid;
+}
+
+GArray *microhook_threads_snapshot(void)
+{
+    GArray *threads = g_array_new(false, false, sizeof(MicrohookThreadInfo));
+    GHashTableIter iter;
+    MicrohookThread *t;
+
+    g_mutex_lock(&g_lock);
+    if (g_threads) {
+        g_hash_table_iter_init(&iter, g_threads);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&t)) {
+            MicrohookThreadInfo info = {
+                .tid = t->tid,
+                .start_pc = t->start_pc,
+                .cpu_time_ns = thread_cpu_time(t),
+            };
+            g_array_append_val(threads, info);
+        }
+    }
+    g_mutex_unlock(&g_lock);
+
+    g_array_sort(threads, thread_info_cmp);
+    return threads;
+}
@@ -0,0 +1,59 @@
+/*
+ * Microhook Threads - registry of live guest threads for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_THREADS_H
+#define MICROHOOK_THREADS_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A live guest thread
+ */
+typedef struct MicrohookThreadInfo {
+    int tid;                /* Host thread id, as seen by the guest */
+    uint64_t start_pc;      /* Guest PC the thread started executing at */
+    uint64_t cpu_time_ns;   /* CPU time consumed so far */
+} MicrohookThreadInfo;
+
+/*
+ * Register the calling thread.
+ * start_pc: guest PC the thread starts at
+ *
+ * Called for the main thread before it enters the cpu loop and from each
+ * new thread created by clone().
+ */
+void microhook_threads_start(uint64_t start_pc);
+
+/*
+ * Remove the calling thread from the registry.
+ * Returns the CPU time the thread consumed, in nanoseconds.
+ */
+uint64_t microhook_threads_exit(void);
+
+/*
+ * Reset the registry in a forked child, which only has the calling thread.
+ */
+void microhook_threads_after_fork(void);
+
+/*
+ * Look up the calling thread. Returns false if it is not registered.
+ */
+bool microhook_threads_self(MicrohookThreadInfo *info);
+
+/*
+ * Return all live threads as a GArray of MicrohookThreadInfo, sorted
+ * by tid.
+ */
+GArray *microhook_threads_snapshot(void);
+
+#endif /* MICROHOOK_THREADS_H */
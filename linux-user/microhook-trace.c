@@ -0,0 +1,552 @@
+/*
+ * Microhook Trace - compressed execution trace for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * Every block starts with a few inline ops that append its id to a buffer
+ * owned by the running thread, and with -exec-trace file,mem every guest
+ * load and store appends its address the same way. Nothing is formatted
+ * while the guest runs: blocks are described once, when translated, in a
+ * block table that the decoder uses to expand ids into instructions. When
+ * a buffer fills up, it is handed to a writer thread that compresses the
+ * stream with zstd, writing the block table ahead of the records that
+ * refer to it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/target-info.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "microhook-trace.h"
+#include <glib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+#define TRACE_BUF_RECORDS   32768
+#define TRACE_ZSTD_LEVEL    3
+
+#define TRACE_MAGIC         "MHTRACE"
+#define TRACE_VERSION       1
+#define TRACE_FLAG_MEM      1
+
+enum {
+    CHUNK_BLOCKS = 1,       /* Block table entries */
+    CHUNK_RECORDS = 2,      /* Records of one thread */
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t pid;
+    uint32_t reserved;
+    char target[16];
+} TraceHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t tid;
+    uint32_t size;          /* Bytes following the chunk header */
+    uint32_t reserved;
+} TraceChunk;
+
+/* Block table entry, followed by insn_off[icount] and sites[nb_sites] */
+typedef struct {
+    uint32_t id;
+    uint16_t icount;
+    uint16_t nb_sites;
+    uint64_t pc;
+} TraceBlock;
+
+/*
+ * Buffer of one thread. Generated code appends at cpu->neg.exec_trace_ptr
+ * up to exec_trace_end; one more slot takes the writes of a block that
+ * overruns the buffer, which are lost.
+ */
+typedef struct TraceThread {
+    CPUState *cpu;
+    uint32_t tid;
+    uint64_t *buf;
+} TraceThread;
+
+static bool g_enabled = false;
+static bool g_mem = false;
+static char *g_path = NULL;
+static int g_fd = -1;
+static GThread *g_writer = NULL;
+static GAsyncQueue *g_queue = NULL;
+static GByteArray g_stop;       /* Tells the writer to finish */
+static GByteArray g_sync;       /* Tells the writer to end the frame */
+static GMutex g_sync_lock;
+static GCond g_sync_cond;
+static uint64_t g_sync_done = 0;
+#ifdef CONFIG_ZSTD
+static ZSTD_CCtx *g_zstd = NULL;
+static void *g_zbuf = NULL;
+static size_t g_zbuf_size;
+#endif
+
+static GMutex g_lock;           /* Protects g_threads */
+static GList *g_threads = NULL;
+
+static GMutex g_table_lock;     /* Protects the block table */
+static GByteArray *g_table = NULL;
+static size_t g_table_written;  /* Part of g_table already in the file */
+static uint32_t g_next_id = 0;
+
+static __thread TraceThread *t_trace = NULL;
+
+bool microhook_trace_enabled(void)
+{
+    return qatomic_read(&g_enabled);
+}
+
+bool microhook_trace_mem_enabled(void)
+{
+    return qatomic_read(&g_mem);
+}
+
+/* Output */
+
+static void write_all(const void *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(g_fd, data, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "microhook: trace write failed: %s\n",
+                    strerror(errno));
+            return;
+        }
+        data = (const uint8_t *)data + n;
+        len -= n;
+    }
+}
+
+/* Compress data into the file; with end, finish the zstd frame */
+static void emit(const void *data, size_t len, bool end)
+{
+#ifdef CONFIG_ZSTD
+    ZSTD_inBuffer in = { data, len, 0 };
+
+    for (;;) {
+        ZSTD_outBuffer out = { g_zbuf, g_zbuf_size, 0 };
+        size_t left = ZSTD_compressStream2(g_zstd, &out, &in,
+                                           end ? ZSTD_e_end : ZSTD_e_continue);
+
+        if (ZSTD_isError(left)) {
+            fprintf(stderr, "microhook: trace compression failed: %s\n",
+                    ZSTD_getErrorName(left));
+            return;
+        }
+        write_all(g_zbuf, out.pos);
+        if (end ? left == 0 : in.pos == in.size) {
+            return;
+        }
+    }
+#else
+    write_all(data, len);
+#endif
+}
+
+static void emit_chunk(uint32_t type, uint32_t tid, const void *data,
+                       size_t len)
+{
+    TraceChunk c = { .type = type, .tid = tid, .size = len };
+
+    emit(&c, sizeof(c), false);
+    emit(data, len, false);
+}
+
+static void emit_header(void)
+{
+    TraceHeader h = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .flags = g_mem ? TRACE_FLAG_MEM : 0,
+        .pid = getpid(),
+    };
+
+    g_strlcpy(h.target, target_name(), sizeof(h.target));
+    emit(&h, sizeof(h), false);
+}
+
+/* Write the blocks translated since the last call */
+static void emit_blocks(void)
+{
+    g_autoptr(GByteArray) b = NULL;
+
+    g_mutex_lock(&g_table_lock);
+    if (g_table_written < g_table->len) {
+        b = g_byte_array_sized_new(g_table->len - g_table_written);
+        g_byte_array_append(b, g_table->data + g_table_written,
+                            g_table->len - g_table_written);
+        g_table_written = g_table->len;
+    }
+    g_mutex_unlock(&g_table_lock);
+
+    if (b) {
+        emit_chunk(CHUNK_BLOCKS, 0, b->data, b->len);
+    }
+}
+
+static gpointer writer_thread(gpointer opaque)
+{
+    for (;;) {
+        GByteArray *b = g_async_queue_pop(g_queue);
+
+        /* Blocks are in the table before any record refers to them */
+        emit_blocks();
+        if (b == &g_stop) {
+            break;
+        }
+        if (b == &g_sync) {
+            emit(NULL, 0, true);
+            g_mutex_lock(&g_sync_lock);
+            g_sync_done++;
+            g_cond_broadcast(&g_sync_cond);
+            g_mutex_unlock(&g_sync_lock);
+            continue;
+        }
+        /* A chunk header followed by the records */
+        emit(b->data, b->len, false);
+        g_byte_array_unref(b);
+    }
+    emit(NULL, 0, true);
+    return NULL;
+}
+
+/* Per-thread buffers */
+
+static void push_records(TraceThread *t, const uint64_t *rec, size_t n)
+{
+    TraceChunk c = {
+        .type = CHUNK_RECORDS,
+        .tid = t->tid,
+        .size = n * sizeof(uint64_t),
+    };
+    GByteArray *b = g_byte_array_sized_new(sizeof(c) + c.size);
+
+    g_byte_array_append(b, (const guint8 *)&c, sizeof(c));
+    g_byte_array_append(b, (const guint8 *)rec, c.size);
+    g_async_queue_push(g_queue, b);
+}
+
+/* Number of records in t's buffer, and whether some were lost */
+static size_t thread_used(TraceThread *t, bool *lost)
+{
+    size_t n = t->cpu->neg.exec_trace_ptr - t->buf;
+
+    *lost = n >= TRACE_BUF_RECORDS;
+    return MIN(n, TRACE_BUF_RECORDS);
+}
+
+static void thread_reset(TraceThread *t, bool lost)
+{
+    uint64_t *p = t->buf;
+
+    if (lost) {
+        *p++ = (uint64_t)MICROHOOK_TRACE_LOST << MICROHOOK_TRACE_TAG_SHIFT;
+    }
+    t->cpu->neg.exec_trace_ptr = p;
+    t->cpu->neg.exec_trace_end = t->buf + TRACE_BUF_RECORDS;
+}
+
+/* Hand the owner's records to the writer and start over */
+static void thread_flush(TraceThread *t)
+{
+    bool lost;
+    size_t n = thread_used(t, &lost);
+
+    if (n) {
+        push_records(t, t->buf, n);
+    }
+    thread_reset(t, lost);
+}
+
+void microhook_trace_flush(CPUArchState *env)
+{
+    CPUState *cpu = env_cpu(env);
+    TraceThread *t = t_trace;
+
+    if (t && t->cpu == cpu) {
+        thread_flush(t);
+        return;
+    }
+
+    /* First block of this thread, or of the CPU copied for a thread */
+    if (!t) {
+        t = g_new0(TraceThread, 1);
+        t->buf = g_new(uint64_t, TRACE_BUF_RECORDS + 1);
+        g_mutex_lock(&g_lock);
+        g_threads = g_list_prepend(g_threads, t);
+        g_mutex_unlock(&g_lock);
+        t_trace = t;
+    }
+    t->cpu = cpu;
+    t->tid = qemu_get_thread_id();
+    thread_reset(t, false);
+}
+
+void microhook_trace_partial(CPUState *cpu, int insns)
+{
+    uint64_t *p = cpu->neg.exec_trace_ptr;
+
+    /* No allocation or locking here: this may run in a signal handler */
+    if (!t_trace || t_trace->cpu != cpu || !p) {
+        return;
+    }
+    if (p < cpu->neg.exec_trace_end) {
+        *p++ = (uint64_t)MICROHOOK_TRACE_PARTIAL << MICROHOOK_TRACE_TAG_SHIFT |
+               insns;
+    } else {
+        p = cpu->neg.exec_trace_end;
+    }
+    cpu->neg.exec_trace_ptr = p;
+}
+
+/* Block table */
+
+uint32_t microhook_trace_translate(uint64_t pc, int icount,
+                                   const uint32_t *insn_off,
+                                   int nb_sites, const uint32_t *sites)
+{
+    TraceBlock b = {
+        .icount = icount,
+        .nb_sites = nb_sites,
+        .pc = pc,
+    };
+
+    g_mutex_lock(&g_table_lock);
+    b.id = g_next_id++;
+    g_byte_array_append(g_table, (const guint8 *)&b, sizeof(b));
+    g_byte_array_append(g_table, (const guint8 *)insn_off,
+                        icount * sizeof(uint32_t));
+    g_byte_array_append(g_table, (const guint8 *)sites,
+                        nb_sites * sizeof(uint32_t));
+    g_mutex_unlock(&g_table_lock);
+    return b.id;
+}
+
+/* Setup */
+
+static int open_file(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        fprintf(stderr, "microhook: cannot open trace file %s: %s\n",
+                path, strerror(errno));
+    }
+    return fd;
+}
+
+/* Start writing to g_fd */
+static void start_output(void)
+{
+#ifdef CONFIG_ZSTD
+    /* A forked child may have copied a context the writer was using */
+    g_zstd = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(g_zstd, ZSTD_c_compressionLevel, TRACE_ZSTD_LEVEL);
+    g_zbuf_size = ZSTD_CStreamOutSize();
+    g_zbuf = g_malloc(g_zbuf_size);
+#endif
+    emit_header();
+
+    g_queue = g_async_queue_new();
+    g_writer = g_thread_new("trace-writer", writer_thread, NULL);
+}
+
+int microhook_trace_init(const char *path, int fd, bool mem)
+{
+    g_path = g_strdup(path);
+    g_mem = mem;
+    g_table = g_byte_array_new();
+
+    /* A QEMU started by execve() continues the file of its process */
+    g_fd = fd >= 0 ? fd : open_file(path);
+    if (g_fd < 0) {
+        return -1;
+    }
+    qemu_fd_register(g_fd);
+    start_output();
+    qatomic_set(&g_enabled, true);
+    return 0;
+}
+
+char *microhook_trace_child_arg(void)
+{
+    fcntl(g_fd, F_SETFD, 0);
+    return g_strdup_printf("%s,fd=%d%s", g_path, g_fd, g_mem ? ",mem" : "");
+}
+
+void microhook_trace_thread_exit(CPUState *cpu)
+{
+    TraceThread *t = t_trace;
+
+    if (!t || t->cpu != cpu) {
+        return;
+    }
+    g_mutex_lock(&g_lock);
+    g_threads = g_list_remove(g_threads, t);
+    g_mutex_unlock(&g_lock);
+
+    if (qatomic_read(&g_enabled)) {
+        bool lost;
+        size_t n = thread_used(t, &lost);
+
+        if (n) {
+            push_records(t, t->buf, n);
+        }
+    }
+    cpu->neg.exec_trace_ptr = NULL;
+    cpu->neg.exec_trace_end = NULL;
+    g_free(t->buf);
+    g_free(t);
+    t_trace = NULL;
+}
+
+void microhook_trace_after_fork(CPUState *cpu)
+{
+    g_autofree char *name = NULL;
+    int fd;
+
+    if (!qatomic_read(&g_enabled)) {
+        return;
+    }
+
+    /*
+     * Locks may have been held by threads that do not exist here, and
+     * everything recorded so far is written by the parent. The child gets
+     * a file of its own with the whole block table.
+     */
+    g_mutex_init(&g_lock);
+    g_mutex_init(&g_table_lock);
+    g_mutex_init(&g_sync_lock);
+    g_cond_init(&g_sync_cond);
+    g_threads = NULL;
+    if (t_trace && t_trace->cpu == cpu) {
+        g_threads = g_list_prepend(NULL, t_trace);
+        t_trace->tid = qemu_get_thread_id();
+        thread_reset(t_trace, false);
+    } else {
+        cpu->neg.exec_trace_ptr = NULL;
+        cpu->neg.exec_trace_end = NULL;
+    }
+    g_table_written = 0;
+
+    /*
+     * The new file takes the place of the parent's under the same fd, which
+     * the argument for execve() children refers to.
+     */
+    name = g_strdup_printf("%s.%d", g_path, getpid());
+    fd = open_file(name);
+    if (fd < 0) {
+        qemu_fd_unregister(g_fd);
+        close(g_fd);
+        g_fd = -1;
+        qatomic_set(&g_enabled, false);
+        qatomic_set(&g_mem, false);
+        return;
+    }
+    dup3(fd, g_fd, fcntl(g_fd, F_GETFD) & FD_CLOEXEC ? O_CLOEXEC : 0);
+    close(fd);
+    start_output();
+}
+
+/* Start over in the calling thread's buffer under the caller's tid */
+static void thread_retag(CPUState *cpu)
+{
+    if (!qatomic_read(&g_enabled)) {
+        return;
+    }
+    if (t_trace && t_trace->cpu == cpu) {
+        thread_flush(t_trace);
+        t_trace->tid = qemu_get_thread_id();
+    }
+}
+
+void microhook_trace_vfork_begin(CPUState *cpu)
+{
+    thread_retag(cpu);
+}
+
+void microhook_trace_vfork_end(CPUState *cpu)
+{
+    thread_retag(cpu);
+}
+
+void microhook_trace_sync(CPUState *cpu)
+{
+    g_autofree char *name = NULL;
+    uint64_t ticket;
+    int fd;
+
+    if (!qatomic_read(&g_enabled)) {
+        return;
+    }
+    if (t_trace && t_trace->cpu == cpu) {
+        thread_flush(t_trace);
+    }
+    g_mutex_lock(&g_sync_lock);
+    ticket = g_sync_done + 1;
+    g_async_queue_push(g_queue, &g_sync);
+    while (g_sync_done < ticket) {
+        g_cond_wait(&g_sync_cond, &g_sync_lock);
+    }
+    g_mutex_unlock(&g_sync_lock);
+
+    /*
+     * The parent's writer goes on writing to its own fd table, so the
+     * child's copy of the fd can take a file of its own without the two
+     * processes interleaving frames.
+     */
+    if (in_vfork_child()) {
+        name = g_strdup_printf("%s.%d", g_path, getpid());
+        fd = open_file(name);
+        if (fd >= 0) {
+            dup3(fd, g_fd, fcntl(g_fd, F_GETFD) & FD_CLOEXEC ? O_CLOEXEC : 0);
+            close(fd);
+        }
+    }
+}
+
+void microhook_trace_finish(void)
+{
+    if (!qatomic_xchg(&g_enabled, false)) {
+        return;
+    }
+
+    /*
+     * Other threads may still be running guest code, so their buffers are
+     * copied as far as they got rather than reset.
+     */
+    g_mutex_lock(&g_lock);
+    for (GList *l = g_threads; l; l = l->next) {
+        TraceThread *t = l->data;
+        bool lost;
+        size_t n = thread_used(t, &lost);
+
+        if (n) {
+            push_records(t, t->buf, n);
+        }
+    }
+    g_mutex_unlock(&g_lock);
+
+    g_async_queue_push(g_queue, &g_stop);
+    g_thread_join(g_writer);
+    g_writer = NULL;
+    qemu_fd_unregister(g_fd);
+    close(g_fd);
+    g_fd = -1;
+}
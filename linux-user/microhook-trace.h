@@ -0,0 +1,114 @@
+/*
+ * Microhook Trace - compressed execution trace for QEMU linux-user
+ *
+ * Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MICROHOOK_TRACE_H
+#define MICROHOOK_TRACE_H
+
+#include "qemu/osdep.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Generated code appends 64-bit records to a buffer per thread. The top
+ * byte is the kind of record, the rest depends on it. See
+ * scripts/microhook-trace.py for the file layout.
+ */
+#define MICROHOOK_TRACE_TAG_SHIFT   56
+
+/* A block was entered; low 32 bits: block id from the block table */
+#define MICROHOOK_TRACE_TB          0x01
+/* The last block was left early; low 32 bits: instructions it completed */
+#define MICROHOOK_TRACE_PARTIAL     0x02
+/* Records were dropped because a block overran the buffer */
+#define MICROHOOK_TRACE_LOST        0x03
+/* A memory access (| site number); low 56 bits: guest address */
+#define MICROHOOK_TRACE_MEM         0x80
+
+/*
+ * Memory access sites numbered per block. Later sites all use the last
+ * number, which the block table leaves undescribed.
+ */
+#define MICROHOOK_TRACE_SITES       127
+
+/* Records a block makes room for on entry at most */
+#define MICROHOOK_TRACE_RESERVE     4096
+
+/* Site descriptor: instruction index << 8 | kind of access | log2 size */
+#define MICROHOOK_TRACE_SITE_W      0x10
+#define MICROHOOK_TRACE_SITE_RMW    0x20    /* atomic, reads and writes */
+
+/*
+ * Start tracing to path, which is truncated. With fd >= 0, the trace is
+ * added to the file already open as fd instead, and path only names the
+ * files of forked children. With mem, guest loads and stores are recorded
+ * as well. Returns 0 on success or -1 after printing an error.
+ */
+int microhook_trace_init(const char *path, int fd, bool mem);
+
+/* Whether blocks are traced. Lock-free. */
+bool microhook_trace_enabled(void);
+
+/* Whether memory accesses are traced. Lock-free. */
+bool microhook_trace_mem_enabled(void);
+
+/*
+ * Add a translated block to the block table and return its id. insn_off
+ * holds the offset from pc of each of its icount instructions and sites
+ * the descriptors of its first nb_sites memory access sites.
+ */
+uint32_t microhook_trace_translate(uint64_t pc, int icount,
+                                   const uint32_t *insn_off,
+                                   int nb_sites, const uint32_t *sites);
+
+/*
+ * Make room in the calling thread's buffer. Called by generated code on
+ * block entry when the buffer cannot take the block's records.
+ */
+void microhook_trace_flush(CPUArchState *env);
+
+/*
+ * Record that the last block entered by cpu's thread stopped after insns
+ * instructions. Called while unwinding, possibly from a signal handler.
+ */
+void microhook_trace_partial(CPUState *cpu, int insns);
+
+/*
+ * Argument for -exec-trace that lets a QEMU started by execve() continue
+ * the file of the process, which stays open across execve().
+ */
+char *microhook_trace_child_arg(void);
+
+/* Hand the calling thread's records to the writer */
+void microhook_trace_thread_exit(CPUState *cpu);
+
+/* Continue the trace in <path>.<pid> in a forked child */
+void microhook_trace_after_fork(CPUState *cpu);
+
+/*
+ * Called in a vfork() child, which runs on the parent's buffer: write out
+ * the parent's records and tag the rest with the child's tid.
+ */
+void microhook_trace_vfork_begin(CPUState *cpu);
+
+/* Called in the parent once its vfork() child has exec'd or exited */
+void microhook_trace_vfork_end(CPUState *cpu);
+
+/*
+ * Write out the calling thread's records and end the frame, before execve.
+ * A vfork() child moves on to <path>.<pid>, where the program it runs
+ * continues.
+ */
+void microhook_trace_sync(CPUState *cpu);
+
+/* Write out everything recorded and stop the writer */
+void microhook_trace_finish(void);
+
+#endif /* MICROHOOK_TRACE_H */
@@ -11,13 +11,22 @@
 
 #include "qemu/osdep.h"
 #include "microhook.h"
+#include "microhook-call.h"
+#include "microhook-density.h"
+#include "microhook-net.h"
+#include "microhook-patch.h"
+#include "microhook-ranges.h"
+#include "microhook-threads.h"
 #include "qemu.h"
 #include "user-internals.h"
+#include "exec/cpu-common.h"
+#include "qemu/timer.h"
 
 #define PY_SSIZE_T_CLEAN
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wredundant-decls"
 #include <Python.h>
+#include <arpa/inet.h>
 #pragma GCC diagnostic pop
 
 static bool g_microhook_enabled = false;
@@ -25,6 +34,13 @@ static PyObject *g_module = NULL;
 static PyObject *g_pre_syscall_hooks = NULL;   /* dict: syscall_num -> callable */
 static PyObject *g_post_syscall_hooks = NULL;  /* dict: syscall_num -> callable */
 
+/* Lifecycle callbacks, NULL if not set */
+static PyObject *g_on_thread_start = NULL;
+static PyObject *g_on_thread_exit = NULL;
+static PyObject *g_on_fork = NULL;
+static PyObject *g_on_exec = NULL;
+static PyObject *g_on_exit = NULL;
+
 /* Constants exposed to Python */
 #define MICROHOOK_ACTION_CONTINUE 0
 #define MICROHOOK_ACTION_SKIP 1
@@ -315,6 +331,208 @@ static PyObject *py_write_memory(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+/*
+ * Python API: microhook.patch(addr, data) -> int
+ *
+ * Write guest code: lift the page protection for the write and invalidate
+ * the translated blocks of the patched pages. Returns the number of pages
+ * whose translations were invalidated.
+ */
+static PyObject *py_patch(PyObject *self, PyObject *args)
+{
+    unsigned long long addr;
+    Py_buffer buffer;
+    MicrohookPatch patch;
+    int pages;
+
+    if (!PyArg_ParseTuple(args, "Ky*", &addr, &buffer)) {
+        return NULL;
+    }
+
+    patch.addr = addr;
+    patch.data = buffer.buf;
+    patch.len = buffer.len;
+    pages = microhook_patch_apply(&patch, 1, NULL);
+    PyBuffer_Release(&buffer);
+
+    if (pages < 0) {
+        PyErr_SetString(PyExc_MemoryError, "invalid guest address");
+        return NULL;
+    }
+    return PyLong_FromLong(pages);
+}
+
+/*
+ * Python API: microhook.patch_many([(addr, data), ...]) -> int
+ *
+ * Like patch(), for many patches at once: every page is invalidated once
+ * however many patches hit it. Nothing is written if any address is
+ * invalid.
+ */
+static PyObject *py_patch_many(PyObject *self, PyObject *args)
+{
+    PyObject *list, *seq;
+    g_autofree MicrohookPatch *patches = NULL;
+    g_autofree Py_buffer *buffers = NULL;
+    Py_ssize_t n, parsed = 0;
+    size_t bad = 0;
+    int pages = -1;
+
+    if (!PyArg_ParseTuple(args, "O", &list)) {
+        return NULL;
+    }
+    seq = PySequence_Fast(list, "patch_many() expects a list of "
+                                "(addr, data) tuples");
+    if (!seq) {
+        return NULL;
+    }
+
+    n = PySequence_Fast_GET_SIZE(seq);
+    patches = g_new0(MicrohookPatch, n);
+    buffers = g_new0(Py_buffer, n);
+
+    for (; parsed < n; parsed++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, parsed);
+        unsigned long long addr;
+
+        if (!PyTuple_Check(item) ||
+            !PyArg_ParseTuple(item, "Ky*", &addr, &buffers[parsed])) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_TypeError,
+                                "patch_many() expects (addr, data) tuples");
+            }
+            goto out;
+        }
+        patches[parsed].addr = addr;
+        patches[parsed].data = buffers[parsed].buf;
+        patches[parsed].len = buffers[parsed].len;
+    }
+
+    pages = microhook_patch_apply(patches, n, &bad);
+    if (pages < 0) {
+        PyErr_Format(PyExc_MemoryError, "invalid guest address 0x%llx",
+                     (unsigned long long)patches[bad].addr);
+    }
+
+out:
+    for (Py_ssize_t i = 0; i < parsed; i++) {
+        PyBuffer_Release(&buffers[i]);
+    }
+    Py_DECREF(seq);
+    return pages < 0 ? NULL : PyLong_FromLong(pages);
+}
+
+/*
+ * Python API: microhook.call(addr, *args, stack_size=0, timeout=None,
+ *                            max_insns=0) -> int
+ *
+ * Run the guest function at addr with integer arguments on this thread's
+ * vCPU and return its result register. timeout is in seconds.
+ */
+static PyObject *py_call(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"stack_size", "timeout", "max_insns", NULL};
+    PyObject *empty;
+    MicrohookCallOpts opts = { 0 };
+    uint64_t call_args[MICROHOOK_CALL_MAX_ARGS];
+    unsigned long long addr, max_insns = 0;
+    Py_ssize_t stack_size = 0;
+    PyObject *timeout = Py_None;
+    Py_ssize_t nargs = PyTuple_GET_SIZE(args);
+    uint64_t result = 0;
+    int exception = 0, sig = 0;
+
+    /* The positional arguments are the function's; only parse keywords */
+    empty = PyTuple_New(0);
+    if (!empty) {
+        return NULL;
+    }
+    if (!PyArg_ParseTupleAndKeywords(empty, kwargs, "|nOK", kwlist,
+                                     &stack_size, &timeout, &max_insns)) {
+        Py_DECREF(empty);
+        return NULL;
+    }
+    Py_DECREF(empty);
+    if (nargs < 1) {
+        PyErr_SetString(PyExc_TypeError, "call() needs a function address");
+        return NULL;
+    }
+    if (nargs - 1 > MICROHOOK_CALL_MAX_ARGS) {
+        PyErr_Format(PyExc_ValueError, "at most %d arguments are supported",
+                     MICROHOOK_CALL_MAX_ARGS);
+        return NULL;
+    }
+
+    addr = PyLong_AsUnsignedLongLong(PyTuple_GET_ITEM(args, 0));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    for (Py_ssize_t i = 1; i < nargs; i++) {
+        /* Negative arguments are passed in two's complement */
+        call_args[i - 1] =
+            PyLong_AsUnsignedLongLongMask(PyTuple_GET_ITEM(args, i));
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+
+    if (stack_size < 0) {
+        PyErr_SetString(PyExc_ValueError, "stack_size must not be negative");
+        return NULL;
+    }
+    opts.stack_size = stack_size;
+    opts.max_insns = max_insns;
+    if (timeout != Py_None) {
+        double seconds = PyFloat_AsDouble(timeout);
+
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        if (seconds <= 0) {
+            PyErr_SetString(PyExc_ValueError, "timeout must be positive");
+            return NULL;
+        }
+        opts.timeout_ns = seconds * NANOSECONDS_PER_SECOND;
+    }
+
+    switch (microhook_call(addr, call_args, nargs - 1, &opts,
+                           &result, &exception, &sig)) {
+    case MICROHOOK_CALL_OK:
+        return PyLong_FromUnsignedLongLong(result);
+    case MICROHOOK_CALL_UNSUPPORTED:
+        PyErr_SetString(PyExc_NotImplementedError,
+                        "calls with these arguments are not supported on "
+                        "this target");
+        return NULL;
+    case MICROHOOK_CALL_BUSY:
+        PyErr_SetString(PyExc_RuntimeError,
+                        "call() cannot be used from a range hook");
+        return NULL;
+    case MICROHOOK_CALL_NOMEM:
+        PyErr_SetString(PyExc_MemoryError, "cannot allocate the call stack");
+        return NULL;
+    case MICROHOOK_CALL_TIMEOUT:
+        PyErr_SetString(PyExc_TimeoutError, "guest function timed out");
+        return NULL;
+    case MICROHOOK_CALL_INSN_LIMIT:
+        PyErr_SetString(PyExc_TimeoutError,
+                        "guest function exceeded max_insns");
+        return NULL;
+    case MICROHOOK_CALL_EXCEPTION:
+        if (sig) {
+            PyErr_Format(PyExc_RuntimeError,
+                         "guest function raised signal %d", sig);
+            return NULL;
+        }
+        /* fall through */
+    default:
+        PyErr_Format(PyExc_RuntimeError,
+                     "guest function raised exception %d (syscalls and "
+                     "faults are not supported)", exception);
+        return NULL;
+    }
+}
+
 /*
  * Python API: microhook.read_string(addr) -> str
  *
@@ -344,6 +562,401 @@ static PyObject *py_read_string(PyObject *self, PyObject *args)
     return PyUnicode_FromStringAndSize(host_ptr, len);
 }
 
+/*
+ * Deliver a batch of range hook events to the Python callback (opaque).
+ */
+static void deliver_range_batch(void *opaque, const uint64_t *pcs, size_t n)
+{
+    PyObject *callback = opaque;
+
+    if (!g_microhook_enabled) {
+        return;
+    }
+
+    PyObject *py_pcs = PyList_New(n);
+    if (!py_pcs) {
+        PyErr_Print();
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        PyObject *item = PyLong_FromUnsignedLongLong(pcs[i]);
+        if (!item) {
+            Py_DECREF(py_pcs);
+            PyErr_Print();
+            return;
+        }
+        PyList_SET_ITEM(py_pcs, i, item);  /* Steals reference */
+    }
+
+    PyObject *py_result = PyObject_CallFunctionObjArgs(callback, py_pcs, NULL);
+    if (!py_result) {
+        fprintf(stderr, "microhook: error in range hook:\n");
+        PyErr_Print();
+    }
+    Py_XDECREF(py_result);
+    Py_DECREF(py_pcs);
+}
+
+/*
+ * Python API: microhook.register_range_hook(start, end, callback,
+ *                                           mode="first", period=100) -> int
+ *
+ * Call callback for blocks starting in or overlapping [start, end). mode
+ * can be:
+ *   - "first":   report each block once, when it first executes
+ *   - "every":   report every execution of each block
+ *   - "sampled": report every period-th execution of each block
+ *
+ * Blocks are matched when they are translated, so code outside all ranges
+ * is not slowed down. Events are buffered per thread and delivered in
+ * batches:
+ *   callback(pcs) where pcs is a list of block start addresses, in the
+ *   order the calling thread executed them
+ *
+ * Batches are delivered when the buffer fills up and at each syscall, so
+ * a batch never spans a syscall. Returns the hook id.
+ */
+static PyObject *py_register_range_hook(PyObject *self, PyObject *args,
+                                        PyObject *kwargs)
+{
+    static char *kwlist[] = {"start", "end", "callback", "mode", "period",
+                             NULL};
+    unsigned long long start, end;
+    PyObject *callback;
+    const char *mode_str = "first";
+    unsigned int period = 100;
+    MicrohookRangeMode mode;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "KKO|sI", kwlist,
+                                     &start, &end, &callback,
+                                     &mode_str, &period)) {
+        return NULL;
+    }
+
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+
+    if (end <= start) {
+        PyErr_SetString(PyExc_ValueError, "end must be greater than start");
+        return NULL;
+    }
+
+    if (strcmp(mode_str, "first") == 0) {
+        mode = MICROHOOK_RANGE_FIRST;
+    } else if (strcmp(mode_str, "every") == 0) {
+        mode = MICROHOOK_RANGE_EVERY;
+    } else if (strcmp(mode_str, "sampled") == 0) {
+        mode = MICROHOOK_RANGE_SAMPLED;
+        if (period == 0) {
+            PyErr_SetString(PyExc_ValueError, "period must be positive");
+            return NULL;
+        }
+    } else {
+        PyErr_Format(PyExc_ValueError,
+                     "unknown mode '%s' (expected 'first', 'every' or "
+                     "'sampled')", mode_str);
+        return NULL;
+    }
+
+    /* Range hooks are never removed, so the callback is kept forever */
+    Py_INCREF(callback);
+    int id = microhook_ranges_add(start, end, mode, period,
+                                  deliver_range_batch, callback);
+    if (id < 0) {
+        Py_DECREF(callback);
+        PyErr_SetString(PyExc_RuntimeError, "failed to add range hook");
+        return NULL;
+    }
+
+    return PyLong_FromLong(id);
+}
+
+/*
+ * Hand the other end of a redirected socket to the Python handler (opaque).
+ */
+static void deliver_socket_pair(void *opaque, int fd,
+                                const struct sockaddr *addr, socklen_t len)
+{
+    PyObject *handler = opaque;
+    char ip[INET6_ADDRSTRLEN] = "";
+    int port;
+
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+
+        inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip));
+        port = ntohs(sin6->sin6_port);
+    } else {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+
+        inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+        port = ntohs(sin->sin_port);
+    }
+
+    PyObject *py_result = PyObject_CallFunction(handler, "isi", fd, ip, port);
+    if (!py_result) {
+        fprintf(stderr, "microhook: error in redirect handler:\n");
+        PyErr_Print();
+    }
+    Py_XDECREF(py_result);
+}
+
+/*
+ * Python API: microhook.redirect(match, target=None, handler=None,
+ *                                ops="connect,bind,sendto") -> int
+ *
+ * Redirect socket operations on guest addresses matching match, written
+ * "ip:port" with "*" for any address or port, a bracketed IPv6 address and
+ * an optional "/prefix". With a target, the address is replaced:
+ *   - "inet:ip[:port]": another address, keeping the port if none is given
+ *   - "unix:path":      a Unix socket, "unix:@name" for an abstract one
+ * With a handler instead, the socket is replaced by one end of a
+ * socketpair at connect() or sendto() and handler(fd, ip, port) receives
+ * the other end, which it owns from then on.
+ *
+ * Data never passes through Python, except what the handler reads and
+ * writes itself. Returns the rule id.
+ */
+static PyObject *py_redirect(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"match", "target", "handler", "ops", NULL};
+    const char *match;
+    const char *target = NULL;
+    PyObject *handler = Py_None;
+    const char *ops_str = NULL;
+    g_autofree char *err = NULL;
+    unsigned ops;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|zOz", kwlist,
+                                     &match, &target, &handler, &ops_str)) {
+        return NULL;
+    }
+
+    if ((target != NULL) == (handler != Py_None)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "exactly one of target and handler is required");
+        return NULL;
+    }
+    if (handler != Py_None && !PyCallable_Check(handler)) {
+        PyErr_SetString(PyExc_TypeError, "handler must be callable");
+        return NULL;
+    }
+
+    if (ops_str) {
+        ops = microhook_net_parse_ops(ops_str);
+        if (!ops) {
+            PyErr_Format(PyExc_ValueError,
+                         "invalid ops '%s' (expected 'connect', 'bind' or "
+                         "'sendto', comma separated)", ops_str);
+            return NULL;
+        }
+    } else {
+        /* A socketpair has no address to bind to */
+        ops = handler != Py_None ?
+              MICROHOOK_NET_CONNECT | MICROHOOK_NET_SENDTO : MICROHOOK_NET_ALL;
+    }
+
+    /* Rules are never removed, so the handler is kept forever */
+    if (handler != Py_None) {
+        Py_INCREF(handler);
+    }
+    int id = microhook_net_add_rule(ops, match, target,
+                                    handler != Py_None ?
+                                    deliver_socket_pair : NULL,
+                                    handler, &err);
+    if (id < 0) {
+        if (handler != Py_None) {
+            Py_DECREF(handler);
+        }
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    return PyLong_FromLong(id);
+}
+
+/*
+ * Replace a lifecycle callback. None clears it.
+ */
+static PyObject *set_lifecycle_hook(PyObject **slot, PyObject *args)
+{
+    PyObject *callback;
+
+    if (!PyArg_ParseTuple(args, "O", &callback)) {
+        return NULL;
+    }
+
+    if (callback == Py_None) {
+        callback = NULL;
+    } else if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable or None");
+        return NULL;
+    }
+
+    Py_XINCREF(callback);
+    Py_XDECREF(*slot);
+    *slot = callback;
+
+    Py_RETURN_NONE;
+}
+
+/*
+ * Python API: microhook.on_thread_start(callback)
+ *
+ * callback(tid, start_pc) is called from each new guest thread (and once
+ * for the main thread) before it executes its first instruction.
+ */
+static PyObject *py_on_thread_start(PyObject *self, PyObject *args)
+{
+    return set_lifecycle_hook(&g_on_thread_start, args);
+}
+
+/*
+ * Python API: microhook.on_thread_exit(callback)
+ *
+ * callback(tid, cpu_time_ns) is called from a guest thread that exits
+ * while other threads keep running. The last thread triggers on_exit.
+ */
+static PyObject *py_on_thread_exit(PyObject *self, PyObject *args)
+{
+    return set_lifecycle_hook(&g_on_thread_exit, args);
+}
+
+/*
+ * Python API: microhook.on_fork(callback)
+ *
+ * callback(child_pid, is_child) is called in both processes after the
+ * guest forks. In the child, child_pid is the child's own pid.
+ */
+static PyObject *py_on_fork(PyObject *self, PyObject *args)
+{
+    return set_lifecycle_hook(&g_on_fork, args);
+}
+
+/*
+ * Python API: microhook.on_exec(callback)
+ *
+ * callback(path, argv) is called just before the guest replaces itself
+ * with execve(). If the exec fails the process simply continues.
+ */
+static PyObject *py_on_exec(PyObject *self, PyObject *args)
+{
+    return set_lifecycle_hook(&g_on_exec, args);
+}
+
+/*
+ * Python API: microhook.on_exit(callback)
+ *
+ * callback(code) is called once when the guest process exits.
+ */
+static PyObject *py_on_exit(PyObject *self, PyObject *args)
+{
+    return set_lifecycle_hook(&g_on_exit, args);
+}
+
+/*
+ * Python API: microhook.threads() -> list
+ *
+ * Return the live guest threads, sorted by tid:
+ *   [{"tid": int, "start_pc": int, "cpu_time": int (ns)}, ...]
+ */
+static PyObject *py_threads(PyObject *self, PyObject *args)
+{
+    g_autoptr(GArray) threads = microhook_threads_snapshot();
+    PyObject *list = PyList_New(threads->len);
+
+    if (!list) {
+        return NULL;
+    }
+
+    for (guint i = 0; i < threads->len; i++) {
+        MicrohookThreadInfo *t = &g_array_index(threads, MicrohookThreadInfo, i);
+        PyObject *item = Py_BuildValue("{s:i,s:K,s:K}",
+                                       "tid", t->tid,
+                                       "start_pc",
+                                       (unsigned long long)t->start_pc,
+                                       "cpu_time",
+                                       (unsigned long long)t->cpu_time_ns);
+        if (!item) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);  /* Steals reference */
+    }
+
+    return list;
+}
+
+/*
+ * Python API: microhook.atomic_steps() -> list
+ *
+ * Return how often each guest pc had to be re-executed serially because
+ * the host could not perform its atomic access, most frequent first:
+ *   [{"pc": int, "exclusive": int, "striped": int}, ...]
+ */
+static PyObject *py_atomic_steps(PyObject *self, PyObject *args)
+{
+    g_autoptr(GArray) stats = cpu_exec_atomic_step_stats();
+    PyObject *list = PyList_New(stats->len);
+
+    if (!list) {
+        return NULL;
+    }
+
+    for (guint i = 0; i < stats->len; i++) {
+        AtomicStepStat *st = &g_array_index(stats, AtomicStepStat, i);
+        PyObject *item = Py_BuildValue("{s:K,s:K,s:K}",
+                                       "pc", (unsigned long long)st->pc,
+                                       "exclusive",
+                                       (unsigned long long)st->exclusive,
+                                       "striped",
+                                       (unsigned long long)st->striped);
+        if (!item) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);  /* Steals reference */
+    }
+
+    return list;
+}
+
+/*
+ * Python API: microhook.memory_usage() -> dict
+ *
+ * Resident memory of this instance in bytes, by kind of mapping:
+ * {name: {rss, pss, shared}}
+ */
+static PyObject *py_memory_usage(PyObject *self, PyObject *args)
+{
+    g_autoptr(GArray) entries = microhook_density_rss();
+    PyObject *dict = PyDict_New();
+
+    if (!dict) {
+        return NULL;
+    }
+
+    for (guint i = 0; i < entries->len; i++) {
+        MicrohookRssEntry *e = &g_array_index(entries, MicrohookRssEntry, i);
+        PyObject *item = Py_BuildValue("{s:K,s:K,s:K}",
+                                       "rss", (unsigned long long)e->rss,
+                                       "pss", (unsigned long long)e->pss,
+                                       "shared",
+                                       (unsigned long long)e->shared);
+        if (!item || PyDict_SetItemString(dict, e->name, item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+
+    return dict;
+}
+
 static PyMethodDef microhook_methods[] = {
     {"register_pre_hook", py_register_pre_hook, METH_VARARGS,
      "Register a pre-syscall hook: register_pre_hook(syscall, callback)\n"
@@ -363,6 +976,44 @@ static PyMethodDef microhook_methods[] = {
      "Write guest memory: write_memory(addr, data)"},
     {"read_string", py_read_string, METH_VARARGS,
      "Read null-terminated string from guest memory: read_string(addr) -> str"},
+    {"call", (PyCFunction)(void (*)(void))py_call,
+     METH_VARARGS | METH_KEYWORDS,
+     "Run a guest function to completion: call(addr, *args, stack_size=0,\n"
+     "timeout=None, max_insns=0) -> int"},
+    {"patch", py_patch, METH_VARARGS,
+     "Patch guest code and drop its translations: patch(addr, data) -> int"},
+    {"patch_many", py_patch_many, METH_VARARGS,
+     "Apply many code patches with one invalidation per page: "
+     "patch_many([(addr, data), ...]) -> int"},
+    {"register_range_hook", (PyCFunction)(void (*)(void))py_register_range_hook,
+     METH_VARARGS | METH_KEYWORDS,
+     "Hook blocks in [start, end): register_range_hook(start, end, callback,\n"
+     "mode='first'|'every'|'sampled', period=100) -> int\n"
+     "callback receives a list of block addresses per batch"},
+    {"redirect", (PyCFunction)(void (*)(void))py_redirect,
+     METH_VARARGS | METH_KEYWORDS,
+     "Redirect sockets: redirect(match, target=None, handler=None,\n"
+     "ops='connect,bind,sendto') -> int\n"
+     "target is 'inet:ip[:port]' or 'unix:path'; handler(fd, ip, port)\n"
+     "receives the other end of a socketpair"},
+    {"on_thread_start", py_on_thread_start, METH_VARARGS,
+     "Set thread start callback: on_thread_start(callback(tid, start_pc))"},
+    {"on_thread_exit", py_on_thread_exit, METH_VARARGS,
+     "Set thread exit callback: on_thread_exit(callback(tid, cpu_time_ns))"},
+    {"on_fork", py_on_fork, METH_VARARGS,
+     "Set fork callback: on_fork(callback(child_pid, is_child))"},
+    {"on_exec", py_on_exec, METH_VARARGS,
+     "Set exec callback: on_exec(callback(path, argv))"},
+    {"on_exit", py_on_exit, METH_VARARGS,
+     "Set process exit callback: on_exit(callback(code))"},
+    {"threads", py_threads, METH_NOARGS,
+     "List live guest threads: threads() -> [{tid, start_pc, cpu_time}]"},
+    {"atomic_steps", py_atomic_steps, METH_NOARGS,
+     "Serial atomic re-executions per guest pc: atomic_steps() -> "
+     "[{pc, exclusive, striped}]"},
+    {"memory_usage", py_memory_usage, METH_NOARGS,
+     "Resident memory by kind of mapping: memory_usage() -> "
+     "{name: {rss, pss, shared}}"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -824,6 +1475,17 @@ int microhook_init(const char *script_path)
     /* Suppress the "Could not find platform independent/dependent libraries" warnings */
     config.pathconfig_warnings = 0;
 
+#if PY_VERSION_HEX >= 0x030B0000
+    /*
+     * Import the stdlib modules Python needs at startup from the bytecode
+     * frozen into libpython, which all instances share through the page
+     * cache, instead of unmarshalling a private copy from disk.
+     */
+    if (microhook_density_enabled()) {
+        config.use_frozen_modules = 1;
+    }
+#endif
+
     status = Py_InitializeFromConfig(&config);
     PyConfig_Clear(&config);
 
@@ -855,6 +1517,7 @@ int microhook_init(const char *script_path)
         microhook_shutdown();
         return -1;
     }
+    startup_phase("python-init");
 
     /* Add the script's directory to sys.path */
     char *script_dir = g_path_get_dirname(script_path);
@@ -892,6 +1555,7 @@ int microhook_init(const char *script_path)
         return -1;
     }
     Py_DECREF(result);
+    startup_phase("script");
 
     g_microhook_enabled = true;
     fprintf(stderr, "microhook: loaded script '%s'\n", script_path);
@@ -903,6 +1567,11 @@ void microhook_shutdown(void)
     if (g_microhook_enabled) {
         Py_XDECREF(g_pre_syscall_hooks);
         Py_XDECREF(g_post_syscall_hooks);
+        Py_CLEAR(g_on_thread_start);
+        Py_CLEAR(g_on_thread_exit);
+        Py_CLEAR(g_on_fork);
+        Py_CLEAR(g_on_exec);
+        Py_CLEAR(g_on_exit);
         Py_XDECREF(g_module);
         g_pre_syscall_hooks = NULL;
         g_post_syscall_hooks = NULL;
@@ -1150,3 +1819,136 @@ abi_long microhook_post_syscall(CPUArchState *cpu_env, int num,
     Py_DECREF(ctx);
     return new_ret;
 }
+
+/*
+ * Call a lifecycle callback with a new reference to its argument tuple.
+ */
+static void call_lifecycle_hook(PyObject *callback, const char *name,
+                                PyObject *args)
+{
+    if (!args) {
+        PyErr_Print();
+        return;
+    }
+
+    PyObject *py_result = PyObject_CallObject(callback, args);
+    if (!py_result) {
+        fprintf(stderr, "microhook: error in %s hook:\n", name);
+        PyErr_Print();
+    }
+    Py_XDECREF(py_result);
+    Py_DECREF(args);
+}
+
+void microhook_on_thread_start(int tid, uint64_t start_pc)
+{
+    if (!g_microhook_enabled || !g_on_thread_start) {
+        return;
+    }
+    call_lifecycle_hook(g_on_thread_start, "on_thread_start",
+                        Py_BuildValue("(iK)", tid,
+                                      (unsigned long long)start_pc));
+}
+
+void microhook_on_thread_exit(int tid, uint64_t cpu_time_ns)
+{
+    if (!g_microhook_enabled || !g_on_thread_exit) {
+        return;
+    }
+    call_lifecycle_hook(g_on_thread_exit, "on_thread_exit",
+                        Py_BuildValue("(iK)", tid,
+                                      (unsigned long long)cpu_time_ns));
+}
+
+void microhook_on_fork(int child_pid, bool is_child)
+{
+    if (!g_microhook_enabled || !g_on_fork) {
+        return;
+    }
+    call_lifecycle_hook(g_on_fork, "on_fork",
+                        Py_BuildValue("(iO)", child_pid,
+                                      is_child ? Py_True : Py_False));
+}
+
+void microhook_on_exec(const char *path, char **argv)
+{
+    if (!g_microhook_enabled || !g_on_exec) {
+        return;
+    }
+
+    PyObject *py_argv = PyList_New(0);
+    if (!py_argv) {
+        PyErr_Print();
+        return;
+    }
+    for (char **q = argv; *q; q++) {
+        PyObject *item = PyUnicode_DecodeFSDefault(*q);
+        if (!item || PyList_Append(py_argv, item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(py_argv);
+            PyErr_Print();
+            return;
+        }
+        Py_DECREF(item);
+    }
+
+    call_lifecycle_hook(g_on_exec, "on_exec",
+                        Py_BuildValue("(sN)", path, py_argv));
+}
+
+void microhook_on_exit(int code)
+{
+    PyObject *callback = g_on_exit;
+
+    if (!g_microhook_enabled || !callback) {
+        return;
+    }
+
+    /* Only once, even if exit races with exit_group in another thread */
+    g_on_exit = NULL;
+    call_lifecycle_hook(callback, "on_exit", Py_BuildValue("(i)", code));
+    Py_DECREF(callback);
+}
+
+void microhook_script_fds(GHashTable *fds)
+{
+    static const char code[] =
+        "import gc, io, socket\n"
+        "fds = []\n"
+        "for o in gc.get_objects():\n"
+        "    if isinstance(o, (io.IOBase, socket.socket)):\n"
+        "        try:\n"
+        "            fds.append(o.fileno())\n"
+        "        except (OSError, ValueError):\n"
+        "            pass\n";
+    PyObject *globals, *result, *list;
+
+    if (!g_microhook_enabled) {
+        return;
+    }
+
+    globals = PyDict_New();
+    if (!globals) {
+        PyErr_Print();
+        return;
+    }
+    result = PyRun_String(code, Py_file_input, globals, globals);
+    if (!result) {
+        fprintf(stderr, "microhook: cannot list the script's files:\n");
+        PyErr_Print();
+        Py_DECREF(globals);
+        return;
+    }
+
+    list = PyDict_GetItemString(globals, "fds");
+    for (Py_ssize_t i = 0; list && i < PyList_Size(list); i++) {
+        long fd = PyLong_AsLong(PyList_GetItem(list, i));
+
+        if (fd >= 0) {
+            g_hash_table_add(fds, GINT_TO_POINTER(fd));
+        }
+    }
+    PyErr_Clear();
+    Py_DECREF(result);
+    Py_DECREF(globals);
+}
@@ -76,4 +76,30 @@ abi_long microhook_post_syscall(CPUArchState *cpu_env, int num,
                                abi_long arg4, abi_long arg5, abi_long arg6,
                                abi_long arg7, abi_long arg8);
 
+/*
+ * Guest lifecycle notifications, forwarded to the script's on_* callbacks
+ * if it set any. All of these are no-ops when microhook is disabled.
+ */
+
+/* Called from a new guest thread before it starts executing */
+void microhook_on_thread_start(int tid, uint64_t start_pc);
+
+/* Called from a guest thread that exits while others keep running */
+void microhook_on_thread_exit(int tid, uint64_t cpu_time_ns);
+
+/* Called in the parent and in the child after a guest fork */
+void microhook_on_fork(int child_pid, bool is_child);
+
+/* Called before execve() replaces the guest; argv is NULL-terminated */
+void microhook_on_exec(const char *path, char **argv);
+
+/* Called once when the guest process exits */
+void microhook_on_exit(int code);
+
+/*
+ * Add the host fds of the files and sockets the script holds open to the
+ * set fds, so that an in-place execve() leaves them to the interpreter.
+ */
+void microhook_script_fds(GHashTable *fds);
+
 #endif /* MICROHOOK_H */
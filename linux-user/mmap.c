@@ -26,6 +26,7 @@
 #include "user/page-protection.h"
 #include "user-internals.h"
 #include "user-mmap.h"
+#include "microhook-modules.h"
 #include "target_mman.h"
 #include "qemu/interval-tree.h"
 
@@ -1003,6 +1004,12 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
     ret = target_mmap__locked(start, len, target_prot, flags,
                               page_flags, fd, offset);
 
+    /* Track executable images for coverage and symbolisation */
+    if (ret != -1 && fd >= 0 && !(flags & MAP_ANONYMOUS) &&
+        (target_prot & PROT_EXEC)) {
+        microhook_modules_note_mmap(ret, len, fd, offset);
+    }
+
     mmap_unlock();
 
     /*
@@ -1103,6 +1110,30 @@ int target_munmap(abi_ulong start, abi_ulong len)
     return ret;
 }
 
+static int note_region(void *priv, vaddr start, vaddr end, int prot)
+{
+    GArray *regions = priv;
+    abi_ulong range[2] = { start, end - start };
+
+    g_array_append_vals(regions, range, 2);
+    return 0;
+}
+
+void target_munmap_all(void)
+{
+    g_autoptr(GArray) regions = g_array_new(false, false, sizeof(abi_ulong));
+
+    mmap_lock();
+    walk_memory_regions(regions, note_region);
+    for (guint i = 0; i < regions->len; i += 2) {
+        /* Fails harmlessly for pages outside the reserved space */
+        target_munmap(g_array_index(regions, abi_ulong, i),
+                      g_array_index(regions, abi_ulong, i + 1));
+    }
+    mmap_next_start = task_unmapped_base;
+    mmap_unlock();
+}
+
 abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
                        abi_ulong new_size, unsigned long flags,
                        abi_ulong new_addr)
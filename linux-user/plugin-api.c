@@ -13,4 +13,47 @@
 #include "qemu/osdep.h"
 #include "qemu.h"
 #include "loader.h"
+#include "microhook-coverage.h"
+#include "microhook-modules.h"
 #include "common-user/plugin-api.c.inc"
+
+/*
+ * Coverage - backed by the microhook coverage engine so plugins do not
+ * need per-execution callbacks to collect blocks.
+ */
+bool qemu_plugin_coverage_enable(void)
+{
+    return microhook_coverage_collect() == 0;
+}
+
+GArray *qemu_plugin_coverage_snapshot(void)
+{
+    return microhook_coverage_snapshot();
+}
+
+GArray *qemu_plugin_coverage_modules(void)
+{
+    unsigned n = microhook_modules_count();
+    GArray *mods = g_array_sized_new(false, true,
+                                     sizeof(struct qemu_plugin_coverage_module),
+                                     n);
+
+    for (unsigned i = 0; i < n; i++) {
+        const MicrohookModule *mod = microhook_modules_get(i);
+        struct qemu_plugin_coverage_module m = {
+            .id = mod->id,
+            .base = mod->base,
+            .start = mod->start,
+            .end = mod->end,
+            .entry = mod->entry,
+            .path = mod->path,
+        };
+        g_array_append_val(mods, m);
+    }
+    return mods;
+}
+
+bool qemu_plugin_coverage_write_drcov(const char *path)
+{
+    return microhook_coverage_write_drcov(path);
+}
@@ -74,6 +74,16 @@ long do_rt_sigreturn(CPUArchState *env);
 abi_long do_sigaltstack(abi_ulong uss_addr, abi_ulong uoss_addr,
                         CPUArchState *env);
 int do_sigprocmask(int how, const sigset_t *set, sigset_t *oldset);
+
+/*
+ * Copy the guest signal handlers, for a vfork() child that changes them in
+ * memory it shares with its parent. restore_sigactions() frees the copy.
+ */
+struct target_sigaction *save_sigactions(void);
+void restore_sigactions(struct target_sigaction *saved);
+
+/* Reset caught signals to their default action, as execve() does */
+void flush_signal_handlers(void);
 abi_long do_swapcontext(CPUArchState *env, abi_ulong uold_ctx,
                         abi_ulong unew_ctx, abi_long ctx_size);
 /**
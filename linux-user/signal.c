@@ -38,6 +38,7 @@
 #include "user/safe-syscall.h"
 #include "user/signal.h"
 #include "tcg/tcg.h"
+#include "microhook-sched.h"
 
 /* target_siginfo_t must fit in gdbstub's siginfo save area. */
 QEMU_BUILD_BUG_ON(sizeof(target_siginfo_t) > MAX_SIGINFO_LENGTH);
@@ -1164,6 +1165,50 @@ abi_long do_sigaltstack(abi_ulong uss_addr, abi_ulong uoss_addr,
     return ret;
 }
 
+struct target_sigaction *save_sigactions(void)
+{
+    return g_memdup2(sigact_table, sizeof(sigact_table));
+}
+
+void restore_sigactions(struct target_sigaction *saved)
+{
+    memcpy(sigact_table, saved, sizeof(sigact_table));
+    g_free(saved);
+}
+
+void flush_signal_handlers(void)
+{
+    struct sigaction act;
+    int sig;
+
+    sigfillset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO;
+
+    for (sig = 1; sig <= TARGET_NSIG; sig++) {
+        struct target_sigaction *k = &sigact_table[sig - 1];
+        int host_sig = target_to_host_signal(sig);
+
+        if (k->_sa_handler == TARGET_SIG_DFL ||
+            k->_sa_handler == TARGET_SIG_IGN) {
+            continue;
+        }
+        k->_sa_handler = TARGET_SIG_DFL;
+        k->sa_flags = 0;
+        target_sigemptyset(&k->sa_mask);
+
+        /* As for SIG_DFL in do_sigaction() */
+        if (host_sig > SIGRTMAX || host_sig == SIGSEGV || host_sig == SIGBUS) {
+            continue;
+        }
+        if (core_dump_signal(sig)) {
+            act.sa_sigaction = host_signal_handler;
+        } else {
+            act.sa_sigaction = (void *)SIG_DFL;
+        }
+        sigaction(host_sig, &act, NULL);
+    }
+}
+
 /* do_sigaction() return target values and host errnos */
 int do_sigaction(int sig, const struct target_sigaction *act,
                  struct target_sigaction *oact, abi_ulong ka_restorer)
@@ -1362,6 +1407,11 @@ void process_pending_signals(CPUArchState *cpu_env)
     sigset_t set;
     sigset_t *blocked_set;
 
+    /* Let another thread run if this one's time slice is over */
+    if (unlikely(microhook_sched_enabled())) {
+        microhook_sched_preempt(cpu_env);
+    }
+
     while (qatomic_read(&ts->signal_pending)) {
         sigfillset(&set);
         sigprocmask(SIG_SETMASK, &set, 0);
@@ -26,6 +26,12 @@
 #include "tcg/startup.h"
 #include "target_mman.h"
 #include "microhook.h"
+#include "microhook-net.h"
+#include "microhook-pcap.h"
+#include "microhook-ranges.h"
+#include "microhook-sched.h"
+#include "microhook-threads.h"
+#include "microhook-trace.h"
 #include "exec/page-protection.h"
 #include "exec/mmap-lock.h"
 #include <elf.h>
@@ -480,24 +486,6 @@ static int sys_utimensat(int dirfd, const char *pathname,
 #endif
 #endif /* TARGET_NR_utimensat */
 
-#ifdef TARGET_NR_renameat2
-#if defined(__NR_renameat2)
-#define __NR_sys_renameat2 __NR_renameat2
-_syscall5(int, sys_renameat2, int, oldfd, const char *, old, int, newfd,
-          const char *, new, unsigned int, flags)
-#else
-static int sys_renameat2(int oldfd, const char *old,
-                         int newfd, const char *new, int flags)
-{
-    if (flags == 0) {
-        return renameat(oldfd, old, newfd, new);
-    }
-    errno = ENOSYS;
-    return -1;
-}
-#endif
-#endif /* TARGET_NR_renameat2 */
-
 #ifdef CONFIG_INOTIFY
 #include <sys/inotify.h>
 #else
@@ -3233,6 +3221,7 @@ static abi_long do_bind(int sockfd, abi_ulong target_addr,
                         socklen_t addrlen)
 {
     void *addr;
+    struct sockaddr_storage redirected;
     abi_long ret;
 
     if ((int)addrlen < 0) {
@@ -3245,6 +3234,15 @@ static abi_long do_bind(int sockfd, abi_ulong target_addr,
     if (ret)
         return ret;
 
+    ret = microhook_net_redirect(sockfd, MICROHOOK_NET_BIND, addr, addrlen,
+                                 &redirected, &addrlen);
+    if (ret < 0) {
+        return -host_to_target_errno(-ret);
+    }
+    if (ret == MICROHOOK_NET_REWRITTEN) {
+        addr = &redirected;
+    }
+
     return get_errno(bind(sockfd, addr, addrlen));
 }
 
@@ -3253,6 +3251,7 @@ static abi_long do_connect(int sockfd, abi_ulong target_addr,
                            socklen_t addrlen)
 {
     void *addr;
+    struct sockaddr_storage redirected;
     abi_long ret;
 
     if ((int)addrlen < 0) {
@@ -3265,6 +3264,18 @@ static abi_long do_connect(int sockfd, abi_ulong target_addr,
     if (ret)
         return ret;
 
+    ret = microhook_net_redirect(sockfd, MICROHOOK_NET_CONNECT, addr, addrlen,
+                                 &redirected, &addrlen);
+    if (ret < 0) {
+        return -host_to_target_errno(-ret);
+    }
+    if (ret == MICROHOOK_NET_PAIRED) {
+        return 0;
+    }
+    if (ret == MICROHOOK_NET_REWRITTEN) {
+        addr = &redirected;
+    }
+
     return get_errno(safe_connect(sockfd, addr, addrlen));
 }
 
@@ -3582,6 +3593,7 @@ static abi_long do_sendto(int fd, abi_ulong msg, size_t len, int flags,
                           abi_ulong target_addr, socklen_t addrlen)
 {
     void *addr;
+    struct sockaddr_storage redirected;
     void *host_msg = NULL;
     void *copy_msg = NULL;
     abi_long ret;
@@ -3611,6 +3623,19 @@ static abi_long do_sendto(int fd, abi_ulong msg, size_t len, int flags,
         if (ret) {
             goto fail;
         }
+        ret = microhook_net_redirect(fd, MICROHOOK_NET_SENDTO, addr, addrlen,
+                                     &redirected, &addrlen);
+        if (ret < 0) {
+            ret = -host_to_target_errno(-ret);
+            goto fail;
+        }
+        if (ret == MICROHOOK_NET_PAIRED) {
+            /* Connected socketpair end: the peer is implied */
+            addr = NULL;
+            addrlen = 0;
+        } else if (ret == MICROHOOK_NET_REWRITTEN) {
+            addr = &redirected;
+        }
         ret = get_errno(safe_sendto(fd, host_msg, len, flags, addr, addrlen));
     } else {
         ret = get_errno(safe_sendto(fd, host_msg, len, flags, NULL, 0));
@@ -6698,6 +6723,10 @@ static void *clone_func(void *arg)
     if (info->parent_tidptr)
         put_user_u32(info->tid, info->parent_tidptr);
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
+    /* Visible in the thread registry by the time clone() returns */
+    microhook_threads_start(cpu->cc->get_pc(cpu));
+    /* Join the scheduler before the parent can draw the next thread */
+    microhook_sched_add_thread(cpu);
     /* Enable signals.  */
     sigprocmask(SIG_SETMASK, &info->sigmask, NULL);
     /* Signal to the parent that we're ready.  */
@@ -6707,11 +6736,153 @@ static void *clone_func(void *arg)
     /* Wait until the parent has finished initializing the tls state.  */
     pthread_mutex_lock(&clone_lock);
     pthread_mutex_unlock(&clone_lock);
+    microhook_sched_thread_begin();
+    microhook_on_thread_start(info->tid, cpu->cc->get_pc(cpu));
     cpu_loop(env);
     /* never exits */
     return NULL;
 }
 
+/*
+ * A vfork() child runs on the parent's CPU, TaskState and TLS, on a host
+ * stack of its own in our address space, while the parent is suspended
+ * in clone(). This is safe for libc because no other guest thread exists
+ * and the parent holds no locks until the child has exec'd or exited.
+ */
+static __thread bool t_vfork_child;
+
+typedef struct {
+    CPUArchState *env;
+    unsigned int flags;
+    abi_ulong newsp;
+    abi_ulong parent_tidptr;
+    target_ulong newtls;
+    abi_ulong child_tidptr;
+} vfork_info;
+
+bool in_vfork_child(void)
+{
+    return t_vfork_child;
+}
+
+static int vfork_func(void *arg)
+{
+    vfork_info *info = arg;
+    CPUArchState *env = info->env;
+    TaskState *ts = get_task_state(env_cpu(env));
+
+    t_vfork_child = true;
+    ts->ts_tid = qemu_get_thread_id();
+    cpu_clone_regs_child(env, info->newsp, info->flags);
+    if (info->flags & CLONE_CHILD_SETTID) {
+        put_user_u32(sys_gettid(), info->child_tidptr);
+    }
+    if (info->flags & CLONE_PARENT_SETTID) {
+        put_user_u32(sys_gettid(), info->parent_tidptr);
+    }
+    if (info->flags & CLONE_SETTLS) {
+        cpu_set_tls(env, info->newtls);
+    }
+    if (info->flags & CLONE_CHILD_CLEARTID) {
+        ts->child_tidptr = info->child_tidptr;
+    }
+    microhook_pcap_vfork_begin();
+    microhook_trace_vfork_begin(env_cpu(env));
+    microhook_on_fork(getpid(), true);
+    /* Unblock signals as the return from do_syscall() would */
+    process_pending_signals(env);
+    cpu_loop(env);
+    /* never exits */
+    return 0;
+}
+
+/*
+ * vfork() without copying QEMU: the child shares our memory until it calls
+ * execve() or exits, like on a real kernel. Guest memory needs no undoing,
+ * but the CPU state, TaskState and guest signal handlers the child may have
+ * changed live in QEMU and are put back before the parent continues.
+ */
+static int do_vfork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
+                    abi_ulong parent_tidptr, target_ulong newtls,
+                    abi_ulong child_tidptr)
+{
+    TaskState *ts = get_task_state(env_cpu(env));
+    vfork_info info = {
+        .env = env,
+        .flags = flags,
+        .newsp = newsp,
+        .parent_tidptr = parent_tidptr,
+        .newtls = newtls,
+        .child_tidptr = child_tidptr,
+    };
+    struct target_sigaction *saved_sigact;
+    CPUArchState *saved_env;
+    TaskState *saved_ts;
+    void *stack;
+    int ret;
+
+    if (flags & (CLONE_INVALID_FORK_FLAGS & ~(CLONE_VM | CLONE_VFORK))) {
+        return -TARGET_EINVAL;
+    }
+    if ((flags & CSIGNAL) != TARGET_SIGCHLD) {
+        return -TARGET_EINVAL;
+    }
+#if !defined(__NR_pidfd_open) || !defined(TARGET_NR_pidfd_open)
+    if (flags & CLONE_PIDFD) {
+        return -TARGET_EINVAL;
+    }
+#endif
+    if ((flags & CLONE_PIDFD) && (flags & CLONE_PARENT_SETTID)) {
+        return -TARGET_EINVAL;
+    }
+
+    if (block_signals()) {
+        return -QEMU_ERESTARTSYS;
+    }
+
+    stack = mmap(NULL, NEW_STACK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        return -TARGET_EAGAIN;
+    }
+    saved_env = g_memdup2(env, sizeof(*env));
+    saved_ts = g_memdup2(ts, sizeof(*ts));
+    saved_sigact = save_sigactions();
+
+    ret = get_errno(clone(vfork_func, stack + NEW_STACK_SIZE,
+                          CLONE_VM | CLONE_VFORK | SIGCHLD, &info));
+
+    /* The child has exec'd or exited */
+    t_vfork_child = false;
+    microhook_pcap_vfork_end();
+    microhook_trace_vfork_end(env_cpu(env));
+    memcpy(env, saved_env, sizeof(*env));
+    memcpy(ts, saved_ts, sizeof(*ts));
+    restore_sigactions(saved_sigact);
+    g_free(saved_env);
+    g_free(saved_ts);
+    munmap(stack, NEW_STACK_SIZE);
+    if (is_error(ret)) {
+        return ret;
+    }
+
+    cpu_clone_regs_parent(env, flags);
+    if (flags & CLONE_PIDFD) {
+        int pid_fd = 0;
+#if defined(__NR_pidfd_open) && defined(TARGET_NR_pidfd_open)
+        pid_fd = pidfd_open(ret, 0);
+        if (pid_fd >= 0) {
+            qemu_set_cloexec(pid_fd);
+        } else {
+            pid_fd = 0;
+        }
+#endif
+        put_user_u32(pid_fd, parent_tidptr);
+    }
+    microhook_on_fork(ret, false);
+    return ret;
+}
+
 /* do_fork() Must return host values and target errnos (unlike most
    do_*() functions). */
 static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
@@ -6727,15 +6898,25 @@ static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
 
     flags &= ~CLONE_IGNORED_FLAGS;
 
-    /* Emulate vfork() with fork() */
-    if (flags & CLONE_VFORK)
+    if (flags & CLONE_VFORK) {
+        if (!qemu_slow_vfork && !t_vfork_child && !CPU_NEXT(first_cpu)) {
+            return do_vfork(env, flags, newsp, parent_tidptr, newtls,
+                            child_tidptr);
+        }
+        /* Emulate vfork() with fork() */
         flags &= ~(CLONE_VFORK | CLONE_VM);
+    }
 
     if (flags & CLONE_VM) {
         TaskState *parent_ts = get_task_state(cpu);
         new_thread_info info;
         pthread_attr_t attr;
 
+        /* A vfork child shares the TLS of its suspended parent thread */
+        if (t_vfork_child) {
+            return -TARGET_EAGAIN;
+        }
+
         if (((flags & CLONE_THREAD_FLAGS) != CLONE_THREAD_FLAGS) ||
             (flags & CLONE_INVALID_THREAD_FLAGS)) {
             return -TARGET_EINVAL;
@@ -6862,6 +7043,10 @@ static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
             /* Child Process.  */
             cpu_clone_regs_child(env, newsp, flags);
             fork_end(ret);
+            microhook_threads_after_fork();
+            microhook_pcap_after_fork();
+            microhook_trace_after_fork(cpu);
+            microhook_sched_after_fork();
             /* There is a race condition here.  The parent process could
                theoretically read the TID in the child process before the child
                tid is set.  This would require using either ptrace
@@ -6877,6 +7062,7 @@ static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
                 cpu_set_tls (env, newtls);
             if (flags & CLONE_CHILD_CLEARTID)
                 ts->child_tidptr = child_tidptr;
+            microhook_on_fork(getpid(), true);
         } else {
             cpu_clone_regs_parent(env, flags);
             if (flags & CLONE_PIDFD) {
@@ -6893,6 +7079,9 @@ static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
                 put_user_u32(pid_fd, parent_tidptr);
             }
             fork_end(ret);
+            if (ret > 0) {
+                microhook_on_fork(ret, false);
+            }
         }
         g_assert(!cpu_in_exclusive_context(cpu));
     }
@@ -8642,16 +8831,31 @@ static int maybe_do_fake_open(CPUArchState *cpu_env, int dirfd,
 int do_guest_openat(CPUArchState *cpu_env, int dirfd, const char *pathname,
                     int flags, mode_t mode, bool safe)
 {
+    const char *hostpath;
+    bool follow;
     int fd = maybe_do_fake_open(cpu_env, dirfd, pathname, flags, mode, 0, safe);
     if (fd > -2) {
         return fd;
     }
 
+    /* O_CREAT | O_EXCL never follows a final symlink */
+    follow = !(flags & O_NOFOLLOW) &&
+             (flags & (O_CREAT | O_EXCL)) != (O_CREAT | O_EXCL);
+    if (flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC)) {
+        hostpath = path_write_at(dirfd, pathname, follow);
+    } else {
+        hostpath = path_at(dirfd, pathname, follow);
+    }
+
     if (safe) {
-        return safe_openat(dirfd, path(pathname), flags, mode);
+        fd = safe_openat(dirfd, hostpath, flags, mode);
     } else {
-        return openat(dirfd, path(pathname), flags, mode);
+        fd = openat(dirfd, hostpath, flags, mode);
     }
+    if (fd >= 0 && (flags & O_DIRECTORY)) {
+        path_opened_dir(fd);
+    }
+    return fd;
 }
 
 
@@ -8822,6 +9026,27 @@ static int do_execv(CPUArchState *cpu_env, int dirfd,
         exe = exec_path;
     }
 
+    microhook_on_exec(p, argp + argp_offset);
+
+    if (dirfd == AT_FDCWD && !flags) {
+        ret = exec_in_place(cpu_env, is_proc_myself(p, "exe") ? exec_path : p,
+                            argp + argp_offset, envp);
+        if (ret == 0) {
+            /* The strings were in the old program's memory, now unmapped */
+            g_free(argp);
+            g_free(envp);
+            return -QEMU_ESIGRETURN;
+        }
+        if (ret < 0) {
+            ret = -host_to_target_errno(-ret);
+            unlock_user(p, pathname, 0);
+            goto execve_end;
+        }
+    }
+
+    microhook_pcap_sync();
+    microhook_trace_sync(env_cpu(cpu_env));
+
     ret = is_execveat
         ? safe_execveat(dirfd, exe, argp, envp, flags)
         : safe_execve(exe, argp, envp);
@@ -8943,6 +9168,39 @@ static int host_to_target_cpu_mask(const unsigned long *host_mask,
 }
 
 #ifdef TARGET_NR_getdents
+#ifdef EMULATE_GETDENTS_WITH_GETDENTS
+/*
+ * Listings of overlay directories come as linux_dirent64 records. Repack
+ * them in place as linux_dirent, which is never larger.
+ */
+static int overlay_getdents(int dirfd, void *hdirp, unsigned int count)
+{
+    int hlen = path_getdents64(dirfd, hdirp, count);
+    int hoff, off = 0;
+
+    for (hoff = 0; hoff < hlen; ) {
+        struct linux_dirent64 *hde64 = hdirp + hoff;
+        struct linux_dirent *hde = hdirp + off;
+        uint64_t ino = hde64->d_ino;
+        int64_t diroff = hde64->d_off;
+        uint8_t type = hde64->d_type;
+        int namelen = strlen(hde64->d_name) + 1;
+        int reclen = QEMU_ALIGN_UP(offsetof(struct linux_dirent, d_name) +
+                                   namelen + 1,
+                                   __alignof(struct linux_dirent));
+
+        hoff += hde64->d_reclen;
+        memmove(hde->d_name, hde64->d_name, namelen);
+        hde->d_ino = ino;
+        hde->d_off = diroff;
+        hde->d_reclen = reclen;
+        *((uint8_t *)hde + reclen - 1) = type;
+        off += reclen;
+    }
+    return hlen < 0 ? hlen : off;
+}
+#endif
+
 static int do_getdents(abi_long dirfd, abi_long arg2, abi_long count)
 {
     g_autofree void *hdirp = NULL;
@@ -8957,9 +9215,17 @@ static int do_getdents(abi_long dirfd, abi_long arg2, abi_long count)
     }
 
 #ifdef EMULATE_GETDENTS_WITH_GETDENTS
-    hlen = sys_getdents(dirfd, hdirp, count);
+    if (path_is_overlay_dir(dirfd)) {
+        hlen = overlay_getdents(dirfd, hdirp, count);
+    } else {
+        hlen = sys_getdents(dirfd, hdirp, count);
+    }
 #else
-    hlen = sys_getdents64(dirfd, hdirp, count);
+    if (path_is_overlay_dir(dirfd)) {
+        hlen = path_getdents64(dirfd, hdirp, count);
+    } else {
+        hlen = sys_getdents64(dirfd, hdirp, count);
+    }
 #endif
 
     hlen = get_errno(hlen);
@@ -9043,7 +9309,11 @@ static int do_getdents64(abi_long dirfd, abi_long arg2, abi_long count)
         return -TARGET_ENOMEM;
     }
 
-    hlen = get_errno(sys_getdents64(dirfd, hdirp, count));
+    if (path_is_overlay_dir(dirfd)) {
+        hlen = get_errno(path_getdents64(dirfd, hdirp, count));
+    } else {
+        hlen = get_errno(sys_getdents64(dirfd, hdirp, count));
+    }
     if (is_error(hlen)) {
         return hlen;
     }
@@ -9487,6 +9757,15 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             return -QEMU_ERESTARTSYS;
         }
 
+        /*
+         * The hook may run guest code or flush translations, so it needs
+         * this thread's CPU and must not hold clone_lock. Only the last
+         * thread can see no other, so the unlocked check is enough.
+         */
+        if (CPU_NEXT(first_cpu)) {
+            microhook_on_thread_exit(sys_gettid(), microhook_threads_exit());
+        }
+
         pthread_mutex_lock(&clone_lock);
 
         if (CPU_NEXT(first_cpu)) {
@@ -9504,6 +9783,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             }
 #endif
 
+            microhook_trace_thread_exit(cpu);
             object_unparent(OBJECT(cpu));
             object_unref(OBJECT(cpu));
             /*
@@ -9514,6 +9794,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
 
             pthread_mutex_unlock(&clone_lock);
 
+            microhook_pcap_thread_exit();
+            microhook_sched_thread_exit();
+
             thread_cpu = NULL;
             g_free(ts);
             rcu_unregister_thread();
@@ -9683,7 +9966,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_creat:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(creat(p, arg2));
+        ret = get_errno(creat(path_write_at(AT_FDCWD, p, true), arg2));
         fd_trans_unregister(ret);
         unlock_user(p, arg1, 0);
         return ret;
@@ -9697,7 +9980,8 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!p || !p2)
                 ret = -TARGET_EFAULT;
             else
-                ret = get_errno(link(p, p2));
+                ret = get_errno(link(path_write_at(AT_FDCWD, p, false),
+                                     path_write_at(AT_FDCWD, p2, false)));
             unlock_user(p2, arg2, 0);
             unlock_user(p, arg1, 0);
         }
@@ -9714,7 +9998,11 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!p || !p2)
                 ret = -TARGET_EFAULT;
             else
-                ret = get_errno(linkat(arg1, p, arg3, p2, arg5));
+                ret = get_errno(linkat(arg1,
+                                       path_write_at(arg1, p,
+                                                     arg5 & AT_SYMLINK_FOLLOW),
+                                       arg3, path_write_at(arg3, p2, false),
+                                       arg5));
             unlock_user(p, arg2, 0);
             unlock_user(p2, arg4, 0);
         }
@@ -9724,7 +10012,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_unlink:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(unlink(p));
+        ret = get_errno(path_unlinkat(AT_FDCWD, p, 0));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -9732,7 +10020,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_unlinkat:
         if (!(p = lock_user_string(arg2)))
             return -TARGET_EFAULT;
-        ret = get_errno(unlinkat(arg1, p, arg3));
+        ret = get_errno(path_unlinkat(arg1, p, arg3));
         unlock_user(p, arg2, 0);
         return ret;
 #endif
@@ -9762,7 +10050,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_mknod:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(mknod(p, arg2, arg3));
+        ret = get_errno(mknod(path_write_at(AT_FDCWD, p, false), arg2, arg3));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -9770,7 +10058,8 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_mknodat:
         if (!(p = lock_user_string(arg2)))
             return -TARGET_EFAULT;
-        ret = get_errno(mknodat(arg1, p, arg3, arg4));
+        ret = get_errno(mknodat(arg1, path_write_at(arg1, p, false),
+                                arg3, arg4));
         unlock_user(p, arg2, 0);
         return ret;
 #endif
@@ -9778,7 +10067,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_chmod:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(chmod(p, arg2));
+        ret = get_errno(chmod(path_write_at(AT_FDCWD, p, true), arg2));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -9957,7 +10246,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             }
             if (!(p = lock_user_string(arg1)))
                 return -TARGET_EFAULT;
-            ret = get_errno(utime(p, host_tbuf));
+            ret = get_errno(utime(path_write_at(AT_FDCWD, p, true), host_tbuf));
             unlock_user(p, arg1, 0);
         }
         return ret;
@@ -9977,7 +10266,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             }
             if (!(p = lock_user_string(arg1)))
                 return -TARGET_EFAULT;
-            ret = get_errno(utimes(p, tvp));
+            ret = get_errno(utimes(path_write_at(AT_FDCWD, p, true), tvp));
             unlock_user(p, arg1, 0);
         }
         return ret;
@@ -9998,7 +10287,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!(p = lock_user_string(arg2))) {
                 return -TARGET_EFAULT;
             }
-            ret = get_errno(futimesat(arg1, path(p), tvp));
+            ret = get_errno(futimesat(arg1, path_write_at(arg1, p, true), tvp));
             unlock_user(p, arg2, 0);
         }
         return ret;
@@ -10008,7 +10297,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         if (!(p = lock_user_string(arg1))) {
             return -TARGET_EFAULT;
         }
-        ret = get_errno(access(path(p), arg2));
+        ret = get_errno(access(path_at(AT_FDCWD, p, true), arg2));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -10052,7 +10341,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!p || !p2)
                 ret = -TARGET_EFAULT;
             else
-                ret = get_errno(rename(p, p2));
+                ret = get_errno(path_renameat2(AT_FDCWD, p, AT_FDCWD, p2, 0));
             unlock_user(p2, arg2, 0);
             unlock_user(p, arg1, 0);
         }
@@ -10067,7 +10356,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!p || !p2)
                 ret = -TARGET_EFAULT;
             else
-                ret = get_errno(renameat(arg1, p, arg3, p2));
+                ret = get_errno(path_renameat2(arg1, p, arg3, p2, 0));
             unlock_user(p2, arg4, 0);
             unlock_user(p, arg2, 0);
         }
@@ -10082,7 +10371,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!p || !p2) {
                 ret = -TARGET_EFAULT;
             } else {
-                ret = get_errno(sys_renameat2(arg1, p, arg3, p2, arg5));
+                ret = get_errno(path_renameat2(arg1, p, arg3, p2, arg5));
             }
             unlock_user(p2, arg4, 0);
             unlock_user(p, arg2, 0);
@@ -10093,7 +10382,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_mkdir:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(mkdir(p, arg2));
+        ret = get_errno(path_mkdirat(AT_FDCWD, p, arg2));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -10101,7 +10390,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_mkdirat:
         if (!(p = lock_user_string(arg2)))
             return -TARGET_EFAULT;
-        ret = get_errno(mkdirat(arg1, p, arg3));
+        ret = get_errno(path_mkdirat(arg1, p, arg3));
         unlock_user(p, arg2, 0);
         return ret;
 #endif
@@ -10109,7 +10398,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_rmdir:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(rmdir(p));
+        ret = get_errno(path_unlinkat(AT_FDCWD, p, AT_REMOVEDIR));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -10783,7 +11072,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!p || !p2)
                 ret = -TARGET_EFAULT;
             else
-                ret = get_errno(symlink(p, p2));
+                ret = get_errno(symlink(p, path_write_at(AT_FDCWD, p2, false)));
             unlock_user(p2, arg2, 0);
             unlock_user(p, arg1, 0);
         }
@@ -10798,7 +11087,8 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!p || !p2)
                 ret = -TARGET_EFAULT;
             else
-                ret = get_errno(symlinkat(p, arg2, p2));
+                ret = get_errno(symlinkat(p, arg2,
+                                          path_write_at(arg2, p2, false)));
             unlock_user(p2, arg3, 0);
             unlock_user(p, arg1, 0);
         }
@@ -10836,7 +11126,8 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 /* We cannot NUL terminate the string. */
                 memcpy(p2, exec_path, ret);
             } else {
-                ret = get_errno(readlinkat(arg1, path(p), p2, arg4));
+                ret = get_errno(readlinkat(arg1, path_at(arg1, p, false),
+                                           p2, arg4));
             }
             unlock_user(p2, arg3, ret);
             unlock_user(p, arg2, 0);
@@ -10943,7 +11234,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_truncate:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(truncate(p, arg2));
+        ret = get_errno(truncate(path_write_at(AT_FDCWD, p, true), arg2));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -10957,7 +11248,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_fchmodat:
         if (!(p = lock_user_string(arg2)))
             return -TARGET_EFAULT;
-        ret = get_errno(fchmodat(arg1, p, arg3, 0));
+        ret = get_errno(fchmodat(arg1, path_write_at(arg1, p, true), arg3, 0));
         unlock_user(p, arg2, 0);
         return ret;
 #endif
@@ -10966,7 +11257,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         if (!(p = lock_user_string(arg2))) {
             return -TARGET_EFAULT;
         }
-        ret = get_errno(safe_fchmodat2(arg1, p, arg3, arg4));
+        ret = get_errno(safe_fchmodat2(arg1,
+                        path_write_at(arg1, p, !(arg4 & AT_SYMLINK_NOFOLLOW)),
+                        arg3, arg4));
         unlock_user(p, arg2, 0);
         return ret;
 #endif
@@ -10993,7 +11286,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         if (!(p = lock_user_string(arg1))) {
             return -TARGET_EFAULT;
         }
-        ret = get_errno(statfs(path(p), &stfs));
+        ret = get_errno(statfs(path_at(AT_FDCWD, p, true), &stfs));
         unlock_user(p, arg1, 0);
     convert_statfs:
         if (!is_error(ret)) {
@@ -11032,7 +11325,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         if (!(p = lock_user_string(arg1))) {
             return -TARGET_EFAULT;
         }
-        ret = get_errno(statfs(path(p), &stfs));
+        ret = get_errno(statfs(path_at(AT_FDCWD, p, true), &stfs));
         unlock_user(p, arg1, 0);
     convert_statfs64:
         if (!is_error(ret)) {
@@ -11239,7 +11532,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         if (!(p = lock_user_string(arg1))) {
             return -TARGET_EFAULT;
         }
-        ret = get_errno(stat(path(p), &st));
+        ret = get_errno(stat(path_at(AT_FDCWD, p, true), &st));
         unlock_user(p, arg1, 0);
         goto do_stat;
 #endif
@@ -12093,7 +12386,8 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_truncate64:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-	ret = target_truncate64(cpu_env, p, arg2, arg3, arg4);
+	ret = target_truncate64(cpu_env, path_write_at(AT_FDCWD, p, true),
+                                arg2, arg3, arg4);
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -12106,7 +12400,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         if (!(p = lock_user_string(arg1))) {
             return -TARGET_EFAULT;
         }
-        ret = get_errno(stat(path(p), &st));
+        ret = get_errno(stat(path_at(AT_FDCWD, p, true), &st));
         unlock_user(p, arg1, 0);
         if (!is_error(ret))
             ret = host_to_target_stat64(cpu_env, arg2, &st);
@@ -12140,7 +12434,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         if (!(p = lock_user_string(arg2))) {
             return -TARGET_EFAULT;
         }
-        ret = get_errno(fstatat(arg1, path(p), &st, arg4));
+        ret = get_errno(fstatat(arg1,
+                        path_at(arg1, p, !(arg4 & AT_SYMLINK_NOFOLLOW)),
+                        &st, arg4));
         unlock_user(p, arg2, 0);
         if (!is_error(ret))
             ret = host_to_target_stat64(cpu_env, arg3, &st);
@@ -12165,7 +12461,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 struct target_statx host_stx;
                 int mask = arg4;
 
-                ret = get_errno(sys_statx(dirfd, p, flags, mask, &host_stx));
+                ret = get_errno(sys_statx(dirfd,
+                    path_at(dirfd, p, !(flags & AT_SYMLINK_NOFOLLOW)),
+                    flags, mask, &host_stx));
                 if (!is_error(ret)) {
                     if (host_to_target_statx(&host_stx, arg5) != 0) {
                         unlock_user(p, arg2, 0);
@@ -12179,7 +12477,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 }
             }
 #endif
-            ret = get_errno(fstatat(dirfd, path(p), &st, flags));
+            ret = get_errno(fstatat(dirfd,
+                    path_at(dirfd, p, !(flags & AT_SYMLINK_NOFOLLOW)),
+                    &st, flags));
             unlock_user(p, arg2, 0);
 
             if (!is_error(ret)) {
@@ -12211,7 +12511,8 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_lchown:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(lchown(p, low2highuid(arg2), low2highgid(arg3)));
+        ret = get_errno(lchown(path_write_at(AT_FDCWD, p, false),
+                               low2highuid(arg2), low2highgid(arg3)));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -12300,8 +12601,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_fchownat:
         if (!(p = lock_user_string(arg2))) 
             return -TARGET_EFAULT;
-        ret = get_errno(fchownat(arg1, p, low2highuid(arg3),
-                                 low2highgid(arg4), arg5));
+        ret = get_errno(fchownat(arg1,
+                        path_write_at(arg1, p, !(arg5 & AT_SYMLINK_NOFOLLOW)),
+                        low2highuid(arg3), low2highgid(arg4), arg5));
         unlock_user(p, arg2, 0);
         return ret;
 #endif
@@ -12349,7 +12651,8 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_chown:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(chown(p, low2highuid(arg2), low2highgid(arg3)));
+        ret = get_errno(chown(path_write_at(AT_FDCWD, p, true),
+                              low2highuid(arg2), low2highgid(arg3)));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -12366,7 +12669,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_lchown32:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(lchown(p, arg2, arg3));
+        ret = get_errno(lchown(path_write_at(AT_FDCWD, p, false), arg2, arg3));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -12675,7 +12978,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     case TARGET_NR_chown32:
         if (!(p = lock_user_string(arg1)))
             return -TARGET_EFAULT;
-        ret = get_errno(chown(p, arg2, arg3));
+        ret = get_errno(chown(path_write_at(AT_FDCWD, p, true), arg2, arg3));
         unlock_user(p, arg1, 0);
         return ret;
 #endif
@@ -13229,7 +13532,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 if (!(p = lock_user_string(arg2))) {
                     return -TARGET_EFAULT;
                 }
-                ret = get_errno(sys_utimensat(arg1, path(p), tsp, arg4));
+                ret = get_errno(sys_utimensat(arg1,
+                        path_write_at(arg1, p, !(arg4 & AT_SYMLINK_NOFOLLOW)),
+                        tsp, arg4));
                 unlock_user(p, arg2, 0);
             }
         }
@@ -13258,7 +13563,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 if (!p) {
                     return -TARGET_EFAULT;
                 }
-                ret = get_errno(sys_utimensat(arg1, path(p), tsp, arg4));
+                ret = get_errno(sys_utimensat(arg1,
+                        path_write_at(arg1, p, !(arg4 & AT_SYMLINK_NOFOLLOW)),
+                        tsp, arg4));
                 unlock_user(p, arg2, 0);
             }
         }
@@ -14189,6 +14496,7 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
     abi_long ret;
     MicrohookResult hook_result;
     bool hooked = false;
+    int64_t sched_ret;
 
 #ifdef DEBUG_ERESTARTSYS
     /* Debug-only code for exercising the syscall-restart code paths
@@ -14208,6 +14516,36 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
         return -QEMU_ESIGRETURN;
     }
 
+    /* Hand range hook events to Python before any syscall hook runs */
+    microhook_ranges_flush();
+
+    /* Plugin syscall filters, called from the same point as microhook */
+    {
+        uint64_t plugin_args[QEMU_PLUGIN_SYSCALL_ARGS] = {
+            arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8
+        };
+        uint64_t plugin_ret = 0;
+        bool filtered = qemu_plugin_vcpu_syscall_filter(cpu, num, plugin_args,
+                                                        &plugin_ret);
+
+        arg1 = plugin_args[0];
+        arg2 = plugin_args[1];
+        arg3 = plugin_args[2];
+        arg4 = plugin_args[3];
+        arg5 = plugin_args[4];
+        arg6 = plugin_args[5];
+        arg7 = plugin_args[6];
+        arg8 = plugin_args[7];
+
+        if (filtered) {
+            ret = plugin_ret;
+            record_syscall_start(cpu, num, arg1,
+                                 arg2, arg3, arg4, arg5, arg6, arg7, arg8);
+            record_syscall_return(cpu, num, ret);
+            return ret;
+        }
+    }
+
     /* Microhook pre-syscall hook */
     if (microhook_enabled()) {
         hooked = microhook_pre_syscall(cpu_env, num,
@@ -14243,8 +14581,22 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
         print_syscall(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6);
     }
 
-    ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
-                      arg5, arg6, arg7, arg8);
+    /* -deterministic-threads lets other threads run while this one waits */
+    if (unlikely(microhook_sched_enabled()) &&
+        microhook_sched_syscall(cpu_env, num, arg1, arg2, arg3, arg4,
+                                arg5, arg6, &sched_ret)) {
+        ret = sched_ret;
+    } else {
+        ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
+                          arg5, arg6, arg7, arg8);
+        if (unlikely(microhook_sched_enabled())) {
+            ret = microhook_sched_syscall_done(cpu_env, num, ret);
+        }
+    }
+
+    if (unlikely(microhook_pcap_enabled())) {
+        microhook_pcap_syscall(num, ret, arg1, arg2, arg3, arg4, arg5, arg6);
+    }
 
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
         print_syscall_ret(cpu_env, num, ret, arg1, arg2,
@@ -14258,6 +14610,18 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
                                     arg5, arg6, arg7, arg8);
     }
 
+    /* Plugin syscall return filters */
+    {
+        const uint64_t plugin_args[QEMU_PLUGIN_SYSCALL_ARGS] = {
+            arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8
+        };
+        int64_t plugin_ret = ret;
+
+        qemu_plugin_vcpu_syscall_ret_filter(cpu, num, plugin_args,
+                                            &plugin_ret);
+        ret = plugin_ret;
+    }
+
     record_syscall_return(cpu, num, ret);
     return ret;
 }
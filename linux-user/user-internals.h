@@ -31,9 +31,15 @@ extern const char *qemu_uname_release;
 extern unsigned long mmap_min_addr;
 
 extern bool qemu_dup_for_children;
+extern bool qemu_slow_vfork;
 extern int qemu_argc;
 extern char **qemu_argv;
 
+/*
+ * Log the time spent since the previous startup phase under -d startup.
+ */
+void startup_phase(const char *name);
+
 typedef struct IOCTLEntry IOCTLEntry;
 
 typedef abi_long do_ioctl_fn(const IOCTLEntry *ie, uint8_t *buf_temp,
@@ -75,6 +81,25 @@ int get_osversion(void);
 void init_qemu_uname_release(void);
 void fork_start(void);
 void fork_end(pid_t pid);
+/* Whether this is a vfork() child still sharing its parent's memory */
+bool in_vfork_child(void);
+
+/*
+ * Load the program at pathname into this process for execve(), as
+ * -exec-in-process asks. Returns 0 once the new program is ready to run,
+ * a negative errno if execve() should fail, or 1 if the exec has to start
+ * a new QEMU instead.
+ */
+int exec_in_place(CPUArchState *env, const char *pathname, char **argv,
+                  char **envp);
+
+/*
+ * Record a host fd that QEMU opened for itself, e.g. an output file, so
+ * that exec_in_place() keeps it open. Unregister it when it is closed.
+ * The fds open when the guest starts are kept without registering.
+ */
+void qemu_fd_register(int fd);
+void qemu_fd_unregister(int fd);
 
 /**
  * probe_guest_base:
@@ -41,6 +41,12 @@
 extern abi_ulong task_unmapped_base;
 extern abi_ulong elf_et_dyn_base;
 
+/*
+ * Unmap all guest memory, including the commpage, and place mappings from
+ * task_unmapped_base again, for an exec that stays in this process.
+ */
+void target_munmap_all(void);
+
 abi_long target_madvise(abi_ulong start, abi_ulong len_in, int advice);
 
 abi_ulong target_shmat(CPUArchState *cpu_env, int shmid,
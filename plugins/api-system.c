@@ -42,6 +42,31 @@ uint64_t qemu_plugin_entry_code(void)
     return 0;
 }
 
+/*
+ * Coverage is collected by the user-mode coverage engine, which does
+ * not exist in system mode.
+ */
+bool qemu_plugin_coverage_enable(void)
+{
+    return false;
+}
+
+GArray *qemu_plugin_coverage_snapshot(void)
+{
+    return NULL;
+}
+
+GArray *qemu_plugin_coverage_modules(void)
+{
+    return g_array_new(false, true,
+                       sizeof(struct qemu_plugin_coverage_module));
+}
+
+bool qemu_plugin_coverage_write_drcov(const char *path)
+{
+    return false;
+}
+
 /*
  * Virtual Memory queries
  */
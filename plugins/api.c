@@ -208,6 +208,27 @@ qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
     plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_SYSCALL_RET, cb);
 }
 
+void
+qemu_plugin_register_vcpu_syscall_filter_cb(qemu_plugin_id_t id,
+                                            qemu_plugin_vcpu_syscall_filter_cb_t cb)
+{
+    plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_SYSCALL_FILTER, cb);
+}
+
+void
+qemu_plugin_register_vcpu_syscall_ret_filter_cb(
+    qemu_plugin_id_t id, qemu_plugin_vcpu_syscall_ret_filter_cb_t cb)
+{
+    plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_SYSCALL_RET_FILTER, cb);
+}
+
+void qemu_plugin_register_coverage_cb(qemu_plugin_id_t id,
+                                      qemu_plugin_coverage_cb_t cb,
+                                      void *userdata)
+{
+    plugin_register_cb_udata(id, QEMU_PLUGIN_EV_COVERAGE, cb, userdata);
+}
+
 /*
  * Plugin Queries
  *
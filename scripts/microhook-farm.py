@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+#
+# Run many microhook instances over a work queue with one coverage map
+#
+# Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Every instance is started with QEMU_COVERAGE_MAP pointing at the same
+# file, into which it ORs the blocks it executes (see
+# linux-user/microhook-covmap.h for the layout). While the campaign runs,
+# the blocks nobody had covered before are printed as they are found,
+# together with throughput and campaign-wide coverage.
+#
+# Inputs, substituted for @@ in the command or fed on stdin:
+#   microhook-farm.py -j 32 --inputs corpus/ -- microhook-mipsel ./target @@
+#
+# One complete command line per line of a file:
+#   microhook-farm.py -j 32 --commands jobs.txt
+
+import argparse
+import fcntl
+import mmap
+import os
+import shlex
+import signal
+import struct
+import subprocess
+import sys
+import time
+
+COVMAP_MAGIC = 0x4d43484d
+COVMAP_VERSION = 1
+COVMAP_DEFAULT_BITS = 20
+COVMAP_DEFAULT_RING = 4096
+
+# CovMapHeader: magic, version, map_bits, ring_size, covered, blocks,
+# instances, event_head, reserved[2]
+HEADER = struct.Struct('=IIIIQQQQ16x')
+# CovMapEvent: seq, pid, size, offset, module[40]
+EVENT = struct.Struct('=QIIQ40s')
+
+
+def covmap_size(map_bits, ring_size):
+    return HEADER.size + ring_size * EVENT.size + (1 << map_bits) // 8
+
+
+class CoverageMap:
+    def __init__(self, path, map_bits):
+        fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o644)
+        try:
+            fcntl.flock(fd, fcntl.LOCK_EX)
+            if os.fstat(fd).st_size == 0:
+                os.ftruncate(fd, covmap_size(map_bits, COVMAP_DEFAULT_RING))
+                os.pwrite(fd, HEADER.pack(COVMAP_MAGIC, COVMAP_VERSION,
+                                          map_bits, COVMAP_DEFAULT_RING,
+                                          0, 0, 0, 0), 0)
+            magic, version, self.map_bits, self.ring_size = \
+                struct.unpack_from('=IIII', os.pread(fd, HEADER.size, 0))
+            if magic != COVMAP_MAGIC or version != COVMAP_VERSION:
+                sys.exit(f'{path}: not a coverage map')
+            self.map = mmap.mmap(fd, covmap_size(self.map_bits,
+                                                 self.ring_size))
+        finally:
+            fcntl.flock(fd, fcntl.LOCK_UN)
+            os.close(fd)
+        self.next_seq = self.header()['event_head']
+        self.lost = 0
+
+    def header(self):
+        fields = HEADER.unpack_from(self.map, 0)
+        return dict(zip(('magic', 'version', 'map_bits', 'ring_size',
+                         'covered', 'blocks', 'instances', 'event_head'),
+                        fields))
+
+    def events(self):
+        """Yield (pid, module, offset, size) of events not seen yet."""
+        head = self.header()['event_head']
+        while self.next_seq < head:
+            seq = self.next_seq
+            off = HEADER.size + (seq % self.ring_size) * EVENT.size
+            ev = EVENT.unpack_from(self.map, off)
+            again = struct.unpack_from('=Q', self.map, off)[0]
+            if ev[0] == seq + 1 and again == seq + 1:
+                _, pid, size, offset, module = ev
+                yield pid, module.split(b'\0')[0].decode(errors='replace'), \
+                    offset, size
+            elif ev[0] > seq + 1 or head - seq > self.ring_size:
+                # Overwritten before we got to it
+                self.lost += 1
+            else:
+                # Still being written; pick it up on the next tick
+                return
+            self.next_seq += 1
+
+
+def build_queue(args):
+    """Return a list of (label, argv, stdin path or None)."""
+    queue = []
+    if args.commands:
+        with open(args.commands) as f:
+            for line in f:
+                line = line.strip()
+                if line and not line.startswith('#'):
+                    queue.append((line, shlex.split(line), None))
+        return queue
+
+    if not args.command:
+        sys.exit('no command given (use -- command ... or --commands)')
+    files = []
+    for p in args.inputs or []:
+        if os.path.isdir(p):
+            files += sorted(os.path.join(p, n) for n in os.listdir(p)
+                            if os.path.isfile(os.path.join(p, n)))
+        else:
+            files.append(p)
+    if not files:
+        return [(shlex.join(args.command), args.command, None)]
+    for f in files:
+        if '@@' in args.command:
+            argv = [f if a == '@@' else a for a in args.command]
+            queue.append((f, argv, None))
+        else:
+            queue.append((f, args.command, f))
+    return queue
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Run microhook instances in parallel over a work queue, '
+                    'sharing one coverage map')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+                        help='instances to run at once (default: all cpus)')
+    parser.add_argument('--map', default='campaign.covmap',
+                        help='coverage map file (default: %(default)s)')
+    parser.add_argument('--map-bits', type=int, default=COVMAP_DEFAULT_BITS,
+                        help='log2 of the bitmap size when creating the map')
+    parser.add_argument('--inputs', nargs='+', metavar='PATH',
+                        help='input files or directories, substituted for @@ '
+                             'or fed on stdin')
+    parser.add_argument('--commands', metavar='FILE',
+                        help='file with one command line per line')
+    parser.add_argument('--timeout', type=float, default=0,
+                        help='kill instances running longer (seconds)')
+    parser.add_argument('--interval', type=float, default=1.0,
+                        help='seconds between status lines')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='pass the output of instances through')
+    parser.add_argument('command', nargs=argparse.REMAINDER,
+                        help='-- command line, with @@ for the input')
+    args = parser.parse_args()
+    if args.command and args.command[0] == '--':
+        args.command = args.command[1:]
+
+    queue = build_queue(args)
+    covmap = CoverageMap(args.map, args.map_bits)
+    env = dict(os.environ, QEMU_COVERAGE_MAP=os.path.abspath(args.map))
+    out = None if args.verbose else subprocess.DEVNULL
+
+    running = {}            # pid -> (label, start time, Popen)
+    labels = {}             # pid -> label, kept for late events
+    done = crashes = timeouts = 0
+    total = len(queue)
+    start = last_status = time.monotonic()
+    last_blocks = covmap.header()['blocks']
+
+    def status(now):
+        nonlocal last_status, last_blocks
+        hdr = covmap.header()
+        elapsed = now - start
+        rate = (hdr['blocks'] - last_blocks) / max(now - last_status, 1e-6)
+        print(f'[{elapsed:7.1f}s] runs {done}/{total} '
+              f'({done / max(elapsed, 1e-6):.1f}/s) running {len(running)} '
+              f'crashes {crashes} timeouts {timeouts} | '
+              f'covered {hdr["covered"]} '
+              f'blocks {hdr["blocks"]} ({rate:.0f}/s)'
+              + (f' lost-events {covmap.lost}' if covmap.lost else ''),
+              flush=True)
+        last_status = now
+        last_blocks = hdr['blocks']
+
+    def new_coverage():
+        for pid, module, offset, size in covmap.events():
+            where = f'{module}+{offset:#x}' if module else f'{offset:#x}'
+            print(f'new: {where} ({size} bytes) from {labels.get(pid, pid)}',
+                  flush=True)
+
+    try:
+        while queue or running:
+            while queue and len(running) < args.jobs:
+                label, argv, stdin_path = queue.pop(0)
+                stdin = open(stdin_path, 'rb') if stdin_path else \
+                    subprocess.DEVNULL
+                proc = subprocess.Popen(argv, env=env, stdin=stdin,
+                                        stdout=out, stderr=out)
+                if stdin_path:
+                    stdin.close()
+                running[proc.pid] = (label, time.monotonic(), proc)
+                labels[proc.pid] = label
+
+            now = time.monotonic()
+            for pid, (label, started, proc) in list(running.items()):
+                rc = proc.poll()
+                if rc is None:
+                    if args.timeout and now - started > args.timeout:
+                        proc.kill()
+                        proc.wait()
+                        timeouts += 1
+                        print(f'timeout: {label}', flush=True)
+                    else:
+                        continue
+                elif rc < 0:
+                    crashes += 1
+                    print(f'crash: {label} '
+                          f'({signal.Signals(-rc).name})', flush=True)
+                del running[pid]
+                done += 1
+
+            new_coverage()
+            if now - last_status >= args.interval:
+                status(now)
+            time.sleep(0.02)
+    except KeyboardInterrupt:
+        for label, started, proc in running.values():
+            proc.kill()
+            proc.wait()
+
+    new_coverage()
+    status(time.monotonic())
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+#
+# Expand a microhook -exec-trace file into instruction and memory streams
+#
+# Copyright (c) 2025 Thomas 'stacksmashing' Roth <code@stacksmashing.net>
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# The file is a zstd stream (or several, one per program run in the
+# process) of a header followed by chunks (see linux-user/microhook-trace.c
+# for the layout and linux-user/microhook-trace.h for the records). Block
+# table chunks describe every translated block; record chunks hold what one
+# thread executed, as block ids and memory addresses. Output is one line
+# per executed instruction, followed by the memory it accessed:
+#
+#   microhook-trace.py out.trace
+#   1234 0x400580
+#   1234 0x400584
+#   1234   R4 0x7ffe0010
+#
+# Needs the zstandard module, or Python 3.14, or the zstd command.
+
+import argparse
+import shutil
+import struct
+import subprocess
+import sys
+
+TRACE_MAGIC = b'MHTRACE\0'
+TRACE_FLAG_MEM = 1
+
+CHUNK_BLOCKS = 1
+CHUNK_RECORDS = 2
+
+TAG_SHIFT = 56
+TAG_TB = 0x01
+TAG_PARTIAL = 0x02
+TAG_LOST = 0x03
+TAG_MEM = 0x80
+SITES = 127
+SITE_W = 0x10
+SITE_RMW = 0x20
+
+ZSTD_MAGIC = b'\x28\xb5\x2f\xfd'
+
+# TraceHeader: magic, version, flags, pid, reserved, target
+HEADER = struct.Struct('=8sIIII16s')
+# TraceChunk: type, tid, size, reserved
+CHUNK = struct.Struct('=IIII')
+# TraceBlock: id, icount, nb_sites, pc
+BLOCK = struct.Struct('=IHHQ')
+
+
+def decompress(data):
+    if not data.startswith(ZSTD_MAGIC):
+        return data
+    try:
+        import zstandard
+        reader = zstandard.ZstdDecompressor().stream_reader(
+            data, read_across_frames=True)
+        return reader.read()
+    except ImportError:
+        pass
+    try:
+        from compression import zstd
+        return zstd.decompress(data)
+    except ImportError:
+        pass
+    if shutil.which('zstd'):
+        return subprocess.run(['zstd', '-dc'], input=data, check=True,
+                              stdout=subprocess.PIPE).stdout
+    sys.exit('microhook-trace: install the zstandard module or zstd to '
+             'read compressed traces')
+
+
+class Block:
+    def __init__(self, pc, insn_off, sites):
+        self.pc = pc
+        self.insn_off = insn_off
+        self.sites = sites
+
+
+class Thread:
+    """Expands the records of one thread, a block execution at a time"""
+
+    def __init__(self, tid, out, args):
+        self.tid = tid
+        self.out = out
+        self.args = args
+        self.block = None
+        self.accesses = []
+        self.executed = None
+
+    def access_text(self, site, addr):
+        if site >= len(self.block.sites):
+            return '  ?? 0x%x' % addr
+        desc = self.block.sites[site]
+        kind = 'A' if desc & SITE_RMW else 'W' if desc & SITE_W else 'R'
+        return '  %s%d 0x%x' % (kind, 1 << (desc & 7), addr)
+
+    def end_block(self):
+        """Print the block execution collected so far"""
+        b = self.block
+        if b is None:
+            return
+        n = len(b.insn_off) if self.executed is None else self.executed
+        if self.args.blocks:
+            suffix = '' if n == len(b.insn_off) else ' (%d insns)' % n
+            self.out.write('%d 0x%x%s\n' % (self.tid, b.pc, suffix))
+        else:
+            by_insn = {}
+            late = []
+            for site, addr in self.accesses:
+                insn = b.sites[site] >> 8 if site < len(b.sites) else None
+                if insn is not None and insn < n:
+                    by_insn.setdefault(insn, []).append((site, addr))
+                else:
+                    late.append((site, addr))
+            for i in range(n):
+                self.out.write('%d 0x%x\n' % (self.tid, b.pc + b.insn_off[i]))
+                for site, addr in by_insn.get(i, ()):
+                    self.out.write('%d %s\n' % (self.tid,
+                                                self.access_text(site, addr)))
+            # Accesses of a faulting instruction or beyond the site table
+            for site, addr in late:
+                self.out.write('%d %s\n' % (self.tid,
+                                            self.access_text(site, addr)))
+        self.block = None
+        self.accesses = []
+        self.executed = None
+
+    def record(self, rec, blocks):
+        tag = rec >> TAG_SHIFT
+        if tag & TAG_MEM:
+            if self.block is not None and not self.args.no_mem:
+                self.accesses.append((tag & SITES, rec & ((1 << TAG_SHIFT) - 1)))
+        elif tag == TAG_TB:
+            self.end_block()
+            self.block = blocks.get(rec & 0xffffffff)
+            if self.block is None:
+                self.out.write('%d unknown block %d\n' %
+                               (self.tid, rec & 0xffffffff))
+        elif tag == TAG_PARTIAL:
+            self.executed = rec & 0xffffffff
+        elif tag == TAG_LOST:
+            self.end_block()
+            self.out.write('%d records lost\n' % self.tid)
+
+
+def parse_blocks(data, blocks):
+    off = 0
+    while off < len(data):
+        bid, icount, nb_sites, pc = BLOCK.unpack_from(data, off)
+        off += BLOCK.size
+        insn_off = struct.unpack_from('=%dI' % icount, data, off)
+        off += 4 * icount
+        sites = struct.unpack_from('=%dI' % nb_sites, data, off)
+        off += 4 * nb_sites
+        blocks[bid] = Block(pc, insn_off, sites)
+
+
+def decode(data, out, args):
+    blocks = {}
+    threads = {}
+    off = 0
+    while off < len(data):
+        if data.startswith(TRACE_MAGIC, off):
+            # A program started by execve() continues here
+            for t in threads.values():
+                t.end_block()
+            _, version, flags, pid, _, target = HEADER.unpack_from(data, off)
+            off += HEADER.size
+            blocks = {}
+            threads = {}
+            if args.verbose:
+                sys.stderr.write('pid %d, %s%s\n' % (
+                    pid, target.rstrip(b'\0').decode(),
+                    ', memory accesses' if flags & TRACE_FLAG_MEM else ''))
+            continue
+        ctype, tid, size, _ = CHUNK.unpack_from(data, off)
+        off += CHUNK.size
+        payload = data[off:off + size]
+        off += size
+        if ctype == CHUNK_BLOCKS:
+            parse_blocks(payload, blocks)
+        elif ctype == CHUNK_RECORDS:
+            if args.thread is not None and tid != args.thread:
+                continue
+            t = threads.get(tid)
+            if t is None:
+                t = threads[tid] = Thread(tid, out, args)
+            for (rec,) in struct.iter_unpack('=Q', payload):
+                t.record(rec, blocks)
+    for t in threads.values():
+        t.end_block()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Expand a microhook -exec-trace file')
+    parser.add_argument('trace', help='file written by -exec-trace')
+    parser.add_argument('--blocks', action='store_true',
+                        help='one line per executed block instead of per '
+                             'instruction')
+    parser.add_argument('--no-mem', action='store_true',
+                        help='leave out memory accesses')
+    parser.add_argument('--thread', type=int,
+                        help='only the thread with this host tid')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='describe each program in the trace on stderr')
+    args = parser.parse_args()
+
+    with open(args.trace, 'rb') as f:
+        data = decompress(f.read())
+    try:
+        decode(data, sys.stdout, args)
+    except BrokenPipeError:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -473,6 +473,11 @@ struct TCState {
     target_ulong LO[MIPS_DSP_ACC];
     target_ulong ACX[MIPS_DSP_ACC];
     target_ulong DSPControl;
+    /*
+     * Overflows recorded by inline DSP code and not yet folded into the
+     * DSPControl ouflag field: entry i is non-zero if bit 16 + i is set.
+     */
+    uint32_t DSPOverflow[8];
     int32_t CP0_TCStatus;
 #define CP0TCSt_TCU3    31
 #define CP0TCSt_TCU2    30
@@ -1234,6 +1239,21 @@ struct MIPSCPUClass {
 void cpu_wrdsp(uint32_t rs, uint32_t mask_num, CPUMIPSState *env);
 uint32_t cpu_rddsp(uint32_t mask_num, CPUMIPSState *env);
 
+static inline void tc_dsp_sync_overflow(TCState *tc)
+{
+    for (int i = 0; i < ARRAY_SIZE(tc->DSPOverflow); i++) {
+        if (tc->DSPOverflow[i]) {
+            tc->DSPControl |= 1 << (16 + i);
+            tc->DSPOverflow[i] = 0;
+        }
+    }
+}
+
+static inline void cpu_dsp_sync_overflow(CPUMIPSState *env)
+{
+    tc_dsp_sync_overflow(&env->active_tc);
+}
+
 /*
  * MMU modes definitions. We carefully match the indices with our
  * hflags layout.
@@ -64,6 +64,27 @@ static inline void restore_fp_status(CPUMIPSState *env)
     restore_snan_bit_mode(env);
 }
 
+/*
+ * An inexact result that cannot trap is left pending in fp_status instead
+ * of being copied to FCSR by each FP instruction: with float_flag_inexact
+ * sticky, softfloat can compute on the host FPU. Fold it into the FCSR
+ * Flags and Cause fields wherever the guest (or a debugger) can observe
+ * FCSR. Cause.I then reports whether any operation since the last sync
+ * was inexact, which is exact for the first operation after a sync.
+ */
+static inline void mips_fpu_sync_flags(CPUMIPSState *env)
+{
+    float_status *s = &env->active_fpu.fp_status;
+    int flags = get_float_exception_flags(s);
+
+    if (flags & float_flag_inexact) {
+        UPDATE_FP_FLAGS(env->active_fpu.fcr31, FP_INEXACT);
+        SET_FP_CAUSE(env->active_fpu.fcr31,
+                     GET_FP_CAUSE(env->active_fpu.fcr31) | FP_INEXACT);
+        set_float_exception_flags(flags & ~float_flag_inexact, s);
+    }
+}
+
 static inline void fp_reset(CPUMIPSState *env)
 {
     restore_fp_status(env);
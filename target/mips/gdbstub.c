@@ -33,6 +33,7 @@ int mips_cpu_gdb_read_register(CPUState *cs, GByteArray *mem_buf, int n)
     if (env->CP0_Config1 & (1 << CP0C1_FP) && n >= 38 && n < 72) {
         switch (n) {
         case 70:
+            mips_fpu_sync_flags(env);
             return gdb_get_regl(mem_buf, (int32_t)env->active_fpu.fcr31);
         case 71:
             return gdb_get_regl(mem_buf, (int32_t)env->active_fpu.fcr0);
@@ -89,6 +90,7 @@ int mips_cpu_gdb_write_register(CPUState *cs, uint8_t *mem_buf, int n)
     if (env->CP0_Config1 & (1 << CP0C1_FP) && n >= 38 && n < 72) {
         switch (n) {
         case 70:
+            mips_fpu_sync_flags(env);
             env->active_fpu.fcr31 = (tmp & env->active_fpu.fcr31_rw_bitmask) |
                   (env->active_fpu.fcr31 & ~(env->active_fpu.fcr31_rw_bitmask));
             restore_fp_status(env);
@@ -17,6 +17,16 @@ static int cpu_post_load(void *opaque, int version_id)
     return 0;
 }
 
+static int cpu_pre_save(void *opaque)
+{
+    MIPSCPU *cpu = opaque;
+
+    cpu_dsp_sync_overflow(&cpu->env);
+    mips_fpu_sync_flags(&cpu->env);
+
+    return 0;
+}
+
 /* FPU state */
 
 static int get_fpr(QEMUFile *f, void *pv, size_t size,
@@ -223,6 +233,7 @@ const VMStateDescription vmstate_mips_cpu = {
     .name = "cpu",
     .version_id = 21,
     .minimum_version_id = 21,
+    .pre_save = cpu_pre_save,
     .post_load = cpu_post_load,
     .fields = (const VMStateField[]) {
         /* Active TC */
@@ -3620,6 +3620,7 @@ void cpu_wrdsp(uint32_t rs, uint32_t mask_num, CPUMIPSState *env)
 
     newbits   = 0x00;
     overwrite = 0xFFFFFFFF;
+    cpu_dsp_sync_overflow(env);
     dsp = env->active_tc.DSPControl;
 
     for (i = 0; i < 6; i++) {
@@ -3696,6 +3697,7 @@ uint32_t cpu_rddsp(uint32_t mask_num, CPUMIPSState *env)
     }
 
     temp  = 0x00;
+    cpu_dsp_sync_overflow(env);
     dsp = env->active_tc.DSPControl;
 
     if (mask[0] == 1) {
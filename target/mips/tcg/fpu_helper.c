@@ -40,6 +40,8 @@ target_ulong helper_cfc1(CPUMIPSState *env, uint32_t reg)
 {
     target_ulong arg1 = 0;
 
+    mips_fpu_sync_flags(env);
+
     switch (reg) {
     case 0:
         arg1 = (int32_t)env->active_fpu.fcr0;
@@ -86,6 +88,8 @@ target_ulong helper_cfc1(CPUMIPSState *env, uint32_t reg)
 
 void helper_ctc1(CPUMIPSState *env, target_ulong arg1, uint32_t fs, uint32_t rt)
 {
+    mips_fpu_sync_flags(env);
+
     switch (fs) {
     case 1:
         /* UFR Alias - Reset Status FR */
@@ -205,6 +209,28 @@ static inline void update_fcr31(CPUMIPSState *env, uintptr_t pc)
                                    &env->active_fpu.fp_status);
     int mips_exception_flags = 0;
 
+    /*
+     * Nothing but an untrapped inexact result: leave it pending for
+     * mips_fpu_sync_flags() so that the next operation can use hardfloat.
+     * No other exception was raised, so Cause is clear apart from Cause.I,
+     * which mips_fpu_sync_flags() fills in.
+     */
+    if (likely(!(ieee_exception_flags & ~float_flag_inexact)) &&
+        !(GET_FP_ENABLE(env->active_fpu.fcr31) & FP_INEXACT)) {
+        SET_FP_CAUSE(env->active_fpu.fcr31, 0);
+        return;
+    }
+
+    /*
+     * Earlier operations may have left an inexact result pending, which
+     * only happens while inexact does not trap: fold it into Flags.I
+     * before the flags are cleared below. Cause is still computed from
+     * all the flags read above.
+     */
+    if (!(GET_FP_ENABLE(env->active_fpu.fcr31) & FP_INEXACT)) {
+        mips_fpu_sync_flags(env);
+    }
+
     if (ieee_exception_flags) {
         mips_exception_flags = ieee_to_mips_xcpt(ieee_exception_flags);
     }
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "translate.h"
 #include "fpu_helper.h"
+#include "tcg/tcg-op-gvec.h"
 
 static int elm_n(DisasContext *ctx, int x);
 static int elm_df(DisasContext *ctx, int x);
@@ -164,6 +165,83 @@ static inline bool check_msa_enabled(DisasContext *ctx)
     return true;
 }
 
+/*
+ * Common integer operations are expanded inline with TCG gvec, so that
+ * TCG can emit host vector instructions instead of calling an element
+ * loop helper.
+ *
+ * The gvec expanders operate on env memory, which the msa_wr_d[] globals
+ * alias. Sources are written back before an expansion, the destination is
+ * discarded before it and reloaded after it. Bitwise operations, moves and splats are cheaper
+ * done directly on the two 64-bit halves in the globals.
+ */
+
+/* Size in bytes of an MSA vector register */
+#define MSA_VLEN (MSA_WRLEN / 8)
+
+typedef void gen_gvec_3(unsigned, uint32_t, uint32_t, uint32_t,
+                        uint32_t, uint32_t);
+typedef void gen_gvec_2i(unsigned, uint32_t, uint32_t, int64_t,
+                         uint32_t, uint32_t);
+typedef void gen_i64_3(TCGv_i64, TCGv_i64, TCGv_i64);
+
+static inline uint32_t msa_wr_offset(int wr)
+{
+    return offsetof(CPUMIPSState, active_fpu.fpr[wr].wr);
+}
+
+static void gen_msa_wr_writeback(int wr)
+{
+    tcg_gen_st_i64(msa_wr_d[wr * 2], tcg_env,
+                   msa_wr_offset(wr) + offsetof(wr_t, d[0]));
+    tcg_gen_st_i64(msa_wr_d[wr * 2 + 1], tcg_env,
+                   msa_wr_offset(wr) + offsetof(wr_t, d[1]));
+}
+
+/*
+ * Forget wd's cached value before an expansion stores to it, so that a
+ * dirty global is never spilled over the result. Sources that alias wd
+ * have been written back already.
+ */
+static void gen_msa_wr_discard(int wr)
+{
+    tcg_gen_discard_i64(msa_wr_d[wr * 2]);
+    tcg_gen_discard_i64(msa_wr_d[wr * 2 + 1]);
+}
+
+static void gen_msa_wr_reload(int wr)
+{
+    tcg_gen_ld_i64(msa_wr_d[wr * 2], tcg_env,
+                   msa_wr_offset(wr) + offsetof(wr_t, d[0]));
+    tcg_gen_ld_i64(msa_wr_d[wr * 2 + 1], tcg_env,
+                   msa_wr_offset(wr) + offsetof(wr_t, d[1]));
+}
+
+/* Set both halves of wd to the 64-bit value t */
+static void gen_msa_wr_dup(int wd, TCGv_i64 t)
+{
+    tcg_gen_mov_i64(msa_wr_d[wd * 2], t);
+    tcg_gen_mov_i64(msa_wr_d[wd * 2 + 1], t);
+}
+
+/* d = (a & b) | (~a & c) for each 64-bit half */
+static void gen_msa_bitsel(int wd, const TCGv_i64 *a, const TCGv_i64 *b,
+                           const TCGv_i64 *c)
+{
+    TCGv_i64 t = tcg_temp_new_i64();
+
+    for (int i = 0; i < 2; i++) {
+        tcg_gen_and_i64(t, b[i], a[i]);
+        tcg_gen_andc_i64(msa_wr_d[wd * 2 + i], c[i], a[i]);
+        tcg_gen_or_i64(msa_wr_d[wd * 2 + i], msa_wr_d[wd * 2 + i], t);
+    }
+}
+
+static inline const TCGv_i64 *msa_wr_pair(int wr)
+{
+    return &msa_wr_d[wr * 2];
+}
+
 typedef void gen_helper_piv(TCGv_ptr, TCGv_i32, TCGv);
 typedef void gen_helper_pii(TCGv_ptr, TCGv_i32, TCGv_i32);
 typedef void gen_helper_piii(TCGv_ptr, TCGv_i32, TCGv_i32, TCGv_i32);
@@ -175,9 +253,6 @@ typedef void gen_helper_piiii(TCGv_ptr, TCGv_i32, TCGv_i32, TCGv_i32, TCGv_i32);
     }; \
     TRANS(NAME, trans_func, NAME##_tab[a->df])
 
-#define TRANS_DF_iv(NAME, trans_func, gen_func) \
-    TRANS_DF_x(iv, NAME, trans_func, gen_func)
-
 #define TRANS_DF_ii(NAME, trans_func, gen_func) \
     TRANS_DF_x(ii, NAME, trans_func, gen_func)
 
@@ -281,28 +356,73 @@ static bool trans_BNZ(DisasContext *ctx, arg_msa_bz *a)
     return gen_msa_BxZ(ctx, a->df, a->wt, a->sa, true);
 }
 
-static bool trans_msa_i8(DisasContext *ctx, arg_msa_i *a,
-                         gen_helper_piii *gen_msa_i8)
+static bool trans_msa_i8_logic(DisasContext *ctx, arg_msa_i *a,
+                               gen_i64_3 *gen_logic, bool invert)
 {
+    TCGv_i64 imm;
+
     if (!check_msa_enabled(ctx)) {
         return true;
     }
 
-    gen_msa_i8(tcg_env,
-               tcg_constant_i32(a->wd),
-               tcg_constant_i32(a->ws),
-               tcg_constant_i32(a->sa));
+    imm = tcg_constant_i64(dup_const(MO_8, a->sa));
+    for (int i = 0; i < 2; i++) {
+        gen_logic(msa_wr_d[a->wd * 2 + i], msa_wr_d[a->ws * 2 + i], imm);
+        if (invert) {
+            tcg_gen_not_i64(msa_wr_d[a->wd * 2 + i],
+                            msa_wr_d[a->wd * 2 + i]);
+        }
+    }
+
+    return true;
+}
+
+TRANS(ANDI,     trans_msa_i8_logic, tcg_gen_and_i64, false);
+TRANS(ORI,      trans_msa_i8_logic, tcg_gen_or_i64, false);
+TRANS(NORI,     trans_msa_i8_logic, tcg_gen_or_i64, true);
+TRANS(XORI,     trans_msa_i8_logic, tcg_gen_xor_i64, false);
+
+static bool trans_BMNZI(DisasContext *ctx, arg_msa_i *a)
+{
+    TCGv_i64 imm[2];
+
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    imm[0] = imm[1] = tcg_constant_i64(dup_const(MO_8, a->sa));
+    gen_msa_bitsel(a->wd, imm, msa_wr_pair(a->ws), msa_wr_pair(a->wd));
 
     return true;
 }
 
-TRANS(ANDI,     trans_msa_i8, gen_helper_msa_andi_b);
-TRANS(ORI,      trans_msa_i8, gen_helper_msa_ori_b);
-TRANS(NORI,     trans_msa_i8, gen_helper_msa_nori_b);
-TRANS(XORI,     trans_msa_i8, gen_helper_msa_xori_b);
-TRANS(BMNZI,    trans_msa_i8, gen_helper_msa_bmnzi_b);
-TRANS(BMZI,     trans_msa_i8, gen_helper_msa_bmzi_b);
-TRANS(BSELI,    trans_msa_i8, gen_helper_msa_bseli_b);
+static bool trans_BMZI(DisasContext *ctx, arg_msa_i *a)
+{
+    TCGv_i64 imm[2];
+
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    imm[0] = imm[1] = tcg_constant_i64(dup_const(MO_8, a->sa));
+    gen_msa_bitsel(a->wd, imm, msa_wr_pair(a->wd), msa_wr_pair(a->ws));
+
+    return true;
+}
+
+static bool trans_BSELI(DisasContext *ctx, arg_msa_i *a)
+{
+    TCGv_i64 imm[2];
+
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    imm[0] = imm[1] = tcg_constant_i64(dup_const(MO_8, a->sa));
+    gen_msa_bitsel(a->wd, msa_wr_pair(a->wd), imm, msa_wr_pair(a->ws));
+
+    return true;
+}
 
 static bool trans_SHF(DisasContext *ctx, arg_msa_i *a)
 {
@@ -339,17 +459,49 @@ static bool trans_msa_i5(DisasContext *ctx, arg_msa_i *a,
     return true;
 }
 
-TRANS(ADDVI,    trans_msa_i5, gen_helper_msa_addvi_df);
-TRANS(SUBVI,    trans_msa_i5, gen_helper_msa_subvi_df);
+static bool trans_msa_i5_gvec(DisasContext *ctx, arg_msa_i *a,
+                              gen_gvec_2i *gen_gvec, bool negate)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_wr_writeback(a->ws);
+    gen_msa_wr_discard(a->wd);
+    gen_gvec(a->df, msa_wr_offset(a->wd), msa_wr_offset(a->ws),
+             negate ? -a->sa : a->sa, MSA_VLEN, MSA_VLEN);
+    gen_msa_wr_reload(a->wd);
+
+    return true;
+}
+
+TRANS(ADDVI,    trans_msa_i5_gvec, tcg_gen_gvec_addi, false);
+TRANS(SUBVI,    trans_msa_i5_gvec, tcg_gen_gvec_addi, true);
 TRANS(MAXI_S,   trans_msa_i5, gen_helper_msa_maxi_s_df);
 TRANS(MAXI_U,   trans_msa_i5, gen_helper_msa_maxi_u_df);
 TRANS(MINI_S,   trans_msa_i5, gen_helper_msa_mini_s_df);
 TRANS(MINI_U,   trans_msa_i5, gen_helper_msa_mini_u_df);
-TRANS(CLTI_S,   trans_msa_i5, gen_helper_msa_clti_s_df);
-TRANS(CLTI_U,   trans_msa_i5, gen_helper_msa_clti_u_df);
-TRANS(CLEI_S,   trans_msa_i5, gen_helper_msa_clei_s_df);
-TRANS(CLEI_U,   trans_msa_i5, gen_helper_msa_clei_u_df);
-TRANS(CEQI,     trans_msa_i5, gen_helper_msa_ceqi_df);
+
+static bool trans_msa_cmpi(DisasContext *ctx, arg_msa_i *a, TCGCond cond)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_wr_writeback(a->ws);
+    gen_msa_wr_discard(a->wd);
+    tcg_gen_gvec_cmpi(cond, a->df, msa_wr_offset(a->wd),
+                      msa_wr_offset(a->ws), a->sa, MSA_VLEN, MSA_VLEN);
+    gen_msa_wr_reload(a->wd);
+
+    return true;
+}
+
+TRANS(CLTI_S,   trans_msa_cmpi, TCG_COND_LT);
+TRANS(CLTI_U,   trans_msa_cmpi, TCG_COND_LTU);
+TRANS(CLEI_S,   trans_msa_cmpi, TCG_COND_LE);
+TRANS(CLEI_U,   trans_msa_cmpi, TCG_COND_LEU);
+TRANS(CEQI,     trans_msa_cmpi, TCG_COND_EQ);
 
 static bool trans_LDI(DisasContext *ctx, arg_msa_ldi *a)
 {
@@ -357,10 +509,7 @@ static bool trans_LDI(DisasContext *ctx, arg_msa_ldi *a)
         return true;
     }
 
-    gen_helper_msa_ldi_df(tcg_env,
-                          tcg_constant_i32(a->df),
-                          tcg_constant_i32(a->wd),
-                          tcg_constant_i32(a->sa));
+    gen_msa_wr_dup(a->wd, tcg_constant_i64(dup_const(a->df, a->sa)));
 
     return true;
 }
@@ -385,9 +534,29 @@ static bool trans_msa_bit(DisasContext *ctx, arg_msa_bit *a,
     return true;
 }
 
-TRANS(SLLI,     trans_msa_bit, gen_helper_msa_slli_df);
-TRANS(SRAI,     trans_msa_bit, gen_helper_msa_srai_df);
-TRANS(SRLI,     trans_msa_bit, gen_helper_msa_srli_df);
+static bool trans_msa_bit_gvec(DisasContext *ctx, arg_msa_bit *a,
+                               gen_gvec_2i *gen_gvec)
+{
+    if (a->df < 0) {
+        return false;
+    }
+
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_wr_writeback(a->ws);
+    gen_msa_wr_discard(a->wd);
+    gen_gvec(a->df, msa_wr_offset(a->wd), msa_wr_offset(a->ws), a->m,
+             MSA_VLEN, MSA_VLEN);
+    gen_msa_wr_reload(a->wd);
+
+    return true;
+}
+
+TRANS(SLLI,     trans_msa_bit_gvec, tcg_gen_gvec_shli);
+TRANS(SRAI,     trans_msa_bit_gvec, tcg_gen_gvec_sari);
+TRANS(SRLI,     trans_msa_bit_gvec, tcg_gen_gvec_shri);
 TRANS(BCLRI,    trans_msa_bit, gen_helper_msa_bclri_df);
 TRANS(BSETI,    trans_msa_bit, gen_helper_msa_bseti_df);
 TRANS(BNEGI,    trans_msa_bit, gen_helper_msa_bnegi_df);
@@ -433,37 +602,154 @@ static bool trans_msa_3r(DisasContext *ctx, arg_msa_r *a,
     return true;
 }
 
-TRANS(AND_V,            trans_msa_3r,   gen_helper_msa_and_v);
-TRANS(OR_V,             trans_msa_3r,   gen_helper_msa_or_v);
-TRANS(NOR_V,            trans_msa_3r,   gen_helper_msa_nor_v);
-TRANS(XOR_V,            trans_msa_3r,   gen_helper_msa_xor_v);
-TRANS(BMNZ_V,           trans_msa_3r,   gen_helper_msa_bmnz_v);
-TRANS(BMZ_V,            trans_msa_3r,   gen_helper_msa_bmz_v);
-TRANS(BSEL_V,           trans_msa_3r,   gen_helper_msa_bsel_v);
+static bool trans_msa_3r_gvec(DisasContext *ctx, arg_msa_r *a,
+                              gen_gvec_3 *gen_gvec)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_wr_writeback(a->ws);
+    gen_msa_wr_writeback(a->wt);
+    gen_msa_wr_discard(a->wd);
+    gen_gvec(a->df, msa_wr_offset(a->wd), msa_wr_offset(a->ws),
+             msa_wr_offset(a->wt), MSA_VLEN, MSA_VLEN);
+    gen_msa_wr_reload(a->wd);
+
+    return true;
+}
+
+static bool trans_msa_cmp(DisasContext *ctx, arg_msa_r *a, TCGCond cond)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_wr_writeback(a->ws);
+    gen_msa_wr_writeback(a->wt);
+    gen_msa_wr_discard(a->wd);
+    tcg_gen_gvec_cmp(cond, a->df, msa_wr_offset(a->wd),
+                     msa_wr_offset(a->ws), msa_wr_offset(a->wt),
+                     MSA_VLEN, MSA_VLEN);
+    gen_msa_wr_reload(a->wd);
+
+    return true;
+}
+
+static bool trans_msa_3r_logic(DisasContext *ctx, arg_msa_r *a,
+                               gen_i64_3 *gen_logic)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        gen_logic(msa_wr_d[a->wd * 2 + i], msa_wr_d[a->ws * 2 + i],
+                  msa_wr_d[a->wt * 2 + i]);
+    }
+
+    return true;
+}
+
+/*
+ * Interleave and pack of doublewords only move whole halves: wd gets
+ * the given half of wt (low) and of ws (high). Other formats use the
+ * helper.
+ */
+static bool trans_msa_3r_shuffle(DisasContext *ctx, arg_msa_r *a,
+                                 gen_helper_piii * const gen_msa_3r[4],
+                                 int half)
+{
+    TCGv_i64 lo, hi;
+
+    if (a->df != DF_DOUBLE) {
+        return trans_msa_3r(ctx, a, gen_msa_3r[a->df]);
+    }
+
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    lo = tcg_temp_new_i64();
+    hi = tcg_temp_new_i64();
+    tcg_gen_mov_i64(lo, msa_wr_d[a->wt * 2 + half]);
+    tcg_gen_mov_i64(hi, msa_wr_d[a->ws * 2 + half]);
+    tcg_gen_mov_i64(msa_wr_d[a->wd * 2], lo);
+    tcg_gen_mov_i64(msa_wr_d[a->wd * 2 + 1], hi);
+
+    return true;
+}
+
+#define TRANS_DF_iii_d(NAME, half, gen_func) \
+    static gen_helper_piii * const NAME##_tab[4] = { \
+        gen_func##_b, gen_func##_h, gen_func##_w, gen_func##_d \
+    }; \
+    TRANS(NAME, trans_msa_3r_shuffle, NAME##_tab, half)
+
+TRANS(AND_V,            trans_msa_3r_logic, tcg_gen_and_i64);
+TRANS(OR_V,             trans_msa_3r_logic, tcg_gen_or_i64);
+TRANS(NOR_V,            trans_msa_3r_logic, tcg_gen_nor_i64);
+TRANS(XOR_V,            trans_msa_3r_logic, tcg_gen_xor_i64);
+
+static bool trans_BMNZ_V(DisasContext *ctx, arg_msa_r *a)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_bitsel(a->wd, msa_wr_pair(a->wt), msa_wr_pair(a->ws),
+                   msa_wr_pair(a->wd));
+
+    return true;
+}
+
+static bool trans_BMZ_V(DisasContext *ctx, arg_msa_r *a)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_bitsel(a->wd, msa_wr_pair(a->wt), msa_wr_pair(a->wd),
+                   msa_wr_pair(a->ws));
+
+    return true;
+}
 
-TRANS_DF_iii(SLL,       trans_msa_3r,   gen_helper_msa_sll);
-TRANS_DF_iii(SRA,       trans_msa_3r,   gen_helper_msa_sra);
-TRANS_DF_iii(SRL,       trans_msa_3r,   gen_helper_msa_srl);
+static bool trans_BSEL_V(DisasContext *ctx, arg_msa_r *a)
+{
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    gen_msa_bitsel(a->wd, msa_wr_pair(a->wd), msa_wr_pair(a->wt),
+                   msa_wr_pair(a->ws));
+
+    return true;
+}
+
+TRANS(SLL,              trans_msa_3r_gvec, tcg_gen_gvec_shlv);
+TRANS(SRA,              trans_msa_3r_gvec, tcg_gen_gvec_sarv);
+TRANS(SRL,              trans_msa_3r_gvec, tcg_gen_gvec_shrv);
 TRANS_DF_iii(BCLR,      trans_msa_3r,   gen_helper_msa_bclr);
 TRANS_DF_iii(BSET,      trans_msa_3r,   gen_helper_msa_bset);
 TRANS_DF_iii(BNEG,      trans_msa_3r,   gen_helper_msa_bneg);
 TRANS_DF_iii(BINSL,     trans_msa_3r,   gen_helper_msa_binsl);
 TRANS_DF_iii(BINSR,     trans_msa_3r,   gen_helper_msa_binsr);
 
-TRANS_DF_iii(ADDV,      trans_msa_3r,   gen_helper_msa_addv);
-TRANS_DF_iii(SUBV,      trans_msa_3r,   gen_helper_msa_subv);
-TRANS_DF_iii(MAX_S,     trans_msa_3r,   gen_helper_msa_max_s);
-TRANS_DF_iii(MAX_U,     trans_msa_3r,   gen_helper_msa_max_u);
-TRANS_DF_iii(MIN_S,     trans_msa_3r,   gen_helper_msa_min_s);
-TRANS_DF_iii(MIN_U,     trans_msa_3r,   gen_helper_msa_min_u);
+TRANS(ADDV,             trans_msa_3r_gvec, tcg_gen_gvec_add);
+TRANS(SUBV,             trans_msa_3r_gvec, tcg_gen_gvec_sub);
+TRANS(MAX_S,            trans_msa_3r_gvec, tcg_gen_gvec_smax);
+TRANS(MAX_U,            trans_msa_3r_gvec, tcg_gen_gvec_umax);
+TRANS(MIN_S,            trans_msa_3r_gvec, tcg_gen_gvec_smin);
+TRANS(MIN_U,            trans_msa_3r_gvec, tcg_gen_gvec_umin);
 TRANS_DF_iii(MAX_A,     trans_msa_3r,   gen_helper_msa_max_a);
 TRANS_DF_iii(MIN_A,     trans_msa_3r,   gen_helper_msa_min_a);
 
-TRANS_DF_iii(CEQ,       trans_msa_3r,   gen_helper_msa_ceq);
-TRANS_DF_iii(CLT_S,     trans_msa_3r,   gen_helper_msa_clt_s);
-TRANS_DF_iii(CLT_U,     trans_msa_3r,   gen_helper_msa_clt_u);
-TRANS_DF_iii(CLE_S,     trans_msa_3r,   gen_helper_msa_cle_s);
-TRANS_DF_iii(CLE_U,     trans_msa_3r,   gen_helper_msa_cle_u);
+TRANS(CEQ,              trans_msa_cmp,  TCG_COND_EQ);
+TRANS(CLT_S,            trans_msa_cmp,  TCG_COND_LT);
+TRANS(CLT_U,            trans_msa_cmp,  TCG_COND_LTU);
+TRANS(CLE_S,            trans_msa_cmp,  TCG_COND_LE);
+TRANS(CLE_U,            trans_msa_cmp,  TCG_COND_LEU);
 
 TRANS_DF_iii(ADD_A,     trans_msa_3r,   gen_helper_msa_add_a);
 TRANS_DF_iii(ADDS_A,    trans_msa_3r,   gen_helper_msa_adds_a);
@@ -481,7 +767,7 @@ TRANS_DF_iii(SUBSUU_S,  trans_msa_3r,   gen_helper_msa_subsuu_s);
 TRANS_DF_iii(ASUB_S,    trans_msa_3r,   gen_helper_msa_asub_s);
 TRANS_DF_iii(ASUB_U,    trans_msa_3r,   gen_helper_msa_asub_u);
 
-TRANS_DF_iii(MULV,      trans_msa_3r,   gen_helper_msa_mulv);
+TRANS(MULV,             trans_msa_3r_gvec, tcg_gen_gvec_mul);
 TRANS_DF_iii(MADDV,     trans_msa_3r,   gen_helper_msa_maddv);
 TRANS_DF_iii(MSUBV,     trans_msa_3r,   gen_helper_msa_msubv);
 TRANS_DF_iii(DIV_S,     trans_msa_3r,   gen_helper_msa_div_s);
@@ -498,12 +784,12 @@ TRANS_DF_iii_b(DPSUB_U, trans_msa_3r,   gen_helper_msa_dpsub_u);
 
 TRANS(SLD,              trans_msa_3rf,  gen_helper_msa_sld_df);
 TRANS(SPLAT,            trans_msa_3rf,  gen_helper_msa_splat_df);
-TRANS_DF_iii(PCKEV,     trans_msa_3r,   gen_helper_msa_pckev);
-TRANS_DF_iii(PCKOD,     trans_msa_3r,   gen_helper_msa_pckod);
-TRANS_DF_iii(ILVL,      trans_msa_3r,   gen_helper_msa_ilvl);
-TRANS_DF_iii(ILVR,      trans_msa_3r,   gen_helper_msa_ilvr);
-TRANS_DF_iii(ILVEV,     trans_msa_3r,   gen_helper_msa_ilvev);
-TRANS_DF_iii(ILVOD,     trans_msa_3r,   gen_helper_msa_ilvod);
+TRANS_DF_iii_d(PCKEV,   0,              gen_helper_msa_pckev);
+TRANS_DF_iii_d(PCKOD,   1,              gen_helper_msa_pckod);
+TRANS_DF_iii_d(ILVL,    1,              gen_helper_msa_ilvl);
+TRANS_DF_iii_d(ILVR,    0,              gen_helper_msa_ilvr);
+TRANS_DF_iii_d(ILVEV,   0,              gen_helper_msa_ilvev);
+TRANS_DF_iii_d(ILVOD,   1,              gen_helper_msa_ilvod);
 
 TRANS(VSHF,             trans_msa_3rf,  gen_helper_msa_vshf_df);
 TRANS_DF_iii(SRAR,      trans_msa_3r,   gen_helper_msa_srar);
@@ -519,9 +805,8 @@ static bool trans_MOVE_V(DisasContext *ctx, arg_msa_elm *a)
         return true;
     }
 
-    gen_helper_msa_move_v(tcg_env,
-                          tcg_constant_i32(a->wd),
-                          tcg_constant_i32(a->ws));
+    tcg_gen_mov_i64(msa_wr_d[a->wd * 2], msa_wr_d[a->ws * 2]);
+    tcg_gen_mov_i64(msa_wr_d[a->wd * 2 + 1], msa_wr_d[a->ws * 2 + 1]);
 
     return true;
 }
@@ -579,9 +864,33 @@ static bool trans_msa_elm(DisasContext *ctx, arg_msa_elm_df *a,
 }
 
 TRANS(SLDI,   trans_msa_elm, gen_helper_msa_sldi_df);
-TRANS(SPLATI, trans_msa_elm, gen_helper_msa_splati_df);
 TRANS(INSVE,  trans_msa_elm, gen_helper_msa_insve_df);
 
+static bool trans_SPLATI(DisasContext *ctx, arg_msa_elm_df *a)
+{
+    int bits, per_half;
+    TCGv_i64 t;
+
+    if (a->df < 0) {
+        return false;
+    }
+
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    /* Element n lives in half n / per_half, at bit (n % per_half) * bits */
+    bits = 8 << a->df;
+    per_half = 64 / bits;
+    t = tcg_temp_new_i64();
+    tcg_gen_extract_i64(t, msa_wr_d[a->ws * 2 + a->n / per_half],
+                        (a->n % per_half) * bits, bits);
+    tcg_gen_dup_i64(a->df, t, t);
+    gen_msa_wr_dup(a->wd, t);
+
+    return true;
+}
+
 static bool trans_msa_elm_fn(DisasContext *ctx, arg_msa_elm_df *a,
                              gen_helper_piii * const gen_msa_elm[4])
 {
@@ -709,6 +1018,9 @@ TRANS_DF_ii(NLZC, trans_msa_2r, gen_helper_msa_nlzc);
 
 static bool trans_FILL(DisasContext *ctx, arg_msa_r *a)
 {
+    TCGv telm;
+    TCGv_i64 t;
+
     if (TARGET_LONG_BITS != 64 && a->df == DF_DOUBLE) {
         /* Double format valid only for MIPS64 */
         return false;
@@ -718,10 +1030,13 @@ static bool trans_FILL(DisasContext *ctx, arg_msa_r *a)
         return true;
     }
 
-    gen_helper_msa_fill_df(tcg_env,
-                           tcg_constant_i32(a->df),
-                           tcg_constant_i32(a->wd),
-                           tcg_constant_i32(a->ws));
+    telm = tcg_temp_new();
+    t = tcg_temp_new_i64();
+
+    gen_load_gpr(telm, a->ws);
+    tcg_gen_ext_tl_i64(t, telm);
+    tcg_gen_dup_i64(a->df, t, t);
+    gen_msa_wr_dup(a->wd, t);
 
     return true;
 }
@@ -758,25 +1073,101 @@ TRANS(FTINT_U,  trans_msa_2rf, gen_helper_msa_ftint_u_df);
 TRANS(FFINT_S,  trans_msa_2rf, gen_helper_msa_ffint_s_df);
 TRANS(FFINT_U,  trans_msa_2rf, gen_helper_msa_ffint_u_df);
 
-static bool trans_msa_ldst(DisasContext *ctx, arg_msa_i *a,
-                           gen_helper_piv *gen_msa_ldst)
+/*
+ * Vectors are transferred as two little-endian doublewords; for a
+ * big-endian target the elements are then swapped in place, exactly as
+ * helper_msa_ld_{b,h,w,d} do. The transform is its own inverse, so
+ * stores use it too.
+ */
+static void gen_msa_ldst_swap(DisasContext *ctx, TCGv_i64 t, int df)
+{
+    if (!disas_is_bigendian(ctx) || df == DF_BYTE) {
+        return;
+    }
+
+    tcg_gen_bswap64_i64(t, t);
+    switch (df) {
+    case DF_HALF:
+        tcg_gen_hswap_i64(t, t);
+        break;
+    case DF_WORD:
+        tcg_gen_wswap_i64(t, t);
+        break;
+    }
+}
+
+static bool trans_LD(DisasContext *ctx, arg_msa_i *a)
 {
     TCGv taddr;
+    TCGv_i64 d0, d1;
 
     if (!check_msa_enabled(ctx)) {
         return true;
     }
 
     taddr = tcg_temp_new();
+    d0 = tcg_temp_new_i64();
+    d1 = tcg_temp_new_i64();
 
     gen_base_offset_addr(ctx, taddr, a->ws, a->sa << a->df);
-    gen_msa_ldst(tcg_env, tcg_constant_i32(a->wd), taddr);
+    tcg_gen_qemu_ld_i64(d0, taddr, ctx->mem_idx, MO_LE | MO_UQ);
+    tcg_gen_addi_tl(taddr, taddr, 8);
+    tcg_gen_qemu_ld_i64(d1, taddr, ctx->mem_idx, MO_LE | MO_UQ);
+
+    /* Both loads are done before wd is written, in case the second faults */
+    gen_msa_ldst_swap(ctx, d0, a->df);
+    gen_msa_ldst_swap(ctx, d1, a->df);
+    tcg_gen_mov_i64(msa_wr_d[a->wd * 2], d0);
+    tcg_gen_mov_i64(msa_wr_d[a->wd * 2 + 1], d1);
 
     return true;
 }
 
-TRANS_DF_iv(LD, trans_msa_ldst, gen_helper_msa_ld);
-TRANS_DF_iv(ST, trans_msa_ldst, gen_helper_msa_st);
+static bool trans_ST(DisasContext *ctx, arg_msa_i *a)
+{
+    static gen_helper_piv * const gen_msa_st[4] = {
+        gen_helper_msa_st_b, gen_helper_msa_st_h,
+        gen_helper_msa_st_w, gen_helper_msa_st_d
+    };
+    TCGLabel *l_cross, *l_done;
+    TCGv taddr, t;
+    TCGv_i64 d;
+
+    if (!check_msa_enabled(ctx)) {
+        return true;
+    }
+
+    taddr = tcg_temp_new();
+    t = tcg_temp_new();
+    d = tcg_temp_new_i64();
+    l_cross = gen_new_label();
+    l_done = gen_new_label();
+
+    gen_base_offset_addr(ctx, taddr, a->ws, a->sa << a->df);
+
+    /*
+     * A store that crosses a page must not be left half done if the
+     * second page faults; the helper probes both pages first.
+     */
+    tcg_gen_andi_tl(t, taddr, ~TARGET_PAGE_MASK);
+    tcg_gen_brcondi_tl(TCG_COND_GTU, t, TARGET_PAGE_SIZE - MSA_VLEN, l_cross);
+
+    tcg_gen_mov_i64(d, msa_wr_d[a->wd * 2]);
+    gen_msa_ldst_swap(ctx, d, a->df);
+    tcg_gen_qemu_st_i64(d, taddr, ctx->mem_idx, MO_LE | MO_UQ);
+    tcg_gen_addi_tl(t, taddr, 8);
+    tcg_gen_mov_i64(d, msa_wr_d[a->wd * 2 + 1]);
+    gen_msa_ldst_swap(ctx, d, a->df);
+    tcg_gen_qemu_st_i64(d, t, ctx->mem_idx, MO_LE | MO_UQ);
+    tcg_gen_br(l_done);
+
+    gen_set_label(l_cross);
+    gen_msa_st[a->df](tcg_env, tcg_constant_i32(a->wd), taddr);
+
+    gen_set_label(l_done);
+
+    return true;
+}
 
 static bool trans_LSA(DisasContext *ctx, arg_r *a)
 {
@@ -1478,8 +1478,10 @@ target_ulong helper_mftdsp(CPUMIPSState *env)
     CPUMIPSState *other = mips_cpu_map_tc(env, &other_tc);
 
     if (other_tc == other->current_tc) {
+        cpu_dsp_sync_overflow(other);
         return other->active_tc.DSPControl;
     } else {
+        tc_dsp_sync_overflow(&other->tcs[other_tc]);
         return other->tcs[other_tc].DSPControl;
     }
 }
@@ -1538,8 +1540,10 @@ void helper_mttdsp(CPUMIPSState *env, target_ulong arg1)
     CPUMIPSState *other = mips_cpu_map_tc(env, &other_tc);
 
     if (other_tc == other->current_tc) {
+        cpu_dsp_sync_overflow(other);
         other->active_tc.DSPControl = arg1;
     } else {
+        tc_dsp_sync_overflow(&other->tcs[other_tc]);
         other->tcs[other_tc].DSPControl = arg1;
     }
 }
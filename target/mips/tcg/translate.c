@@ -31,6 +31,7 @@
 #include "semihosting/semihost.h"
 #include "trace.h"
 #include "fpu_helper.h"
+#include "tcg/tcg-op-gvec.h"
 
 #define HELPER_H "helper.h"
 #include "exec/helper-info.c.inc"
@@ -1174,6 +1175,7 @@ TCGv cpu_gpr[32], cpu_PC;
 TCGv_i64 cpu_gpr_hi[32];
 TCGv cpu_HI[MIPS_DSP_ACC], cpu_LO[MIPS_DSP_ACC];
 static TCGv cpu_dspctrl, btarget;
+static TCGv_i32 cpu_dsp_ovf[8];
 TCGv bcond;
 static TCGv cpu_lladdr, cpu_llval;
 static TCGv_i32 hflags;
@@ -1188,6 +1190,11 @@ static const char regnames_LO[][4] = {
     "LO0", "LO1", "LO2", "LO3",
 };
 
+static const char regnames_dsp_ovf[][10] = {
+    "DSPOvf16", "DSPOvf17", "DSPOvf18", "DSPOvf19",
+    "DSPOvf20", "DSPOvf21", "DSPOvf22", "DSPOvf23",
+};
+
 /* General purpose registers moves. */
 void gen_load_gpr(TCGv t, int reg)
 {
@@ -11338,6 +11345,235 @@ enum {
 
 /* MIPSDSP functions. */
 
+/*
+ * Inline expansions of the most common DSP ASE operations.
+ *
+ * Overflow is recorded lazily: rather than updating DSPControl, an
+ * expansion ORs a value that is non-zero iff the operation overflowed into
+ * the pending word of the ouflag bit. cpu_rddsp() folds the pending words
+ * into DSPControl when the program actually reads it.
+ */
+static void gen_dsp_overflow(int bit, TCGv_i32 witness)
+{
+    tcg_gen_or_i32(cpu_dsp_ovf[bit - 16], cpu_dsp_ovf[bit - 16], witness);
+}
+
+static void gen_dsp_lane_addsub(TCGv_i32 r, TCGv_i32 a, TCGv_i32 b,
+                                MemOp vece, bool sub)
+{
+    switch (vece) {
+    case MO_8:
+        (sub ? tcg_gen_vec_sub8_i32 : tcg_gen_vec_add8_i32)(r, a, b);
+        break;
+    case MO_16:
+        (sub ? tcg_gen_vec_sub16_i32 : tcg_gen_vec_add16_i32)(r, a, b);
+        break;
+    default:
+        (sub ? tcg_gen_sub_i32 : tcg_gen_add_i32)(r, a, b);
+        break;
+    }
+}
+
+/* ADDU/SUBU[_S].QB and .PH: unsigned lanes, saturating to 0 or all-ones */
+static void gen_dsp_addsub_u(TCGv ret, TCGv v1, TCGv v2, MemOp vece,
+                             bool sub, bool sat)
+{
+    int bits = 8 << vece;
+    uint32_t msb = dup_const(vece, 1ull << (bits - 1));
+    TCGv_i32 a = tcg_temp_new_i32();
+    TCGv_i32 b = tcg_temp_new_i32();
+    TCGv_i32 r = tcg_temp_new_i32();
+    TCGv_i32 c = tcg_temp_new_i32();
+    TCGv_i32 t = tcg_temp_new_i32();
+
+    tcg_gen_trunc_tl_i32(a, v1);
+    tcg_gen_trunc_tl_i32(b, v2);
+    gen_dsp_lane_addsub(r, a, b, vece, sub);
+
+    /* Carry (borrow) out of the top bit of each lane */
+    if (sub) {
+        tcg_gen_andc_i32(c, b, a);
+        tcg_gen_eqv_i32(t, a, b);
+        tcg_gen_and_i32(t, t, r);
+    } else {
+        tcg_gen_and_i32(c, a, b);
+        tcg_gen_or_i32(t, a, b);
+        tcg_gen_andc_i32(t, t, r);
+    }
+    tcg_gen_or_i32(c, c, t);
+    tcg_gen_andi_i32(c, c, msb);
+    gen_dsp_overflow(20, c);
+
+    if (sat) {
+        tcg_gen_shri_i32(c, c, bits - 1);
+        tcg_gen_muli_i32(c, c, MAKE_64BIT_MASK(0, bits));
+        if (sub) {
+            tcg_gen_andc_i32(r, r, c);
+        } else {
+            tcg_gen_or_i32(r, r, c);
+        }
+    }
+
+    tcg_gen_ext_i32_tl(ret, r);
+}
+
+/* ADDQ/SUBQ[_S].PH and _S.W: signed lanes, saturating by the sign of v1 */
+static void gen_dsp_addsub_q(TCGv ret, TCGv v1, TCGv v2, MemOp vece,
+                             bool sub, bool sat)
+{
+    int bits = 8 << vece;
+    uint32_t msb = dup_const(vece, 1ull << (bits - 1));
+    TCGv_i32 a = tcg_temp_new_i32();
+    TCGv_i32 b = tcg_temp_new_i32();
+    TCGv_i32 r = tcg_temp_new_i32();
+    TCGv_i32 o = tcg_temp_new_i32();
+    TCGv_i32 t = tcg_temp_new_i32();
+
+    tcg_gen_trunc_tl_i32(a, v1);
+    tcg_gen_trunc_tl_i32(b, v2);
+    gen_dsp_lane_addsub(r, a, b, vece, sub);
+
+    /* Signed overflow in the top bit of each lane */
+    tcg_gen_xor_i32(o, a, r);
+    if (sub) {
+        tcg_gen_xor_i32(t, a, b);
+    } else {
+        tcg_gen_xor_i32(t, b, r);
+    }
+    tcg_gen_and_i32(o, o, t);
+    tcg_gen_andi_i32(o, o, msb);
+    gen_dsp_overflow(20, o);
+
+    if (sat) {
+        /* 0x7fff.. for a non-negative v1 lane, 0x8000.. otherwise */
+        tcg_gen_shri_i32(t, a, bits - 1);
+        tcg_gen_andi_i32(t, t, dup_const(vece, 1));
+        tcg_gen_addi_i32(t, t, ~msb);
+        tcg_gen_shri_i32(o, o, bits - 1);
+        tcg_gen_muli_i32(o, o, MAKE_64BIT_MASK(0, bits));
+        tcg_gen_and_i32(t, t, o);
+        tcg_gen_andc_i32(r, r, o);
+        tcg_gen_or_i32(r, r, t);
+    }
+
+    tcg_gen_ext_i32_tl(ret, r);
+}
+
+/*
+ * Dot product of two lane pairs of rs and rt into accumulator ac. The
+ * lane positions are the shift counts used by the DP_* helpers.
+ */
+static void gen_dsp_dot(int ac, TCGv rs, TCGv rt, MemOp vece, bool q15,
+                        bool sub, int rs1, int rs0, int rt1, int rt0)
+{
+    const int pos[2][2] = { { rs1, rt1 }, { rs0, rt0 } };
+    int bits = 8 << vece;
+    TCGv_i32 s = tcg_temp_new_i32();
+    TCGv_i32 t = tcg_temp_new_i32();
+    TCGv_i32 x = tcg_temp_new_i32();
+    TCGv_i32 y = tcg_temp_new_i32();
+    TCGv_i64 dotp = tcg_temp_new_i64();
+    TCGv_i64 p = tcg_temp_new_i64();
+
+    tcg_gen_trunc_tl_i32(s, rs);
+    tcg_gen_trunc_tl_i32(t, rt);
+    tcg_gen_movi_i64(dotp, 0);
+
+    for (int i = 0; i < 2; i++) {
+        if (vece == MO_8) {
+            tcg_gen_extract_i32(x, s, pos[i][0], bits);
+            tcg_gen_extract_i32(y, t, pos[i][1], bits);
+        } else {
+            tcg_gen_sextract_i32(x, s, pos[i][0], bits);
+            tcg_gen_sextract_i32(y, t, pos[i][1], bits);
+        }
+        tcg_gen_mul_i32(x, x, y);
+        if (q15) {
+            /*
+             * Only -1.0 * -1.0 gives 0x40000000; doubled it saturates to
+             * 0x7fffffff, i.e. one less than the wrapped 0x80000000.
+             */
+            tcg_gen_setcondi_i32(TCG_COND_EQ, y, x, 0x40000000);
+            tcg_gen_shli_i32(x, x, 1);
+            tcg_gen_sub_i32(x, x, y);
+            gen_dsp_overflow(16 + ac, y);
+        }
+        tcg_gen_ext_i32_i64(p, x);
+        tcg_gen_add_i64(dotp, dotp, p);
+    }
+
+    tcg_gen_concat_tl_i64(p, cpu_LO[ac], cpu_HI[ac]);
+    if (sub) {
+        tcg_gen_sub_i64(p, p, dotp);
+    } else {
+        tcg_gen_add_i64(p, p, dotp);
+    }
+    gen_move_low32(cpu_LO[ac], p);
+    gen_move_high32(cpu_HI[ac], p);
+}
+
+/* PRECEU.PH.QB* and PRECEQU.PH.QB*: widen two bytes of rt to halfwords */
+static void gen_dsp_prece(TCGv ret, TCGv rt, int hi, int lo, int shift)
+{
+    TCGv_i32 a = tcg_temp_new_i32();
+    TCGv_i32 r = tcg_temp_new_i32();
+    TCGv_i32 t = tcg_temp_new_i32();
+
+    tcg_gen_trunc_tl_i32(a, rt);
+    tcg_gen_extract_i32(r, a, lo, 8);
+    tcg_gen_extract_i32(t, a, hi, 8);
+    tcg_gen_deposit_i32(r, r, t, 16, 16);
+    if (shift) {
+        tcg_gen_shli_i32(r, r, shift);
+    }
+    tcg_gen_ext_i32_tl(ret, r);
+}
+
+/* PRECRQ.PH.W: pack the high halfwords of rs and rt */
+static void gen_dsp_precrq_ph_w(TCGv ret, TCGv rs, TCGv rt)
+{
+    TCGv_i32 a = tcg_temp_new_i32();
+    TCGv_i32 b = tcg_temp_new_i32();
+
+    tcg_gen_trunc_tl_i32(a, rs);
+    tcg_gen_trunc_tl_i32(b, rt);
+    tcg_gen_shri_i32(b, b, 16);
+    tcg_gen_deposit_i32(b, a, b, 0, 16);
+    tcg_gen_ext_i32_tl(ret, b);
+}
+
+/* PACKRL.PH: low halfword of rs above the high halfword of rt */
+static void gen_dsp_packrl_ph(TCGv ret, TCGv rs, TCGv rt)
+{
+    TCGv_i32 a = tcg_temp_new_i32();
+    TCGv_i32 b = tcg_temp_new_i32();
+
+    tcg_gen_trunc_tl_i32(a, rs);
+    tcg_gen_trunc_tl_i32(b, rt);
+    tcg_gen_extract2_i32(b, b, a, 16);
+    tcg_gen_ext_i32_tl(ret, b);
+}
+
+/* PRECRQ_RS.PH.W: round and saturate the Q31 words of rs and rt to Q15 */
+static void gen_dsp_precrq_rs_ph_w(TCGv ret, TCGv rs, TCGv rt)
+{
+    TCGv_i32 r[2] = { tcg_temp_new_i32(), tcg_temp_new_i32() };
+    TCGv_i32 sat = tcg_temp_new_i32();
+    TCGv src[2] = { rt, rs };
+
+    for (int i = 0; i < 2; i++) {
+        tcg_gen_trunc_tl_i32(r[i], src[i]);
+        tcg_gen_setcondi_i32(TCG_COND_GT, sat, r[i], 0x7FFF7FFF);
+        gen_dsp_overflow(22, sat);
+        tcg_gen_addi_i32(r[i], r[i], 0x8000);
+        tcg_gen_shri_i32(r[i], r[i], 16);
+        tcg_gen_movcond_i32(TCG_COND_NE, r[i], sat, tcg_constant_i32(0),
+                            tcg_constant_i32(0x7FFF), r[i]);
+    }
+    tcg_gen_deposit_i32(r[0], r[0], r[1], 16, 16);
+    tcg_gen_ext_i32_tl(ret, r[0]);
+}
+
 static void gen_mipsdsp_arith(DisasContext *ctx, uint32_t op1, uint32_t op2,
                               int ret, int v1, int v2)
 {
@@ -11424,35 +11660,35 @@ static void gen_mipsdsp_arith(DisasContext *ctx, uint32_t op1, uint32_t op2,
             break;
         case OPC_PRECEQU_PH_QBL:
             check_dsp(ctx);
-            gen_helper_precequ_ph_qbl(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 24, 16, 7);
             break;
         case OPC_PRECEQU_PH_QBR:
             check_dsp(ctx);
-            gen_helper_precequ_ph_qbr(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 8, 0, 7);
             break;
         case OPC_PRECEQU_PH_QBLA:
             check_dsp(ctx);
-            gen_helper_precequ_ph_qbla(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 24, 8, 7);
             break;
         case OPC_PRECEQU_PH_QBRA:
             check_dsp(ctx);
-            gen_helper_precequ_ph_qbra(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 16, 0, 7);
             break;
         case OPC_PRECEU_PH_QBL:
             check_dsp(ctx);
-            gen_helper_preceu_ph_qbl(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 24, 16, 0);
             break;
         case OPC_PRECEU_PH_QBR:
             check_dsp(ctx);
-            gen_helper_preceu_ph_qbr(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 8, 0, 0);
             break;
         case OPC_PRECEU_PH_QBLA:
             check_dsp(ctx);
-            gen_helper_preceu_ph_qbla(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 24, 8, 0);
             break;
         case OPC_PRECEU_PH_QBRA:
             check_dsp(ctx);
-            gen_helper_preceu_ph_qbra(cpu_gpr[ret], v2_t);
+            gen_dsp_prece(cpu_gpr[ret], v2_t, 16, 0, 0);
             break;
         }
         break;
@@ -11460,59 +11696,59 @@ static void gen_mipsdsp_arith(DisasContext *ctx, uint32_t op1, uint32_t op2,
         switch (op2) {
         case OPC_ADDQ_PH:
             check_dsp(ctx);
-            gen_helper_addq_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_q(cpu_gpr[ret], v1_t, v2_t, MO_16, false, false);
             break;
         case OPC_ADDQ_S_PH:
             check_dsp(ctx);
-            gen_helper_addq_s_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_q(cpu_gpr[ret], v1_t, v2_t, MO_16, false, true);
             break;
         case OPC_ADDQ_S_W:
             check_dsp(ctx);
-            gen_helper_addq_s_w(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_q(cpu_gpr[ret], v1_t, v2_t, MO_32, false, true);
             break;
         case OPC_ADDU_QB:
             check_dsp(ctx);
-            gen_helper_addu_qb(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_8, false, false);
             break;
         case OPC_ADDU_S_QB:
             check_dsp(ctx);
-            gen_helper_addu_s_qb(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_8, false, true);
             break;
         case OPC_ADDU_PH:
             check_dsp_r2(ctx);
-            gen_helper_addu_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_16, false, false);
             break;
         case OPC_ADDU_S_PH:
             check_dsp_r2(ctx);
-            gen_helper_addu_s_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_16, false, true);
             break;
         case OPC_SUBQ_PH:
             check_dsp(ctx);
-            gen_helper_subq_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_q(cpu_gpr[ret], v1_t, v2_t, MO_16, true, false);
             break;
         case OPC_SUBQ_S_PH:
             check_dsp(ctx);
-            gen_helper_subq_s_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_q(cpu_gpr[ret], v1_t, v2_t, MO_16, true, true);
             break;
         case OPC_SUBQ_S_W:
             check_dsp(ctx);
-            gen_helper_subq_s_w(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_q(cpu_gpr[ret], v1_t, v2_t, MO_32, true, true);
             break;
         case OPC_SUBU_QB:
             check_dsp(ctx);
-            gen_helper_subu_qb(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_8, true, false);
             break;
         case OPC_SUBU_S_QB:
             check_dsp(ctx);
-            gen_helper_subu_s_qb(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_8, true, true);
             break;
         case OPC_SUBU_PH:
             check_dsp_r2(ctx);
-            gen_helper_subu_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_16, true, false);
             break;
         case OPC_SUBU_S_PH:
             check_dsp_r2(ctx);
-            gen_helper_subu_s_ph(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_addsub_u(cpu_gpr[ret], v1_t, v2_t, MO_16, true, true);
             break;
         case OPC_ADDSC:
             check_dsp(ctx);
@@ -11560,11 +11796,11 @@ static void gen_mipsdsp_arith(DisasContext *ctx, uint32_t op1, uint32_t op2,
             }
         case OPC_PRECRQ_PH_W:
             check_dsp(ctx);
-            gen_helper_precrq_ph_w(cpu_gpr[ret], v1_t, v2_t);
+            gen_dsp_precrq_ph_w(cpu_gpr[ret], v1_t, v2_t);
             break;
         case OPC_PRECRQ_RS_PH_W:
             check_dsp(ctx);
-            gen_helper_precrq_rs_ph_w(cpu_gpr[ret], v1_t, v2_t, tcg_env);
+            gen_dsp_precrq_rs_ph_w(cpu_gpr[ret], v1_t, v2_t);
             break;
         case OPC_PRECRQU_S_QB_PH:
             check_dsp(ctx);
@@ -12060,35 +12296,36 @@ static void gen_mipsdsp_multiply(DisasContext *ctx, uint32_t op1, uint32_t op2,
         switch (op2) {
         case OPC_DPAU_H_QBL:
             check_dsp(ctx);
-            gen_helper_dpau_h_qbl(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_8, false, false,
+                        24, 16, 24, 16);
             break;
         case OPC_DPAU_H_QBR:
             check_dsp(ctx);
-            gen_helper_dpau_h_qbr(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_8, false, false, 8, 0, 8, 0);
             break;
         case OPC_DPSU_H_QBL:
             check_dsp(ctx);
-            gen_helper_dpsu_h_qbl(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_8, false, true, 24, 16, 24, 16);
             break;
         case OPC_DPSU_H_QBR:
             check_dsp(ctx);
-            gen_helper_dpsu_h_qbr(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_8, false, true, 8, 0, 8, 0);
             break;
         case OPC_DPA_W_PH:
             check_dsp_r2(ctx);
-            gen_helper_dpa_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, false, false, 16, 0, 16, 0);
             break;
         case OPC_DPAX_W_PH:
             check_dsp_r2(ctx);
-            gen_helper_dpax_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, false, false, 16, 0, 0, 16);
             break;
         case OPC_DPAQ_S_W_PH:
             check_dsp(ctx);
-            gen_helper_dpaq_s_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, true, false, 16, 0, 16, 0);
             break;
         case OPC_DPAQX_S_W_PH:
             check_dsp_r2(ctx);
-            gen_helper_dpaqx_s_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, true, false, 16, 0, 0, 16);
             break;
         case OPC_DPAQX_SA_W_PH:
             check_dsp_r2(ctx);
@@ -12096,19 +12333,19 @@ static void gen_mipsdsp_multiply(DisasContext *ctx, uint32_t op1, uint32_t op2,
             break;
         case OPC_DPS_W_PH:
             check_dsp_r2(ctx);
-            gen_helper_dps_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, false, true, 16, 0, 16, 0);
             break;
         case OPC_DPSX_W_PH:
             check_dsp_r2(ctx);
-            gen_helper_dpsx_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, false, true, 16, 0, 0, 16);
             break;
         case OPC_DPSQ_S_W_PH:
             check_dsp(ctx);
-            gen_helper_dpsq_s_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, true, true, 16, 0, 16, 0);
             break;
         case OPC_DPSQX_S_W_PH:
             check_dsp_r2(ctx);
-            gen_helper_dpsqx_s_w_ph(t0, v1_t, v2_t, tcg_env);
+            gen_dsp_dot(ret & 3, v1_t, v2_t, MO_16, true, true, 16, 0, 0, 16);
             break;
         case OPC_DPSQX_SA_W_PH:
             check_dsp_r2(ctx);
@@ -12549,7 +12786,7 @@ static void gen_mipsdsp_add_cmp_pick(DisasContext *ctx,
             break;
         case OPC_PACKRL_PH:
             check_dsp(ctx);
-            gen_helper_packrl_ph(cpu_gpr[ret], v1_t, v2_t);
+            gen_dsp_packrl_ph(cpu_gpr[ret], v1_t, v2_t);
             break;
         }
         break;
@@ -15285,6 +15522,12 @@ void mips_tcg_init(void)
                                      offsetof(CPUMIPSState,
                                               active_tc.DSPControl),
                                      "DSPControl");
+    for (unsigned i = 0; i < ARRAY_SIZE(cpu_dsp_ovf); i++) {
+        cpu_dsp_ovf[i] = tcg_global_mem_new_i32(tcg_env,
+                                                offsetof(CPUMIPSState,
+                                                    active_tc.DSPOverflow[i]),
+                                                regnames_dsp_ovf[i]);
+    }
     bcond = tcg_global_mem_new(tcg_env,
                                offsetof(CPUMIPSState, bcond), "bcond");
     btarget = tcg_global_mem_new(tcg_env,
@@ -288,6 +288,47 @@ static void lookup_and_goto_ptr(DisasContext *ctx)
     tcg_gen_lookup_and_goto_ptr();
 }
 
+/*
+ * Whether state that the TB flags are computed from was changed by an
+ * earlier instruction of this TB, without ending it.
+ */
+static bool tb_flags_changed(DisasContext *ctx)
+{
+    uint32_t tb_flags = ctx->base.tb->flags;
+
+    return ctx->mstatus_fs != FIELD_EX32(tb_flags, TB_FLAGS, FS) ||
+           ctx->mstatus_vs != FIELD_EX32(tb_flags, TB_FLAGS, VS) ||
+           ctx->vstart_eq_zero !=
+               FIELD_EX32(tb_flags, TB_FLAGS, VSTART_EQ_ZERO);
+}
+
+/*
+ * Indirect jump to dest, which must already be in cpu_pc, through an
+ * inline target cache.  ret predicts dest from the shadow return stack,
+ * call pushes the return to this site.  The cache matches the next TB
+ * against this TB's flags, so the caller must check tb_flags_changed().
+ */
+static void lookup_and_goto_ptr_cached(DisasContext *ctx, TCGv dest,
+                                       bool ret, bool call)
+{
+    TCGv_i64 pc = tcg_temp_new_i64();
+
+    tcg_debug_assert(!tb_flags_changed(ctx));
+#ifndef CONFIG_USER_ONLY
+    if (ctx->itrigger) {
+        gen_helper_itrigger_match(tcg_env);
+    }
+#endif
+    tcg_gen_extu_tl_i64(pc, dest);
+    translator_lookup_and_goto_ptr(&ctx->base, pc, ret, call);
+}
+
+/* Link registers of the return-address stack hints, see the jalr spec */
+static bool is_link_reg(int reg)
+{
+    return reg == xRA || reg == xT0;
+}
+
 static void exit_tb(DisasContext *ctx)
 {
 #ifndef CONFIG_USER_ONLY
@@ -639,6 +680,9 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     gen_pc_plus_diff(succ_pc, ctx, ctx->cur_insn_len);
     gen_set_gpr(ctx, rd, succ_pc);
 
+    if (is_link_reg(rd)) {
+        translator_push_return(&ctx->base);
+    }
     gen_goto_tb(ctx, 0, imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -10,6 +10,7 @@
 
 #include "qemu/osdep.h"
 #include "elf.h"
+#include "disas/disas.h"
 #include "exec/target_page.h"
 #include "exec/translation-block.h"
 #include "qemu/timer.h"
@@ -233,6 +234,11 @@ void perf_enable_jitdump(void)
     fwrite(&header, sizeof(header), 1, jitdump);
 }
 
+bool perf_enabled(void)
+{
+    return perfmap || jitdump;
+}
+
 void perf_report_prologue(const void *start, size_t size)
 {
     if (perfmap) {
@@ -340,6 +346,20 @@ void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
     }
     debuginfo_query(q, tb->icount);
 
+    /*
+     * Fall back to the front-end's symbol tables, which in user mode
+     * cover every loaded shared object even without libdw or DWARF.
+     */
+    for (insn = 0; insn < tb->icount; insn++) {
+        if (!q[insn].symbol) {
+            const char *symbol = lookup_symbol(q[insn].address);
+
+            if (symbol[0] != '\0') {
+                q[insn].symbol = symbol;
+            }
+        }
+    }
+
     /* Emit perfmap entries if needed. */
     if (perfmap) {
         flockfile(perfmap);
@@ -68,6 +68,7 @@ struct tcg_region_state {
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
     size_t total_size; /* size of entire buffer, >= n * stride */
+    size_t limit; /* usable size of a region, 0 if all of it */
 
     /* fields protected by the lock */
     size_t current; /* current region index */
@@ -350,6 +351,9 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     void *start, *end;
 
     tcg_region_bounds(curr_region, &start, &end);
+    if (region.limit && end - start > region.limit) {
+        end = start + region.limit;
+    }
 
     s->code_gen_buffer = start;
     s->code_gen_ptr = start;
@@ -403,6 +407,40 @@ void tcg_region_initial_alloc(TCGContext *s)
     qemu_mutex_unlock(&region.lock);
 }
 
+/*
+ * With an adaptive limit, grow it if the flush is due to the buffer filling
+ * up and drop the pages holding the stale code. Must be called with
+ * region.lock held.
+ */
+static void tcg_region_adapt__locked(unsigned int n_ctxs)
+{
+    const size_t page_size = qemu_real_host_page_size();
+    bool full = false;
+    unsigned int i;
+
+    if (!region.limit) {
+        return;
+    }
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        size_t used = s->code_gen_ptr - s->code_gen_buffer;
+        void *start = QEMU_ALIGN_PTR_UP(s->code_gen_buffer, page_size);
+        void *end = QEMU_ALIGN_PTR_UP(s->code_gen_ptr, page_size);
+
+        full |= used >= s->code_gen_buffer_size / 4 * 3;
+
+        /* Split-wx buffers are shared mappings; dropping pages won't help */
+        if (tcg_splitwx_diff == 0 && end > start) {
+            qemu_madvise(start, end - start, QEMU_MADV_DONTNEED);
+        }
+    }
+
+    if (full && region.limit < region.size) {
+        region.limit = MIN(region.limit * 2, region.size);
+    }
+}
+
 /* Call from a safe-work context */
 void tcg_region_reset_all(void)
 {
@@ -410,6 +448,7 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
+    tcg_region_adapt__locked(n_ctxs);
     region.current = 0;
     region.agg_size_full = 0;
 
@@ -860,6 +899,24 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
     tcg_region_initial_alloc__locked(&tcg_init_ctx);
 }
 
+void tcg_region_set_adaptive(size_t initial)
+{
+    const size_t page_size = qemu_real_host_page_size();
+
+    qemu_mutex_lock(&region.lock);
+    initial = MAX(QEMU_ALIGN_UP(initial, page_size), MIN_CODE_GEN_BUFFER_SIZE);
+    region.limit = initial < region.size ? initial : 0;
+    qemu_mutex_unlock(&region.lock);
+
+    /* Huge pages would back the whole limit with memory right away */
+    qemu_madvise(region.start_aligned, region.total_size,
+                 QEMU_MADV_NOHUGEPAGE);
+    if (tcg_splitwx_diff) {
+        qemu_madvise(region.start_aligned + tcg_splitwx_diff,
+                     region.total_size, QEMU_MADV_NOHUGEPAGE);
+    }
+}
+
 void tcg_region_prologue_set(TCGContext *s)
 {
     /* Deduct the prologue from the first region.  */
@@ -916,6 +973,9 @@ size_t tcg_code_capacity(void)
     capacity = region.total_size;
     capacity -= (region.n - 1) * guard_size;
     capacity -= region.n * TCG_HIGHWATER;
+    if (region.limit) {
+        capacity = MIN(capacity, region.n * (region.limit - TCG_HIGHWATER));
+    }
 
     return capacity;
 }
@@ -33,6 +33,7 @@
 #include "tcg-internal.h"
 #include "tcg-has.h"
 #include "tcg-target-mo.h"
+#include "linux-user/microhook-trace.h"
 
 static void check_max_alignment(unsigned a_bits)
 {
@@ -159,6 +160,56 @@ static void maybe_free_addr(TCGTemp *addr, TCGTemp *copy)
     }
 }
 
+/*
+ * Append the address of a guest memory access to the -exec-trace buffer.
+ * Emitted before the access, while addr is still live. The end of the
+ * buffer was checked on entry to the TB only, so accesses past it, which
+ * loops within a TB can cause, overwrite the spare slot after it.
+ */
+static void exec_trace_gen_mem(TCGTemp *addr, MemOp memop, uint32_t kind)
+{
+    int site = MIN(tcg_ctx->exec_trace_nb_mem, MICROHOOK_TRACE_SITES);
+    TCGv_i64 rec;
+    TCGv_ptr ptr, end;
+
+    if (!tcg_ctx->exec_trace_sites) {
+        return;
+    }
+    if (site < MICROHOOK_TRACE_SITES) {
+        tcg_ctx->exec_trace_sites[site] =
+            tcg_ctx->exec_trace_insn << 8 | kind | (memop & MO_SIZE);
+    }
+    tcg_ctx->exec_trace_nb_mem++;
+
+    rec = tcg_temp_ebb_new_i64();
+    if (tcg_ctx->addr_type == TCG_TYPE_I32) {
+        tcg_gen_extu_i32_i64(rec, temp_tcgv_i32(addr));
+        tcg_gen_ori_i64(rec, rec, (uint64_t)(MICROHOOK_TRACE_MEM | site)
+                                  << MICROHOOK_TRACE_TAG_SHIFT);
+    } else {
+        tcg_gen_deposit_i64(rec, temp_tcgv_i64(addr),
+                            tcg_constant_i64(MICROHOOK_TRACE_MEM | site),
+                            MICROHOOK_TRACE_TAG_SHIFT,
+                            64 - MICROHOOK_TRACE_TAG_SHIFT);
+    }
+
+    ptr = tcg_temp_ebb_new_ptr();
+    end = tcg_temp_ebb_new_ptr();
+    tcg_gen_ld_ptr(ptr, tcg_env,
+                   offsetof(CPUState, neg.exec_trace_ptr) - sizeof(CPUState));
+    tcg_gen_st_i64(rec, ptr, 0);
+    tcg_gen_addi_ptr(ptr, ptr, sizeof(uint64_t));
+    tcg_gen_ld_ptr(end, tcg_env,
+                   offsetof(CPUState, neg.exec_trace_end) - sizeof(CPUState));
+    tcg_gen_umin_ptr(ptr, ptr, end);
+    tcg_gen_st_ptr(ptr, tcg_env,
+                   offsetof(CPUState, neg.exec_trace_ptr) - sizeof(CPUState));
+
+    tcg_temp_free_ptr(end);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i64(rec);
+}
+
 /* Only required for loads, where value might overlap addr. */
 static TCGv_i64 plugin_maybe_preserve_addr(TCGTemp *addr)
 {
@@ -271,6 +322,7 @@ static void tcg_gen_qemu_ld_i32_int(TCGv_i32 val, TCGTemp *addr,
         oi = make_memop_idx(memop, idx);
     }
 
+    exec_trace_gen_mem(addr, memop, 0);
     addr_new = tci_extend_addr(addr);
     copy_addr = plugin_maybe_preserve_addr(addr);
     gen_ldst1(INDEX_op_qemu_ld, TCG_TYPE_I32, tcgv_i32_temp(val), addr_new, oi);
@@ -330,6 +382,7 @@ static void tcg_gen_qemu_st_i32_int(TCGv_i32 val, TCGTemp *addr,
         oi = make_memop_idx(memop, idx);
     }
 
+    exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_W);
     addr_new = tci_extend_addr(addr);
     gen_ldst1(INDEX_op_qemu_st, TCG_TYPE_I32, tcgv_i32_temp(val), addr_new, oi);
     plugin_gen_mem_callbacks_i32(val, NULL, addr, orig_oi, QEMU_PLUGIN_MEM_W);
@@ -379,6 +432,7 @@ static void tcg_gen_qemu_ld_i64_int(TCGv_i64 val, TCGTemp *addr,
         oi = make_memop_idx(memop, idx);
     }
 
+    exec_trace_gen_mem(addr, memop, 0);
     addr_new = tci_extend_addr(addr);
     copy_addr = plugin_maybe_preserve_addr(addr);
     gen_ld_i64(val, addr_new, oi);
@@ -450,6 +504,7 @@ static void tcg_gen_qemu_st_i64_int(TCGv_i64 val, TCGTemp *addr,
         oi = make_memop_idx(memop, idx);
     }
 
+    exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_W);
     addr_new = tci_extend_addr(addr);
     gen_st_i64(val, addr_new, oi);
     plugin_gen_mem_callbacks_i64(val, NULL, addr, orig_oi, QEMU_PLUGIN_MEM_W);
@@ -575,6 +630,7 @@ static void tcg_gen_qemu_ld_i128_int(TCGv_i128 val, TCGTemp *addr,
         memop |= MO_ATOM_NONE;
     }
     orig_oi = make_memop_idx(memop, idx);
+    exec_trace_gen_mem(addr, memop, 0);
 
     /* TODO: For now, force 32-bit hosts to use the helper. */
     if (TCG_TARGET_HAS_qemu_ldst_i128 && TCG_TARGET_REG_BITS == 64) {
@@ -688,6 +744,7 @@ static void tcg_gen_qemu_st_i128_int(TCGv_i128 val, TCGTemp *addr,
         memop |= MO_ATOM_NONE;
     }
     orig_oi = make_memop_idx(memop, idx);
+    exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_W);
 
     /* TODO: For now, force 32-bit hosts to use the helper. */
 
@@ -925,6 +982,7 @@ static void tcg_gen_atomic_cmpxchg_i32_int(TCGv_i32 retv, TCGTemp *addr,
     tcg_debug_assert(gen != NULL);
 
     oi = make_memop_idx(memop & ~MO_SIGN, idx);
+    exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_RMW);
     a64 = maybe_extend_addr64(addr);
     gen(retv, tcg_env, a64, cmpv, newv, tcg_constant_i32(oi));
     maybe_free_addr64(a64);
@@ -1005,7 +1063,10 @@ static void tcg_gen_atomic_cmpxchg_i64_int(TCGv_i64 retv, TCGTemp *addr,
         gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
         if (gen) {
             MemOpIdx oi = make_memop_idx(memop, idx);
-            TCGv_i64 a64 = maybe_extend_addr64(addr);
+            TCGv_i64 a64;
+
+            exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_RMW);
+            a64 = maybe_extend_addr64(addr);
             gen(retv, tcg_env, a64, cmpv, newv, tcg_constant_i32(oi));
             maybe_free_addr64(a64);
             return;
@@ -1127,7 +1188,10 @@ static void tcg_gen_atomic_cmpxchg_i128_int(TCGv_i128 retv, TCGTemp *addr,
     gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
     if (gen) {
         MemOpIdx oi = make_memop_idx(memop, idx);
-        TCGv_i64 a64 = maybe_extend_addr64(addr);
+        TCGv_i64 a64;
+
+        exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_RMW);
+        a64 = maybe_extend_addr64(addr);
         gen(retv, tcg_env, a64, cmpv, newv, tcg_constant_i32(oi));
         maybe_free_addr64(a64);
         return;
@@ -1186,6 +1250,7 @@ static void do_atomic_op_i32(TCGv_i32 ret, TCGTemp *addr, TCGv_i32 val,
     tcg_debug_assert(gen != NULL);
 
     oi = make_memop_idx(memop & ~MO_SIGN, idx);
+    exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_RMW);
     a64 = maybe_extend_addr64(addr);
     gen(ret, tcg_env, a64, val, tcg_constant_i32(oi));
     maybe_free_addr64(a64);
@@ -1224,7 +1289,10 @@ static void do_atomic_op_i64(TCGv_i64 ret, TCGTemp *addr, TCGv_i64 val,
 
         if (gen) {
             MemOpIdx oi = make_memop_idx(memop & ~MO_SIGN, idx);
-            TCGv_i64 a64 = maybe_extend_addr64(addr);
+            TCGv_i64 a64;
+
+            exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_RMW);
+            a64 = maybe_extend_addr64(addr);
             gen(ret, tcg_env, a64, val, tcg_constant_i32(oi));
             maybe_free_addr64(a64);
             return;
@@ -1275,7 +1343,10 @@ static void do_atomic_op_i128(TCGv_i128 ret, TCGTemp *addr, TCGv_i128 val,
 
     if (gen) {
         MemOpIdx oi = make_memop_idx(memop & ~MO_SIGN, idx);
-        TCGv_i64 a64 = maybe_extend_addr64(addr);
+        TCGv_i64 a64;
+
+        exec_trace_gen_mem(addr, memop, MICROHOOK_TRACE_SITE_RMW);
+        a64 = maybe_extend_addr64(addr);
         gen(ret, tcg_env, a64, val, tcg_constant_i32(oi));
         maybe_free_addr64(a64);
         return;
@@ -6878,7 +6878,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     /* Do not reuse any EBB that may be allocated within the TB. */
     tcg_temp_ebb_reset_freed(s);
 
+    s->nb_ops_emitted = s->nb_ops;
     tcg_optimize(s);
+    s->nb_ops_optimized = s->nb_ops;
 
     reachable_code_pass(s);
     liveness_pass_0(s);
@@ -0,0 +1,42 @@
+/*
+ * Calling a faulting guest function from a microhook hook
+ *
+ * microhook-call.py calls fault() through microhook.call() when the
+ * program writes to MAGIC_FD, once without and once with a timeout. Both
+ * calls must fail with the fault instead of hanging, and the SIGSEGV must
+ * not be delivered to the program afterwards.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MAGIC_FD 1000
+
+int * volatile null_ptr;
+
+int __attribute__((noinline)) fault(void)
+{
+    return *null_ptr;
+}
+
+int main(void)
+{
+    ssize_t ret = write(MAGIC_FD, (void *)fault, 0);
+
+    if (ret < 0 && errno == EBADF) {
+        printf("SKIP: not run with microhook-call.py\n");
+        return 0;
+    }
+    if (ret == 2) {
+        printf("SKIP: microhook.call() is not supported on this target\n");
+        return 0;
+    }
+    if (ret != 1) {
+        printf("FAIL: faulting call returned %zd\n", ret);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,27 @@
+# Call a faulting guest function from a hook, see microhook-call.c
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+import microhook
+
+MAGIC_FD = 1000
+
+
+def pre_write(ctx):
+    if ctx["args"][0] != MAGIC_FD:
+        return False
+
+    ctx["ret"] = 1
+    for kwargs in ({}, {"timeout": 5}):
+        try:
+            microhook.call(ctx["args"][1], **kwargs)
+            print("call(%r) returned" % kwargs)
+            ctx["ret"] = -1
+        except NotImplementedError:
+            ctx["ret"] = 2
+        except RuntimeError as e:
+            print("call(%r): %s" % (kwargs, e))
+    return True
+
+
+microhook.register_pre_hook("write", pre_write)
@@ -72,6 +72,7 @@ static GHashTable *statistics;
 static GByteArray *memory_buffer;
 static bool do_log_writes;
 static int64_t write_sysno = -1;
+static int64_t skip_sysno = -1;
 
 static SyscallStats *get_or_create_entry(int64_t num)
 {
@@ -150,6 +151,17 @@ static void vcpu_syscall(qemu_plugin_id_t id, unsigned int vcpu_index,
     }
 }
 
+static bool vcpu_syscall_filter(qemu_plugin_id_t id, unsigned int vcpu_index,
+                                int64_t num, uint64_t *args, uint64_t *sysret)
+{
+    if (num != skip_sysno) {
+        return false;
+    }
+
+    *sysret = 0;
+    return true;
+}
+
 static void vcpu_syscall_ret(qemu_plugin_id_t id, unsigned int vcpu_idx,
                              int64_t num, int64_t ret)
 {
@@ -225,6 +237,8 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
             if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_log_writes)) {
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
             }
+        } else if (g_strcmp0(tokens[0], "skip") == 0 && tokens[1]) {
+            skip_sysno = g_ascii_strtoll(tokens[1], NULL, 0);
         } else {
             fprintf(stderr, "unsupported argument: %s\n", argv[i]);
             return -1;
@@ -255,6 +269,9 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
 
     qemu_plugin_register_vcpu_syscall_cb(id, vcpu_syscall);
     qemu_plugin_register_vcpu_syscall_ret_cb(id, vcpu_syscall_ret);
+    if (skip_sysno >= 0) {
+        qemu_plugin_register_vcpu_syscall_filter_cb(id, vcpu_syscall_filter);
+    }
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
 }
@@ -523,6 +523,8 @@ const QEMULogItem qemu_log_items[] = {
       "include VPU registers in the 'cpu' logging" },
     { LOG_INVALID_MEM, "invalid_mem",
       "log invalid memory accesses" },
+    { LOG_STARTUP, "startup",
+      "log the time spent in each startup phase (user mode)" },
     { 0, NULL, NULL },
 };
 
@@ -2,10 +2,31 @@
    eg. open("/lib/foo.so") => open("/usr/gnemul/i386-linux/lib/foo.so");
 
    The assumption is that this area does not change.
+
+   With an overlay, the prefix becomes the read-only lower layer of a
+   copy-on-write union, as with overlayfs: names are looked up in the upper
+   directory first, and whatever changes a name happens there, copying
+   files up from the lower layer first.  Deleted lower entries are hidden
+   by ".wh.<name>" whiteout files, and directories recreated over them
+   carry a ".wh..wh..opq" marker that hides the lower contents, following
+   the aufs convention.  Symlinks are followed inside the union, so
+   absolute links in the rootfs do not escape to the host.
+
+   Lookups are cached, except for names missing from an upper directory,
+   which the guest may create at any time.  Everything else only changes
+   through the functions below, which drop what they invalidate.  Other
+   processes sharing the upper directory, such as forked children, bump a
+   generation counter kept in it, which makes the others drop everything.
 */
 #include "qemu/osdep.h"
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <dirent.h>
+#ifdef CONFIG_LINUX
+#include <sys/syscall.h>
+#endif
+#include "qapi/error.h"
+#include "qemu/atomic.h"
 #include "qemu/cutils.h"
 #include "qemu/path.h"
 #include "qemu/thread.h"
@@ -28,10 +49,729 @@ void init_paths(const char *prefix)
         g_free(cwd);
     }
 
-    hash = g_hash_table_new(g_str_hash, g_str_equal);
+    hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     qemu_mutex_init(&lock);
 }
 
+#ifdef CONFIG_LINUX
+#define WH_PREFIX ".wh."
+#define WH_OPAQUE WH_PREFIX ".wh..opq"
+#define WH_GENERATION WH_PREFIX ".wh..gen"
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+typedef enum {
+    LAYER_NONE,         /* In neither layer: use the host name */
+    LAYER_UPPER,
+    LAYER_LOWER,
+    LAYER_WHITEOUT,     /* Deleted from the lower layer */
+} Layer;
+
+typedef struct {
+    Layer layer;
+    mode_t mode;        /* lstat() mode */
+    bool lower;         /* Upper entry hiding a lower one */
+    bool merged;        /* Directory whose lower entries show through */
+    const char *link;   /* Symlink target */
+} Entry;
+
+typedef struct {
+    GString *canon;     /* Guest name without links, "" for the root */
+    Entry e;
+    Entry parent;
+    bool cacheable;
+} Walk;
+
+typedef struct {
+    Entry e;
+    size_t len;         /* Length of the canonical name up to here */
+    bool cacheable;
+} Step;
+
+typedef struct {
+    uint64_t ino;
+    uint8_t type;
+    char *name;
+} DirEntry;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    char *canon;
+    GArray *list;       /* DirEntry, for reading from offset 0 on */
+} OpenDir;
+
+static const char *upper;
+static Entry root;
+static GHashTable *follow_hash; /* Like hash, following a final symlink */
+static GHashTable *entries;     /* Canonical name -> Entry */
+static GHashTable *open_dirs;   /* fd -> OpenDir */
+static GStringChunk *strings;   /* Names handed out, never freed */
+static uint32_t *generation;    /* Shared through WH_GENERATION */
+static uint32_t generation_seen;
+
+static void free_dir_list(GArray *list)
+{
+    for (guint i = 0; i < list->len; i++) {
+        g_free(g_array_index(list, DirEntry, i).name);
+    }
+    g_array_free(list, TRUE);
+}
+
+static void free_open_dir(gpointer data)
+{
+    OpenDir *od = data;
+
+    if (od->list) {
+        free_dir_list(od->list);
+    }
+    g_free(od->canon);
+    g_free(od);
+}
+
+static bool exists(const char *name)
+{
+    struct stat st;
+
+    return lstat(name, &st) == 0;
+}
+
+/* Map the change counter shared by all processes using the upper layer */
+static uint32_t *map_generation(const char *dir)
+{
+    g_autofree char *name = g_strconcat(dir, "/" WH_GENERATION, NULL);
+    struct stat st;
+    void *p = MAP_FAILED;
+    int fd;
+
+    fd = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 &&
+        (st.st_size >= sizeof(uint32_t) ||
+         ftruncate(fd, sizeof(uint32_t)) == 0)) {
+        p = mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+    }
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+bool init_overlay(const char *upper_dir, Error **errp)
+{
+    g_autofree char *opaque = NULL;
+    char *real_base, *real_upper;
+
+    if (!base) {
+        error_setg(errp, "an overlay needs a prefix to use as lower layer");
+        return false;
+    }
+    if (g_mkdir_with_parents(upper_dir, 0755) != 0) {
+        error_setg_errno(errp, errno, "cannot create overlay directory '%s'",
+                         upper_dir);
+        return false;
+    }
+
+    /* Compared with the names of open directories, which are canonical */
+    real_base = realpath(base, NULL);
+    real_upper = realpath(upper_dir, NULL);
+    if (!real_base || !real_upper) {
+        error_setg_errno(errp, errno, "cannot resolve overlay layers");
+        free(real_base);
+        free(real_upper);
+        return false;
+    }
+    generation = map_generation(real_upper);
+    if (!generation) {
+        error_setg_errno(errp, errno, "cannot share overlay state in '%s'",
+                         upper_dir);
+        free(real_base);
+        free(real_upper);
+        return false;
+    }
+    generation_seen = qatomic_load_acquire(generation);
+    g_free((char *)base);
+    base = real_base;
+    upper = real_upper;
+
+    opaque = g_strconcat(upper, "/" WH_OPAQUE, NULL);
+    root = (Entry) {
+        .layer = LAYER_UPPER,
+        .mode = S_IFDIR | 0755,
+        .lower = true,
+        .merged = !exists(opaque),
+    };
+    follow_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    open_dirs = g_hash_table_new_full(NULL, NULL, NULL, free_open_dir);
+    strings = g_string_chunk_new(4096);
+    return true;
+}
+
+static const char *intern(const char *prefix, const char *canon)
+{
+    g_autofree char *name = g_strconcat(prefix, canon, NULL);
+
+    return g_string_chunk_insert_const(strings, *name ? name : "/");
+}
+
+static char *upper_name(const char *canon)
+{
+    return g_strconcat(upper, canon, NULL);
+}
+
+static char *lower_name(const char *canon)
+{
+    return g_strconcat(base, canon, NULL);
+}
+
+/* Upper name of the whiteout for canon */
+static char *whiteout_name(const char *canon)
+{
+    const char *slash = strrchr(canon, '/');
+
+    return g_strdup_printf("%s%.*s/" WH_PREFIX "%s", upper,
+                           (int)(slash - canon), canon, slash + 1);
+}
+
+static const char *read_link(const char *name)
+{
+    g_autofree char *link = g_file_read_link(name, NULL);
+
+    return link ? g_string_chunk_insert_const(strings, link) : NULL;
+}
+
+/*
+ * Find canon, whose parent directory is described by parent.
+ * Returns whether the result may be cached.
+ */
+static bool lookup(const char *canon, const Entry *parent, Entry *e)
+{
+    g_autofree char *up = NULL;
+    g_autofree char *low = lower_name(canon);
+    struct stat st, lst;
+
+    memset(e, 0, sizeof(*e));
+    if (parent->layer == LAYER_NONE || parent->layer == LAYER_WHITEOUT) {
+        e->layer = parent->layer;
+        return true;
+    }
+    if (g_str_has_prefix(strrchr(canon, '/') + 1, WH_PREFIX)) {
+        /* Overlay metadata is not for the guest */
+        e->layer = LAYER_WHITEOUT;
+        return true;
+    }
+
+    if (parent->layer == LAYER_UPPER) {
+        up = upper_name(canon);
+        if (lstat(up, &st) == 0) {
+            e->layer = LAYER_UPPER;
+            e->mode = st.st_mode;
+            if (parent->merged && lstat(low, &lst) == 0) {
+                g_autofree char *opaque = g_strconcat(up, "/" WH_OPAQUE,
+                                                      NULL);
+
+                e->lower = true;
+                e->merged = S_ISDIR(st.st_mode) && S_ISDIR(lst.st_mode) &&
+                            !exists(opaque);
+            }
+            if (S_ISLNK(st.st_mode)) {
+                e->link = read_link(up);
+            }
+            return true;
+        }
+        if (parent->merged) {
+            g_autofree char *wh = whiteout_name(canon);
+
+            if (exists(wh)) {
+                e->layer = LAYER_WHITEOUT;
+                return false;
+            }
+        }
+    }
+
+    if ((parent->layer == LAYER_LOWER || parent->merged) &&
+        lstat(low, &st) == 0) {
+        e->layer = LAYER_LOWER;
+        e->mode = st.st_mode;
+        e->merged = S_ISDIR(st.st_mode);
+        if (S_ISLNK(st.st_mode)) {
+            e->link = read_link(low);
+        }
+        return true;
+    }
+
+    /* Missing names in an upper directory may be created by the guest */
+    e->layer = LAYER_NONE;
+    return parent->layer != LAYER_UPPER;
+}
+
+/*
+ * Drop the caches if another process changed the overlay since they were
+ * filled. Must be called with lock held, before using the caches.
+ */
+static void sync_generation(void)
+{
+    uint32_t gen = qatomic_load_acquire(generation);
+
+    if (gen != generation_seen) {
+        g_hash_table_remove_all(entries);
+        g_hash_table_remove_all(hash);
+        g_hash_table_remove_all(follow_hash);
+        generation_seen = gen;
+    }
+}
+
+static bool get_entry(const char *canon, const Entry *parent,
+                      bool parent_cacheable, Entry *e)
+{
+    Entry *cached = g_hash_table_lookup(entries, canon);
+
+    if (cached) {
+        *e = *cached;
+        return true;
+    }
+    if (!lookup(canon, parent, e) || !parent_cacheable) {
+        return false;
+    }
+    g_hash_table_insert(entries, g_strdup(canon), g_memdup2(e, sizeof(*e)));
+    return true;
+}
+
+/* Queue the components of name in front of those already in todo */
+static void push_components(GQueue *todo, const char *name)
+{
+    g_auto(GStrv) parts = g_strsplit(name, "/", -1);
+
+    for (int i = g_strv_length(parts) - 1; i >= 0; i--) {
+        g_queue_push_head(todo, g_strdup(parts[i]));
+    }
+}
+
+/*
+ * Walk the absolute guest name through the overlay like the kernel walks a
+ * path: symlinks are followed inside the overlay, the last one only if
+ * follow. Returns false with errno set on a symlink loop. The caller frees
+ * w->canon either way.
+ */
+static bool walk(const char *name, bool follow, Walk *w)
+{
+    g_autoptr(GArray) steps = g_array_new(FALSE, FALSE, sizeof(Step));
+    GQueue todo = G_QUEUE_INIT;
+    Step step = { .e = root, .len = 0, .cacheable = true };
+    int links = 0;
+    char *comp;
+
+    sync_generation();
+    w->canon = g_string_new(NULL);
+    w->cacheable = true;
+    g_array_append_val(steps, step);
+    push_components(&todo, name);
+
+    while ((comp = g_queue_pop_head(&todo))) {
+        Step *cur = &g_array_index(steps, Step, steps->len - 1);
+
+        if (!strcmp(comp, "..")) {
+            if (steps->len > 1) {
+                g_array_set_size(steps, steps->len - 1);
+                cur = &g_array_index(steps, Step, steps->len - 1);
+                g_string_truncate(w->canon, cur->len);
+            }
+        } else if (*comp && strcmp(comp, ".")) {
+            g_string_append_printf(w->canon, "/%s", comp);
+            step.len = w->canon->len;
+            step.cacheable = get_entry(w->canon->str, &cur->e,
+                                       cur->cacheable, &step.e);
+            if (step.e.link && (follow || !g_queue_is_empty(&todo))) {
+                if (++links > MAXSYMLINKS) {
+                    g_free(comp);
+                    g_queue_clear_full(&todo, g_free);
+                    errno = ELOOP;
+                    return false;
+                }
+                w->cacheable &= step.cacheable;
+                if (step.e.link[0] == '/') {
+                    g_array_set_size(steps, 1);
+                }
+                g_string_truncate(w->canon,
+                    g_array_index(steps, Step, steps->len - 1).len);
+                push_components(&todo, step.e.link);
+            } else {
+                g_array_append_val(steps, step);
+            }
+        }
+        g_free(comp);
+    }
+
+    step = g_array_index(steps, Step, steps->len - 1);
+    w->e = step.e;
+    w->parent = steps->len > 1 ?
+                g_array_index(steps, Step, steps->len - 2).e : root;
+    w->cacheable &= step.cacheable;
+    return true;
+}
+
+/* Host name that reads of a walked name go to */
+static const char *host_name(const Walk *w)
+{
+    switch (w->e.layer) {
+    case LAYER_UPPER:
+    case LAYER_WHITEOUT:
+        return intern(upper, w->canon->str);
+    case LAYER_LOWER:
+        return intern(base, w->canon->str);
+    default:
+        return intern("", w->canon->str);
+    }
+}
+
+static bool is_dir_in_overlay(const Entry *e)
+{
+    return (e->layer == LAYER_UPPER || e->layer == LAYER_LOWER) &&
+           S_ISDIR(e->mode);
+}
+
+static gboolean is_below(gpointer key, gpointer value, gpointer data)
+{
+    const char *dir = data;
+    size_t len = strlen(dir);
+
+    return !strncmp(key, dir, len) && ((char *)key)[len] == '/';
+}
+
+/*
+ * Forget what is known about canon, and about everything below if tree.
+ * Called after changing canon; tells the other processes to forget too.
+ */
+static void forget(const char *canon, bool tree)
+{
+    uint32_t gen = qatomic_fetch_inc(generation);
+
+    if (gen != generation_seen) {
+        g_hash_table_remove_all(entries);
+    } else {
+        g_hash_table_remove(entries, canon);
+        if (tree) {
+            g_hash_table_foreach_remove(entries, is_below, (gpointer)canon);
+        }
+    }
+    g_hash_table_remove_all(hash);
+    g_hash_table_remove_all(follow_hash);
+    generation_seen = gen + 1;
+}
+
+/*
+ * Make sure the directories leading to canon exist in the upper layer,
+ * copying their modes from the lower layer. Returns false with errno set.
+ */
+static bool upper_parents(const char *canon)
+{
+    g_autofree char *dir = g_strdup(canon);
+    char *p = dir;
+
+    while ((p = strchr(p + 1, '/'))) {
+        g_autofree char *up = NULL;
+        struct stat st;
+
+        *p = '\0';
+        up = upper_name(dir);
+        if (lstat(up, &st) != 0) {
+            g_autofree char *low = lower_name(dir);
+            mode_t mode = 0755;
+
+            if (lstat(low, &st) == 0 && S_ISDIR(st.st_mode)) {
+                mode = (st.st_mode & 07777) | S_IRWXU;
+            }
+            if (mkdir(up, mode) != 0 && errno != EEXIST) {
+                return false;
+            }
+            forget(dir, true);
+        } else if (!S_ISDIR(st.st_mode)) {
+            errno = ENOTDIR;
+            return false;
+        }
+        *p = '/';
+    }
+    return true;
+}
+
+static bool copy_file(const char *src, const char *dst, const struct stat *st)
+{
+    g_autofree char *tmp = NULL;
+    const char *slash = strrchr(dst, '/');
+    const struct timespec times[2] = { st->st_atim, st->st_mtim };
+    char buf[64 * 1024];
+    ssize_t n = 0;
+    int in, out;
+
+    in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    tmp = g_strdup_printf("%.*s/" WH_PREFIX "copyup.XXXXXX",
+                          (int)(slash - dst), dst);
+    out = mkostemp(tmp, O_CLOEXEC);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (qemu_write_full(out, buf, n) != n) {
+            n = -1;
+            break;
+        }
+    }
+    if (n == 0 && fchmod(out, st->st_mode & 07777) == 0) {
+        futimens(out, times);
+    } else {
+        n = -1;
+    }
+    close(in);
+    if (close(out) != 0 || n != 0 || rename(tmp, dst) != 0) {
+        int err = errno;
+
+        unlink(tmp);
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+/* Copy canon from the lower to the upper layer. Returns false on error. */
+static bool copy_up(const char *canon)
+{
+    g_autofree char *low = lower_name(canon);
+    g_autofree char *up = upper_name(canon);
+    struct stat st;
+    bool ok;
+
+    if (!upper_parents(canon) || lstat(low, &st) != 0) {
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        ok = copy_file(low, up, &st);
+    } else if (S_ISDIR(st.st_mode)) {
+        ok = mkdir(up, (st.st_mode & 07777) | S_IRWXU) == 0;
+    } else if (S_ISLNK(st.st_mode)) {
+        g_autofree char *link = g_file_read_link(low, NULL);
+
+        ok = link && symlink(link, up) == 0;
+    } else {
+        ok = mknod(up, st.st_mode, st.st_rdev) == 0;
+    }
+    if (ok) {
+        forget(canon, S_ISDIR(st.st_mode));
+    }
+    return ok;
+}
+
+static int make_whiteout(const char *canon)
+{
+    g_autofree char *wh = whiteout_name(canon);
+    int fd = open(wh, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+
+    return fd < 0 ? -1 : close(fd);
+}
+
+static int make_opaque(const char *canon)
+{
+    g_autofree char *opaque = g_strconcat(upper, canon, "/" WH_OPAQUE, NULL);
+    int fd = open(opaque, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+
+    return fd < 0 ? -1 : close(fd);
+}
+
+/* Remove the whiteouts from an upper directory before it is removed */
+static void clear_whiteouts(const char *canon)
+{
+    g_autofree char *up = upper_name(canon);
+    DIR *dir = opendir(up);
+    struct dirent *de;
+
+    if (!dir) {
+        return;
+    }
+    while ((de = readdir(dir))) {
+        if (g_str_has_prefix(de->d_name, WH_PREFIX)) {
+            unlinkat(dirfd(dir), de->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+static void read_dir(GArray *list, GHashTable *seen, const char *name,
+                     bool is_upper)
+{
+    DIR *dir = opendir(name);
+    struct dirent *de;
+
+    if (!dir) {
+        return;
+    }
+    while ((de = readdir(dir))) {
+        DirEntry entry;
+
+        if (g_str_has_prefix(de->d_name, WH_PREFIX)) {
+            if (is_upper) {
+                g_hash_table_add(seen,
+                                 g_strdup(de->d_name + strlen(WH_PREFIX)));
+            }
+            continue;
+        }
+        if (g_hash_table_contains(seen, de->d_name)) {
+            continue;
+        }
+        g_hash_table_add(seen, g_strdup(de->d_name));
+        entry = (DirEntry) { de->d_ino, de->d_type, g_strdup(de->d_name) };
+        g_array_append_val(list, entry);
+    }
+    closedir(dir);
+}
+
+/*
+ * Listing of a directory: upper entries, then the lower ones that are
+ * neither in the upper directory nor whited out.
+ */
+static GArray *list_dir(const char *canon, const Entry *e)
+{
+    g_autoptr(GHashTable) seen = g_hash_table_new_full(g_str_hash,
+                                                       g_str_equal,
+                                                       g_free, NULL);
+    GArray *list = g_array_new(FALSE, FALSE, sizeof(DirEntry));
+
+    if (e->layer == LAYER_UPPER) {
+        g_autofree char *up = upper_name(canon);
+
+        read_dir(list, seen, up, true);
+    }
+    if (e->layer == LAYER_LOWER || e->merged) {
+        g_autofree char *low = lower_name(canon);
+
+        read_dir(list, seen, low, false);
+    }
+    return list;
+}
+
+static bool dir_empty(const Walk *w)
+{
+    GArray *list = list_dir(w->canon->str, &w->e);
+    bool empty = true;
+
+    for (guint i = 0; i < list->len; i++) {
+        const char *name = g_array_index(list, DirEntry, i).name;
+
+        if (strcmp(name, ".") && strcmp(name, "..")) {
+            empty = false;
+            break;
+        }
+    }
+    free_dir_list(list);
+    return empty;
+}
+
+/* Host name for changing the walked name, copied up if needed */
+static const char *write_name(const Walk *w)
+{
+    const char *canon = w->canon->str;
+    struct stat st;
+
+    switch (w->e.layer) {
+    case LAYER_UPPER:
+        break;
+    case LAYER_LOWER:
+        copy_up(canon);
+        break;
+    case LAYER_WHITEOUT:
+        break;
+    default:
+        /* Outside the overlay, and devices such as /dev/null, stay host */
+        if (!is_dir_in_overlay(&w->parent) ||
+            (stat(canon, &st) == 0 && !S_ISREG(st.st_mode) &&
+             !S_ISDIR(st.st_mode))) {
+            return host_name(w);
+        }
+        upper_parents(canon);
+        break;
+    }
+    return intern(upper, canon);
+}
+
+/* The rest of host name if it lies inside dir, else NULL */
+static const char *strip_dir(const char *name, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    if (strncmp(name, dir, len) || (name[len] && name[len] != '/')) {
+        return NULL;
+    }
+    return name + len;
+}
+
+/*
+ * Absolute guest name for name relative to dirfd, or NULL if it is neither
+ * absolute nor relative to a directory inside one of the layers.
+ */
+static char *absolute(int dirfd, const char *name)
+{
+    g_autofree char *dir = NULL;
+    const char *rest;
+
+    if (name[0] == '/') {
+        return g_strdup(name);
+    }
+    if (!name[0]) {
+        return NULL;
+    }
+
+    if (dirfd == AT_FDCWD) {
+        dir = g_get_current_dir();
+    } else {
+        g_autofree char *link = g_strdup_printf("/proc/self/fd/%d", dirfd);
+
+        dir = g_file_read_link(link, NULL);
+    }
+    if (!dir) {
+        return NULL;
+    }
+    /* The upper directory may well be inside the lower one, not the reverse */
+    if (!(rest = strip_dir(dir, upper)) && !(rest = strip_dir(dir, base))) {
+        return NULL;
+    }
+    return g_build_filename("/", rest, name, NULL);
+}
+
+static const char *overlay_path(const char *name, bool follow)
+{
+    GHashTable *cache = follow ? follow_hash : hash;
+    const char *ret;
+    Walk w;
+
+    qemu_mutex_lock(&lock);
+    sync_generation();
+    ret = g_hash_table_lookup(cache, name);
+    if (!ret) {
+        if (walk(name, follow, &w)) {
+            ret = host_name(&w);
+            if (w.cacheable) {
+                g_hash_table_insert(cache, g_strdup(name), (gpointer)ret);
+            }
+        } else {
+            /* Symlink loop: a name that does not exist */
+            ret = intern(upper, name);
+        }
+        g_string_free(w.canon, TRUE);
+    }
+    qemu_mutex_unlock(&lock);
+    return ret;
+}
+
+#endif /* CONFIG_LINUX */
+
 /* Look for path in emulation dir, otherwise return name. */
 const char *path(const char *name)
 {
@@ -42,6 +782,11 @@ const char *path(const char *name)
     if (!base || !name || name[0] != '/') {
         return name;
     }
+#ifdef CONFIG_LINUX
+    if (upper) {
+        return overlay_path(name, false);
+    }
+#endif
 
     qemu_mutex_lock(&lock);
 
@@ -68,3 +813,409 @@ const char *path(const char *name)
     qemu_mutex_unlock(&lock);
     return ret;
 }
+
+#ifdef CONFIG_LINUX
+const char *path_at(int dirfd, const char *name, bool follow)
+{
+    g_autofree char *abs = NULL;
+
+    if (!upper || !name) {
+        return path(name);
+    }
+    if (name[0] == '/') {
+        return overlay_path(name, follow);
+    }
+    /* The working directory is a host one, chdir() is not translated */
+    if (dirfd == AT_FDCWD || !(abs = absolute(dirfd, name))) {
+        return name;
+    }
+    return overlay_path(abs, follow);
+}
+
+const char *path_write_at(int dirfd, const char *name, bool follow)
+{
+    g_autofree char *abs = NULL;
+    const char *ret;
+    Walk w;
+
+    if (!upper || !name) {
+        return path(name);
+    }
+    if (!(abs = absolute(dirfd, name))) {
+        return name;
+    }
+
+    qemu_mutex_lock(&lock);
+    ret = walk(abs, follow, &w) ? write_name(&w) : intern(upper, abs);
+    g_string_free(w.canon, TRUE);
+    qemu_mutex_unlock(&lock);
+    return ret;
+}
+
+int path_mkdirat(int dirfd, const char *name, mode_t mode)
+{
+    g_autofree char *abs = NULL;
+    g_autofree char *up = NULL;
+    int ret = -1;
+    Walk w;
+
+    if (!upper) {
+        return mkdirat(dirfd, path(name), mode);
+    }
+    if (!(abs = absolute(dirfd, name))) {
+        return mkdirat(dirfd, name, mode);
+    }
+
+    qemu_mutex_lock(&lock);
+    if (!walk(abs, false, &w)) {
+        goto out;
+    }
+    up = upper_name(w.canon->str);
+
+    switch (w.e.layer) {
+    case LAYER_UPPER:
+    case LAYER_LOWER:
+        errno = EEXIST;
+        break;
+    case LAYER_WHITEOUT:
+        /* Replaces a deleted lower directory, which must stay hidden */
+        if (w.parent.layer != LAYER_UPPER) {
+            errno = ENOENT;
+            break;
+        }
+        ret = mkdir(up, mode);
+        if (ret == 0) {
+            ret = make_opaque(w.canon->str);
+        }
+        break;
+    default:
+        if (!is_dir_in_overlay(&w.parent)) {
+            ret = mkdir(host_name(&w), mode);
+        } else if (upper_parents(w.canon->str)) {
+            ret = mkdir(up, mode);
+        }
+        break;
+    }
+    if (ret == 0) {
+        forget(w.canon->str, true);
+    }
+out:
+    g_string_free(w.canon, TRUE);
+    qemu_mutex_unlock(&lock);
+    return ret;
+}
+
+int path_unlinkat(int dirfd, const char *name, int flags)
+{
+    g_autofree char *abs = NULL;
+    bool is_dir;
+    int ret = -1;
+    Walk w;
+
+    if (!upper) {
+        return unlinkat(dirfd, path(name), flags);
+    }
+    if (!(abs = absolute(dirfd, name))) {
+        return unlinkat(dirfd, name, flags);
+    }
+
+    qemu_mutex_lock(&lock);
+    if (!walk(abs, false, &w)) {
+        goto out;
+    }
+
+    switch (w.e.layer) {
+    case LAYER_NONE:
+        ret = unlinkat(AT_FDCWD, host_name(&w), flags);
+        break;
+    case LAYER_WHITEOUT:
+        errno = ENOENT;
+        break;
+    default:
+        is_dir = S_ISDIR(w.e.mode);
+        if ((flags & AT_REMOVEDIR) && !is_dir) {
+            errno = ENOTDIR;
+            break;
+        }
+        if (!(flags & AT_REMOVEDIR) && is_dir) {
+            errno = EISDIR;
+            break;
+        }
+        if (is_dir && !dir_empty(&w)) {
+            errno = ENOTEMPTY;
+            break;
+        }
+
+        if (w.e.layer == LAYER_UPPER) {
+            g_autofree char *up = upper_name(w.canon->str);
+
+            if (is_dir) {
+                clear_whiteouts(w.canon->str);
+            }
+            ret = unlinkat(AT_FDCWD, up, flags);
+            if (ret != 0 || !w.e.lower) {
+                break;
+            }
+        } else if (!upper_parents(w.canon->str)) {
+            break;
+        }
+        ret = make_whiteout(w.canon->str);
+        break;
+    }
+    if (ret == 0) {
+        forget(w.canon->str, true);
+    }
+out:
+    g_string_free(w.canon, TRUE);
+    qemu_mutex_unlock(&lock);
+    return ret;
+}
+
+static int host_renameat2(int olddirfd, const char *oldpath, int newdirfd,
+                          const char *newpath, unsigned int flags)
+{
+    if (flags == 0) {
+        return renameat(olddirfd, oldpath, newdirfd, newpath);
+    }
+#ifdef __NR_renameat2
+    return syscall(__NR_renameat2, olddirfd, oldpath, newdirfd, newpath,
+                   flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Rename between walked names, like overlayfs without redirect_dir */
+static int overlay_rename(const Walk *from, const Walk *to, bool noreplace)
+{
+    const char *old = from->canon->str, *new = to->canon->str;
+    g_autofree char *old_up = upper_name(old);
+    g_autofree char *new_up = upper_name(new);
+    bool is_dir = S_ISDIR(from->e.mode);
+    bool old_lower = from->e.layer == LAYER_LOWER || from->e.lower;
+    bool new_lower = to->e.layer == LAYER_LOWER ||
+                     to->e.layer == LAYER_WHITEOUT || to->e.lower;
+
+    switch (from->e.layer) {
+    case LAYER_NONE:
+        if (to->e.layer == LAYER_NONE && !is_dir_in_overlay(&to->parent)) {
+            return rename(old, new);
+        }
+        errno = EXDEV;
+        return -1;
+    case LAYER_WHITEOUT:
+        errno = ENOENT;
+        return -1;
+    default:
+        break;
+    }
+    if (!strcmp(old, new)) {
+        return 0;
+    }
+    /* Directories with lower contents would need a redirect */
+    if (is_dir && old_lower) {
+        errno = EXDEV;
+        return -1;
+    }
+
+    switch (to->e.layer) {
+    case LAYER_NONE:
+        if (!is_dir_in_overlay(&to->parent)) {
+            errno = EXDEV;
+            return -1;
+        }
+        break;
+    case LAYER_WHITEOUT:
+        if (to->parent.layer != LAYER_UPPER) {
+            errno = ENOENT;
+            return -1;
+        }
+        break;
+    default:
+        if (noreplace) {
+            errno = EEXIST;
+            return -1;
+        }
+        if (S_ISDIR(to->e.mode) != is_dir) {
+            errno = is_dir ? ENOTDIR : EISDIR;
+            return -1;
+        }
+        if (is_dir) {
+            if (!dir_empty(to)) {
+                errno = ENOTEMPTY;
+                return -1;
+            }
+            if (to->e.layer == LAYER_UPPER) {
+                clear_whiteouts(new);
+            }
+        }
+        break;
+    }
+
+    if ((from->e.layer == LAYER_LOWER && !copy_up(old)) ||
+        !upper_parents(new) || rename(old_up, new_up) != 0) {
+        return -1;
+    }
+    if (is_dir && new_lower && make_opaque(new) != 0) {
+        return -1;
+    }
+    return old_lower ? make_whiteout(old) : 0;
+}
+
+int path_renameat2(int olddirfd, const char *oldpath, int newdirfd,
+                   const char *newpath, unsigned int flags)
+{
+    g_autofree char *old_abs = NULL;
+    g_autofree char *new_abs = NULL;
+    Walk from = { 0 }, to = { 0 };
+    int ret = -1;
+
+    if (!upper) {
+        return host_renameat2(olddirfd, path(oldpath), newdirfd,
+                              path(newpath), flags);
+    }
+    old_abs = absolute(olddirfd, oldpath);
+    new_abs = absolute(newdirfd, newpath);
+    if (!old_abs && !new_abs) {
+        return host_renameat2(olddirfd, oldpath, newdirfd, newpath, flags);
+    }
+    if (!old_abs || !new_abs) {
+        errno = EXDEV;
+        return -1;
+    }
+    if (flags & ~RENAME_NOREPLACE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    qemu_mutex_lock(&lock);
+    if (walk(old_abs, false, &from) && walk(new_abs, false, &to)) {
+        ret = overlay_rename(&from, &to, flags & RENAME_NOREPLACE);
+        forget(from.canon->str, true);
+        forget(to.canon->str, true);
+    }
+    if (from.canon) {
+        g_string_free(from.canon, TRUE);
+    }
+    if (to.canon) {
+        g_string_free(to.canon, TRUE);
+    }
+    qemu_mutex_unlock(&lock);
+    return ret;
+}
+
+void path_opened_dir(int fd)
+{
+    g_autofree char *link = NULL;
+    g_autofree char *dir = NULL;
+    const char *rest;
+    OpenDir *od;
+    struct stat st;
+
+    if (!upper) {
+        return;
+    }
+    link = g_strdup_printf("/proc/self/fd/%d", fd);
+    dir = g_file_read_link(link, NULL);
+
+    /* Lower directories are listed as they are */
+    if (!dir || !(rest = strip_dir(dir, upper)) || fstat(fd, &st) != 0 ||
+        !S_ISDIR(st.st_mode)) {
+        return;
+    }
+
+    od = g_new0(OpenDir, 1);
+    od->dev = st.st_dev;
+    od->ino = st.st_ino;
+    od->canon = g_strdup(rest);
+    qemu_mutex_lock(&lock);
+    g_hash_table_replace(open_dirs, GINT_TO_POINTER(fd), od);
+    qemu_mutex_unlock(&lock);
+}
+
+bool path_is_overlay_dir(int fd)
+{
+    OpenDir *od;
+    struct stat st;
+    bool ret = false;
+
+    if (!upper) {
+        return false;
+    }
+
+    qemu_mutex_lock(&lock);
+    od = g_hash_table_lookup(open_dirs, GINT_TO_POINTER(fd));
+    if (od) {
+        /* The guest closed it and the number was reused */
+        ret = fstat(fd, &st) == 0 && st.st_dev == od->dev &&
+              st.st_ino == od->ino;
+        if (!ret) {
+            g_hash_table_remove(open_dirs, GINT_TO_POINTER(fd));
+        }
+    }
+    qemu_mutex_unlock(&lock);
+    return ret;
+}
+
+int path_getdents64(int fd, void *dirp, unsigned int count)
+{
+    OpenDir *od;
+    off_t pos;
+    unsigned int off = 0;
+    guint i = 0;
+    int ret = -1;
+
+    qemu_mutex_lock(&lock);
+    od = g_hash_table_lookup(open_dirs, GINT_TO_POINTER(fd));
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (!od || pos < 0) {
+        errno = od ? errno : EBADF;
+        goto out;
+    }
+
+    /* The offset is an index into the listing, made at each rewind */
+    if (pos == 0 || !od->list) {
+        Walk w;
+
+        if (od->list) {
+            free_dir_list(od->list);
+            od->list = NULL;
+        }
+        if (walk(od->canon, false, &w)) {
+            od->list = list_dir(w.canon->str, &w.e);
+        }
+        g_string_free(w.canon, TRUE);
+        if (!od->list) {
+            goto out;
+        }
+    }
+
+    for (i = pos; i < od->list->len; i++) {
+        DirEntry *de = &g_array_index(od->list, DirEntry, i);
+        struct dirent64 *hde = dirp + off;
+        size_t namelen = strlen(de->name) + 1;
+        unsigned int reclen = QEMU_ALIGN_UP(offsetof(struct dirent64, d_name) +
+                                            namelen, 8);
+
+        if (off + reclen > count) {
+            break;
+        }
+        hde->d_ino = de->ino;
+        hde->d_off = i + 1;
+        hde->d_reclen = reclen;
+        hde->d_type = de->type;
+        memcpy(hde->d_name, de->name, namelen);
+        off += reclen;
+    }
+    if (off == 0 && i < od->list->len) {
+        errno = EINVAL;
+        goto out;
+    }
+    lseek(fd, i, SEEK_SET);
+    ret = off;
+out:
+    qemu_mutex_unlock(&lock);
+    return ret;
+}
+#endif /* CONFIG_LINUX */